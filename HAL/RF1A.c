@@ -1,5 +1,6 @@
 #include "RF1A.h"
 #include "cc430x513x.h"
+#include "clock.h"
 #include <stdint.h>
 
 // *****************************************************************************
@@ -12,6 +13,7 @@ unsigned char Strobe(unsigned char strobe)
 {
   unsigned char statusByte = 0;
   unsigned int  gdo_state;
+  uint8_t       mhz;
   
   // Check for valid strobe command 
   if((strobe == 0xBD) || ((strobe >= RF_SRES) && (strobe <= RF_SNOP)))
@@ -35,8 +37,12 @@ unsigned char Strobe(unsigned char strobe)
         else  	
         {
           while ((RF1AIN&0x04)== 0x04);     // chip-ready ?
-          // Delay for ~810usec at 1.05MHz CPU clock, see erratum RF1A7
-          __delay_cycles(850);	            
+          // Delay for ~810usec at the MCLK of the clock profile, see
+          // erratum RF1A7
+          for (mhz = clock_mclk_mhz(); mhz > 0; mhz--)
+          {
+            __delay_cycles(850);
+          }
         }
       }
       WriteSingleReg(IOCFG2, gdo_state);    // restore IOCFG2 setting
@@ -52,6 +58,29 @@ unsigned char Strobe(unsigned char strobe)
   return statusByte;
 }
 
+// *****************************************************************************
+// @fn          StrobeWakeup
+// @brief       Send a strobe that wakes the radio from sleep without waiting
+//              for the chip to be ready. The next Strobe() returns right
+//              away if the chip has been ready for ~810usec (erratum RF1A7)
+//              by then, otherwise it waits as usual.
+// @param       unsigned char strobe        The strobe command to be sent
+// @return      none
+// *****************************************************************************
+void StrobeWakeup(unsigned char strobe)
+{
+  if ((strobe > RF_SRES) && (strobe < RF_SNOP))
+  {
+    // Clear the Status read flag
+    RF1AIFCTL1 &= ~(RFSTATIFG);
+
+    // Wait for radio to be ready for next instruction
+    while( !(RF1AIFCTL1 & RFINSTRIFG));
+
+    RF1AINSTRB = strobe;
+  }
+}
+
 // *****************************************************************************
 // @fn          ReadSingleReg
 // @brief       Read a single byte from the radio register
@@ -157,17 +186,12 @@ void ResetRadioCore (void)
   Strobe(RF_SNOP);                          // Reset Radio Pointer
 }
 
-// *****************************************************************************
-// @fn          WriteRfSettings
-// @brief       Write the minimum set of RF configuration register settings
-// @param       RF_SETTINGS *pRfSettings  Pointer to the structure that holds the rf settings
-// @return      none
-// *****************************************************************************
-void WriteRfSettings(void) {
-
 //#define RF_MODE_OPTIMISED_CONSUMPTION 1
 #define RF_MODE_OPTIMISED_SENSITIVITY 1
 
+// Configuration registers from IOCFG2 (0x00) to TEST0 (0x2E) in address
+// order so that they can be written with one burst
+
 #ifdef RF_MODE_OPTIMISED_CONSUMPTION
 /* Sync word qualifier mode = 30/32 sync word bits detected */
 /* CRC autoflush = false */
@@ -178,65 +202,69 @@ void WriteRfSettings(void) {
 /* PA ramping = false */
 /* Preamble count = 4 */
 /* Whitening = false */
-/* Address config = No address check */
+/* Address config = Address check and 0 (0x00) broadcast */
 /* Carrier frequency = 433.999969 */
-/* Device address = 0 */
+/* Device address = 0, the node address is written in rf_init() */
 /* TX power = 0 */
 /* Manchester enable = false */
 /* CRC enable = true */
 /* Deviation = 20.629883 */
 /* Packet length mode = Variable packet length mode. Packet length configured by the first byte after sync word */
-/* Packet length = 32 */
+/* Packet length = 248 */
 /* Modulation format = 2-GFSK */
 /* Base frequency = 433.999969 */
 /* Modulated = true */
 /* Channel number = 0 */
 /* RF settings SoC: CC430 */
-    WriteSingleReg(IOCFG2      , 0x29); // gdo2 output configuration, 0x29 == RF_RDY
-    WriteSingleReg(IOCFG1      , 0x2E); // gdo1 output configuration, 0x2E == tristate (meaning what?), not even connected in RBv2
-    WriteSingleReg(IOCFG0      , 0x06); // gdo0 output configuration, 0x06 == Assert on sync word
-    WriteSingleReg(FIFOTHR     , 0x47); // rx fifo and tx fifo thresholds
-    WriteSingleReg(SYNC1       , 0xD3); // sync word, high byte
-    WriteSingleReg(SYNC0       , 0x91); // sync word, low byte
-    WriteSingleReg(PKTLEN      , 0x32); // packet length
-    WriteSingleReg(PKTCTRL1    , 0x04); // packet automation control
-    WriteSingleReg(PKTCTRL0    , 0x05); // packet automation control
-    WriteSingleReg(ADDR        , 0x00); // device address
-    WriteSingleReg(CHANNR      , 0x00); // channel number
-    WriteSingleReg(FSCTRL1     , 0x08); // frequency synthesizer control
-    WriteSingleReg(FSCTRL0     , 0x00); // frequency synthesizer control
-    WriteSingleReg(FREQ2       , 0x10); // frequency control word, high byte
-    WriteSingleReg(FREQ1       , 0xB1); // frequency control word, middle byte
-    WriteSingleReg(FREQ0       , 0x3B); // frequency control word, low byte
-    WriteSingleReg(MDMCFG4     , 0xCA); // modem configuration
-    WriteSingleReg(MDMCFG3     , 0x83); // modem configuration
-    WriteSingleReg(MDMCFG2     , 0x93); // modem configuration
-    WriteSingleReg(MDMCFG1     , 0x22); // modem configuration
-    WriteSingleReg(MDMCFG0     , 0xF8); // modem configuration
-    WriteSingleReg(DEVIATN     , 0x35); // modem deviation setting
-    WriteSingleReg(MCSM2       , 0x07); // main radio control state machine configuration
-    WriteSingleReg(MCSM1       , 0x30); // main radio control state machine configuration
-    WriteSingleReg(MCSM0       , 0x10); // main radio control state machine configuration
-    WriteSingleReg(FOCCFG      , 0x16); // frequency offset compensation configuration
-    WriteSingleReg(BSCFG       , 0x6C); // bit synchronization configuration
-    WriteSingleReg(AGCCTRL2    , 0x43); // agc control
-    WriteSingleReg(AGCCTRL1    , 0x40); // agc control
-    WriteSingleReg(AGCCTRL0    , 0x91); // agc control
-    WriteSingleReg(WOREVT1     , 0x80); // high byte event0 timeout
-    WriteSingleReg(WOREVT0     , 0x00); // low byte event0 timeout
-    WriteSingleReg(WORCTRL     , 0xFB); // wake on radio control
-    WriteSingleReg(FREND1      , 0x56); // front end rx configuration
-    WriteSingleReg(FREND0      , 0x10); // front end tx configuration
-    WriteSingleReg(FSCAL3      , 0xE9); // frequency synthesizer calibration
-    WriteSingleReg(FSCAL2      , 0x2A); // frequency synthesizer calibration
-    WriteSingleReg(FSCAL1      , 0x00); // frequency synthesizer calibration
-    WriteSingleReg(FSCAL0      , 0x1F); // frequency synthesizer calibration
-    WriteSingleReg(FSTEST      , 0x59); // frequency synthesizer calibration control
-    WriteSingleReg(PTEST       , 0x7F); // production test
-    WriteSingleReg(AGCTEST     , 0x3F); // agc test
-    WriteSingleReg(TEST2       , 0x81); // various test settings
-    WriteSingleReg(TEST1       , 0x35); // various test settings
-    WriteSingleReg(TEST0       , 0x09); // various test settings
+static const unsigned char RfSettings[RF_SETTINGS_LEN] = {
+  0x29, // IOCFG2    gdo2 output configuration, 0x29 == RF_RDY
+  0x02, // IOCFG1    gdo1 output configuration, 0x02 == TX FIFO at or above threshold (RFIFG1)
+  0x00, // IOCFG0    gdo0 output configuration, 0x00 == RX FIFO at or above threshold (RFIFG0)
+  0x47, // FIFOTHR   rx fifo and tx fifo thresholds
+  0xD3, // SYNC1     sync word, high byte
+  0x91, // SYNC0     sync word, low byte
+  0xF8, // PKTLEN    max packet length, PAYLOAD_LEN + RF_HEADER_LEN in rf.h
+  0x06, // PKTCTRL1  packet automation control, address check with 0x00 broadcast
+  0x05, // PKTCTRL0  packet automation control
+  0x00, // ADDR      device address, set in rf_init()
+  0x00, // CHANNR    channel number
+  0x08, // FSCTRL1   frequency synthesizer control
+  0x00, // FSCTRL0   frequency synthesizer control
+  0x10, // FREQ2     frequency control word, high byte
+  0xB1, // FREQ1     frequency control word, middle byte
+  0x3B, // FREQ0     frequency control word, low byte
+  0xCA, // MDMCFG4   modem configuration
+  0x83, // MDMCFG3   modem configuration
+  0x93, // MDMCFG2   modem configuration
+  0x22, // MDMCFG1   modem configuration
+  0xF8, // MDMCFG0   modem configuration
+  0x35, // DEVIATN   modem deviation setting
+  0x07, // MCSM2     main radio control state machine configuration
+  0x30, // MCSM1     main radio control state machine configuration
+  0x10, // MCSM0     main radio control state machine configuration
+  0x16, // FOCCFG    frequency offset compensation configuration
+  0x6C, // BSCFG     bit synchronization configuration
+  0x43, // AGCCTRL2  agc control
+  0x40, // AGCCTRL1  agc control
+  0x91, // AGCCTRL0  agc control
+  0x80, // WOREVT1   high byte event0 timeout
+  0x00, // WOREVT0   low byte event0 timeout
+  0xFB, // WORCTRL   wake on radio control
+  0x56, // FREND1    front end rx configuration
+  0x10, // FREND0    front end tx configuration
+  0xE9, // FSCAL3    frequency synthesizer calibration
+  0x2A, // FSCAL2    frequency synthesizer calibration
+  0x00, // FSCAL1    frequency synthesizer calibration
+  0x1F, // FSCAL0    frequency synthesizer calibration
+  0x41, // RCCTRL1   rc oscillator configuration
+  0x00, // RCCTRL0   rc oscillator configuration
+  0x59, // FSTEST    frequency synthesizer calibration control
+  0x7F, // PTEST     production test
+  0x3F, // AGCTEST   agc test
+  0x81, // TEST2     various test settings
+  0x35, // TEST1     various test settings
+  0x09  // TEST0     various test settings
+};
 #endif
 
 #ifdef RF_MODE_OPTIMISED_SENSITIVITY
@@ -249,67 +277,92 @@ void WriteRfSettings(void) {
 /* PA ramping = false */
 /* Preamble count = 4 */
 /* Whitening = false */
-/* Address config = No address check */
+/* Address config = Address check and 0 (0x00) broadcast */
 /* Carrier frequency = 433.999969 */
-/* Device address = 0 */
+/* Device address = 0, the node address is written in rf_init() */
 /* TX power = 0 */
 /* Manchester enable = false */
 /* CRC enable = true */
 /* Deviation = 20.629883 */
 /* Packet length mode = Variable packet length mode. Packet length configured by the first byte after sync word */
-/* Packet length = 32 */
+/* Packet length = 248 */
 /* Modulation format = 2-GFSK */
 /* Base frequency = 433.999969 */
 /* Modulated = true */
 /* Channel number = 0 */
 /* RF settings SoC: CC430 */
-    WriteSingleReg(IOCFG2      , 0x29); // gdo2 output configuration, 0x29 == RF_RDY
-    WriteSingleReg(IOCFG1      , 0x2E); // gdo1 output configuration, 0x2E == tristate (meaning what?), not even connected in RBv2
-    WriteSingleReg(IOCFG0      , 0x06); // gdo0 output configuration, 0x06 == Assert on sync word
-    WriteSingleReg(FIFOTHR     , 0x47); // rx fifo and tx fifo thresholds
-    WriteSingleReg(SYNC1       , 0xD3); // sync word, high byte
-    WriteSingleReg(SYNC0       , 0x91); // sync word, low byte
-    WriteSingleReg(PKTLEN      , 0x32); // packet length
-    WriteSingleReg(PKTCTRL1    , 0x04); // packet automation control
-    WriteSingleReg(PKTCTRL0    , 0x05); // packet automation control
-    WriteSingleReg(ADDR        , 0x00); // device address
-    WriteSingleReg(CHANNR      , 0x00); // channel number
-    WriteSingleReg(FSCTRL1     , 0x06); // frequency synthesizer control
-    WriteSingleReg(FSCTRL0     , 0x00); // frequency synthesizer control
-    WriteSingleReg(FREQ2       , 0x10); // frequency control word, high byte
-    WriteSingleReg(FREQ1       , 0xB1); // frequency control word, middle byte
-    WriteSingleReg(FREQ0       , 0x3B); // frequency control word, low byte
-    WriteSingleReg(MDMCFG4     , 0xCA); // modem configuration
-    WriteSingleReg(MDMCFG3     , 0x83); // modem configuration
-    WriteSingleReg(MDMCFG2     , 0x13); // modem configuration
-    WriteSingleReg(MDMCFG1     , 0x22); // modem configuration
-    WriteSingleReg(MDMCFG0     , 0xF8); // modem configuration
-    WriteSingleReg(DEVIATN     , 0x35); // modem deviation setting
-    WriteSingleReg(MCSM2       , 0x07); // main radio control state machine configuration
-    WriteSingleReg(MCSM1       , 0x30); // main radio control state machine configuration
-    WriteSingleReg(MCSM0       , 0x10); // main radio control state machine configuration
-    WriteSingleReg(FOCCFG      , 0x16); // frequency offset compensation configuration
-    WriteSingleReg(BSCFG       , 0x6C); // bit synchronization configuration
-    WriteSingleReg(AGCCTRL2    , 0x43); // agc control
-    WriteSingleReg(AGCCTRL1    , 0x40); // agc control
-    WriteSingleReg(AGCCTRL0    , 0x91); // agc control
-    WriteSingleReg(WOREVT1     , 0x80); // high byte event0 timeout
-    WriteSingleReg(WOREVT0     , 0x00); // low byte event0 timeout
-    WriteSingleReg(WORCTRL     , 0xFB); // wake on radio control
-    WriteSingleReg(FREND1      , 0x56); // front end rx configuration
-    WriteSingleReg(FREND0      , 0x10); // front end tx configuration
-    WriteSingleReg(FSCAL3      , 0xE9); // frequency synthesizer calibration
-    WriteSingleReg(FSCAL2      , 0x2A); // frequency synthesizer calibration
-    WriteSingleReg(FSCAL1      , 0x00); // frequency synthesizer calibration
-    WriteSingleReg(FSCAL0      , 0x1F); // frequency synthesizer calibration
-    WriteSingleReg(FSTEST      , 0x59); // frequency synthesizer calibration control
-    WriteSingleReg(PTEST       , 0x7F); // production test
-    WriteSingleReg(AGCTEST     , 0x3F); // agc test
-    WriteSingleReg(TEST2       , 0x81); // various test settings
-    WriteSingleReg(TEST1       , 0x35); // various test settings
-    WriteSingleReg(TEST0       , 0x09); // various test settings
+static const unsigned char RfSettings[RF_SETTINGS_LEN] = {
+  0x29, // IOCFG2    gdo2 output configuration, 0x29 == RF_RDY
+  0x02, // IOCFG1    gdo1 output configuration, 0x02 == TX FIFO at or above threshold (RFIFG1)
+  0x00, // IOCFG0    gdo0 output configuration, 0x00 == RX FIFO at or above threshold (RFIFG0)
+  0x47, // FIFOTHR   rx fifo and tx fifo thresholds
+  0xD3, // SYNC1     sync word, high byte
+  0x91, // SYNC0     sync word, low byte
+  0xF8, // PKTLEN    max packet length, PAYLOAD_LEN + RF_HEADER_LEN in rf.h
+  0x06, // PKTCTRL1  packet automation control, address check with 0x00 broadcast
+  0x05, // PKTCTRL0  packet automation control
+  0x00, // ADDR      device address, set in rf_init()
+  0x00, // CHANNR    channel number
+  0x06, // FSCTRL1   frequency synthesizer control
+  0x00, // FSCTRL0   frequency synthesizer control
+  0x10, // FREQ2     frequency control word, high byte
+  0xB1, // FREQ1     frequency control word, middle byte
+  0x3B, // FREQ0     frequency control word, low byte
+  0xCA, // MDMCFG4   modem configuration
+  0x83, // MDMCFG3   modem configuration
+  0x13, // MDMCFG2   modem configuration
+  0x22, // MDMCFG1   modem configuration
+  0xF8, // MDMCFG0   modem configuration
+  0x35, // DEVIATN   modem deviation setting
+  0x07, // MCSM2     main radio control state machine configuration
+  0x30, // MCSM1     main radio control state machine configuration
+  0x10, // MCSM0     main radio control state machine configuration
+  0x16, // FOCCFG    frequency offset compensation configuration
+  0x6C, // BSCFG     bit synchronization configuration
+  0x43, // AGCCTRL2  agc control
+  0x40, // AGCCTRL1  agc control
+  0x91, // AGCCTRL0  agc control
+  0x80, // WOREVT1   high byte event0 timeout
+  0x00, // WOREVT0   low byte event0 timeout
+  0xFB, // WORCTRL   wake on radio control
+  0x56, // FREND1    front end rx configuration
+  0x10, // FREND0    front end tx configuration
+  0xE9, // FSCAL3    frequency synthesizer calibration
+  0x2A, // FSCAL2    frequency synthesizer calibration
+  0x00, // FSCAL1    frequency synthesizer calibration
+  0x1F, // FSCAL0    frequency synthesizer calibration
+  0x41, // RCCTRL1   rc oscillator configuration
+  0x00, // RCCTRL0   rc oscillator configuration
+  0x59, // FSTEST    frequency synthesizer calibration control
+  0x7F, // PTEST     production test
+  0x3F, // AGCTEST   agc test
+  0x81, // TEST2     various test settings
+  0x35, // TEST1     various test settings
+  0x09  // TEST0     various test settings
+};
 #endif
 
+// *****************************************************************************
+// @fn          WriteRfSettings
+// @brief       Write all RF configuration register settings with one burst
+// @param       none
+// @return      none
+// *****************************************************************************
+void WriteRfSettings(void)
+{
+  WriteBurstReg(IOCFG2, (unsigned char *)RfSettings, RF_SETTINGS_LEN);
+}
+
+// *****************************************************************************
+// @fn          WriteRfTestSettings
+// @brief       Write the test registers (FSTEST to TEST0) that are not
+//              retained in SLEEP state
+// @param       none
+// @return      none
+// *****************************************************************************
+void WriteRfTestSettings(void)
+{
+  WriteBurstReg(FSTEST, (unsigned char *)&RfSettings[FSTEST], RF_SETTINGS_LEN - FSTEST);
 }
 
 // *****************************************************************************
@@ -3,8 +3,12 @@
 
 void ResetRadioCore (void);
 unsigned char Strobe(unsigned char strobe);
+void StrobeWakeup(unsigned char strobe);
+
+#define RF_SETTINGS_LEN  (0x2F)            // Registers IOCFG2 (0x00) to TEST0 (0x2E)
 
 void WriteRfSettings(void);
+void WriteRfTestSettings(void);
 
 void WriteSingleReg(unsigned char addr, unsigned char value);
 void WriteBurstReg(unsigned char addr, unsigned char *buffer, unsigned char count);
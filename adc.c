@@ -27,7 +27,11 @@
  */
 
 #include "adc.h"
+#include "clock.h"
+#include "dma.h"
 #include "led.h"
+#include "timer.h"
+#include "sched.h"
 
 #define ADC_MAX_CHANNELS                5
 
@@ -37,6 +41,25 @@ static volatile uint16_t adc_result[ADC_MAX_CHANNELS];
 static volatile uint32_t adc_counter[ADC_MAX_CHANNELS];
 static adc_mode_t adc_mode;
 
+// Oversampling: sums of the sequences, sequences left and channel count
+static volatile uint32_t adc_sum[ADC_MAX_CHANNELS];
+static volatile uint16_t adc_samples_left;
+static volatile uint8_t adc_busy;
+static uint8_t adc_ch_count;
+
+// Timer triggered sampling: the block being filled, the one ready for
+// the main loop (or ADC_BLOCK_NONE), index of the first sample in each
+// and the blocks overwritten before they were read
+#define ADC_BLOCK_NONE                  0xFF
+static uint16_t adc_block[2][ADC_BLOCK_LEN];
+static volatile uint8_t adc_block_filling;
+static volatile uint8_t adc_block_ready;
+static volatile uint32_t adc_block_first[2];
+static volatile uint16_t adc_block_lost;
+static uint8_t adc_timer_on = 0;
+
+static uint8_t adc_dma_done(void);
+
 /*
  * ADC interrupt
  */
@@ -64,7 +87,25 @@ void ADC12_ISR(void)
     adc_result[0] = ADC12MEM0;
     ++adc_counter[0];
 
+    if (adc_samples_left) {
+      uint8_t i;
+
+      for (i = 0; i < adc_ch_count; ++i) {
+        adc_sum[i] += adc_result[i];
+      }
+
+      // Keep sleeping until all the sequences are accumulated
+      if (--adc_samples_left) {
+        break;
+      }
+
+      // Stop at the end of the current sequence
+      ADC12CTL0 &= ~ADC12ENC;
+      adc_busy = 0;
+    }
+
     adc_state = ADC_STATE_DATA;
+    sched_post(SCHED_EVENT_ADC);
 
 #if SC_USE_SLEEP == 1
     // Exit active
@@ -193,6 +234,167 @@ void adc_get_data(uint8_t ch, uint16_t *data, uint32_t *counter)
   __bis_status_register(GIE);
 }
 
+/*
+ * Start accumulating samples sequences of the channels in the ADC
+ * interrupt. The main loop is woken up only once all are done.
+ */
+void adc_oversample_start(uint8_t ch_count, uint8_t *chan, unsigned int clks, uint16_t samples)
+{
+  uint8_t i;
+
+  if (ch_count > ADC_MAX_CHANNELS) {
+    ch_count = ADC_MAX_CHANNELS;
+  }
+
+  for (i = 0; i < ADC_MAX_CHANNELS; ++i) {
+    adc_sum[i] = 0;
+  }
+  adc_ch_count     = ch_count;
+  adc_samples_left = samples;
+  adc_busy         = samples > 0;
+
+  adc_start(ch_count, chan, clks, ADC_MODE_CONT);
+}
+
+
+
+/*
+ * Wait for the oversampling to complete, with timeout, and read the
+ * sums. Returns the number of sequences accumulated.
+ */
+uint16_t adc_oversample_wait(uint16_t samples, uint32_t *sums, uint16_t ms, uint32_t mode)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+  uint8_t i;
+  uint16_t done;
+
+  timer_wait_while(&adc_busy, ms, mode);
+
+  // Stop also on timeout so that the sums don't change while read
+  ADC12CTL0 &= ~ADC12ENC;
+  __bic_status_register(GIE);
+  done = samples - adc_samples_left;
+  adc_samples_left = 0;
+  adc_busy = 0;
+  __bis_status_register(gie);
+
+  for (i = 0; i < adc_ch_count; ++i) {
+    sums[i] = adc_sum[i];
+  }
+
+  return done;
+}
+
+
+
+/*
+ * Sample chan at rate_hz, each conversion triggered by the TA1 CCR1
+ * output from SMCLK, so the sample index is an exact timestamp. The DMA
+ * fills ADC_BLOCK_LEN samples to one block while the main loop reads
+ * the other with adc_get_block(), woken up once per block with
+ * SCHED_EVENT_ADC. The conversion (clks + 13 MODOSC cycles) has to fit
+ * in the period. Takes TA1 until adc_shutdown().
+ */
+void adc_timer_start(uint8_t chan, unsigned int clks, uint32_t rate_hz)
+{
+  uint32_t period = clock_smclk_hz() / rate_hz;
+
+  ADC12CTL0  &= ~ADC12ENC;
+
+  // Enable 2.0 shared reference
+  REFCTL0 |= REFMSTR + REFVSEL_1 + REFON;
+
+  // One conversion per rising edge of the timer output, MODOSC
+  ADC12CTL0   = clks + ADC12ON;
+  ADC12CTL1   = ADC_TIMER_SHS + ADC12SHP + ADC12SSEL_0 + ADC12CONSEQ_2;
+  ADC12CTL2  |= ADC12RES_2;
+  ADC12MCTL0  = ADC12SREF_1 + chan;
+  ADC12IE     = 0;                             // Only the DMA reads
+
+  adc_block_filling = 0;
+  adc_block_ready   = ADC_BLOCK_NONE;
+  adc_block_first[0] = 0;
+  adc_block_lost    = 0;
+  adc_timer_on      = 1;
+
+  // Repeated block of words to block 0, then to the address in DMA2DA,
+  // which is switched on each completion
+  dma_set_trigger(DMA_CHANNEL_ADC, DMA_TRIGGER_ADC12IFG);
+  dma_set_handler(DMA_CHANNEL_ADC, adc_dma_done);
+  DMA2CTL = 0;
+  DMA2SAL = (uint16_t)(uintptr_t)&ADC12MEM0;
+  DMA2DAL = (uint16_t)(uintptr_t)adc_block[0];
+  DMA2SZ  = ADC_BLOCK_LEN;
+  DMA2CTL = DMADT_4 + DMADSTINCR_3 + DMAIE + DMAEN;
+  DMA2DAL = (uint16_t)(uintptr_t)adc_block[1];
+
+  adc_state = ADC_STATE_MEASURING;
+  ADC12CTL0 |= ADC12ENC;
+
+  // Up mode, period in SMCLK cycles, the output rises at CCR1
+  TA1CTL   = TASSEL_2 + TACLR;
+  TA1CCR0  = period - 1;
+  TA1CCR1  = period / 2;
+  TA1CCTL1 = OUTMOD_3;                         // Set at CCR1, reset at CCR0
+  TA1CTL  |= MC_1;
+}
+
+
+
+/*
+ * Called from the DMA interrupt handler when a block is full
+ */
+static uint8_t adc_dma_done(void)
+{
+  uint8_t done = adc_block_filling;
+
+  // The DMA has already reloaded the other block's address, the done
+  // one is filled again after it
+  adc_block_filling ^= 1;
+  DMA2DAL = (uint16_t)(uintptr_t)adc_block[done];
+  adc_block_first[adc_block_filling] = adc_block_first[done] + ADC_BLOCK_LEN;
+
+  if (adc_block_ready != ADC_BLOCK_NONE) {
+    adc_block_lost += ADC_BLOCK_LEN;
+  }
+  adc_block_ready = done;
+  adc_state = ADC_STATE_DATA;
+  sched_post(SCHED_EVENT_ADC);
+
+  return 1;
+}
+
+
+
+/*
+ * Take the block of ADC_BLOCK_LEN samples filled last, or 0 if there's
+ * none since the last call. first is the index of its first sample and
+ * missed the samples in blocks not taken in time since the last call.
+ * The block stays valid for one block period.
+ */
+const uint16_t *adc_get_block(uint32_t *first, uint16_t *missed)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+  const uint16_t *block = 0;
+
+  __bic_status_register(GIE);
+
+  if (adc_block_ready != ADC_BLOCK_NONE) {
+    block = adc_block[adc_block_ready];
+    *first = adc_block_first[adc_block_ready];
+    adc_block_ready = ADC_BLOCK_NONE;
+    adc_state = ADC_STATE_MEASURING;
+  }
+  *missed = adc_block_lost;
+  adc_block_lost = 0;
+
+  __bis_status_register(gie);
+
+  return block;
+}
+
+
+
 /*
  * Shutdown ADC
  */
@@ -210,6 +412,16 @@ void adc_shutdown(void)
   REFCTL0    = 0;
 
   adc_state  = ADC_STATE_IDLE;
+  adc_samples_left = 0;
+  adc_busy   = 0;
+
+  // TA1 is shared with comp.c, stop it only if it was taken here
+  if (adc_timer_on) {
+    TA1CTL   = 0;
+    TA1CCTL1 = 0;
+    DMA2CTL  = 0;
+    adc_timer_on = 0;
+  }
 }
 
 
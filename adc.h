@@ -39,6 +39,11 @@
 #define ADC_CHANNEL_3           ADC12INCH_3
 #define ADC_CHANNEL_BATTERY     ADC12INCH_11 // (AVCC - AVSS) / 2
 
+// Timer triggered sampling: TA1 CCR1 output starts each conversion and
+// the DMA moves the results to two alternating blocks of samples
+#define ADC_TIMER_SHS           ADC12SHS_3   // TA1 CCR1 output
+#define ADC_BLOCK_LEN           64
+
 typedef enum adc_mode_t {
   ADC_MODE_SINGLE,
   ADC_MODE_CONT
@@ -55,6 +60,10 @@ extern volatile adc_state_t adc_state;
 
 void adc_start(uint8_t ch_count, uint8_t *chan, unsigned int clks, adc_mode_t mode);
 void adc_get_data(uint8_t ch, uint16_t *data, uint32_t *counter);
+void adc_oversample_start(uint8_t ch_count, uint8_t *chan, unsigned int clks, uint16_t samples);
+uint16_t adc_oversample_wait(uint16_t samples, uint32_t *sums, uint16_t ms, uint32_t mode);
+void adc_timer_start(uint8_t chan, unsigned int clks, uint32_t rate_hz);
+const uint16_t *adc_get_block(uint32_t *first, uint16_t *missed);
 void adc_shutdown(void);
 
 #endif
@@ -0,0 +1,327 @@
+/*
+ * Link layer acknowledgements and retransmission
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "arq.h"
+#include "rf.h"
+#include "ringbuf.h"
+#include "sched.h"
+#include "timer.h"
+
+// Sender: frames from arq_base up to arq_next are in flight, made of
+// the first arq_sent_bytes of RfTxQueue
+static uint8_t arq_base;
+static uint8_t arq_next;
+static uint8_t arq_in_flight;
+static uint8_t arq_frame_len[ARQ_SEQ_MASK + 1];
+static uint16_t arq_sent_bytes;
+static uint8_t arq_waiting;                 // Poll sent, waiting for the ACK
+static uint8_t arq_poll_on_air;             // Poll queued, not yet sent
+static uint8_t arq_retries;
+static uint8_t arq_synced;                  // ACK received since (re)start
+static uint16_t arq_drop_count;
+static timer_event_t arq_timer;
+
+// Receiver
+static uint8_t arq_expected;
+static uint8_t arq_ack_pending;
+
+/*
+ * Resend everything in flight, the frames are rebuilt from the queue
+ */
+static void arq_go_back(void)
+{
+  arq_next = arq_base;
+  arq_in_flight = 0;
+  arq_sent_bytes = 0;
+}
+
+
+
+/*
+ * No ACK for the poll, resend or give up on the window
+ */
+static void arq_timeout(void)
+{
+  arq_waiting = 0;
+
+  if (++arq_retries > ARQ_MAX_RETRIES) {
+    // Drop the data and tell the receiver to accept the new sequence
+    ringbuf_skip(&RfTxQueue, arq_sent_bytes);
+    arq_base = arq_next;
+    arq_synced = 0;
+    arq_retries = 0;
+    ++arq_drop_count;
+  }
+
+  arq_go_back();
+  sched_post(SCHED_EVENT_LINK);
+}
+
+
+
+/*
+ * Cumulative ACK, next is the next frame the receiver expects
+ */
+static void arq_ack(uint8_t next)
+{
+  uint8_t acked = (next - arq_base) & ARQ_SEQ_MASK;
+  uint16_t bytes = 0;
+
+  // ACK for frames not sent, stale or from an earlier window
+  if (acked > arq_in_flight) {
+    return;
+  }
+
+  while (arq_base != next) {
+    bytes += arq_frame_len[arq_base];
+    arq_base = (arq_base + 1) & ARQ_SEQ_MASK;
+  }
+
+  ringbuf_skip(&RfTxQueue, bytes);
+  arq_sent_bytes -= bytes;
+  arq_in_flight -= acked;
+  arq_synced = 1;
+  if (acked > 0) {
+    arq_retries = 0;
+  }
+
+  if (arq_waiting) {
+    arq_waiting = 0;
+    arq_poll_on_air = 0;
+    timer_event_stop(&arq_timer);
+
+    // Receiver missed a frame, resend from it right away
+    if (arq_in_flight > 0) {
+      ++arq_retries;
+      arq_go_back();
+    }
+  }
+}
+
+
+
+/*
+ * Reset both directions
+ */
+void arq_init(void)
+{
+  timer_event_stop(&arq_timer);
+
+  arq_base = 0;
+  arq_go_back();
+  arq_waiting = 0;
+  arq_poll_on_air = 0;
+  arq_retries = 0;
+  arq_synced = 0;
+  arq_drop_count = 0;
+
+  arq_expected = 0;
+  arq_ack_pending = 0;
+}
+
+
+
+/*
+ * Forget the frames in flight after RfTxQueue was emptied, e.g. by
+ * rf_init(). The receiver is told to resynchronise.
+ */
+void arq_reset_tx(void)
+{
+  timer_event_stop(&arq_timer);
+
+  arq_base = arq_next;
+  arq_go_back();
+  arq_waiting = 0;
+  arq_poll_on_air = 0;
+  arq_retries = 0;
+  arq_synced = 0;
+}
+
+
+
+/*
+ * Handle a packet received into RfRxBuffer. Returns 1 if it's the next
+ * data frame in order, and its payload after ARQ_HEADER_LEN should be
+ * forwarded (e.g. with gateway_forward_skip()). Otherwise the packet is
+ * consumed here.
+ */
+uint8_t arq_handle_rx(void)
+{
+  unsigned char header;
+  uint8_t seq;
+  uint8_t len;
+
+  if (!rf_rx_ready) {
+    return 0;
+  }
+
+  len = RfRxBufferLength - RF_PAYLOAD_OFFSET - 2;
+
+  // Broken frames are resent by the peer
+  if (!(rf_rx_status & RF_RX_STATUS_CRC_OK) || len < ARQ_HEADER_LEN) {
+    rf_rx_ready = 0;
+    return 0;
+  }
+
+  header = RfRxBuffer[RF_PAYLOAD_OFFSET];
+  seq = header & ARQ_SEQ_MASK;
+
+  if (header & ARQ_FLAG_ACK) {
+    arq_ack(seq);
+    rf_rx_ready = 0;
+    return 0;
+  }
+
+  if (header & ARQ_FLAG_POLL) {
+    arq_ack_pending = 1;
+  }
+
+  // The sender restarted, unless this is a resent frame already taken
+  if ((header & ARQ_FLAG_SYNC) && seq != arq_expected &&
+      ((arq_expected - seq) & ARQ_SEQ_MASK) > ARQ_WINDOW) {
+    arq_expected = seq;
+  }
+
+  // Drop duplicates and frames after a missed one
+  if (seq != arq_expected) {
+    rf_rx_ready = 0;
+    return 0;
+  }
+
+  arq_expected = (arq_expected + 1) & ARQ_SEQ_MASK;
+
+  if (len == ARQ_HEADER_LEN) {
+    rf_rx_ready = 0;
+    return 0;
+  }
+
+  return 1;
+}
+
+
+
+/*
+ * Bytes in RfTxQueue not yet sent
+ */
+uint16_t arq_unsent(void)
+{
+  return ringbuf_len(&RfTxQueue) - arq_sent_bytes;
+}
+
+
+
+/*
+ * Send a pending ACK or the next data frame, if the radio is free and
+ * the window allows. Data is sent in full frames, or all of it with
+ * flush set. Returns the number of data bytes sent.
+ */
+uint8_t arq_service(uint8_t flush)
+{
+  unsigned char header;
+  uint16_t unsent;
+  uint8_t len;
+
+  if (rf_transmitting) {
+    return 0;
+  }
+
+  // The poll frame has been sent, the ACK timeout runs from its end
+  if (arq_poll_on_air) {
+    arq_poll_on_air = 0;
+    timer_event_start(&arq_timer, timer_ms_to_ticks(ARQ_ACK_TIMEOUT_MS), 0, arq_timeout);
+  }
+
+  // Answer a poll before sending own data
+  if (arq_ack_pending) {
+    arq_ack_pending = 0;
+    RfTxBuffer[RF_PAYLOAD_OFFSET] = ARQ_FLAG_ACK | arq_expected;
+    rf_send_buffer(ARQ_HEADER_LEN);
+    return 0;
+  }
+
+  if (arq_waiting || arq_in_flight >= ARQ_WINDOW) {
+    return 0;
+  }
+
+  unsent = arq_unsent();
+  if (unsent == 0 || (!flush && unsent < ARQ_PAYLOAD_LEN)) {
+    return 0;
+  }
+
+  len = unsent > ARQ_PAYLOAD_LEN ? ARQ_PAYLOAD_LEN : unsent;
+  ringbuf_copy(&RfTxQueue, arq_sent_bytes, &RfTxBuffer[RF_PAYLOAD_OFFSET + ARQ_HEADER_LEN], len);
+
+  header = arq_next;
+  if (!arq_synced) {
+    header |= ARQ_FLAG_SYNC;
+  }
+
+  arq_frame_len[arq_next] = len;
+  arq_next = (arq_next + 1) & ARQ_SEQ_MASK;
+  arq_sent_bytes += len;
+  ++arq_in_flight;
+
+  // Last frame of the burst, listen for the ACK after it
+  unsent -= len;
+  if (arq_in_flight == ARQ_WINDOW || unsent == 0 ||
+      (!flush && unsent < ARQ_PAYLOAD_LEN)) {
+    header |= ARQ_FLAG_POLL;
+    arq_waiting = 1;
+    arq_poll_on_air = 1;
+    // Restarted at the end of the frame, this only covers a transmit
+    // that never finishes
+    timer_event_start(&arq_timer,
+                      timer_ms_to_ticks(rf_tx_ms(len + ARQ_HEADER_LEN) + ARQ_ACK_TIMEOUT_MS),
+                      0, arq_timeout);
+  }
+
+  RfTxBuffer[RF_PAYLOAD_OFFSET] = header;
+  rf_send_buffer(len + ARQ_HEADER_LEN);
+
+  return len;
+}
+
+
+
+/*
+ * Number of windows dropped after ARQ_MAX_RETRIES
+ */
+uint16_t arq_dropped(void)
+{
+  return arq_drop_count;
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,79 @@
+/*
+ * Link layer acknowledgements and retransmission
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_ARQ_H
+#define RB_ARQ_H
+
+#include "common.h"
+#include "rf.h"
+
+#include <stdint.h>
+
+/*
+ * Go-Back-N over the half-duplex radio. Every frame starts with a
+ * header byte:
+ *
+ *   bit 7    ACK:  acknowledgement, seq is the next frame expected
+ *   bit 6    POLL: last frame of a burst, acknowledge it
+ *   bit 5    SYNC: sender has restarted, accept seq as the next frame
+ *   bit 2-0  sequence number
+ *
+ * The sender sends up to ARQ_WINDOW frames from RfTxQueue back to back
+ * and then listens for a cumulative ACK, so the receiver never has to
+ * answer while the sender is still transmitting. Data stays in the
+ * queue until acknowledged. The receiver delivers frames in order and
+ * drops duplicates. With 3 sequence bits the window can be at most 3
+ * for the SYNC resynchronisation to tell a restart from a duplicate.
+ */
+#define ARQ_HEADER_LEN           (1)
+#define ARQ_PAYLOAD_LEN          (PAYLOAD_LEN - ARQ_HEADER_LEN)
+#define ARQ_WINDOW               (3)
+#define ARQ_SEQ_MASK             (0x07)
+#define ARQ_FLAG_ACK             (0x80)
+#define ARQ_FLAG_POLL            (0x40)
+#define ARQ_FLAG_SYNC            (0x20)
+
+#define ARQ_ACK_TIMEOUT_MS       (50)    // From the end of the poll frame
+#define ARQ_MAX_RETRIES          (8)     // Then drop the window and resync
+
+void arq_init(void);
+void arq_reset_tx(void);
+uint8_t arq_handle_rx(void);
+uint16_t arq_unsent(void);
+uint8_t arq_service(uint8_t flush);
+uint16_t arq_dropped(void);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,167 @@
+/*
+ * Clock system profiles
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "clock.h"
+#include "prof.h"
+#include "utils.h"
+
+#include <msp430.h>
+#include "hal_pmm.h"
+
+#include <stdint.h>
+
+// FLL lock from any DCO tap, 32 x 32 reference clock cycles
+#define CLOCK_SETTLE_MS          (32)
+
+typedef struct clock_profile_data_t {
+  uint16_t dcorsel;                              // UCSCTL1
+  uint16_t flln;                                 // UCSCTL2, with FLLD_1
+  uint16_t selref;                               // UCSCTL3
+  uint16_t sela;                                 // UCSCTL4, ACLK source
+  uint8_t vcore;                                 // Lowest PMMCOREV for MCLK
+  uint8_t mhz;                                   // MCLK, rounded
+} clock_profile_data_t;
+
+static const clock_profile_data_t clock_profiles[CLOCK_PROFILE_COUNT] = {
+  // CLOCK_PROFILE_LOW_POWER
+  { DCORSEL_2, 31, SELREF__XT1CLK, SELA__VLOCLK, 0, 1 },
+  // CLOCK_PROFILE_1MHZ
+  { DCORSEL_2, 31, SELREF__XT1CLK, SELA__XT1CLK, 0, 1 },
+  // CLOCK_PROFILE_8MHZ
+  { DCORSEL_5, 243, SELREF__REFOCLK, SELA__REFOCLK, 0, 8 },
+  // CLOCK_PROFILE_12MHZ
+  { DCORSEL_5, 374, SELREF__REFOCLK, SELA__REFOCLK, 1, 12 },
+  // CLOCK_PROFILE_20MHZ
+  { DCORSEL_6, 609, SELREF__REFOCLK, SELA__REFOCLK, 2, 20 },
+};
+
+static clock_profile_t clock_profile = CLOCK_PROFILE_1MHZ;
+
+/*
+ * Switch MCLK and SMCLK to the profile's DCO frequency and ACLK to its
+ * source. VCore is raised first if needed, but never lowered here.
+ */
+void clock_set_profile(clock_profile_t id)
+{
+  const clock_profile_data_t *p;
+  const clock_profile_data_t *cur;
+
+  if (id >= CLOCK_PROFILE_COUNT) {
+    return;
+  }
+  p = &clock_profiles[id];
+  cur = &clock_profiles[clock_profile];
+
+  if ((PMMCTL0 & PMMCOREV_3) < p->vcore) {
+    PROF_SET_VCORE(p->vcore);
+  }
+
+  // Only ACLK changes, e.g. from the reset defaults to low power
+  if (p->dcorsel == cur->dcorsel && p->flln == cur->flln && p->selref == cur->selref) {
+    UCSCTL4 = p->sela + SELS__DCOCLKDIV + SELM__DCOCLKDIV;
+    clock_profile = id;
+    return;
+  }
+
+  // FLL off while changing the DCO
+  __bis_status_register(SCG0);
+  UCSCTL0 = 0;                              // Lowest DCO tap, the FLL moves it
+  UCSCTL1 = p->dcorsel;
+  UCSCTL2 = FLLD_1 + p->flln;               // DCOCLKDIV = (N + 1) * reference
+  UCSCTL3 = p->selref;
+  __bic_status_register(SCG0);
+
+  UCSCTL4 = p->sela + SELS__DCOCLKDIV + SELM__DCOCLKDIV;
+
+  clock_profile = id;
+
+  // Let the FLL lock, then clear the fault the DCO tap change raised
+  busysleep_ms(CLOCK_SETTLE_MS);
+  do {
+    UCSCTL7 &= ~DCOFFG;
+  } while (UCSCTL7 & DCOFFG);
+}
+
+
+
+/*
+ * The active profile
+ */
+clock_profile_t clock_get_profile(void)
+{
+  return clock_profile;
+}
+
+
+
+/*
+ * MCLK frequency of the active profile
+ */
+uint32_t clock_mclk_hz(void)
+{
+  return (clock_profiles[clock_profile].flln + 1) * CLOCK_REF_HZ;
+}
+
+
+
+/*
+ * SMCLK frequency of the active profile, for baud rate dividers
+ */
+uint32_t clock_smclk_hz(void)
+{
+  return clock_mclk_hz();
+}
+
+
+
+/*
+ * MCLK frequency of the active profile in MHz, rounded, for busy waits
+ */
+uint8_t clock_mclk_mhz(void)
+{
+  return clock_profiles[clock_profile].mhz;
+}
+
+
+
+/*
+ * ACLK frequency of the active profile, for the TA0 tick rate
+ */
+uint32_t clock_aclk_hz(void)
+{
+  return clock_profiles[clock_profile].sela == SELA__VLOCLK ? CLOCK_VLO_HZ : CLOCK_REF_HZ;
+}
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,80 @@
+/*
+ * Clock system profiles
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_CLOCK_H
+#define RB_CLOCK_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * MCLK and SMCLK from the DCO, locked by the FLL to the 32768 Hz
+ * reference. XT2 is the radio crystal and stops with the radio, so
+ * it's not used here.
+ *
+ * CLOCK_PROFILE_LOW_POWER: DCO at the reset default 1.048576 MHz, ACLK
+ *                          from VLO. For the battery powered sensors.
+ * CLOCK_PROFILE_1MHZ:      The reset defaults, ACLK from XT1 or REFO.
+ * CLOCK_PROFILE_8MHZ...:   DCO at (N + 1) * 32768 Hz with REFO as the
+ *                          FLL reference and ACLK. Raises VCore to the
+ *                          level the frequency needs.
+ *
+ * The drivers compute their dividers from clock_smclk_hz() when they're
+ * initialised, so set the profile first.
+ */
+typedef enum clock_profile_t {
+  CLOCK_PROFILE_LOW_POWER,
+  CLOCK_PROFILE_1MHZ,
+  CLOCK_PROFILE_8MHZ,
+  CLOCK_PROFILE_12MHZ,
+  CLOCK_PROFILE_20MHZ,
+  CLOCK_PROFILE_COUNT
+} clock_profile_t;
+
+#define CLOCK_REF_HZ             (32768UL)
+
+// Typical VLO frequency, the part varies from 6 to 14 kHz
+#define CLOCK_VLO_HZ             (9400UL)
+
+void clock_set_profile(clock_profile_t id);
+clock_profile_t clock_get_profile(void);
+uint32_t clock_mclk_hz(void);
+uint32_t clock_smclk_hz(void);
+uint8_t clock_mclk_mhz(void);
+uint32_t clock_aclk_hz(void);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
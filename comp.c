@@ -28,8 +28,12 @@
 
 #include "comp.h"
 #include "led.h"
+#include "sched.h"
+#include "utils.h"
 
 static uint32_t comp_counter;
+static volatile uint16_t comp_overflows;
+static comp_mode_t comp_mode;
 
 /*
  * Comp_B interrupt
@@ -39,6 +43,7 @@ void Comp_B_ISR (void)
 {
   CBINT &= ~CBIFG;              // Clear Interrupt flag
   comp_counter++;
+  sched_post(SCHED_EVENT_COMP);
   //  led_toggle(1);
   // FIXME: wake up based on parameter?
 #if 0
@@ -51,12 +56,67 @@ void Comp_B_ISR (void)
 
 
 
+/*
+ * TA1 overflow while counting CBOUT pulses
+ */
+__attribute__((interrupt(TIMER1_A1_VECTOR)))
+void TIMER1_A1_ISR(void)
+{
+  switch (TA1IV) {
+  case 14:                                  // TAIFG
+    ++comp_overflows;
+    break;
+  default:
+    break;
+  }
+}
+
+
+
+/*
+ * Read TA1R reliably while it's clocked asynchronously by CBOUT
+ */
+static uint16_t comp_timer_read(void)
+{
+  uint16_t a, b;
+
+  do {
+    a = TA1R;
+    b = TA1R;
+  } while (a != b);
+
+  return a;
+}
+
+
+
+/*
+ * Count rising edges of CBOUT in TA1, the overflow is the only interrupt
+ */
+static void comp_timer_start(void)
+{
+  comp_overflows = 0;
+
+  // CBOUT1 out of the pin, the same mapping feeds the pin to TA1CLK
+  PMAPPWD = 0x02D52;                        // Get write-access to port mapping regs
+  COMP_TIMER_PMAP = PM_CBOUT1;              // Map CBOUT1 output and TA1CLK input
+  PMAPPWD = 0;                              // Lock port mapping registers
+  P1DIR |= COMP_TIMER_PIN;
+  P1SEL |= COMP_TIMER_PIN;
+
+  TA1CCTL0 = 0;
+  TA1CTL = TASSEL_0 + MC_2 + TACLR + TAIE;  // TA1CLK, continuous mode
+}
+
+
+
 /*
  * Start compare
  */
-void comp_start(void)
+void comp_start(comp_mode_t mode)
 {
   comp_counter = 0;
+  comp_mode = mode;
 
   // P2.0 (A0) as ADC
   P2SEL |= BIT0;
@@ -76,7 +136,14 @@ void comp_start(void)
   CBCTL3 |= BIT0;                           // Input Buffer Disable @P2.0/CB0
   CBCTL1 |= CBON;                           // Turn On ComparatorB
 
-  __delay_cycles(75);                       // Delay for shared ref to stabilize
+  busysleep_us(75);                         // Delay for shared ref to stabilize
+
+  if (mode == COMP_MODE_TIMER) {
+    CBCTL1 |= CBF;                          // Filter the output clocking TA1
+    CBINT = 0;                              // No interrupt per pulse
+    comp_timer_start();
+    return;
+  }
 
   CBINT = CBIE;                             // Clear any errant interrupts
                                             // Enable CompB Interrupt on rising
@@ -92,6 +159,24 @@ void comp_get_count(uint32_t *counter)
   // Disable interrupts for mutex
   __bic_status_register(GIE);
 
+  if (comp_mode == COMP_MODE_TIMER) {
+    uint16_t count = comp_timer_read();
+
+    // Overflow not yet handled
+    if (TA1CTL & TAIFG) {
+      count = comp_timer_read();
+      ++comp_overflows;
+    }
+
+    // Restart counting, a pulse in between may be lost
+    TA1CTL = TASSEL_0 + MC_2 + TACLR + TAIE;
+    *counter = ((uint32_t)comp_overflows << 16) | count;
+    comp_overflows = 0;
+
+    __bis_status_register(GIE);
+    return;
+  }
+
   // Return and zero the counter
   // FIXME: it seems that interrupts are triggered both for rising and
   // falling edges, so halving the value here.
@@ -109,6 +194,12 @@ void comp_get_count(uint32_t *counter)
 void comp_shutdown(void)
 {
   // FIXME: untested
+  if (comp_mode == COMP_MODE_TIMER) {
+    TA1CTL = TACLR;
+    P1SEL &= ~COMP_TIMER_PIN;
+    P1DIR |= COMP_TIMER_PIN;
+  }
+
   // Disable comparator by clearing to reset values
   CBINT  = 0;
   CBCTL3 = 0;
@@ -33,7 +33,16 @@
 #include <msp430.h>
 #include <stdint.h>
 
-void comp_start(void);
+// COMP_MODE_TIMER maps CBOUT to this pin, the pad loops back to TA1CLK
+#define COMP_TIMER_PMAP          P1MAP7
+#define COMP_TIMER_PIN           BIT7
+
+typedef enum comp_mode_t {
+  COMP_MODE_IRQ,
+  COMP_MODE_TIMER
+} comp_mode_t;
+
+void comp_start(comp_mode_t mode);
 void comp_get_count(uint32_t *counter);
 void comp_shutdown(void);
 
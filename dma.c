@@ -0,0 +1,100 @@
+/*
+ * DMA controller
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "dma.h"
+
+static dma_handler_t dma_handlers[DMA_CHANNELS];
+
+/*
+ * Select the trigger source for a channel
+ */
+void dma_set_trigger(uint8_t ch, uint8_t trigger)
+{
+  // Let CPU read-modify-write instructions finish before a transfer
+  DMACTL4 |= DMARMWDIS;
+
+  switch (ch) {
+  case 0:
+    DMACTL0 = (DMACTL0 & 0xff00) | trigger;
+    break;
+  case 1:
+    DMACTL0 = (DMACTL0 & 0x00ff) | ((uint16_t)trigger << 8);
+    break;
+  case 2:
+    DMACTL1 = (DMACTL1 & 0xff00) | trigger;
+    break;
+  default:
+    break;
+  }
+}
+
+
+
+/*
+ * Set the function called when a transfer on the channel is done
+ */
+void dma_set_handler(uint8_t ch, dma_handler_t handler)
+{
+  if (ch < DMA_CHANNELS) {
+    dma_handlers[ch] = handler;
+  }
+}
+
+
+
+/*
+ * DMA transfer done
+ */
+__attribute__((interrupt(DMA_VECTOR)))
+void DMA_ISR(void)
+{
+  uint8_t ch;
+
+  switch (DMAIV) {
+  case 2: ch = 0; break;                    // DMA0IFG
+  case 4: ch = 1; break;                    // DMA1IFG
+  case 6: ch = 2; break;                    // DMA2IFG
+  default: return;
+  }
+
+  if (dma_handlers[ch] && dma_handlers[ch]()) {
+#if SC_USE_SLEEP == 1
+    __bic_status_register_on_exit(LPM4_bits);
+#endif
+  }
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
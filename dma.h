@@ -0,0 +1,64 @@
+/*
+ * DMA controller
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_DMA_H
+#define RB_DMA_H
+
+#include "common.h"
+
+#include <msp430.h>
+#include <stdint.h>
+
+#define DMA_CHANNELS             (3)
+
+// Channel allocation
+#define DMA_CHANNEL_UART_TX      (0)
+#define DMA_CHANNEL_UART_RX      (1)
+#define DMA_CHANNEL_ADC          (2)
+
+// Trigger sources (see CC430F5137 datasheet)
+#define DMA_TRIGGER_UCA0RXIFG    (16)
+#define DMA_TRIGGER_UCA0TXIFG    (17)
+#define DMA_TRIGGER_ADC12IFG     (24)
+
+// Called from the DMA interrupt handler when a transfer is done.
+// Return non-zero to wake up the main loop.
+typedef uint8_t (*dma_handler_t)(void);
+
+void dma_set_trigger(uint8_t ch, uint8_t trigger);
+void dma_set_handler(uint8_t ch, dma_handler_t handler);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,224 @@
+/*
+ * Integer and fixed point formatting without division
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "fmt.h"
+
+#define FMT_ERROR                (0xff)
+
+static const uint32_t fmt_pow10_32[] = {
+  1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL, 10000UL
+};
+
+static const uint16_t fmt_pow10_16[] = {
+  10000, 1000, 100, 10
+};
+
+/*
+ * Empty string for an error
+ */
+static uint8_t fmt_error(unsigned char *str, uint8_t len)
+{
+  if (len > 0) {
+    str[0] = '\0';
+  }
+  return 0;
+}
+
+
+
+/*
+ * Write c at str[out] if there's still space for the \0 after it.
+ * Returns the new length or FMT_ERROR.
+ */
+static inline uint8_t fmt_put(unsigned char c, unsigned char *str, uint8_t out, uint8_t len)
+{
+  if (out == FMT_ERROR || out + 1 >= len) {
+    return FMT_ERROR;
+  }
+  str[out] = c;
+  return out + 1;
+}
+
+
+
+/*
+ * Write the digits of value from fmt_pow10_16[first] down after out
+ * bytes of str. Leading zeros are written too if started is set, i.e.
+ * value is the low part of a longer number.
+ */
+static uint8_t fmt_put_u16(uint16_t value, uint8_t first, uint8_t started,
+                           unsigned char *str, uint8_t out, uint8_t len)
+{
+  uint8_t i;
+
+  for (i = first; i < sizeof(fmt_pow10_16) / sizeof(fmt_pow10_16[0]); ++i) {
+    unsigned char digit = '0';
+
+    while (value >= fmt_pow10_16[i]) {
+      value -= fmt_pow10_16[i];
+      ++digit;
+    }
+
+    if (digit != '0' || started) {
+      out = fmt_put(digit, str, out, len);
+      started = 1;
+    }
+  }
+
+  return fmt_put('0' + value, str, out, len);
+}
+
+
+
+/*
+ * Write the digits of a 32 bit value after out bytes of str
+ */
+static uint8_t fmt_put_u32(uint32_t value, unsigned char *str, uint8_t out, uint8_t len)
+{
+  uint8_t started = 0;
+  uint8_t i;
+
+  if (value <= 0xffff) {
+    return fmt_put_u16(value, 0, 0, str, out, len);
+  }
+
+  // Down to 10^4, the rest fits 16 bits
+  for (i = 0; i < sizeof(fmt_pow10_32) / sizeof(fmt_pow10_32[0]); ++i) {
+    unsigned char digit = '0';
+
+    while (value >= fmt_pow10_32[i]) {
+      value -= fmt_pow10_32[i];
+      ++digit;
+    }
+
+    if (digit != '0' || started) {
+      out = fmt_put(digit, str, out, len);
+      started = 1;
+    }
+  }
+
+  return fmt_put_u16(value, 1, started, str, out, len);
+}
+
+
+
+/*
+ * Terminate the string, or report an error
+ */
+static uint8_t fmt_end(unsigned char *str, uint8_t out, uint8_t len)
+{
+  if (out == FMT_ERROR) {
+    return fmt_error(str, len);
+  }
+  str[out] = '\0';
+  return out;
+}
+
+
+
+/*
+ * Unsigned 16 bit value
+ */
+uint8_t fmt_u16(uint16_t value, unsigned char *str, uint8_t len)
+{
+  return fmt_end(str, fmt_put_u16(value, 0, 0, str, 0, len), len);
+}
+
+
+
+/*
+ * Unsigned 32 bit value
+ */
+uint8_t fmt_u32(uint32_t value, unsigned char *str, uint8_t len)
+{
+  return fmt_end(str, fmt_put_u32(value, str, 0, len), len);
+}
+
+
+
+/*
+ * Signed 32 bit value, - for negative ones
+ */
+uint8_t fmt_i32(int32_t value, unsigned char *str, uint8_t len)
+{
+  uint8_t out = 0;
+  uint32_t magnitude = value;
+
+  if (value < 0) {
+    out = fmt_put('-', str, out, len);
+    magnitude = -magnitude;
+  }
+
+  return fmt_end(str, fmt_put_u32(magnitude, str, out, len), len);
+}
+
+
+
+/*
+ * Signed Q8.8 fixed point value, e.g. a raw TMP275 temperature, with
+ * the sign always and two decimals truncated, e.g. "+23.50"
+ */
+uint8_t fmt_q8_8(int16_t value, unsigned char *str, uint8_t len)
+{
+  uint16_t magnitude = value;
+  uint16_t frac;
+  unsigned char tens = '0';
+  uint8_t out;
+
+  // The sign always, it makes parsing easier
+  if (value < 0) {
+    magnitude = -magnitude;
+    out = fmt_put('-', str, 0, len);
+  } else {
+    out = fmt_put('+', str, 0, len);
+  }
+
+  out = fmt_put_u16(magnitude >> 8, 0, 0, str, out, len);
+  out = fmt_put('.', str, out, len);
+
+  // Hundredths, the multiply is a single MPY32 operation
+  frac = ((magnitude & 0xff) * 100) >> 8;
+  while (frac >= 10) {
+    frac -= 10;
+    ++tens;
+  }
+  out = fmt_put(tens, str, out, len);
+  out = fmt_put('0' + frac, str, out, len);
+
+  return fmt_end(str, out, len);
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,59 @@
+/*
+ * Integer and fixed point formatting without division
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_FMT_H
+#define RB_FMT_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * Decimal conversion by subtracting powers of ten, as the CC430 has no
+ * divider and libgcc division takes hundreds of cycles per digit. A
+ * digit takes at most nine subtractions, 16 bit ones for values that
+ * fit 16 bits.
+ *
+ * All functions write a \0 terminated string and return its length
+ * (excluding the \0), or 0 and an empty string if it doesn't fit len
+ * bytes.
+ */
+uint8_t fmt_u16(uint16_t value, unsigned char *str, uint8_t len);
+uint8_t fmt_u32(uint32_t value, unsigned char *str, uint8_t len);
+uint8_t fmt_i32(int32_t value, unsigned char *str, uint8_t len);
+uint8_t fmt_q8_8(int16_t value, unsigned char *str, uint8_t len);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
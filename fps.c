@@ -27,24 +27,49 @@
  */
 
 #include "common.h"
+#include "fmt.h"
 #include "fps.h"
-#include "utils.h"
 
 #include <stdint.h>
 
-#define FPS_PREV_FRAMES  100
+#define FPS_PREV_FRAMES  160    // Room for 120+ Hz displays
 #define FPS_STATE_INIT     0
 #define FPS_STATE_HIGH     1
 #define FPS_STATE_LOW      2
 
+// Timestamp ticks in a second, milliseconds by default
+static uint16_t ticks_per_s = 1000;
+
+// Timestamps of the frames during the last second, oldest at frame_tail
 static uint32_t frames[FPS_PREV_FRAMES] = { 0 };
-static uint16_t frame_i = 0;
+static uint16_t frame_head = 0;
+static uint16_t frame_tail = 0;
+static uint16_t frame_count = 0;
 static uint8_t  state = FPS_STATE_INIT;
 static uint16_t high = 0;
 static uint16_t low = 0xffff;
 static uint16_t new_high = 0;
 static uint16_t new_low = 0xffff;
 
+/*
+ * Restart the detection with timestamps in rate ticks per second, e.g.
+ * the sample rate when they count samples
+ */
+void fps_init(uint16_t rate)
+{
+  ticks_per_s = rate;
+  frame_head = 0;
+  frame_tail = 0;
+  frame_count = 0;
+  state = FPS_STATE_INIT;
+  high = 0;
+  low = 0xffff;
+  new_high = 0;
+  new_low = 0xffff;
+}
+
+
+
 /*
  * Takes brightness and timestamp as parameters and returns FPS (and limits) on a new frame
  */
@@ -52,7 +77,6 @@ uint8_t handle_adc(uint16_t adc, uint32_t timestamp_ms, uint8_t *fps, uint16_t *
 {
 
   uint16_t quarter_range;
-  uint16_t i;
   uint8_t is_new_frame = 0;
 
   *fps = 0;
@@ -63,7 +87,7 @@ uint8_t handle_adc(uint16_t adc, uint32_t timestamp_ms, uint8_t *fps, uint16_t *
   }
 
   // Gather initial statistics
-  if (state == FPS_STATE_INIT && timestamp_ms < 1000) {
+  if (state == FPS_STATE_INIT && timestamp_ms < ticks_per_s) {
 
     if (adc > high) {
       high = adc;
@@ -191,18 +215,43 @@ uint8_t handle_adc(uint16_t adc, uint32_t timestamp_ms, uint8_t *fps, uint16_t *
     return 0;
   }
 
-  frames[frame_i] = timestamp_ms;
+  // Drop the oldest frame if the window is full
+  if (frame_count == FPS_PREV_FRAMES) {
+    if (++frame_tail == FPS_PREV_FRAMES) {
+      frame_tail = 0;
+    }
+    --frame_count;
+  }
 
-  // Count the amount of new frames during last 1000 ms
-  for (i = 0; i < FPS_PREV_FRAMES; ++i) {
-    if (timestamp_ms - frames[i] < 1000) {
-      ++*fps;
+  frames[frame_head] = timestamp_ms;
+  if (++frame_head == FPS_PREV_FRAMES) {
+    frame_head = 0;
+  }
+  ++frame_count;
+
+  // Drop frames older than a second, each frame is dropped only once
+  while (timestamp_ms - frames[frame_tail] >= ticks_per_s) {
+    if (++frame_tail == FPS_PREV_FRAMES) {
+      frame_tail = 0;
     }
+    --frame_count;
   }
 
-  if (++frame_i == FPS_PREV_FRAMES) {
-    frame_i = 0;
+#if FPS_USE_AVERAGE_INTERVAL
+  // Average interval between the frames in the window, rounded
+  {
+    uint32_t span = timestamp_ms - frames[frame_tail];
+
+    if (frame_count > 1 && span > 0) {
+      *fps = ((uint32_t)(frame_count - 1) * ticks_per_s + span / 2) / span;
+    } else {
+      *fps = frame_count;
+    }
   }
+#else
+  // Amount of frames during the last second
+  *fps = frame_count;
+#endif
 
   *low_ret = low;
   *high_ret = high;
@@ -211,6 +260,28 @@ uint8_t handle_adc(uint16_t adc, uint32_t timestamp_ms, uint8_t *fps, uint16_t *
 
 
 
+/*
+ * Run handle_adc() over consecutive samples, the first one at
+ * timestamp first, until a new frame. Returns the number of samples
+ * used, the last of them completed the frame if the fps is non-zero.
+ */
+uint16_t handle_adc_block(const uint16_t *samples, uint16_t count, uint32_t first, uint8_t *fps, uint16_t *low, uint16_t *low_limit, uint16_t *high_limit, uint16_t *high)
+{
+  uint16_t i;
+
+  *fps = 0;
+
+  for (i = 0; i < count; ++i) {
+    if (handle_adc(samples[i], first + i, fps, low, low_limit, high_limit, high)) {
+      return i + 1;
+    }
+  }
+
+  return count;
+}
+
+
+
 /*
  * Construct a message and send it over the UART
  */
@@ -228,15 +299,15 @@ uint8_t create_message(uint8_t *buf,
   uint8_t len = 0;
 
   // FIXME: all this will fail is buf is too small
-#define BUF_APPEND(a) len += sc_itoa(a, &buf[len], max_len - len); buf[len++] = ',';
-  BUF_APPEND(timestamp_ms);
-  BUF_APPEND(fps);
-  BUF_APPEND(missed_adc);
-  BUF_APPEND(frame_len);
-  BUF_APPEND(low);
-  BUF_APPEND(low_limit);
-  BUF_APPEND(high_limit);
-  BUF_APPEND(high);
+#define BUF_APPEND(f, a) len += f(a, &buf[len], max_len - len); buf[len++] = ',';
+  BUF_APPEND(fmt_u32, timestamp_ms);
+  BUF_APPEND(fmt_u16, fps);
+  BUF_APPEND(fmt_u16, missed_adc);
+  BUF_APPEND(fmt_u16, frame_len);
+  BUF_APPEND(fmt_u16, low);
+  BUF_APPEND(fmt_u16, low_limit);
+  BUF_APPEND(fmt_u16, high_limit);
+  BUF_APPEND(fmt_u16, high);
 #undef BUF_APPEND
 
   // Overwrite the last ,
@@ -33,7 +33,16 @@
 
 #include <stdint.h>
 
+// Report fps from the average frame interval during the last second
+// instead of the amount of frames, which is accurate to sub-frame
+// level but costs a division per frame
+#ifndef FPS_USE_AVERAGE_INTERVAL
+#define FPS_USE_AVERAGE_INTERVAL 0
+#endif
+
+void fps_init(uint16_t rate);
 uint8_t handle_adc(uint16_t adc, uint32_t timestamp_ms, uint8_t *fps, uint16_t *low, uint16_t *low_limit, uint16_t *high_limit, uint16_t *high);
+uint16_t handle_adc_block(const uint16_t *samples, uint16_t count, uint32_t first, uint8_t *fps, uint16_t *low, uint16_t *low_limit, uint16_t *high_limit, uint16_t *high);
 uint8_t create_message(uint8_t *buf,
                        uint8_t max_len,
                        uint32_t timestamp_ms,
@@ -0,0 +1,409 @@
+/*
+ * Forwarding of received RF packets to the UART
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "gateway.h"
+#include "fmt.h"
+#include "pktbuf.h"
+#include "report.h"
+#include "rf.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "timer.h"
+#include "uart.h"
+
+#define COBS_MAX_BLOCK           (254)
+
+// Room for the code byte and the header in front of a received payload
+#if PKTBUF_HEADROOM + RF_PAYLOAD_OFFSET < GATEWAY_HEADER_LEN + 1
+#error "PKTBUF_HEADROOM too small for in place COBS frames"
+#endif
+
+static gateway_mode_t gateway_mode = GATEWAY_DEFAULT_MODE;
+
+// Received telemetry records decoded to text
+static unsigned char TelemetryText[TELEMETRY_TEXT_LEN];
+
+// Delta report rewritten as a full record
+static unsigned char ReportRecord[REPORT_EXPANDED_LEN];
+
+static void forward_text(unsigned char *payload, uint8_t payload_len,
+                         uint8_t rssi, uint8_t lqi);
+static void write_line(unsigned char *line, uint8_t line_len,
+                       unsigned char *debug, uint8_t debug_len);
+static void forward_raw(unsigned char *payload, uint8_t payload_len);
+static void forward_cobs(unsigned char *payload, uint8_t payload_len,
+                         uint8_t rssi, uint8_t lqi);
+static void cobs_encode_block(unsigned char *frame, uint16_t frame_len);
+
+/*
+ * Byte i of a frame made of the header and the payload
+ */
+static inline unsigned char frame_byte(unsigned char *header, unsigned char *payload, uint16_t i)
+{
+  return i < GATEWAY_HEADER_LEN ? header[i] : payload[i - GATEWAY_HEADER_LEN];
+}
+
+
+
+/*
+ * Initialise the gateway in the given output mode
+ */
+void gateway_init(gateway_mode_t mode)
+{
+  gateway_mode = mode;
+  timer_stamp_start();
+}
+
+
+
+/*
+ * Change the output mode
+ */
+void gateway_set_mode(gateway_mode_t mode)
+{
+  gateway_mode = mode;
+}
+
+
+
+/*
+ * Forward a packet received over RF, if any, to the UART. Call from the
+ * main loop before the receiver is restarted.
+ */
+void gateway_forward(void)
+{
+  gateway_forward_skip(0);
+}
+
+
+
+/*
+ * Forward a received packet without the first skip bytes of payload,
+ * e.g. a link layer header
+ */
+void gateway_forward_skip(uint8_t skip)
+{
+  unsigned char *payload = (unsigned char *)&RfRxBuffer[RF_PAYLOAD_OFFSET + skip];
+  uint8_t payload_len;
+  uint8_t rssi, lqi;
+
+  if (!rf_rx_ready) {
+    return;
+  }
+
+  if (RfRxBufferLength < RF_PAYLOAD_OFFSET + 2 + skip) {
+    rf_rx_ready = 0;
+    return;
+  }
+
+  payload_len = RfRxBufferLength - RF_PAYLOAD_OFFSET - 2 - skip;
+  rssi = RfRxBuffer[RfRxBufferLength - 2];
+  lqi = RfRxBuffer[RfRxBufferLength - 1] & ~CRC_OK;
+
+  if (gateway_mode == GATEWAY_MODE_COBS) {
+    forward_cobs(payload, payload_len, rssi, lqi);
+  } else if (rf_rx_status & RF_RX_STATUS_CRC_OK) {
+    // Only framed output can tell about broken packets
+    if (gateway_mode == GATEWAY_MODE_RAW) {
+      forward_raw(payload, payload_len);
+    } else {
+      forward_text(payload, payload_len, rssi, lqi);
+    }
+  }
+
+  rf_rx_ready = 0;
+
+  // Start sending to Uart, unless already sending
+  uart_send_next_msg();
+}
+
+
+
+/*
+ * Write locally generated telemetry records to the UART as text, one
+ * line per record, whatever the mode
+ */
+void gateway_print_records(unsigned char *payload, uint8_t payload_len)
+{
+  unsigned char eol[2] = { '\r', '\n' };
+
+  while (payload_len > 0) {
+    uint8_t rec_len = telemetry_record_len(payload, payload_len);
+    uint8_t text_len;
+
+    if (rec_len == 0) {
+      break;
+    }
+
+    text_len = telemetry_decode(payload, rec_len,
+                                TelemetryText, sizeof(TelemetryText));
+    if (text_len == 0) {
+      break;
+    }
+
+    write_line(TelemetryText, text_len, eol, sizeof(eol));
+    payload += rec_len;
+    payload_len -= rec_len;
+  }
+
+  uart_send_next_msg();
+}
+
+
+
+/*
+ * Forward payload with RSSI, LQI and the source address appended as text
+ */
+static void forward_text(unsigned char *payload, uint8_t payload_len,
+                         uint8_t rssi_raw, uint8_t lqi)
+{
+  unsigned char debug[3 * 6 + 3];
+  unsigned char len = 0;
+  int16_t rssi;
+
+  // Convert RSSI to 0-255, 255 being the best signal
+  if (rssi_raw >= 128) {
+    rssi = rssi_raw - 256;
+  } else {
+    rssi = rssi_raw;
+  }
+  rssi -= 2*74; // double RSSI offset from data sheet
+
+  // turn negative value to 0-255, 255 being the best signal
+  rssi += 276;
+
+  debug[len++] = ' ';
+  len += fmt_i32(rssi, &debug[len], sizeof(debug) - len);
+  debug[len++] = ' ';
+  len += fmt_u16(lqi, &debug[len], sizeof(debug) - len);
+  debug[len++] = ' ';
+  len += fmt_u16(rf_rx_source(), &debug[len], sizeof(debug) - len);
+  debug[len++] = '\r';
+  debug[len++] = '\n';
+
+  if (payload_len > 0 && payload[0] == TELEMETRY_MAGIC) {
+    // Binary telemetry records, print each as a line of text
+    while (payload_len > 0) {
+      uint8_t rec_len = telemetry_record_len(payload, payload_len);
+      uint8_t full_len;
+      uint8_t text_len;
+
+      if (rec_len == 0) {
+        return;
+      }
+
+      full_len = report_expand(payload, rec_len, ReportRecord, sizeof(ReportRecord));
+      if (full_len > 0) {
+        text_len = telemetry_decode(ReportRecord, full_len,
+                                    TelemetryText, sizeof(TelemetryText));
+      } else {
+        text_len = telemetry_decode(payload, rec_len,
+                                    TelemetryText, sizeof(TelemetryText));
+      }
+      if (text_len == 0) {
+        return;
+      }
+
+      write_line(TelemetryText, text_len, debug, len);
+      payload += rec_len;
+      payload_len -= rec_len;
+    }
+    return;
+  }
+
+  if (payload_len >= 2) {
+    // Remove \r\n, it's added back after the debug values
+    payload_len -= 2;
+  }
+
+  write_line(payload, payload_len, debug, len);
+}
+
+
+
+/*
+ * Write a line to the uart with the debug values, or nothing if it
+ * doesn't fit
+ */
+static void write_line(unsigned char *line, uint8_t line_len,
+                       unsigned char *debug, uint8_t debug_len)
+{
+  // If there's not enough space for new data in uart tx buffer, discard new data
+  if (ringbuf_free(&UartTxBuffer) < line_len + debug_len) {
+    STATS_ADD(uart_tx_drops, line_len + debug_len);
+    return;
+  }
+
+  ringbuf_write(&UartTxBuffer, line, line_len);
+  ringbuf_write(&UartTxBuffer, debug, debug_len);
+  STATS_MAX(uart_tx_max, ringbuf_len(&UartTxBuffer));
+}
+
+
+
+/*
+ * Forward payload unchanged
+ */
+static void forward_raw(unsigned char *payload, uint8_t payload_len)
+{
+  uint16_t written;
+  uint8_t slot;
+
+  if (payload_len == 0) {
+    return;
+  }
+
+  // Hand the received slot itself to the UART if there's another one
+  // for the receiver
+  slot = rf_rx_take();
+  if (slot != PKTBUF_NONE) {
+    uart_tx_append_pkt(slot, payload, payload_len);
+    return;
+  }
+
+  // Discard if there's not enough space in uart tx buffer
+  written = ringbuf_write(&UartTxBuffer, payload, payload_len);
+
+  STATS_ADD(uart_tx_drops, payload_len - written);
+  STATS_MAX(uart_tx_max, ringbuf_len(&UartTxBuffer));
+}
+
+
+
+/*
+ * Forward payload in a COBS frame with the link quality header
+ */
+static void forward_cobs(unsigned char *payload, uint8_t payload_len,
+                         uint8_t rssi, uint8_t lqi)
+{
+  unsigned char header[GATEWAY_HEADER_LEN];
+  uint16_t timestamp = rf_rx_timestamp;
+  uint16_t frame_len = GATEWAY_HEADER_LEN + payload_len;
+  uint16_t i = 0;
+  uint8_t slot;
+
+  header[0] = (rf_rx_status & RF_RX_STATUS_CRC_OK) ? GATEWAY_STATUS_CRC_OK : 0;
+  header[1] = rssi;
+  header[2] = lqi;
+  header[3] = timestamp & 0xff;
+  header[4] = timestamp >> 8;
+  header[5] = rf_rx_source();
+
+  // A whole radio packet is a single COBS block, so it can be encoded
+  // in the received slot: the header over the length and addresses in
+  // the headroom, the delimiter over RSSI and LQI
+  if (frame_len <= COBS_MAX_BLOCK) {
+    slot = rf_rx_take();
+  } else {
+    slot = PKTBUF_NONE;
+  }
+
+  if (slot != PKTBUF_NONE) {
+    unsigned char *frame = payload - GATEWAY_HEADER_LEN;
+
+    for (i = 0; i < GATEWAY_HEADER_LEN; ++i) {
+      frame[i] = header[i];
+    }
+    cobs_encode_block(frame, frame_len);
+
+    // Code byte, frame, delimiter
+    uart_tx_append_pkt(slot, frame - 1, frame_len + 2);
+    return;
+  }
+
+  // Encoded frame: one code byte per started block plus the delimiter
+  if (ringbuf_free(&UartTxBuffer) < frame_len + frame_len / COBS_MAX_BLOCK + 2) {
+    STATS_ADD(uart_tx_drops, frame_len);
+    return;
+  }
+
+  // Each block is a code byte (block length + 1) followed by the
+  // bytes before the next zero. A full block has no implied zero.
+  for (;;) {
+    uint16_t j = i;
+    uint16_t k;
+
+    while (j < frame_len && j - i < COBS_MAX_BLOCK &&
+           frame_byte(header, payload, j) != 0) {
+      ++j;
+    }
+
+    ringbuf_put(&UartTxBuffer, j - i + 1);
+    for (k = i; k < j; ++k) {
+      ringbuf_put(&UartTxBuffer, frame_byte(header, payload, k));
+    }
+
+    if (j - i == COBS_MAX_BLOCK) {
+      if (j == frame_len) {
+        break;
+      }
+      i = j;
+    } else if (j == frame_len) {
+      break;
+    } else {
+      // Skip the zero
+      i = j + 1;
+    }
+  }
+
+  ringbuf_put(&UartTxBuffer, 0x00);
+  STATS_MAX(uart_tx_max, ringbuf_len(&UartTxBuffer));
+}
+
+
+
+/*
+ * COBS encode at most COBS_MAX_BLOCK bytes at frame in place. The code
+ * byte goes to frame[-1] and the delimiter to frame[frame_len].
+ */
+static void cobs_encode_block(unsigned char *frame, uint16_t frame_len)
+{
+  unsigned char *code = frame - 1;
+  uint16_t i;
+
+  // Each zero becomes the distance to the next zero or the end
+  for (i = 0; i < frame_len; ++i) {
+    if (frame[i] == 0) {
+      *code = &frame[i] - code;
+      code = &frame[i];
+    }
+  }
+
+  *code = &frame[frame_len] - code;
+  frame[frame_len] = 0x00;
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,73 @@
+/*
+ * Forwarding of received RF packets to the UART
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_GATEWAY_H
+#define RB_GATEWAY_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * GATEWAY_MODE_TEXT: payload followed by " <rssi> <lqi> <src>\r\n", telemetry
+ *                    records decoded to text, one line per record
+ * GATEWAY_MODE_RAW:  payload unchanged
+ * GATEWAY_MODE_COBS: COBS encoded frames terminated by 0x00, each with
+ *                    a header [status][rssi][lqi][timestamp lsb][msb]
+ *                    [source address] followed by the unchanged payload
+ */
+typedef enum gateway_mode_t {
+  GATEWAY_MODE_TEXT,
+  GATEWAY_MODE_RAW,
+  GATEWAY_MODE_COBS
+} gateway_mode_t;
+
+#ifndef GATEWAY_DEFAULT_MODE
+#define GATEWAY_DEFAULT_MODE     GATEWAY_MODE_TEXT
+#endif
+
+#define GATEWAY_HEADER_LEN       (6)
+
+// Bits in the COBS frame status byte
+#define GATEWAY_STATUS_CRC_OK    (0x01)
+
+void gateway_init(gateway_mode_t mode);
+void gateway_set_mode(gateway_mode_t mode);
+void gateway_forward(void);
+void gateway_forward_skip(uint8_t skip);
+void gateway_print_records(unsigned char *payload, uint8_t payload_len);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
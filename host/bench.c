@@ -0,0 +1,1456 @@
+/*
+ * Host benchmarks of the firmware modules on the simulated CC430
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "mock.h"
+#include "adc.h"
+#include "arq.h"
+#include "clock.h"
+#include "fmt.h"
+#include "fps.h"
+#include "gateway.h"
+#include "power.h"
+#include "report.h"
+#include "rf.h"
+#include "samplelog.h"
+#include "sched.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "timer.h"
+#include "uart.h"
+
+#include "hal_pmm.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The firmware runs in zero simulated time, so the simulated latencies
+ * are those of the air, the UART line and the buffering. The CPU cost
+ * of the algorithms is measured separately in host nanoseconds, which
+ * is only good for comparing changes against each other.
+ */
+
+#define BENCH_FMT_CALLS          (1000000)
+
+#define BENCH_FPS_DEFAULT        (60)
+#define BENCH_FPS_SECONDS        (10)
+#define BENCH_FPS_HIGH           (3000)
+#define BENCH_FPS_LOW            (1000)
+#define BENCH_FPS_NOISE          (40)
+#define BENCH_FPS_BLOCK_RATE     (2000)  // Hz, timer triggered sampling
+#define BENCH_FPS_BLOCK_FPS      (144)
+
+#define BENCH_LINES              (1000)
+#define BENCH_LINE_LEN           (48)    // With the \r\n
+#define BENCH_PACKETS            (1000)
+#define BENCH_NODE               (1)
+#define BENCH_OTHER_NODE         (5)     // Filtered by the gateway
+#define BENCH_DRAIN_MS           (2000)
+#define BENCH_SCAN_PACKETS       (500)
+#define BENCH_SCAN_GAP_MS        (40)    // Average between packets
+#define BENCH_MAX_ITEMS          (4096)
+#define BENCH_REPORT_PERIOD_MS   (4000)  // wireless-sensor.c
+#define BENCH_REPORT_HOURS       (24)
+#define BENCH_FLUSH_MAX_MS       (16)    // RB_FLUSH_MAX_MS in wireless-uart.c
+#define BENCH_RATE_WINDOW_MS     (8)     // RB_RATE_WINDOW_MS
+#define BENCH_ARQ_BYTES          (50 * ARQ_PAYLOAD_LEN)
+#define BENCH_ARQ_TURNAROUND_US  (2000)  // Peer from the poll to its ACK
+#define BENCH_ARQ_LIMIT_MS       (60000)
+#define BENCH_TX_PACKETS         (20)
+#define BENCH_TX_LEN             (20)    // A sensor reading
+#define BENCH_CCA_READINGS       (12)
+#define BENCH_CCA_BUSY_DBM       (-60)   // Above RF_CCA_THRESHOLD_DBM
+
+typedef struct bench_latency_t {
+  uint64_t end_us[BENCH_MAX_ITEMS];      // When the item was fully sent
+  uint8_t seen[BENCH_MAX_ITEMS];
+  uint32_t sent;
+  uint32_t received;
+  uint32_t corrupted;
+  uint64_t sum_us;
+  uint64_t worst_us;
+  uint64_t bytes;
+} bench_latency_t;
+
+static bench_latency_t lat;
+static uint16_t cca_readings;           // Readings on air in bench_cca_busy()
+
+// Line being reassembled from the RF packets or the UART bytes
+static char line[256];
+static uint16_t line_len = 0;
+
+static FILE *adc_trace = 0;
+static uint32_t adc_t = 0;
+static uint16_t adc_level = BENCH_FPS_LOW;
+static uint16_t adc_fps = BENCH_FPS_DEFAULT;
+static uint16_t adc_rate = 1000;
+static uint32_t random_state = 1;
+
+static timer_event_t flush_timer;
+static volatile uint8_t flush_due = 0;
+static uint32_t rate_start = 0;
+static uint16_t rate_count = 0;
+static uint16_t rate_bytes = 0;
+
+// ARQ receiver at the other end of the air
+typedef struct bench_arq_peer_t {
+  uint8_t expected;
+  uint8_t loss_percent;
+  uint64_t ack_us;                       // ACK due, 0 for none
+  uint32_t bytes;
+  uint32_t bad;
+  uint32_t frames;
+  uint32_t resent;
+  uint32_t acks;
+  uint32_t lost;
+} bench_arq_peer_t;
+
+static bench_arq_peer_t peer;
+
+static uint64_t now_ns(void);
+static uint32_t bench_random(void);
+static void latency_reset(void);
+static void latency_done(uint32_t id, uint16_t len);
+static void latency_report(const char *name, uint64_t duration_us);
+static void bench_fmt(void);
+static uint16_t adc_sample(uint8_t channel);
+static void bench_fps(void);
+static void bench_fps_block(uint16_t rate, uint16_t fps);
+static void bench_uart_baud(void);
+static void rf_line_sink(const unsigned char *pkt, uint8_t len);
+static void flush_timeout(void);
+static void rate_update(uint16_t bytes);
+static uint8_t bulk_stream(uint16_t queued);
+static void uart_rf_service(void);
+static void bench_uart_rf(rf_profile_id_t profile, uint32_t lines_per_s, uint8_t flow);
+static void uart_line_sink(unsigned char c);
+static void uart_cobs_sink(unsigned char c);
+static void rf_uart_service(void);
+static void bench_rf_uart(rf_profile_id_t profile, uint8_t records, gateway_mode_t mode);
+static void bench_rf_scan(uint16_t preamble_ms);
+static void bench_report(uint8_t loss_percent);
+static void arq_peer_sink(const unsigned char *pkt, uint8_t len);
+static void arq_service_bench(uint8_t flush);
+static void bench_arq(uint8_t loss_percent);
+static void bench_power_up(const char *name, int8_t order);
+static void bench_tx_preamble(uint16_t preamble_ms);
+static void cca_sink(const unsigned char *pkt, uint8_t len);
+static void send_cca_log(void);
+static void bench_cca_busy(void);
+
+static const char *profile_names[RF_PROFILE_COUNT] = {
+  "38k4", "38k4-lp", "250k"
+};
+
+int main(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "a:f:")) != -1) {
+    switch (opt) {
+    case 'a':
+      adc_trace = fopen(optarg, "r");
+      if (!adc_trace) {
+        perror(optarg);
+        return 1;
+      }
+      break;
+    case 'f':
+      adc_fps = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-a adc-trace] [-f fps]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  bench_fmt();
+  bench_fps();
+  if (!adc_trace) {
+    bench_fps_block(BENCH_FPS_BLOCK_RATE, adc_fps);
+    bench_fps_block(BENCH_FPS_BLOCK_RATE, BENCH_FPS_BLOCK_FPS);
+  }
+
+  bench_uart_baud();
+
+  bench_uart_rf(RF_PROFILE_38K4, 50, 0);
+  bench_uart_rf(RF_PROFILE_38K4, 0, 0);
+  bench_uart_rf(RF_PROFILE_38K4, 0, 1);
+  bench_uart_rf(RF_PROFILE_250K, 50, 0);
+  bench_uart_rf(RF_PROFILE_250K, 0, 0);
+  bench_uart_rf(RF_PROFILE_250K, 0, 1);
+
+  bench_rf_uart(RF_PROFILE_38K4, 1, GATEWAY_MODE_TEXT);
+  bench_rf_uart(RF_PROFILE_38K4, 5, GATEWAY_MODE_TEXT);
+  bench_rf_uart(RF_PROFILE_250K, 1, GATEWAY_MODE_TEXT);
+  bench_rf_uart(RF_PROFILE_250K, 5, GATEWAY_MODE_TEXT);
+  bench_rf_uart(RF_PROFILE_38K4, 5, GATEWAY_MODE_COBS);
+  bench_rf_uart(RF_PROFILE_250K, 5, GATEWAY_MODE_COBS);
+
+  bench_rf_scan(0);
+  bench_rf_scan(RF_SCAN_PREAMBLE_MS);
+
+  bench_report(0);
+  bench_report(5);
+
+  bench_arq(0);
+  bench_arq(10);
+
+  bench_power_up("blocking", -1);
+  bench_power_up("vcore first", POWER_ORDER_VCORE_FIRST);
+  bench_power_up("radio first", POWER_ORDER_RADIO_FIRST);
+
+  bench_tx_preamble(0);
+  bench_tx_preamble(RF_SCAN_PREAMBLE_MS);
+
+  bench_cca_busy();
+
+  return 0;
+}
+
+
+
+/*
+ * Host monotonic time
+ */
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+
+/*
+ * Reproducible pseudo random numbers, 32 bit xorshift
+ */
+static uint32_t bench_random(void)
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+
+
+/*
+ * Forget the items of the previous run
+ */
+static void latency_reset(void)
+{
+  memset(&lat, 0, sizeof(lat));
+  line_len = 0;
+}
+
+
+
+/*
+ * Item id arrived intact with len bytes
+ */
+static void latency_done(uint32_t id, uint16_t len)
+{
+  uint64_t us;
+
+  if (id >= lat.sent || lat.seen[id]) {
+    ++lat.corrupted;
+    return;
+  }
+
+  lat.seen[id] = 1;
+  ++lat.received;
+  lat.bytes += len;
+
+  us = mock_time_us() - lat.end_us[id];
+  lat.sum_us += us;
+  if (us > lat.worst_us) {
+    lat.worst_us = us;
+  }
+}
+
+
+
+/*
+ * Print the throughput, latencies and drops of a run
+ */
+static void latency_report(const char *name, uint64_t duration_us)
+{
+  printf("%-28s sent %5u recv %5u lost %5u bad %4u  %6.0f B/s  "
+         "latency avg %7.2f ms worst %7.2f ms\n",
+         name, lat.sent, lat.received, lat.sent - lat.received, lat.corrupted,
+         duration_us ? lat.bytes * 1e6 / duration_us : 0.0,
+         lat.received ? lat.sum_us / 1000.0 / lat.received : 0.0,
+         lat.worst_us / 1000.0);
+  printf("%-28s rf tx %u underflow %u rx %u missed %u filtered %u overflow %u, "
+         "uart rx %u dropped %u tx %u\n", "",
+         mock_stats.rf_tx_packets, mock_stats.rf_tx_underflows,
+         mock_stats.rf_rx_packets, mock_stats.rf_rx_missed,
+         mock_stats.rf_rx_filtered, mock_stats.rf_rx_overflows,
+         mock_stats.uart_rx_bytes, mock_stats.uart_rx_dropped,
+         mock_stats.uart_tx_bytes);
+  printf("%-28s stats tx %lu rx %lu crc %u overflow %u error %u, drops rf %u "
+         "uart rx %u tx %u, max rf %u uart rx %u tx %u\n", "",
+         (unsigned long)stats.rf_tx_packets, (unsigned long)stats.rf_rx_packets,
+         stats.rf_rx_crc_errors, stats.rf_rx_overflows, stats.rf_rx_errors,
+         stats.rf_tx_drops, stats.uart_rx_drops, stats.uart_tx_drops,
+         stats.rf_tx_queue_max, stats.uart_rx_max, stats.uart_tx_max);
+}
+
+
+
+/*
+ * CPU cost of the number formatting used in the messages
+ */
+static void bench_fmt(void)
+{
+  unsigned char buf[12];
+  volatile uint32_t sink = 0;
+  uint64_t start;
+  uint32_t i;
+
+  start = now_ns();
+  for (i = 0; i < BENCH_FMT_CALLS; ++i) {
+    sink += fmt_u16(i & 0xffff, buf, sizeof(buf));
+  }
+  printf("fmt_u16                      %6.1f ns/call\n",
+         (double)(now_ns() - start) / BENCH_FMT_CALLS);
+
+  start = now_ns();
+  for (i = 0; i < BENCH_FMT_CALLS; ++i) {
+    sink += fmt_u32(i * 2654435761u, buf, sizeof(buf));
+  }
+  printf("fmt_u32                      %6.1f ns/call\n",
+         (double)(now_ns() - start) / BENCH_FMT_CALLS);
+
+  start = now_ns();
+  for (i = 0; i < BENCH_FMT_CALLS; ++i) {
+    sink += fmt_q8_8((int16_t)i, buf, sizeof(buf));
+  }
+  printf("fmt_q8_8                     %6.1f ns/call\n",
+         (double)(now_ns() - start) / BENCH_FMT_CALLS);
+
+  (void)sink;
+}
+
+
+
+/*
+ * Next light sensor sample, from the trace file or a synthetic square
+ * wave flickering at adc_fps with a slow sensor and noise. The trace
+ * has a sample per line at 1 kHz, the last number on a line is used.
+ */
+static uint16_t adc_sample(uint8_t channel)
+{
+  uint16_t target;
+  char buf[64];
+
+  (void)channel;
+
+  if (adc_trace) {
+    while (fgets(buf, sizeof(buf), adc_trace)) {
+      char *p = strrchr(buf, ' ');
+
+      return atoi(p ? p + 1 : buf);
+    }
+    return 0;
+  }
+
+  // Frame boundaries at 1 / adc_fps s, alternating black and white
+  target = ((uint64_t)adc_t * adc_fps / adc_rate) & 1 ? BENCH_FPS_HIGH : BENCH_FPS_LOW;
+  ++adc_t;
+
+  // First order response with a 3 ms time constant
+  adc_level += ((int32_t)target - adc_level) / (3 * adc_rate / 1000);
+
+  return adc_level - BENCH_FPS_NOISE / 2 + bench_random() % BENCH_FPS_NOISE;
+}
+
+
+
+/*
+ * Replay the light sensor through adc.c and handle_adc() like main-fps
+ */
+static void bench_fps(void)
+{
+  uint8_t channels[1] = { ADC_CHANNEL_3 };
+  uint32_t samples = 0, frames = 0, reports = 0;
+  uint32_t fps_min = 0xffff, fps_max = 0, fps_sum = 0;
+  uint64_t cpu_ns = 0, worst_ns = 0;
+  uint32_t end_ms = BENCH_FPS_SECONDS * 1000;
+
+  mock_init();
+  fps_init(1000);
+  mock_adc_set_source(adc_sample);
+  adc_start(sizeof(channels), channels, ADC12SHT03 | ADC12SHT02, ADC_MODE_CONT);
+
+  while (adc_trace || mock_time_us() < (uint64_t)end_ms * 1000) {
+    uint16_t adc_value;
+    uint32_t counter;
+    uint16_t low, low_limit, high_limit, high;
+    uint8_t fps;
+    uint64_t start, ns;
+
+    mock_step(MOCK_TICK_US);
+    if (!(mock_take_events() & SCHED_EVENT_ADC)) {
+      continue;
+    }
+
+    adc_get_data(0, &adc_value, &counter);
+    if (adc_trace && feof(adc_trace)) {
+      break;
+    }
+    ++samples;
+
+    start = now_ns();
+    if (handle_adc(adc_value, counter, &fps, &low, &low_limit, &high_limit, &high)) {
+      ++frames;
+      // The window is full after the first second of detected frames
+      if (counter >= 2000) {
+        ++reports;
+        fps_sum += fps;
+        if (fps < fps_min) {
+          fps_min = fps;
+        }
+        if (fps > fps_max) {
+          fps_max = fps;
+        }
+      }
+    }
+    ns = now_ns() - start;
+
+    cpu_ns += ns;
+    if (ns > worst_ns) {
+      worst_ns = ns;
+    }
+  }
+
+  printf("handle_adc                   %6.1f ns/call worst %llu ns, "
+         "%u samples %u frames",
+         samples ? (double)cpu_ns / samples : 0.0,
+         (unsigned long long)worst_ns, samples, frames);
+  if (reports) {
+    printf(", fps %u..%u avg %.1f", fps_min, fps_max, (double)fps_sum / reports);
+  }
+  if (!adc_trace) {
+    printf(" (expected %u)", adc_fps);
+  }
+  printf("\n");
+}
+
+
+
+/*
+ * Frame detection over blocks of samples at rate Hz like main-fps with
+ * timer triggered sampling, on the synthetic signal at fps
+ */
+static void bench_fps_block(uint16_t rate, uint16_t fps)
+{
+  uint16_t block[ADC_BLOCK_LEN];
+  uint32_t first = 0, frames = 0, reports = 0;
+  uint32_t fps_min = 0xffff, fps_max = 0, fps_sum = 0;
+  uint64_t cpu_ns = 0, worst_ns = 0;
+  uint16_t saved_fps = adc_fps;
+
+  adc_rate = rate;
+  adc_fps = fps;
+  adc_t = 0;
+  adc_level = BENCH_FPS_LOW;
+  fps_init(rate);
+
+  while (first < (uint32_t)BENCH_FPS_SECONDS * rate) {
+    uint16_t left = ADC_BLOCK_LEN;
+    const uint16_t *samples = block;
+    uint64_t start, ns;
+    uint16_t i;
+
+    for (i = 0; i < ADC_BLOCK_LEN; ++i) {
+      block[i] = adc_sample(ADC_CHANNEL_3);
+    }
+
+    start = now_ns();
+    while (left > 0) {
+      uint16_t low, low_limit, high_limit, high;
+      uint8_t f;
+      uint16_t used = handle_adc_block(samples, left, first, &f,
+                                       &low, &low_limit, &high_limit, &high);
+
+      samples += used;
+      left -= used;
+      first += used;
+      if (f) {
+        ++frames;
+        if (first >= 2 * (uint32_t)rate) {
+          ++reports;
+          fps_sum += f;
+          if (f < fps_min) {
+            fps_min = f;
+          }
+          if (f > fps_max) {
+            fps_max = f;
+          }
+        }
+      }
+    }
+    ns = now_ns() - start;
+
+    cpu_ns += ns;
+    if (ns > worst_ns) {
+      worst_ns = ns;
+    }
+  }
+
+  printf("handle_adc_block %4u Hz     %6.1f ns/sample worst %llu ns/block, "
+         "%u samples %u frames",
+         rate, (double)cpu_ns / first, (unsigned long long)worst_ns, first, frames);
+  if (reports) {
+    printf(", fps %u..%u avg %.1f", fps_min, fps_max, (double)fps_sum / reports);
+  }
+  printf(" (expected %u)\n", fps);
+
+  adc_rate = 1000;
+  adc_fps = saved_fps;
+}
+
+
+
+/*
+ * UART dividers of each clock profile with the error of the baud rate
+ * they give. Over 2% or a divider N much below 16 isn't reliable, the
+ * modulation then shifts single bits by a large part of a bit time.
+ */
+static void bench_uart_baud(void)
+{
+  static const uint32_t bauds[] = { 115200, 460800, 921600 };
+  static const char *names[CLOCK_PROFILE_COUNT] = {
+    "low power", "1 MHz", "8 MHz", "12 MHz", "20 MHz"
+  };
+  clock_profile_t id;
+  uint8_t i;
+
+  for (id = CLOCK_PROFILE_1MHZ; id < CLOCK_PROFILE_COUNT; ++id) {
+    clock_set_profile(id);
+    printf("uart %-23s", names[id]);
+
+    for (i = 0; i < sizeof(bauds) / sizeof(bauds[0]); ++i) {
+      double div;
+
+      uart_set_baudrate(bauds[i]);
+      uart_init(UART_MODE_IRQ);
+      div = (UCA0BR0 | UCA0BR1 << 8) + ((UCA0MCTL >> 1) & 0x07) / 8.0;
+      printf(" %6lu N %6.2f %+5.1f%%", (unsigned long)bauds[i], div,
+             div > 0 ? (clock_smclk_hz() / div / bauds[i] - 1) * 100 : -100.0);
+    }
+    printf("\n");
+  }
+
+  clock_set_profile(CLOCK_PROFILE_1MHZ);
+  uart_set_baudrate(UART_DEFAULT_BAUDRATE);
+}
+
+
+
+/*
+ * Lines sent over RF, reassembled across packets
+ */
+static void rf_line_sink(const unsigned char *pkt, uint8_t len)
+{
+  uint8_t i;
+
+  for (i = RF_PAYLOAD_OFFSET; i < len; ++i) {
+    if (line_len < sizeof(line)) {
+      line[line_len++] = pkt[i];
+    }
+
+    if (pkt[i] == '\n') {
+      if (line_len == BENCH_LINE_LEN) {
+        latency_done(atoi(line), line_len);
+      } else {
+        ++lat.corrupted;
+      }
+      line_len = 0;
+    }
+  }
+}
+
+
+
+/*
+ * Send what's in the queue even without a newline
+ */
+static void flush_timeout(void)
+{
+  flush_due = 1;
+  sched_post(SCHED_EVENT_UART_RX);
+}
+
+
+
+/*
+ * rate_update() in wireless-uart.c
+ */
+static void rate_update(uint16_t bytes)
+{
+  uint32_t window = timer_ms_to_ticks(BENCH_RATE_WINDOW_MS);
+  uint32_t elapsed = timer_now() - rate_start;
+
+  if (elapsed >= window) {
+    rate_bytes = elapsed < 2 * window ? rate_count : 0;
+    rate_count = 0;
+    rate_start = timer_now();
+  }
+  rate_count += bytes;
+}
+
+
+
+/*
+ * bulk_stream() in wireless-uart.c
+ */
+static uint8_t bulk_stream(uint16_t queued)
+{
+  if (timer_now() - rate_start >= 2 * timer_ms_to_ticks(BENCH_RATE_WINDOW_MS)) {
+    return 0;
+  }
+
+  return (uint32_t)rate_bytes * (BENCH_FLUSH_MAX_MS / BENCH_RATE_WINDOW_MS) + queued >= PAYLOAD_LEN;
+}
+
+
+
+/*
+ * The UART to RF direction of gateway_service() in wireless-uart.c
+ */
+static void uart_rf_service(void)
+{
+  if (!rf_transmitting && !rf_receiving) {
+    rf_receive_off();
+    if (rf_error) {
+      rf_init();
+    }
+    rf_wait_for_idle();
+    if (rf_error) {
+      sched_post(SCHED_EVENT_RF_TX);
+      return;
+    }
+    rf_receive_on();
+  }
+
+  if (ringbuf_len(&UartRxBuffer) > 0 && ringbuf_free(&RfTxQueue) > 0) {
+    unsigned char buf[PAYLOAD_LEN];
+    uint16_t space;
+    uint8_t len;
+
+    uint16_t moved = 0;
+
+    while ((space = ringbuf_free(&RfTxQueue)) > 0 &&
+           (len = uart_read(buf, space < sizeof(buf) ? space : sizeof(buf))) > 0) {
+      rf_append_msg(buf, len);
+      moved += len;
+    }
+    rate_update(moved);
+
+    if (!bulk_stream(ringbuf_len(&RfTxQueue))) {
+      flush_due = 0;
+      timer_event_start(&flush_timer, timer_ms_to_ticks(UART_RX_NEWDATA_TIMEOUT_MS), 0, flush_timeout);
+    } else if (!flush_due && !flush_timer.active) {
+      timer_event_start(&flush_timer, timer_ms_to_ticks(BENCH_FLUSH_MAX_MS), 0, flush_timeout);
+    }
+  }
+
+  if (ringbuf_len(&RfTxQueue) > 0) {
+    enum RF_SEND_MSG mode = RF_SEND_MSG_FULL;
+
+    if (flush_due || ringbuf_len(&RfTxQueue) >= PAYLOAD_LEN) {
+      mode = RF_SEND_MSG_FORCE;
+    } else if (bulk_stream(ringbuf_len(&RfTxQueue))) {
+      return;
+    }
+
+    if (rf_send_next_msg(mode) > 0) {
+      timer_event_stop(&flush_timer);
+      flush_due = 0;
+
+      if (ringbuf_len(&RfTxQueue) > 0) {
+        timer_event_start(&flush_timer,
+                          timer_ms_to_ticks(bulk_stream(ringbuf_len(&RfTxQueue)) ?
+                                            BENCH_FLUSH_MAX_MS : UART_RX_NEWDATA_TIMEOUT_MS),
+                          0, flush_timeout);
+      }
+    }
+  }
+}
+
+
+
+/*
+ * Lines from the UART forwarded over RF, lines_per_s or back to back at
+ * the UART line rate with 0, with or without RTS/CTS
+ */
+static void bench_uart_rf(rf_profile_id_t profile, uint32_t lines_per_s, uint8_t flow)
+{
+  char name[40];
+  uint64_t next_us = 0;
+  uint64_t end_us = 0;
+
+  mock_init();
+  latency_reset();
+  flush_due = 0;
+  flush_timer = (timer_event_t){ 0 };
+  rate_start = rate_count = rate_bytes = 0;
+
+  rf_set_profile(profile);
+  rf_set_address(RF_ADDR_GATEWAY);
+  rf_set_destination(BENCH_NODE);
+  rf_init();
+  uart_set_flow_control(flow);
+  uart_init(UART_MODE_IRQ);
+  mock_rf_set_sink(rf_line_sink);
+  uart_rf_service();
+
+  while (lat.sent < BENCH_LINES || mock_time_us() < end_us) {
+    uint16_t events;
+
+    if (lat.sent < BENCH_LINES && mock_time_us() >= next_us &&
+        (lines_per_s > 0 || mock_uart_rx_pending() == 0)) {
+      char buf[BENCH_LINE_LEN + 1];
+      uint16_t pending = mock_uart_rx_pending();
+
+      // Line number, filler and \r\n
+      memset(buf, 'x', BENCH_LINE_LEN);
+      snprintf(buf, sizeof(buf), "%05u ", lat.sent);
+      buf[6] = 'x';
+      buf[BENCH_LINE_LEN - 2] = '\r';
+      buf[BENCH_LINE_LEN - 1] = '\n';
+      mock_uart_inject((unsigned char *)buf, BENCH_LINE_LEN);
+      lat.end_us[lat.sent] = mock_time_us() +
+        (uint64_t)(pending + BENCH_LINE_LEN) * MOCK_UART_BYTE_US;
+      ++lat.sent;
+
+      if (lines_per_s > 0) {
+        next_us += 1000000 / lines_per_s;
+      }
+      if (lat.sent == BENCH_LINES) {
+        end_us = lat.end_us[lat.sent - 1] + BENCH_DRAIN_MS * 1000;
+      }
+    }
+
+    mock_step(MOCK_TICK_US);
+
+    events = mock_take_events();
+    if (events & SCHED_EVENT_TIMER) {
+      timer_run();
+      events |= mock_take_events();
+    }
+    if (events & (SCHED_EVENT_RF_RX | SCHED_EVENT_RF_TX | SCHED_EVENT_UART_RX)) {
+      uart_rf_service();
+    }
+  }
+
+  snprintf(name, sizeof(name), "uart->rf %s %s%s", profile_names[profile],
+           lines_per_s ? "50 lines/s" : "line rate", flow ? " rts" : "");
+  latency_report(name, end_us - BENCH_DRAIN_MS * 1000);
+  timer_event_stop(&flush_timer);
+  uart_set_flow_control(0);
+}
+
+
+
+/*
+ * Lines written to the UART by the gateway, the counter value is the
+ * record id
+ */
+static void uart_line_sink(unsigned char c)
+{
+  if (line_len < sizeof(line) - 1) {
+    line[line_len++] = c;
+  }
+
+  if (c == '\n') {
+    char *p;
+
+    line[line_len] = '\0';
+    p = strstr(line, " C:");
+    if (p) {
+      latency_done(atoi(p + 3), line_len);
+    } else {
+      ++lat.corrupted;
+    }
+    line_len = 0;
+  }
+}
+
+
+
+/*
+ * COBS frames written to the UART by the gateway, the counter value
+ * of each record is its id
+ */
+static void uart_cobs_sink(unsigned char c)
+{
+  unsigned char frame[sizeof(line)];
+  uint16_t frame_len = 0;
+  uint16_t i = 0;
+
+  if (c != 0x00) {
+    if (line_len < sizeof(line)) {
+      line[line_len++] = c;
+    }
+    return;
+  }
+
+  // Decode, each code byte is followed by code - 1 bytes and a zero
+  // unless it's 0xff or the last block
+  while (i < line_len) {
+    uint8_t code = line[i++];
+    uint8_t k;
+
+    if (code == 0 || i + code - 1 > line_len) {
+      frame_len = 0;
+      break;
+    }
+    for (k = 1; k < code; ++k) {
+      frame[frame_len++] = line[i++];
+    }
+    if (code != 0xff && i < line_len) {
+      frame[frame_len++] = 0;
+    }
+  }
+  line_len = 0;
+
+  if (frame_len < GATEWAY_HEADER_LEN ||
+      !(frame[0] & GATEWAY_STATUS_CRC_OK) || frame[5] != BENCH_NODE) {
+    ++lat.corrupted;
+    return;
+  }
+
+  // Records of [magic][node][seq][counter field][4 byte counter]...
+  i = GATEWAY_HEADER_LEN;
+  while (i < frame_len) {
+    uint8_t rec_len = telemetry_record_len(&frame[i], frame_len - i);
+
+    if (rec_len < TELEMETRY_HEADER_LEN + 5 ||
+        frame[i + TELEMETRY_HEADER_LEN] != ((TELEMETRY_TYPE_COUNTER << 4) | 1)) {
+      ++lat.corrupted;
+      return;
+    }
+    latency_done(frame[i + 4] | frame[i + 5] << 8 | frame[i + 6] << 16 |
+                 (uint32_t)frame[i + 7] << 24, rec_len);
+    i += rec_len;
+  }
+}
+
+
+
+/*
+ * The RF to UART direction of gateway_service() in wireless-uart.c
+ */
+static void rf_uart_service(void)
+{
+  gateway_forward();
+
+  if (!rf_transmitting && !rf_receiving) {
+    rf_receive_off();
+    if (rf_error) {
+      rf_init();
+    }
+    rf_wait_for_idle();
+    if (rf_error) {
+      sched_post(SCHED_EVENT_RF_TX);
+      return;
+    }
+    rf_receive_on();
+  }
+}
+
+
+
+/*
+ * Telemetry packets with records each, back to back on air, forwarded
+ * to the UART as text or COBS frames. Every fourth packet is to
+ * another node.
+ */
+static void bench_rf_uart(rf_profile_id_t profile, uint8_t records, gateway_mode_t mode)
+{
+  char name[40];
+  uint32_t packets = 0;
+  uint64_t start_us, end_us = 0;
+
+  mock_init();
+  latency_reset();
+
+  rf_set_profile(profile);
+  rf_set_address(RF_ADDR_GATEWAY);
+  rf_init();
+  uart_init(UART_MODE_IRQ);
+  gateway_init(mode);
+  mock_uart_set_sink(mode == GATEWAY_MODE_COBS ? uart_cobs_sink : uart_line_sink);
+  rf_uart_service();
+  start_us = mock_time_us();
+
+  while (packets < BENCH_PACKETS || mock_time_us() < end_us) {
+    uint16_t events;
+
+    if (packets < BENCH_PACKETS && !mock_rf_busy()) {
+      unsigned char pkt[PACKET_LEN];
+      uint8_t len = RF_PAYLOAD_OFFSET;
+      uint8_t other = (packets & 3) == 3;
+      uint8_t i;
+
+      for (i = 0; i < records; ++i) {
+        telemetry_t t;
+
+        telemetry_start(&t, &pkt[len], sizeof(pkt) - len, BENCH_NODE);
+        telemetry_add_value(&t, TELEMETRY_TYPE_COUNTER, lat.sent + (other ? 0 : i));
+        telemetry_add_value(&t, TELEMETRY_TYPE_TEMP, 0x1780);
+        telemetry_add_value(&t, TELEMETRY_TYPE_BATTERY, 2345);
+        len += telemetry_end(&t);
+      }
+
+      pkt[0] = len - 1;
+      pkt[1] = other ? BENCH_OTHER_NODE : RF_ADDR_GATEWAY;
+      pkt[2] = BENCH_NODE;
+      mock_rf_inject(pkt, len, -60);
+
+      if (!other) {
+        uint64_t end = mock_time_us() +
+          (uint64_t)(MOCK_RF_OVERHEAD_BYTES + len + MOCK_RF_CRC_BYTES) * rf_byte_us();
+
+        for (i = 0; i < records; ++i) {
+          lat.end_us[lat.sent++] = end;
+        }
+      }
+
+      if (++packets == BENCH_PACKETS) {
+        end_us = mock_time_us() + BENCH_DRAIN_MS * 1000;
+      }
+    }
+
+    mock_step(MOCK_TICK_US);
+
+    events = mock_take_events();
+    if (events & SCHED_EVENT_TIMER) {
+      timer_run();
+    }
+    if (events & (SCHED_EVENT_RF_RX | SCHED_EVENT_RF_TX)) {
+      rf_uart_service();
+    }
+  }
+
+  snprintf(name, sizeof(name), "rf->uart %s %u rec/packet%s", profile_names[profile],
+           records, mode == GATEWAY_MODE_COBS ? " cobs" : "");
+  latency_report(name, end_us - BENCH_DRAIN_MS * 1000 - start_us);
+}
+
+
+
+/*
+ * Nodes hopping over the channels, each packet on the next channel of
+ * its node's sequence, received by a gateway that scans the channels
+ * like wireless-uart with RB_USE_CHANNEL_SCAN
+ */
+static void bench_rf_scan(uint16_t preamble_ms)
+{
+  char name[40];
+  timer_event_t scan_timer = { 0 };
+  uint32_t packets = 0;
+  uint64_t next_us = 0, start_us, end_us = 0;
+  uint16_t preamble_bytes;
+
+  mock_init();
+  latency_reset();
+
+  rf_set_profile(RF_PROFILE_38K4);
+  rf_set_address(RF_ADDR_GATEWAY);
+  rf_set_channel(0);
+  rf_init();
+  rf_calibrate(0);
+  uart_init(UART_MODE_IRQ);
+  gateway_init(GATEWAY_MODE_TEXT);
+  mock_uart_set_sink(uart_line_sink);
+  rf_uart_service();
+  timer_event_start(&scan_timer, timer_ms_to_ticks(RF_SCAN_DWELL_MS),
+                    timer_ms_to_ticks(RF_SCAN_DWELL_MS), rf_scan_next);
+  preamble_bytes = (uint32_t)preamble_ms * 1000 / rf_byte_us();
+  start_us = mock_time_us();
+
+  while (packets < BENCH_SCAN_PACKETS || mock_time_us() < end_us) {
+    uint16_t events;
+
+    if (packets < BENCH_SCAN_PACKETS && mock_time_us() >= next_us && !mock_rf_busy()) {
+      unsigned char pkt[PACKET_LEN];
+      uint8_t len = RF_PAYLOAD_OFFSET;
+      uint8_t node = BENCH_NODE + packets % 8;
+      telemetry_t t;
+
+      telemetry_start(&t, &pkt[len], sizeof(pkt) - len, node);
+      telemetry_add_value(&t, TELEMETRY_TYPE_COUNTER, lat.sent);
+      telemetry_add_value(&t, TELEMETRY_TYPE_TEMP, 0x1780);
+      len += telemetry_end(&t);
+
+      pkt[0] = len - 1;
+      pkt[1] = RF_ADDR_GATEWAY;
+      pkt[2] = node;
+      mock_rf_inject_channel(pkt, len, -60, rf_hop_channel(node, packets / 8),
+                             preamble_bytes);
+      lat.end_us[lat.sent++] = mock_time_us() +
+        (uint64_t)(MOCK_RF_OVERHEAD_BYTES + preamble_bytes + len + MOCK_RF_CRC_BYTES) *
+        rf_byte_us();
+
+      next_us = mock_time_us() + (bench_random() % (2 * BENCH_SCAN_GAP_MS)) * 1000;
+      if (++packets == BENCH_SCAN_PACKETS) {
+        end_us = mock_time_us() + BENCH_DRAIN_MS * 1000;
+      }
+    }
+
+    mock_step(MOCK_TICK_US);
+
+    events = mock_take_events();
+    if (events & SCHED_EVENT_TIMER) {
+      timer_run();
+    }
+    if (events & (SCHED_EVENT_RF_RX | SCHED_EVENT_RF_TX)) {
+      rf_uart_service();
+    }
+  }
+
+  timer_event_stop(&scan_timer);
+
+  snprintf(name, sizeof(name), "rf scan %u ch preamble %u ms", RF_CHANNEL_COUNT,
+           preamble_ms);
+  latency_report(name, end_us - BENCH_DRAIN_MS * 1000 - start_us);
+  printf("%-28s calibrations %u\n", "", mock_stats.rf_calibrations);
+}
+
+
+/*
+ * A day of wireless-sensor readings, the temperature rising from 18 to
+ * 24 C and back at the 1/16 C resolution of the TMP275 and the
+ * battery slowly draining, with a bit of noise in both. Compares sending
+ * every reading to the change based reports, loss_percent of which are
+ * lost on the way, and checks the values the gateway rebuilds.
+ */
+static void bench_report(uint8_t loss_percent)
+{
+  static const report_field_t fields[] = {
+    { TELEMETRY_TYPE_BATTERY, 8 },
+    { TELEMETRY_TYPE_TEMP, 64 },
+  };
+  uint32_t readings = (uint32_t)BENCH_REPORT_HOURS * 3600 * 1000 / BENCH_REPORT_PERIOD_MS;
+  uint32_t reports = 0, keyframes = 0, lost = 0, expanded = 0, unsynced = 0;
+  uint32_t full_bytes = 0, report_bytes = 0, wrong = 0;
+  int32_t worst_temp = 0;
+  uint32_t gw_temp = 0;
+  uint8_t gw_synced = 0;
+  uint64_t start;
+  uint32_t n;
+  char name[40];
+
+  mock_init();
+  report_init(fields, 2, 10UL * 60 * 1000, 8);
+
+  start = now_ns();
+  for (n = 0; n < readings; ++n) {
+    unsigned char rec[32];
+    unsigned char full[REPORT_EXPANDED_LEN];
+    double hours = (double)n * BENCH_REPORT_PERIOD_MS / 3600000.0;
+    double celsius = 24.0 - 6.0 * (hours > 12 ? hours - 12 : 12 - hours) / 12;
+    int16_t temp = ((int16_t)(celsius * 16) + (int16_t)(bench_random() % 3) - 1) * 16;
+    uint16_t batt = 2400 - n * 20 / readings + bench_random() % 3;
+    uint32_t values[2] = { batt, (uint16_t)temp };
+    int32_t error;
+    uint8_t len, full_len;
+
+    // Battery and temperature as telemetry_add_value() in every reading
+    full_bytes += TELEMETRY_HEADER_LEN + 3 + 3;
+
+    len = report_update(values, rec, sizeof(rec), BENCH_NODE);
+    if (len > 0) {
+      ++reports;
+      report_bytes += len;
+      if (rec[TELEMETRY_HEADER_LEN + 2] >> 4 != TELEMETRY_TYPE_DELTA) {
+        ++keyframes;
+      }
+
+      if (bench_random() % 100 < loss_percent) {
+        ++lost;
+      } else {
+        full_len = report_expand(rec, len, full, sizeof(full));
+        if (full_len > 0) {
+          ++expanded;
+          gw_temp = full[full_len - 2] | (full[full_len - 1] << 8);
+          gw_synced = 1;
+        } else if (rec[TELEMETRY_HEADER_LEN + 2] >> 4 != TELEMETRY_TYPE_DELTA) {
+          gw_temp = rec[len - 2] | (rec[len - 1] << 8);
+          gw_synced = 1;
+        } else {
+          ++unsynced;
+          gw_synced = 0;
+        }
+        if (gw_synced && gw_temp != values[1]) {
+          ++wrong;
+        }
+      }
+    }
+
+    // Temperature the gateway shows against the actual one
+    if (gw_synced) {
+      error = (int16_t)gw_temp - temp;
+      if (error < 0) {
+        error = -error;
+      }
+      if (error > worst_temp) {
+        worst_temp = error;
+      }
+    }
+
+    mock_skip(BENCH_REPORT_PERIOD_MS);
+  }
+
+  snprintf(name, sizeof(name), "report %u%% lost", loss_percent);
+  printf("%-28s readings %5u reports %4u keyframes %3u lost %3u unsynced %3u wrong %u\n",
+         name, readings, reports, keyframes, lost, unsynced, wrong);
+  printf("%-28s bytes %6u, every reading %6u, worst temp %+.2f C, %.1f ns/reading\n",
+         "", report_bytes, full_bytes, worst_temp / 256.0,
+         (double)(now_ns() - start) / readings);
+}
+
+
+/*
+ * Data frames received by the peer, like arq_handle_rx(). Frames and
+ * ACKs are lost at random, the ACK goes out after the turnaround.
+ */
+static void arq_peer_sink(const unsigned char *pkt, uint8_t len)
+{
+  unsigned char header;
+  uint8_t seq;
+  uint8_t i;
+
+  if (len <= RF_PAYLOAD_OFFSET) {
+    return;
+  }
+
+  ++peer.frames;
+  if (bench_random() % 100 < peer.loss_percent) {
+    ++peer.lost;
+    return;
+  }
+
+  header = pkt[RF_PAYLOAD_OFFSET];
+  seq = header & ARQ_SEQ_MASK;
+
+  if (header & ARQ_FLAG_POLL) {
+    peer.ack_us = mock_time_us() + BENCH_ARQ_TURNAROUND_US;
+  }
+
+  if ((header & ARQ_FLAG_SYNC) && seq != peer.expected &&
+      ((peer.expected - seq) & ARQ_SEQ_MASK) > ARQ_WINDOW) {
+    peer.expected = seq;
+  }
+
+  if (seq != peer.expected) {
+    ++peer.resent;
+    return;
+  }
+  peer.expected = (peer.expected + 1) & ARQ_SEQ_MASK;
+
+  // The stream counts bytes, in order
+  for (i = RF_PAYLOAD_OFFSET + ARQ_HEADER_LEN; i < len; ++i) {
+    if (pkt[i] != (unsigned char)peer.bytes) {
+      ++peer.bad;
+    }
+    ++peer.bytes;
+  }
+}
+
+
+
+/*
+ * The ARQ sending side of gateway_service() in wireless-uart.c, flush
+ * once the stream has been queued
+ */
+static void arq_service_bench(uint8_t flush)
+{
+  arq_handle_rx();
+
+  if (!rf_transmitting && !rf_receiving) {
+    rf_receive_off();
+    if (rf_error) {
+      rf_init();
+      arq_reset_tx();
+    }
+    rf_wait_for_idle();
+    if (rf_error) {
+      sched_post(SCHED_EVENT_RF_TX);
+      return;
+    }
+    rf_receive_on();
+  }
+
+  arq_service(flush);
+}
+
+
+
+/*
+ * A stream of full ARQ frames to a peer that loses loss_percent of the
+ * frames and of its ACKs. Without loss nothing should be resent, the
+ * ACK timeout starts only after the poll frame is on air.
+ */
+static void bench_arq(uint8_t loss_percent)
+{
+  char name[40];
+  uint32_t fed = 0;
+  uint64_t start_us;
+
+  mock_init();
+  memset(&peer, 0, sizeof(peer));
+  peer.loss_percent = loss_percent;
+
+  rf_set_profile(RF_PROFILE_38K4);
+  rf_set_address(RF_ADDR_GATEWAY);
+  rf_set_destination(BENCH_NODE);
+  rf_init();
+  arq_init();
+  mock_rf_set_sink(arq_peer_sink);
+  start_us = mock_time_us();
+
+  while (peer.bytes < BENCH_ARQ_BYTES &&
+         mock_time_us() - start_us < (uint64_t)BENCH_ARQ_LIMIT_MS * 1000) {
+    uint16_t events;
+
+    while (fed < BENCH_ARQ_BYTES && ringbuf_free(&RfTxQueue) > 0) {
+      unsigned char c = (unsigned char)fed++;
+      rf_append_msg(&c, 1);
+    }
+    sched_post(SCHED_EVENT_UART_RX);
+
+    if (peer.ack_us > 0 && mock_time_us() >= peer.ack_us && !mock_rf_busy()) {
+      unsigned char ack[RF_PAYLOAD_OFFSET + ARQ_HEADER_LEN];
+
+      ack[0] = sizeof(ack) - 1;
+      ack[1] = RF_ADDR_GATEWAY;
+      ack[2] = BENCH_NODE;
+      ack[RF_PAYLOAD_OFFSET] = ARQ_FLAG_ACK | peer.expected;
+      peer.ack_us = 0;
+      ++peer.acks;
+      if (bench_random() % 100 >= loss_percent) {
+        mock_rf_inject(ack, sizeof(ack), -60);
+      }
+    }
+
+    mock_step(MOCK_TICK_US);
+
+    events = mock_take_events();
+    if (events & SCHED_EVENT_TIMER) {
+      timer_run();
+      events |= mock_take_events();
+    }
+    if (events & (SCHED_EVENT_RF_RX | SCHED_EVENT_RF_TX | SCHED_EVENT_UART_RX |
+                  SCHED_EVENT_LINK)) {
+      arq_service_bench(fed == BENCH_ARQ_BYTES);
+    }
+  }
+
+  snprintf(name, sizeof(name), "arq 38k4 %u%% lost", loss_percent);
+  printf("%-28s bytes %6u of %6u bad %u  %6.0f B/s  frames %4u resent %3u lost %3u, "
+         "acks %3u, windows dropped %u\n",
+         name, peer.bytes, BENCH_ARQ_BYTES, peer.bad,
+         peer.bytes * 1e6 / (mock_time_us() - start_us),
+         peer.frames, peer.resent, peer.lost, peer.acks, arq_dropped());
+}
+
+
+
+/*
+ * Sleeping radio and VCore 0 to ready for TX, with SetVCore() and
+ * rf_wakeup() as before (order -1) or power_up_start() in the order.
+ * Busy is the time spent in the busy waits of the HAL at the raised
+ * current.
+ */
+static void bench_power_up(const char *name, int8_t order)
+{
+  char label[40];
+  uint64_t start;
+
+  mock_init();
+  rf_init();
+  rf_shutdown();
+  SetVCore(0);
+  mock_stats.busy_us = 0;
+  mock_stats.sleep_us = 0;
+  start = mock_time_us();
+
+  if (order < 0) {
+    SetVCore(POWER_RF_VCORE);
+    rf_wakeup();
+  } else {
+    power_up_start(order);
+    power_up_wait(LPM3_bits);
+  }
+
+  snprintf(label, sizeof(label), "power up %s", name);
+  printf("%-28s ready %5u us, busy %5u us, asleep %5u us\n", label,
+         (unsigned)(mock_time_us() - start), mock_stats.busy_us, mock_stats.sleep_us);
+
+  power_down();
+}
+
+
+
+/*
+ * Sends of a sensor reading with the preamble, each waited for with
+ * rf_wait_for_tx(). Busy is the CPU time spent in busy waits, the
+ * preamble is slept through.
+ */
+static void bench_tx_preamble(uint16_t preamble_ms)
+{
+  unsigned char msg[BENCH_TX_LEN];
+  char label[40];
+  uint64_t start;
+  uint16_t sent = 0;
+  uint16_t i;
+
+  memset(msg, 'x', sizeof(msg));
+
+  mock_init();
+  rf_init();
+  rf_set_tx_preamble(preamble_ms);
+  mock_stats.busy_us = 0;
+  mock_stats.sleep_us = 0;
+  start = mock_time_us();
+
+  for (i = 0; i < BENCH_TX_PACKETS; ++i) {
+    rf_append_msg(msg, sizeof(msg));
+    rf_send_next_msg(RF_SEND_MSG_FORCE);
+    sent += rf_wait_for_tx(rf_tx_ms(sizeof(msg)), LPM1_bits);
+  }
+
+  snprintf(label, sizeof(label), "tx preamble %u ms", preamble_ms);
+  printf("%-28s sent %3u/%u on air %3u, %5u us/packet, busy %5u us, asleep %6u us\n",
+         label, sent, BENCH_TX_PACKETS, mock_stats.rf_tx_packets,
+         (unsigned)((mock_time_us() - start) / BENCH_TX_PACKETS),
+         mock_stats.busy_us, mock_stats.sleep_us);
+
+  rf_set_tx_preamble(0);
+}
+
+/*
+ * Count the readings in a sample log packet on air
+ */
+static void cca_sink(const unsigned char *pkt, uint8_t len)
+{
+  const unsigned char *rec = pkt + RF_PAYLOAD_OFFSET;
+  uint8_t left = len - RF_PAYLOAD_OFFSET;
+  uint8_t rec_len;
+
+  while (left > 0 && (rec_len = telemetry_record_len(rec, left)) > 0) {
+    ++cca_readings;
+    rec += rec_len;
+    left -= rec_len;
+  }
+}
+
+
+
+/*
+ * Send the sample log as send_log() in wireless-sensor.c
+ */
+static void send_cca_log(void)
+{
+  unsigned char buf[SAMPLELOG_PACKET_LEN];
+  unsigned char len;
+
+  while ((len = samplelog_peek(buf, sizeof(buf))) > 0) {
+    rf_append_msg(buf, len);
+    if (rf_send_next_msg_cca(RF_SEND_MSG_FORCE, LPM3_bits) != RF_TX_SENT) {
+      rf_drop_queued();
+      break;
+    }
+    samplelog_commit();
+    rf_wait_for_tx(rf_tx_ms(len), LPM1_bits);
+  }
+}
+
+
+
+/*
+ * Sends of the sample log, first on a busy channel until CCA gives up
+ * and then on a clear one. The readings of the packets not sent stay
+ * in the log and nothing is left queued, so each reading is on air
+ * once.
+ */
+static void bench_cca_busy(void)
+{
+  unsigned char buf[32];
+  telemetry_t t;
+  uint8_t queued;
+  uint8_t logged;
+  uint16_t i;
+
+  mock_init();
+  rf_init();
+  rf_set_cca(RF_CCA_THRESHOLD_DBM, RF_CCA_RETRIES);
+  mock_rf_set_sink(cca_sink);
+  samplelog_init(BENCH_CCA_READINGS, 0);
+  cca_readings = 0;
+
+  for (i = 0; i < BENCH_CCA_READINGS; ++i) {
+    telemetry_start(&t, buf, sizeof(buf), rf_get_address());
+    telemetry_add_value(&t, TELEMETRY_TYPE_BATTERY, 3000 + i);
+    telemetry_add_value(&t, TELEMETRY_TYPE_TEMP, 5000 + i);
+    samplelog_add(buf, telemetry_end(&t));
+  }
+
+  mock_rf_set_rssi(BENCH_CCA_BUSY_DBM);
+  send_cca_log();
+  queued = ringbuf_len(&RfTxQueue);
+  logged = samplelog_count();
+
+  mock_rf_set_rssi(-100);
+  send_cca_log();
+
+  printf("%-28s busy: queued %u logged %2u, clear: on air %u readings %2u/%u logged %u\n",
+         "cca busy", queued, logged, mock_stats.rf_tx_packets, cca_readings,
+         BENCH_CCA_READINGS, samplelog_count());
+
+  mock_rf_set_sink(NULL);
+}
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,247 @@
+/*
+ * Host build replacement for msp430.h
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_HOST_MSP430_H
+#define RB_HOST_MSP430_H
+
+#include <stdint.h>
+
+/*
+ * Just enough of the CC430F5137 for the portable modules to compile and
+ * run on the host. Peripheral registers are plain variables defined in
+ * mock.c, the radio core is simulated behind the RF1A.h functions and
+ * interrupt handlers are ordinary functions called by the simulation.
+ */
+
+// Interrupt handlers become normal functions, the vector is dropped
+#define interrupt(vector)        used
+
+// Status register: GIE and the low power mode bits are only recorded
+extern volatile uint16_t mock_sr;
+#define GIE                      (0x0008)
+#define CPUOFF                   (0x0010)
+#define OSCOFF                   (0x0020)
+#define SCG0                     (0x0040)
+#define SCG1                     (0x0080)
+#define LPM0_bits                (CPUOFF)
+#define LPM1_bits                (SCG0 + CPUOFF)
+#define LPM2_bits                (SCG1 + CPUOFF)
+#define LPM3_bits                (SCG1 + SCG0 + CPUOFF)
+#define LPM4_bits                (SCG1 + SCG0 + OSCOFF + CPUOFF)
+
+#define __bis_status_register(x) (mock_sr |= (x))
+#define __bic_status_register(x) (mock_sr &= ~(x))
+#define __bis_status_register_on_exit(x) ((void)(x))
+#define __bic_status_register_on_exit(x) ((void)(x))
+#define __get_SR_register()      (mock_sr)
+#define __delay_cycles(x)        ((void)(x))
+#define __no_operation()         ((void)0)
+#define __even_in_range(x, y)    (x)
+
+#define BIT0                     (0x0001)
+#define BIT1                     (0x0002)
+#define BIT2                     (0x0004)
+#define BIT3                     (0x0008)
+#define BIT4                     (0x0010)
+#define BIT5                     (0x0020)
+#define BIT6                     (0x0040)
+#define BIT7                     (0x0080)
+#define BIT8                     (0x0100)
+#define BIT9                     (0x0200)
+#define BITA                     (0x0400)
+#define BITB                     (0x0800)
+#define BITC                     (0x1000)
+#define BITD                     (0x2000)
+#define BITE                     (0x4000)
+#define BITF                     (0x8000)
+
+// Ports and port mapping
+extern volatile uint16_t P1OUT, P1DIR, P1SEL, P2OUT, P2DIR, P2SEL;
+extern volatile uint16_t P2IN, P2REN, P2IE, P2IES, P2IFG;
+extern volatile uint16_t P3OUT, P3DIR, P3SEL, P5OUT, P5DIR, P5SEL;
+extern volatile uint16_t PJOUT, PJDIR;
+extern volatile uint16_t PMAPPWD, P1MAP1, P1MAP5, P1MAP6, P1MAP7;
+#define PM_UCA0RXD               (14)
+#define PM_UCA0TXD               (15)
+#define PM_RFGDO2                (29)
+#define PM_CBOUT1                (24)
+
+// Unified clock system and PMM, clock.c
+extern volatile uint16_t UCSCTL0, UCSCTL1, UCSCTL2, UCSCTL3, UCSCTL4, UCSCTL7;
+extern volatile uint16_t PMMCTL0;
+#define DCORSEL_2                (0x0020)
+#define DCORSEL_5                (0x0050)
+#define DCORSEL_6                (0x0060)
+#define FLLD_1                   (0x1000)
+#define SELREF__XT1CLK           (0x0000)
+#define SELREF__REFOCLK          (0x0020)
+#define SELA__XT1CLK             (0x0000)
+#define SELA__VLOCLK             (0x0100)
+#define SELA__REFOCLK            (0x0200)
+#define SELS__DCOCLKDIV          (0x0040)
+#define SELM__DCOCLKDIV          (0x0004)
+#define DCOFFG                   (0x0001)
+#define PMMCOREV_3               (0x0003)
+
+// USCI_A0 UART
+extern volatile uint16_t UCA0CTL1, UCA0BR0, UCA0BR1, UCA0MCTL;
+extern volatile uint16_t UCA0IE, UCA0IFG, UCA0IV, UCA0RXBUF, UCA0TXBUF;
+#define UCSWRST                  (0x01)
+#define UCSSEL_2                 (0x80)
+#define UCBRS_1                  (0x02)
+#define UCBRF_0                  (0x00)
+#define UCRXIE                   (0x01)
+#define UCTXIE                   (0x02)
+#define UCRXIFG                  (0x01)
+#define UCTXIFG                  (0x02)
+
+// DMA
+extern volatile uint16_t DMACTL0, DMACTL1, DMACTL4, DMAIV;
+extern volatile uint16_t DMA0CTL, DMA0SAL, DMA0DAL, DMA0SZ;
+extern volatile uint16_t DMA1CTL, DMA1SAL, DMA1DAL, DMA1SZ;
+#define DMARMWDIS                (0x0004)
+#define DMADT_0                  (0x0000)
+#define DMADT_4                  (0x4000)
+#define DMADSTINCR_3             (0x0C00)
+#define DMASRCINCR_3             (0x0300)
+#define DMASBDB                  (0x00C0)
+extern volatile uint16_t DMA2CTL, DMA2SAL, DMA2DAL, DMA2SZ;
+#define DMAEN                    (0x0010)
+#define DMAIE                    (0x0004)
+
+// ADC12_A and the shared reference
+extern volatile uint16_t ADC12CTL0, ADC12CTL1, ADC12CTL2, ADC12IE, ADC12IFG, ADC12IV;
+extern volatile uint16_t ADC12MCTL0, ADC12MCTL1, ADC12MCTL2, ADC12MCTL3, ADC12MCTL4;
+extern volatile uint16_t ADC12MEM0, ADC12MEM1, ADC12MEM2, ADC12MEM3, ADC12MEM4;
+extern volatile uint16_t REFCTL0;
+#define ADC12SC                  (0x0001)
+#define ADC12ENC                 (0x0002)
+#define ADC12ON                  (0x0010)
+#define ADC12MSC                 (0x0080)
+#define ADC12SHT02               (0x0400)
+#define ADC12SHT03               (0x0800)
+#define ADC12SHT0_2              (0x0200)
+#define ADC12SHT0_6              (0x0600)
+#define ADC12SHS_3               (0x0C00)
+#define ADC12SSEL_0              (0x0000)
+#define ADC12CONSEQ_1            (0x0002)
+#define ADC12CONSEQ_2            (0x0004)
+#define ADC12CONSEQ_3            (0x0006)
+#define ADC12SSEL0               (0x0008)
+#define ADC12SSEL1               (0x0010)
+#define ADC12SHP                 (0x0200)
+#define ADC12RES_2               (0x0020)
+#define ADC12INCH_0              (0x0000)
+#define ADC12INCH_1              (0x0001)
+#define ADC12INCH_2              (0x0002)
+#define ADC12INCH_3              (0x0003)
+#define ADC12INCH_11             (0x000B)
+#define ADC12SREF_1              (0x0010)
+#define ADC12EOS                 (0x0080)
+#define ADC12IE0                 (0x0001)
+#define ADC12IE1                 (0x0002)
+#define ADC12IE2                 (0x0004)
+#define ADC12IE3                 (0x0008)
+#define ADC12IE4                 (0x0010)
+#define REFON                    (0x0001)
+#define REFVSEL_1                (0x0010)
+#define REFMSTR                  (0x0080)
+
+// Timer_A1, the ADC12 trigger in adc.c
+extern volatile uint16_t TA1CTL, TA1CCR0, TA1CCR1, TA1CCTL1;
+#define TASSEL_2                 (0x0200)
+#define MC_1                     (0x0010)
+#define TACLR                    (0x0004)
+#define OUTMOD_3                 (0x0060)
+
+// Radio core interrupt registers, the rest is behind RF1A.h
+extern volatile uint16_t RF1AIES, RF1AIFG, RF1AIE, RF1AIV;
+
+// CC1101 configuration registers
+#define IOCFG2                   (0x00)
+#define IOCFG1                   (0x01)
+#define IOCFG0                   (0x02)
+#define FIFOTHR                  (0x03)
+#define PKTLEN                   (0x06)
+#define PKTCTRL1                 (0x07)
+#define PKTCTRL0                 (0x08)
+#define ADDR                     (0x09)
+#define CHANNR                   (0x0A)
+#define FSCTRL1                  (0x0B)
+#define MDMCFG4                  (0x10)
+#define DEVIATN                  (0x15)
+#define MCSM2                    (0x16)
+#define MCSM1                    (0x17)
+#define MCSM0                    (0x18)
+#define FOCCFG                   (0x19)
+#define WOREVT1                  (0x1E)
+#define WOREVT0                  (0x1F)
+#define WORCTRL                  (0x20)
+#define FREND1                   (0x21)
+#define FREND0                   (0x22)
+#define FSCAL3                   (0x23)
+#define FSCAL2                   (0x24)
+#define FSCAL1                   (0x25)
+#define FSCAL0                   (0x26)
+#define FSTEST                   (0x29)
+#define TEST2                    (0x2C)
+#define TEST1                    (0x2D)
+#define TEST0                    (0x2E)
+
+// CC1101 status registers
+#define RSSI                     (0x34)
+#define MARCSTATE                (0x35)
+#define TXBYTES                  (0x3A)
+#define RXBYTES                  (0x3B)
+
+// Strobes and FIFO access
+#define RF_SRES                  (0x30)
+#define RF_SFSTXON               (0x31)
+#define RF_SXOFF                 (0x32)
+#define RF_SCAL                  (0x33)
+#define RF_SRX                   (0x34)
+#define RF_STX                   (0x35)
+#define RF_SIDLE                 (0x36)
+#define RF_SWOR                  (0x38)
+#define RF_SPWD                  (0x39)
+#define RF_SFRX                  (0x3A)
+#define RF_SFTX                  (0x3B)
+#define RF_SWORRST               (0x3C)
+#define RF_SNOP                  (0x3D)
+#define RF_TXFIFOWR              (0x3F)
+#define RF_RXFIFORD              (0xBF)
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,685 @@
+/*
+ * Simulated CC430 peripherals, timer and scheduler for the host build
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "mock.h"
+#include "timer.h"
+#include "clock.h"
+#include "sched.h"
+#include "stats.h"
+#include "dma.h"
+#include "uart.h"
+#include "utils.h"
+#include "hal_pmm.h"
+
+#include <msp430.h>
+#include <stdint.h>
+
+// Interrupt handlers of the modules under test
+void USCI_A0_ISR(void);
+void ADC12_ISR(void);
+
+volatile uint16_t mock_sr;
+
+volatile uint16_t P1OUT, P1DIR, P1SEL, P2OUT, P2DIR, P2SEL;
+volatile uint16_t P2IN, P2REN, P2IE, P2IES, P2IFG;
+volatile uint16_t P3OUT, P3DIR, P3SEL, P5OUT, P5DIR, P5SEL;
+volatile uint16_t PJOUT, PJDIR;
+volatile uint16_t PMAPPWD, P1MAP1, P1MAP5, P1MAP6, P1MAP7;
+
+volatile uint16_t UCSCTL0, UCSCTL1, UCSCTL2, UCSCTL3, UCSCTL4, UCSCTL7;
+volatile uint16_t PMMCTL0;
+
+volatile uint16_t UCA0CTL1, UCA0BR0, UCA0BR1, UCA0MCTL;
+volatile uint16_t UCA0IE, UCA0IFG, UCA0IV, UCA0RXBUF, UCA0TXBUF;
+
+volatile uint16_t DMACTL0, DMACTL1, DMACTL4, DMAIV;
+volatile uint16_t DMA0CTL, DMA0SAL, DMA0DAL, DMA0SZ;
+volatile uint16_t DMA1CTL, DMA1SAL, DMA1DAL, DMA1SZ;
+volatile uint16_t DMA2CTL, DMA2SAL, DMA2DAL, DMA2SZ;
+
+volatile uint16_t ADC12CTL0, ADC12CTL1, ADC12CTL2, ADC12IE, ADC12IFG, ADC12IV;
+volatile uint16_t ADC12MCTL0, ADC12MCTL1, ADC12MCTL2, ADC12MCTL3, ADC12MCTL4;
+volatile uint16_t ADC12MEM0, ADC12MEM1, ADC12MEM2, ADC12MEM3, ADC12MEM4;
+volatile uint16_t REFCTL0;
+
+volatile uint16_t TA1CTL, TA1CCR0, TA1CCR1, TA1CCTL1;
+
+volatile uint16_t RF1AIES, RF1AIFG, RF1AIE, RF1AIV;
+
+mock_stats_t mock_stats;
+
+// Written to UCA0TXBUF before calling the TX interrupt to see if it
+// sent a byte
+#define MOCK_UART_TXBUF_EMPTY    (0xFFFF)
+
+static uint64_t mock_us = 0;
+static volatile uint16_t mock_events = 0;
+
+// Armed timer events in deadline order, and the poll handler
+static timer_event_t *mock_timer_events = 0;
+static uint8_t mock_timer_due = 0;
+static timer_handler_t mock_poll_handler = 0;
+static uint16_t mock_poll_ticks = 0;
+static uint64_t mock_poll_next_us = 0;
+
+// Bytes on their way to the UART RX pin
+static unsigned char mock_uart_rx_queue[MOCK_UART_RX_QUEUE_LEN];
+static uint16_t mock_uart_rx_head = 0;
+static uint16_t mock_uart_rx_tail = 0;
+static uint32_t mock_uart_rx_us = 0;
+static uint8_t mock_uart_rts_lag = 0;
+
+// Byte being shifted out of the UART TX pin
+static uint8_t mock_uart_tx_busy = 0;
+static unsigned char mock_uart_tx_byte;
+static uint32_t mock_uart_tx_us = 0;
+static mock_uart_sink_t mock_uart_sink = 0;
+
+static mock_adc_source_t mock_adc_source = 0;
+static uint32_t mock_adc_us = 0;
+
+static uint32_t mock_tick_hz(void);
+static void mock_timer_step(void);
+static uint8_t mock_uart_rx_clear(void);
+static void mock_uart_step(void);
+static void mock_adc_step(void);
+
+/*
+ * Reset the simulated peripherals and time
+ */
+void mock_init(void)
+{
+  mock_us = 0;
+  mock_events = 0;
+  mock_sr = 0;
+  mock_timer_events = 0;
+  mock_timer_due = 0;
+  mock_poll_handler = 0;
+  stats_reset();
+
+  UCA0IE = 0;
+  UCA0IFG = 0;
+  mock_uart_rx_head = mock_uart_rx_tail = 0;
+  mock_uart_rx_us = 0;
+  mock_uart_rts_lag = 0;
+  P2OUT = P2DIR = P2IN = 0;
+  mock_uart_tx_busy = 0;
+  mock_uart_tx_us = 0;
+
+  PMMCTL0 = 0;
+
+  ADC12CTL0 = 0;
+  ADC12IE = 0;
+  mock_adc_us = 0;
+
+  RF1AIE = 0;
+  RF1AIFG = 0;
+  mock_rf_reset();
+
+  mock_stats = (mock_stats_t){ 0 };
+}
+
+
+
+/*
+ * Advance the simulated time by us microseconds
+ */
+void mock_step(uint32_t us)
+{
+  uint32_t t;
+
+  for (t = 0; t < us; t += MOCK_TICK_US) {
+    mock_us += MOCK_TICK_US;
+    mock_rf_step(MOCK_TICK_US);
+    mock_uart_step();
+    mock_adc_step();
+    mock_timer_step();
+  }
+}
+
+
+
+/*
+ * Jump forward in time without stepping the peripherals, like a sleep
+ * in LPM4 with nothing running
+ */
+void mock_skip(uint32_t ms)
+{
+  mock_us += (uint64_t)ms * 1000;
+}
+
+
+
+/*
+ * A busy wait of the CPU, the simulation runs on
+ */
+void mock_busy(uint32_t us)
+{
+  mock_stats.busy_us += us;
+  mock_step(us);
+}
+
+
+
+/*
+ * Simulated time since mock_init()
+ */
+uint64_t mock_time_us(void)
+{
+  return mock_us;
+}
+
+
+
+/*
+ * Scheduler events posted since the last call
+ */
+uint16_t mock_take_events(void)
+{
+  uint16_t events = mock_events;
+
+  mock_events = 0;
+  return events;
+}
+
+
+
+/*
+ * Mark the expired timer events due and call the poll handler, like the
+ * TA0 interrupt
+ */
+static void mock_timer_step(void)
+{
+  uint32_t now = timer_now();
+
+  if (mock_timer_events && !mock_timer_due &&
+      (int32_t)(mock_timer_events->deadline - now) <= 0) {
+    mock_timer_due = 1;
+    sched_post(SCHED_EVENT_TIMER);
+  }
+
+  if (mock_poll_handler && mock_us >= mock_poll_next_us) {
+    mock_poll_next_us += (uint64_t)mock_poll_ticks * 1000000 / mock_tick_hz();
+    mock_poll_handler();
+  }
+}
+
+
+
+/*
+ * Whether the host may send the next byte. Like USB serial adapters it
+ * finishes a few more after RTS is deasserted.
+ */
+static uint8_t mock_uart_rx_clear(void)
+{
+  if (!(UART_RTS_PDIR & UART_RTS_BIT) || !(UART_RTS_POUT & UART_RTS_BIT)) {
+    mock_uart_rts_lag = 0;
+    return 1;
+  }
+
+  if (mock_uart_rts_lag < MOCK_UART_RTS_LAG) {
+    ++mock_uart_rts_lag;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+
+/*
+ * Move a byte from the wire to UCA0RXBUF and shift out the byte in
+ * UCA0TXBUF, at the line rate
+ */
+static void mock_uart_step(void)
+{
+  mock_uart_rx_us += MOCK_TICK_US;
+  if (mock_uart_rx_us >= MOCK_UART_BYTE_US) {
+    mock_uart_rx_us -= MOCK_UART_BYTE_US;
+
+    if (mock_uart_rx_tail != mock_uart_rx_head && mock_uart_rx_clear()) {
+      uint16_t len = ringbuf_len(&UartRxBuffer);
+
+      UCA0RXBUF = mock_uart_rx_queue[mock_uart_rx_tail];
+      mock_uart_rx_tail = (mock_uart_rx_tail + 1) % MOCK_UART_RX_QUEUE_LEN;
+      ++mock_stats.uart_rx_bytes;
+
+      if (UCA0IE & UCRXIE) {
+        UCA0IV = 2;
+        USCI_A0_ISR();
+        if (ringbuf_len(&UartRxBuffer) == len) {
+          ++mock_stats.uart_rx_dropped;
+        }
+      }
+    }
+  } else if (mock_uart_rx_tail == mock_uart_rx_head) {
+    // An idle line starts the next byte right away
+    mock_uart_rx_us = MOCK_UART_BYTE_US;
+  }
+
+  if (mock_uart_tx_busy) {
+    mock_uart_tx_us += MOCK_TICK_US;
+    if (mock_uart_tx_us >= MOCK_UART_BYTE_US) {
+      mock_uart_tx_busy = 0;
+      ++mock_stats.uart_tx_bytes;
+      if (mock_uart_sink) {
+        mock_uart_sink(mock_uart_tx_byte);
+      }
+      UCA0IFG |= UCTXIFG;
+    }
+  }
+
+  // Reading UCA0IV clears the flag, writing UCA0TXBUF starts the shift
+  if (!mock_uart_tx_busy && (UCA0IFG & UCTXIFG) && (UCA0IE & UCTXIE)) {
+    UCA0IFG &= ~UCTXIFG;
+    UCA0TXBUF = MOCK_UART_TXBUF_EMPTY;
+    UCA0IV = 4;
+    USCI_A0_ISR();
+
+    if (UCA0TXBUF != MOCK_UART_TXBUF_EMPTY) {
+      mock_uart_tx_byte = UCA0TXBUF;
+      mock_uart_tx_busy = 1;
+      mock_uart_tx_us = 0;
+    }
+  }
+}
+
+
+
+/*
+ * Convert the enabled memory registers every MOCK_ADC_SAMPLE_US while
+ * the ADC is enabled, and raise the interrupt of the last one
+ */
+static void mock_adc_step(void)
+{
+  volatile uint16_t *mctl[] = { &ADC12MCTL0, &ADC12MCTL1, &ADC12MCTL2, &ADC12MCTL3, &ADC12MCTL4 };
+  volatile uint16_t *mem[] = { &ADC12MEM0, &ADC12MEM1, &ADC12MEM2, &ADC12MEM3, &ADC12MEM4 };
+  uint8_t last = 0;
+  uint8_t i;
+
+  if (!(ADC12CTL0 & ADC12ENC) || !ADC12IE) {
+    mock_adc_us = 0;
+    return;
+  }
+
+  mock_adc_us += MOCK_TICK_US;
+  if (mock_adc_us < MOCK_ADC_SAMPLE_US) {
+    return;
+  }
+  mock_adc_us -= MOCK_ADC_SAMPLE_US;
+
+  while (last < 4 && (ADC12IE >> (last + 1))) {
+    ++last;
+  }
+
+  for (i = 0; i <= last; ++i) {
+    *mem[i] = mock_adc_source ? mock_adc_source(*mctl[i] & 0x0F) : 0;
+  }
+  ++mock_stats.adc_samples;
+
+  // Single conversions and sequences stop by themselves
+  if (!(ADC12CTL1 & ADC12CONSEQ_2)) {
+    ADC12CTL0 &= ~ADC12ENC;
+  }
+
+  ADC12IV = 6 + 2 * last;
+  ADC12_ISR();
+}
+
+
+
+/*
+ * Deliver the bytes sent by the firmware over the UART to sink
+ */
+void mock_uart_set_sink(mock_uart_sink_t sink)
+{
+  mock_uart_sink = sink;
+}
+
+
+
+/*
+ * Queue bytes to be received by the UART at the line rate. Returns the
+ * number of bytes queued.
+ */
+uint16_t mock_uart_inject(const unsigned char *buf, uint16_t len)
+{
+  uint16_t i;
+
+  for (i = 0; i < len; ++i) {
+    uint16_t next = (mock_uart_rx_head + 1) % MOCK_UART_RX_QUEUE_LEN;
+
+    if (next == mock_uart_rx_tail) {
+      break;
+    }
+    mock_uart_rx_queue[mock_uart_rx_head] = buf[i];
+    mock_uart_rx_head = next;
+  }
+
+  return i;
+}
+
+
+
+/*
+ * Bytes queued by mock_uart_inject() not yet received
+ */
+uint16_t mock_uart_rx_pending(void)
+{
+  return (mock_uart_rx_head + MOCK_UART_RX_QUEUE_LEN - mock_uart_rx_tail) % MOCK_UART_RX_QUEUE_LEN;
+}
+
+
+
+/*
+ * Get the conversion results from source, called with the channel
+ * (ADC12INCH_*) of each converted memory register
+ */
+void mock_adc_set_source(mock_adc_source_t source)
+{
+  mock_adc_source = source;
+}
+
+
+
+/*
+ * TA0 tick rate of the clock profile, ACLK/8
+ */
+static uint32_t mock_tick_hz(void)
+{
+  return clock_aclk_hz() / TIMER_ACLK_DIV;
+}
+
+
+
+/*
+ * timer.c replacement running on the simulated time, ticks at the
+ * ACLK/8 of the clock profile like TA0
+ */
+uint32_t timer_now(void)
+{
+  return (uint32_t)(mock_us * mock_tick_hz() / 1000000);
+}
+
+
+
+uint32_t timer_ms_to_ticks(uint32_t ms)
+{
+  return (uint32_t)(((uint64_t)ms * mock_tick_hz() + 999) / 1000);
+}
+
+
+
+uint32_t timer_us_to_ticks(uint32_t us)
+{
+  return (uint32_t)(((uint64_t)us * mock_tick_hz() + 999999) / 1000000);
+}
+
+
+
+uint32_t timer_ticks_to_ms(uint32_t ticks)
+{
+  return (uint32_t)((uint64_t)ticks * 1000 / mock_tick_hz());
+}
+
+
+
+uint16_t timer_stamp(void)
+{
+  return (uint16_t)timer_now();
+}
+
+
+
+void timer_stamp_start(void)
+{
+}
+
+
+
+static void mock_timer_remove(timer_event_t *e)
+{
+  timer_event_t **p = &mock_timer_events;
+
+  while (*p) {
+    if (*p == e) {
+      *p = e->next;
+      break;
+    }
+    p = &(*p)->next;
+  }
+  e->active = 0;
+}
+
+
+
+static void mock_timer_insert(timer_event_t *e)
+{
+  timer_event_t **p = &mock_timer_events;
+
+  while (*p && (int32_t)((*p)->deadline - e->deadline) <= 0) {
+    p = &(*p)->next;
+  }
+  e->next = *p;
+  *p = e;
+  e->active = 1;
+}
+
+
+
+void timer_event_start(timer_event_t *e, uint32_t ticks, uint32_t period,
+                       timer_callback_t callback)
+{
+  mock_timer_remove(e);
+  e->deadline = timer_now() + ticks;
+  e->period = period;
+  e->callback = callback;
+  mock_timer_insert(e);
+}
+
+
+
+void timer_event_stop(timer_event_t *e)
+{
+  mock_timer_remove(e);
+}
+
+
+
+void timer_run(void)
+{
+  uint32_t now = timer_now();
+  timer_event_t *e;
+
+  mock_timer_due = 0;
+
+  while ((e = mock_timer_events) && (int32_t)(e->deadline - now) <= 0) {
+    timer_callback_t callback = e->callback;
+
+    mock_timer_remove(e);
+
+    if (e->period) {
+      e->deadline += e->period;
+      if ((int32_t)(e->deadline - now) <= 0) {
+        e->deadline = now + e->period;
+      }
+      mock_timer_insert(e);
+    }
+
+    if (callback) {
+      callback();
+    }
+  }
+}
+
+
+
+/*
+ * Sleeping lets the simulation run, expired events are handled on the
+ * way like in timer_sleep_ticks()
+ */
+void timer_sleep_until(uint32_t deadline, uint32_t mode)
+{
+  (void)mode;
+
+  while ((int32_t)(deadline - timer_now()) > 0) {
+    mock_stats.sleep_us += MOCK_TICK_US;
+    mock_step(MOCK_TICK_US);
+    if (mock_timer_due) {
+      timer_run();
+    }
+  }
+}
+
+
+
+void timer_sleep_ms(uint16_t ms, uint32_t mode)
+{
+  timer_sleep_until(timer_now() + timer_ms_to_ticks(ms), mode);
+}
+
+
+
+void timer_sleep_min(uint16_t min, uint32_t mode)
+{
+  timer_sleep_until(timer_now() + timer_ms_to_ticks((uint32_t)min * 60000), mode);
+}
+
+
+
+void timer_poll_start(uint16_t ticks, timer_handler_t handler)
+{
+  mock_poll_ticks = ticks;
+  mock_poll_handler = handler;
+  mock_poll_next_us = mock_us + (uint64_t)ticks * 1000000 / mock_tick_hz();
+}
+
+
+
+void timer_poll_stop(void)
+{
+  mock_poll_handler = 0;
+}
+
+
+
+uint8_t timer_wait_while(volatile uint8_t *busy, uint16_t ms, uint32_t mode)
+{
+  uint64_t end = mock_us + (uint64_t)ms * 1000;
+
+  (void)mode;
+
+  while (*busy && mock_us < end) {
+    mock_stats.sleep_us += MOCK_TICK_US;
+    mock_step(MOCK_TICK_US);
+  }
+
+  return !*busy;
+}
+
+
+
+/*
+ * sched.c replacement, the benchmark runs the handlers itself
+ */
+void sched_post(uint16_t events)
+{
+  mock_events |= events;
+}
+
+
+
+void sched_lpm_hold(sched_lpm_t lpm)
+{
+  (void)lpm;
+}
+
+
+
+void sched_lpm_release(sched_lpm_t lpm)
+{
+  (void)lpm;
+}
+
+
+
+/*
+ * The DMA can't reach host memory through 16 bit addresses, use
+ * UART_MODE_IRQ on the host
+ */
+void dma_set_trigger(uint8_t ch, uint8_t trigger)
+{
+  (void)ch;
+  (void)trigger;
+}
+
+
+
+void dma_set_handler(uint8_t ch, dma_handler_t handler)
+{
+  (void)ch;
+  (void)handler;
+}
+
+
+
+/*
+ * Busy waits take simulated time
+ */
+void busysleep_ms(int ms)
+{
+  mock_busy((uint32_t)ms * 1000);
+}
+
+
+
+void busysleep_us(int us)
+{
+  mock_busy(us);
+}
+
+
+
+unsigned int SetVCore(unsigned char level)
+{
+  uint8_t current = PMMCTL0 & PMMCOREV_3;
+
+  // One level at a time, each waiting for SVS and SVM to settle
+  mock_busy((level > current ? level - current : current - level) * MOCK_VCORE_STEP_US);
+  PMMCTL0 = (PMMCTL0 & ~PMMCOREV_3) | level;
+  return PMM_STATUS_OK;
+}
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,106 @@
+/*
+ * Simulated CC430 peripherals for the host build
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_HOST_MOCK_H
+#define RB_HOST_MOCK_H
+
+#include <stdint.h>
+
+/*
+ * Simulated time advances only in mock_step(), in MOCK_TICK_US steps.
+ * On each step the radio moves bytes between its FIFOs and the air at
+ * the byte rate of the current modem profile, the UART shifts bytes in
+ * and out every MOCK_UART_BYTE_US, the ADC converts and due timer
+ * events fire. Interrupt handlers of the driver modules are called from
+ * here like the CPU would, so the code under test runs unmodified.
+ * Timer ticks follow the ACLK of the clock profile like TA0.
+ */
+#define MOCK_TICK_US             (10)
+#define MOCK_UART_BYTE_US        (87)    // 115200 8N1
+#define MOCK_UART_RX_QUEUE_LEN   (4096)  // Bytes waiting to go on the wire
+#define MOCK_UART_RTS_LAG        (2)     // Bytes still sent after RTS deasserts
+#define MOCK_RF_OVERHEAD_BYTES   (8)     // Preamble and sync word before the packet
+#define MOCK_RF_CRC_BYTES        (2)
+#define MOCK_ADC_SAMPLE_US       (1000)  // Conversion rate in continuous mode
+#define MOCK_RF_XOSC_US          (150)   // Radio crystal start from SLEEP
+#define MOCK_RF_RF1A7_US         (810)   // Strobe() delay after chip ready
+#define MOCK_VCORE_STEP_US       (300)   // SetVCore() settling, per level
+
+typedef void (*mock_rf_sink_t)(const unsigned char *pkt, uint8_t len);
+typedef void (*mock_uart_sink_t)(unsigned char c);
+typedef uint16_t (*mock_adc_source_t)(uint8_t channel);
+
+typedef struct mock_stats_t {
+  uint32_t rf_tx_packets;
+  uint32_t rf_tx_underflows;
+  uint32_t rf_rx_packets;
+  uint32_t rf_rx_missed;                 // Radio wasn't listening
+  uint32_t rf_rx_filtered;               // Not for our address
+  uint32_t rf_rx_overflows;
+  uint32_t rf_calibrations;              // SCAL strobes
+  uint32_t uart_rx_bytes;
+  uint32_t uart_rx_dropped;              // UartRxBuffer full
+  uint32_t uart_tx_bytes;
+  uint32_t adc_samples;
+  uint32_t busy_us;                      // Busy waits of the HAL
+  uint32_t sleep_us;                     // In timer_sleep_*()
+} mock_stats_t;
+
+extern mock_stats_t mock_stats;
+
+void mock_init(void);
+void mock_step(uint32_t us);
+void mock_skip(uint32_t ms);
+void mock_busy(uint32_t us);
+uint64_t mock_time_us(void);
+uint16_t mock_take_events(void);
+
+void mock_rf_set_sink(mock_rf_sink_t sink);
+void mock_rf_set_rssi(int8_t dbm);
+uint8_t mock_rf_inject(const unsigned char *pkt, uint8_t len, int8_t rssi_dbm);
+uint8_t mock_rf_inject_channel(const unsigned char *pkt, uint8_t len, int8_t rssi_dbm,
+                               uint8_t channel, uint16_t preamble_bytes);
+uint8_t mock_rf_busy(void);
+void mock_rf_reset(void);
+void mock_rf_step(uint32_t us);
+
+void mock_uart_set_sink(mock_uart_sink_t sink);
+uint16_t mock_uart_inject(const unsigned char *buf, uint16_t len);
+uint16_t mock_uart_rx_pending(void);
+
+void mock_adc_set_source(mock_adc_source_t source);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
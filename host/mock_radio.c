@@ -0,0 +1,569 @@
+/*
+ * Simulated CC1101 radio core behind the RF1A.h interface
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "mock.h"
+#include "rf.h"
+#include "RF1A.h"
+
+#include <msp430.h>
+#include <stdint.h>
+#include <string.h>
+
+// Interrupt handler of rf.c
+void CC1101_ISR(void);
+
+#define MOCK_RF_TX_THRESHOLD     (33)    // FIFOTHR 0x47 in WriteRfSettings()
+#define MOCK_RF_RX_THRESHOLD     (32)
+
+typedef enum mock_rf_air_t {
+  MOCK_RF_AIR_QUIET = 0,
+  MOCK_RF_AIR_TX,                        // Own packet on air
+  MOCK_RF_AIR_RX                         // Injected packet on air
+} mock_rf_air_t;
+
+static unsigned char regs[RF_SETTINGS_LEN];
+static unsigned char patable;
+static unsigned char state = CC430_STATE_IDLE;
+static uint8_t sleeping = 0;
+static uint64_t wake_us = 0;             // Chip ready after StrobeWakeup()
+static uint8_t wake_irq = 0;             // Chip ready edge still to come
+
+static unsigned char tx_fifo[RF_FIFO_LEN];
+static uint8_t tx_fifo_len = 0;
+static uint8_t tx_underflow = 0;
+static unsigned char rx_fifo[RF_FIFO_LEN];
+static uint8_t rx_fifo_len = 0;
+
+// Packet currently on air: bytes done, total length including the len
+// byte, and microseconds until the next byte
+static mock_rf_air_t air = MOCK_RF_AIR_QUIET;
+static unsigned char air_pkt[PACKET_LEN];
+static uint16_t air_pos = 0;
+static uint16_t air_len = 0;
+static int32_t air_us = 0;
+static uint8_t air_accepted = 0;
+static int8_t air_rssi_dbm = 0;
+static uint8_t air_channel = 0;
+
+static int8_t noise_dbm = -100;
+static mock_rf_sink_t sink = 0;
+
+static void interrupt_vector(uint8_t iv);
+static unsigned char rssi_raw(int8_t dbm);
+static void tx_step(void);
+static void rx_step(void);
+
+/*
+ * Chip reset, also the end of mock_init()
+ */
+void mock_rf_reset(void)
+{
+  memset(regs, 0, sizeof(regs));
+  state = CC430_STATE_IDLE;
+  sleeping = 0;
+  wake_us = 0;
+  wake_irq = 0;
+  tx_fifo_len = 0;
+  tx_underflow = 0;
+  rx_fifo_len = 0;
+  air = MOCK_RF_AIR_QUIET;
+}
+
+
+
+/*
+ * Deliver the packets sent by the firmware to sink, with the len byte
+ * and without RSSI and LQI
+ */
+void mock_rf_set_sink(mock_rf_sink_t sink_fn)
+{
+  sink = sink_fn;
+}
+
+
+
+/*
+ * RSSI seen on a quiet channel
+ */
+void mock_rf_set_rssi(int8_t dbm)
+{
+  noise_dbm = dbm;
+}
+
+
+
+/*
+ * Start sending a packet to the radio, [len][dst][src][payload] as on
+ * air, on the channel the radio is on. Returns 0 if the air is already
+ * taken.
+ */
+uint8_t mock_rf_inject(const unsigned char *pkt, uint8_t len, int8_t rssi_dbm)
+{
+  return mock_rf_inject_channel(pkt, len, rssi_dbm, regs[CHANNR], 0);
+}
+
+
+
+/*
+ * mock_rf_inject() on a channel with preamble_bytes more preamble.
+ * Only a radio on the channel sees the signal and receives the packet.
+ */
+uint8_t mock_rf_inject_channel(const unsigned char *pkt, uint8_t len, int8_t rssi_dbm,
+                               uint8_t channel, uint16_t preamble_bytes)
+{
+  if (air != MOCK_RF_AIR_QUIET || len == 0) {
+    return 0;
+  }
+
+  memcpy(air_pkt, pkt, len);
+  air = MOCK_RF_AIR_RX;
+  air_pos = 0;
+  air_len = len;
+  air_us = (int32_t)(MOCK_RF_OVERHEAD_BYTES + preamble_bytes) * rf_byte_us();
+  air_accepted = 0;
+  air_rssi_dbm = rssi_dbm;
+  air_channel = channel;
+
+  return 1;
+}
+
+
+
+/*
+ * Non-zero while a packet is on air
+ */
+uint8_t mock_rf_busy(void)
+{
+  return air != MOCK_RF_AIR_QUIET;
+}
+
+
+
+/*
+ * Move bytes between the FIFOs and the air
+ */
+void mock_rf_step(uint32_t us)
+{
+  // Chip ready falling edge on GDO2 (CHIP_RDYn) after StrobeWakeup()
+  if (wake_irq && mock_time_us() >= wake_us) {
+    wake_irq = 0;
+    if (RF1AIE & BIT2) {
+      interrupt_vector(6);
+    }
+  }
+
+  if (air == MOCK_RF_AIR_QUIET) {
+    return;
+  }
+
+  air_us -= us;
+  while (air != MOCK_RF_AIR_QUIET && air_us <= 0) {
+    air_us += rf_byte_us();
+    if (air == MOCK_RF_AIR_TX) {
+      tx_step();
+    } else {
+      rx_step();
+    }
+  }
+}
+
+
+
+/*
+ * One byte time of own transmit: the preamble is over, take the next
+ * byte from the TX FIFO, or end the packet after the CRC
+ */
+static void tx_step(void)
+{
+  if (state != CC430_STATE_TX) {
+    air = MOCK_RF_AIR_QUIET;
+    return;
+  }
+
+  if (air_pos < air_len || air_len == 0) {
+    uint8_t before = tx_fifo_len;
+
+    if (tx_fifo_len == 0) {
+      // Preamble goes on until the first byte is written
+      if (air_pos == 0) {
+        return;
+      }
+      ++mock_stats.rf_tx_underflows;
+      tx_underflow = 1;
+      state = CC430_STATE_TX_UNDERFLOW;
+      air = MOCK_RF_AIR_QUIET;
+      return;
+    }
+
+    air_pkt[air_pos] = tx_fifo[0];
+    memmove(tx_fifo, tx_fifo + 1, --tx_fifo_len);
+    if (air_pos == 0) {
+      air_len = air_pkt[0] + 1;
+    }
+    ++air_pos;
+
+    // RFIFG1 falling edge, TX FIFO below threshold
+    if (before >= MOCK_RF_TX_THRESHOLD && tx_fifo_len < MOCK_RF_TX_THRESHOLD &&
+        (RF1AIE & BIT1)) {
+      interrupt_vector(4);
+    }
+    return;
+  }
+
+  if (air_pos < air_len + MOCK_RF_CRC_BYTES) {
+    ++air_pos;
+    return;
+  }
+
+  // Packet sent, TXOFF_MODE in MCSM1 is IDLE
+  air = MOCK_RF_AIR_QUIET;
+  state = CC430_STATE_IDLE;
+  ++mock_stats.rf_tx_packets;
+  if (sink) {
+    sink(air_pkt, air_len);
+  }
+
+  // RFIFG9 falling edge, end of packet
+  if (RF1AIE & BIT9) {
+    interrupt_vector(20);
+  }
+}
+
+
+
+/*
+ * One byte time of an injected packet: sync word detection and the
+ * address filter at the start, then bytes to the RX FIFO, and the
+ * status bytes at the end
+ */
+static void rx_step(void)
+{
+  if (air_pos == 0 && !air_accepted) {
+    uint8_t dst = air_len > 1 ? air_pkt[1] : 0;
+
+    if (state != CC430_STATE_RX || sleeping || regs[CHANNR] != air_channel) {
+      ++mock_stats.rf_rx_missed;
+    } else if ((regs[PKTCTRL1] & 0x03) == 0x02 &&
+               dst != regs[ADDR] && dst != RF_ADDR_BROADCAST) {
+      ++mock_stats.rf_rx_filtered;
+    } else {
+      air_accepted = 1;
+    }
+  }
+
+  // Listening radio stopped or hopped away in the middle of the packet
+  if (air_accepted && (state != CC430_STATE_RX || regs[CHANNR] != air_channel)) {
+    air_accepted = 0;
+  }
+
+  if (air_pos < air_len) {
+    if (air_accepted) {
+      if (rx_fifo_len == RF_FIFO_LEN) {
+        ++mock_stats.rf_rx_overflows;
+        state = CC430_STATE_RX_OVERFLOW;
+        air_accepted = 0;
+      } else {
+        rx_fifo[rx_fifo_len++] = air_pkt[air_pos];
+
+        // RFIFG0 rising edge, RX FIFO above threshold
+        if (rx_fifo_len == MOCK_RF_RX_THRESHOLD && (RF1AIE & BIT0)) {
+          interrupt_vector(2);
+        }
+      }
+    }
+    ++air_pos;
+    return;
+  }
+
+  if (air_pos < air_len + MOCK_RF_CRC_BYTES) {
+    ++air_pos;
+    return;
+  }
+
+  air = MOCK_RF_AIR_QUIET;
+  if (!air_accepted) {
+    return;
+  }
+
+  // Appended status bytes, RXOFF_MODE in MCSM1 is IDLE
+  if (rx_fifo_len + 2 > RF_FIFO_LEN) {
+    ++mock_stats.rf_rx_overflows;
+    state = CC430_STATE_RX_OVERFLOW;
+    return;
+  }
+  rx_fifo[rx_fifo_len++] = rssi_raw(air_rssi_dbm);
+  rx_fifo[rx_fifo_len++] = 0x20 | CRC_OK;
+  state = CC430_STATE_IDLE;
+  ++mock_stats.rf_rx_packets;
+
+  if (RF1AIE & BIT9) {
+    interrupt_vector(20);
+  }
+}
+
+
+
+/*
+ * Call the radio interrupt handler with iv in RF1AIV
+ */
+static void interrupt_vector(uint8_t iv)
+{
+  RF1AIV = iv;
+  CC1101_ISR();
+  RF1AIV = 0;
+}
+
+
+
+/*
+ * RSSI register value for dBm
+ */
+static unsigned char rssi_raw(int8_t dbm)
+{
+  return (unsigned char)(int8_t)((dbm + RF_RSSI_OFFSET) * 2);
+}
+
+
+
+/*
+ * RF1A.h on top of the simulation
+ */
+void StrobeWakeup(unsigned char strobe)
+{
+  if (sleeping) {
+    sleeping = 0;
+    wake_us = mock_time_us() + MOCK_RF_XOSC_US;
+    wake_irq = 1;
+  }
+  (void)strobe;
+}
+
+
+
+
+void ResetRadioCore(void)
+{
+  mock_rf_reset();
+}
+
+
+
+unsigned char Strobe(unsigned char strobe)
+{
+  // Waits for the chip to wake up and the RF1A7 delay, like the HAL
+  if (strobe != RF_SRES && strobe != RF_SPWD && strobe != RF_SWOR &&
+      strobe != RF_SNOP) {
+    if (sleeping) {
+      mock_busy(MOCK_RF_XOSC_US + MOCK_RF_RF1A7_US);
+    } else if (mock_time_us() < wake_us) {
+      mock_busy(wake_us - mock_time_us() + MOCK_RF_RF1A7_US);
+    }
+  }
+
+  switch (strobe) {
+  case RF_SRES:
+    mock_rf_reset();
+    break;
+  case RF_SRX:
+  case RF_SWOR:
+    // Wake-on-Radio is simulated as continuous RX
+    sleeping = 0;
+    if (state == CC430_STATE_IDLE) {
+      state = CC430_STATE_RX;
+    }
+    break;
+  case RF_STX:
+    sleeping = 0;
+    if (state == CC430_STATE_IDLE || state == CC430_STATE_RX) {
+      // An injected packet being received is lost
+      if (air == MOCK_RF_AIR_RX) {
+        air_accepted = 0;
+      }
+      state = CC430_STATE_TX;
+      if (air != MOCK_RF_AIR_TX) {
+        air = MOCK_RF_AIR_TX;
+        air_pos = 0;
+        air_len = 0;
+        air_us = (int32_t)MOCK_RF_OVERHEAD_BYTES * rf_byte_us();
+      }
+    }
+    break;
+  case RF_SCAL:
+    ++mock_stats.rf_calibrations;
+    // Fall through
+  case RF_SIDLE:
+    // Calibration is done right away
+    sleeping = 0;
+    if (air == MOCK_RF_AIR_TX) {
+      air = MOCK_RF_AIR_QUIET;
+    }
+    state = CC430_STATE_IDLE;
+    break;
+  case RF_SPWD:
+    if (state == CC430_STATE_IDLE) {
+      sleeping = 1;
+    }
+    break;
+  case RF_SFRX:
+    if (state == CC430_STATE_IDLE || state == CC430_STATE_RX_OVERFLOW) {
+      rx_fifo_len = 0;
+      state = CC430_STATE_IDLE;
+    }
+    break;
+  case RF_SFTX:
+    if (state == CC430_STATE_IDLE || state == CC430_STATE_TX_UNDERFLOW) {
+      tx_fifo_len = 0;
+      tx_underflow = 0;
+      state = CC430_STATE_IDLE;
+    }
+    break;
+  default:
+    break;
+  }
+
+  return state;
+}
+
+
+
+void WriteRfSettings(void)
+{
+  memset(regs, 0, sizeof(regs));
+  regs[IOCFG2] = RF_IOCFG_CHIP_RDYN;
+  regs[IOCFG1] = 0x02;
+  regs[FIFOTHR] = 0x47;
+  regs[PKTLEN] = PAYLOAD_LEN + RF_HEADER_LEN;
+  regs[PKTCTRL1] = 0x06;
+  regs[PKTCTRL0] = 0x05;
+  regs[MCSM2] = RF_MCSM2_DEFAULT;
+  regs[MCSM1] = 0x30;
+  regs[MCSM0] = 0x10;
+  regs[WORCTRL] = RF_WORCTRL_OFF;
+}
+
+
+
+void WriteRfTestSettings(void)
+{
+}
+
+
+
+void WriteSingleReg(unsigned char addr, unsigned char value)
+{
+  if (addr < RF_SETTINGS_LEN) {
+    regs[addr] = value;
+  }
+}
+
+
+
+void WriteBurstReg(unsigned char addr, unsigned char *buffer, unsigned char count)
+{
+  unsigned char i;
+
+  if (addr == RF_TXFIFOWR) {
+    for (i = 0; i < count && tx_fifo_len < RF_FIFO_LEN; ++i) {
+      tx_fifo[tx_fifo_len++] = buffer[i];
+    }
+    return;
+  }
+
+  for (i = 0; i < count; ++i) {
+    WriteSingleReg(addr + i, buffer[i]);
+  }
+}
+
+
+
+unsigned char ReadSingleReg(unsigned char addr)
+{
+  switch (addr) {
+  case RSSI:
+    return rssi_raw(air == MOCK_RF_AIR_RX && air_channel == regs[CHANNR] ?
+                    air_rssi_dbm : noise_dbm);
+  case MARCSTATE:
+    return state;
+  case TXBYTES:
+    return tx_fifo_len | (tx_underflow ? CC430_TXFIFO_UNDERFLOW : 0);
+  case RXBYTES:
+    return rx_fifo_len | (state == CC430_STATE_RX_OVERFLOW ? CC430_RXFIFO_OVERFLOW : 0);
+  }
+
+  if (addr < RF_SETTINGS_LEN) {
+    return regs[addr];
+  }
+
+  return 0;
+}
+
+
+
+void ReadBurstReg(unsigned char addr, unsigned char *buffer, unsigned char count)
+{
+  unsigned char i;
+
+  if (addr == RF_RXFIFORD) {
+    if (count > rx_fifo_len) {
+      count = rx_fifo_len;
+    }
+    memcpy(buffer, rx_fifo, count);
+    memmove(rx_fifo, rx_fifo + count, rx_fifo_len - count);
+    rx_fifo_len -= count;
+    return;
+  }
+
+  for (i = 0; i < count; ++i) {
+    buffer[i] = ReadSingleReg(addr + i);
+  }
+}
+
+
+
+void WriteSinglePATable(unsigned char value)
+{
+  patable = value;
+}
+
+
+
+void WriteBurstPATable(unsigned char *buffer, unsigned char count)
+{
+  if (count > 0) {
+    patable = buffer[0];
+  }
+}
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -27,17 +27,142 @@
  */
 
 #include "i2c.h"
+#include "clock.h"
+#include "sched.h"
+#include "timer.h"
+#include "utils.h"
 
-#define RB_I2C_MAX_RX_BYTES  8
+// Bus free time between a stop and the next start
+#define I2C_BUS_FREE_US      5
+
+#define I2C_SCL_HZ           100000UL
+
+// A byte with its ACK bit on the bus, and the longest busy wait for the
+// USCI to send a start or a stop condition
+#define I2C_BYTE_US          (9 * 1000000UL / I2C_SCL_HZ)
+#define I2C_FLAG_TIMEOUT_US  (2 * I2C_BYTE_US)
+
+// SCL divider for the SMCLK of the clock profile, set in i2c_init()
+static uint16_t i2c_br = 12;
+
+// Queued transfers, the head is on the bus
+static i2c_xfer_t *i2c_queue;
+static i2c_xfer_t *i2c_queue_tail;
+static uint8_t i2c_count;                   // Bytes done in the current direction
+
+static void i2c_start(void);
+
+
+
+/*
+ * Busy wait while the UCB0CTL1 flag is set, at most
+ * I2C_FLAG_TIMEOUT_US. Returns 1 if it cleared, 0 if the bus is stuck.
+ */
+static uint8_t i2c_wait_flag(uint8_t flag)
+{
+  uint16_t us = I2C_FLAG_TIMEOUT_US;
+
+  while (UCB0CTL1 & flag) {
+    if (us-- == 0) {
+      return 0;
+    }
+    busysleep_us(1);
+  }
+
+  return 1;
+}
+
+
+
+/*
+ * Configure the USCI as the 100kHz master, also to recover from errors
+ */
+static void i2c_reset(void)
+{
+  UCB0CTL1 |= UCSWRST;                      // Enable SW reset
+  UCB0CTL0 = UCMST + UCMODE_3 + UCSYNC;     // I2C Master, synchronous mode
+  UCB0CTL1 = UCSSEL_2 + UCSWRST;            // Use SMCLK, keep SW reset
+  UCB0BR0 = i2c_br & 0xff;                  // fSCL = SMCLK/i2c_br, at most 100kHz
+  UCB0BR1 = i2c_br >> 8;
+  UCB0CTL1 &= ~UCSWRST;                     // Clear SW reset, resume operation
+  UCB0IE |= UCTXIE + UCRXIE + UCNACKIE + UCALIE; // Enable interrupts
+}
+
+
+
+/*
+ * Finish the transfer on the bus and start the next one. Called with
+ * interrupts disabled.
+ */
+static void i2c_done(i2c_result_t result)
+{
+  i2c_xfer_t *x = i2c_queue;
+
+  i2c_queue = x->next;
+  if (!i2c_queue) {
+    i2c_queue_tail = 0;
+  }
+
+  x->next = 0;
+  x->result = result;
+  x->busy = 0;
+  sched_post(SCHED_EVENT_I2C);
+
+  if (i2c_queue) {
+    i2c_start();
+  }
+}
+
+
+
+/*
+ * Read phase of the transfer on the bus, with a (repeated) start
+ */
+static void i2c_start_rx(void)
+{
+  i2c_count = 0;
+  UCB0CTL1 &= ~UCTR;                        // Make sure TX is not set
+  UCB0CTL1 |= UCTXSTT;                      // I2C start condition
+
+  // With only one byte the stop must be set during its reception
+  if (i2c_queue->rx_len == 1) {
+    if (!i2c_wait_flag(UCTXSTT)) {          // Start condition sent?
+      // E.g. a slave holding SCL low, don't wait for it here
+      i2c_reset();
+      i2c_done(I2C_TIMEOUT);
+      return;
+    }
+    UCB0CTL1 |= UCTXSTP;                    // I2C stop condition
+  }
+}
+
+
+
+/*
+ * Start the transfer at the head of the queue. Called with interrupts
+ * disabled.
+ */
+static void i2c_start(void)
+{
+  i2c_xfer_t *x = i2c_queue;
+
+  // Ensure stop condition got sent, the reset releases the bus if not
+  if (!i2c_wait_flag(UCTXSTP)) {
+    i2c_reset();
+  }
+  busysleep_us(I2C_BUS_FREE_US);
+
+  UCB0I2CSA = x->addr;
+  i2c_count = 0;
+
+  if (x->tx_len > 0 || x->rx_len == 0) {
+    UCB0CTL1 |= UCTR + UCTXSTT;             // I2C TX, start condition
+  } else {
+    i2c_start_rx();
+  }
+}
 
-volatile enum i2c_state_t i2c_rx_state;
-volatile enum i2c_state_t i2c_tx_state;
 
-static volatile unsigned char I2CTXByteCtr;                  // Bytes to send
-static volatile unsigned char I2CRXByteCtr;                  // Bytes to receive
-static volatile unsigned char *I2CPTxData;                   // Pointer to TX data
-static volatile unsigned char *I2CPRxData;          // Pointer to RX data
-static volatile unsigned char I2CRxBuffer[RB_I2C_MAX_RX_BYTES];       // I2C RX buffer
 
 /*
  * I2C ISR
@@ -45,41 +170,63 @@ static volatile unsigned char I2CRxBuffer[RB_I2C_MAX_RX_BYTES];       // I2C RX
 __attribute__((interrupt(USCI_B0_VECTOR)))
 void USCI_B0_ISR(void)
 {
+  i2c_xfer_t *x = i2c_queue;
+
   switch(UCB0IV) {
   case  0: break;                           // Vector  0: No interrupts
-  case  2: break;                           // Vector  2: ALIFG
-  case  4: break;                           // Vector  4: NACKIFG
+  case  2:                                  // Vector  2: ALIFG
+    // Lost to another master, the USCI dropped to slave mode
+    i2c_reset();
+    if (x) {
+      i2c_done(I2C_ARB_LOST);
+    }
+    break;
+  case  4:                                  // Vector  4: NACKIFG
+    UCB0CTL1 |= UCTXSTP;                    // I2C stop condition
+    UCB0IFG &= ~UCTXIFG;
+    if (x) {
+      i2c_done(I2C_NACK);
+    }
+    break;
   case  6: break;                           // Vector  6: start condition
   case  8: break;                           // Vector  8: stop condition
   case 10:                                  // Vector 10: RXIFG
-    I2CRXByteCtr--;                         // Decrement RX byte counter
-    *I2CPRxData++ = UCB0RXBUF;              // Move RX data to address PRxData
-    if (I2CRXByteCtr > 0) {
-      if (I2CRXByteCtr == 1) {              // Only one byte left?
-        UCB0CTL1 |= UCTXSTP;                // Generate I2C stop condition
-      }
-    } else {
-      i2c_rx_state = I2C_IDLE;
-#if SC_USE_SLEEP == 1
-      __bic_status_register_on_exit(LPM3_bits); // Exit LPMx
-#endif
+    if (!x) {
+      (void)UCB0RXBUF;
+      break;
+    }
+    x->rx[i2c_count++] = UCB0RXBUF;         // Move RX data to the buffer
+    if (i2c_count == x->rx_len) {
+      i2c_done(I2C_OK);
+    } else if (i2c_count == x->rx_len - 1) { // Only one byte left?
+      UCB0CTL1 |= UCTXSTP;                  // Generate I2C stop condition
     }
     break;
   case 12:                                  // Vector 12: TXIFG
-    if (I2CTXByteCtr) {                     // Check TX byte counter
-      UCB0TXBUF = *I2CPTxData++;            // Load TX buffer
-      I2CTXByteCtr--;                       // Decrement TX byte counter
+    if (!x) {
+      UCB0IFG &= ~UCTXIFG;
+      break;
+    }
+    if (i2c_count < x->tx_len) {            // Check TX byte counter
+      UCB0TXBUF = x->tx[i2c_count++];       // Load TX buffer
+    } else if (x->rx_len > 0) {
+      UCB0IFG &= ~UCTXIFG;                  // Clear USCI_B0 TX int flag
+      i2c_start_rx();                       // Repeated start for reading
     } else {
       UCB0CTL1 |= UCTXSTP;                  // I2C stop condition
       UCB0IFG &= ~UCTXIFG;                  // Clear USCI_B0 TX int flag
-      i2c_tx_state = I2C_IDLE;
-#if SC_USE_SLEEP == 1
-      __bic_status_register_on_exit(LPM3_bits); // Exit LPMx
-#endif
+      i2c_done(I2C_OK);
     }
     break;
   default: break;
   }
+
+#if SC_USE_SLEEP == 1
+  // Exit LPMx when a transfer is done
+  if (x && !x->busy) {
+    __bic_status_register_on_exit(LPM3_bits);
+  }
+#endif
 }
 
 
@@ -89,8 +236,8 @@ void USCI_B0_ISR(void)
  */
 void i2c_init(void)
 {
-  i2c_rx_state = I2C_IDLE;
-  i2c_tx_state = I2C_IDLE;
+  i2c_queue = 0;
+  i2c_queue_tail = 0;
 
   PMAPPWD = 0x02D52;                        // Get write-access to port mapping regs
   P1MAP3 = PM_UCB0SDA;                      // Map UCB0SDA output to P1.3
@@ -99,78 +246,122 @@ void i2c_init(void)
 
   P1SEL |= BIT2 + BIT3;                     // Select P1.2 & P1.3 to I2C function
 
-  UCB0CTL1 |= UCSWRST;                      // Enable SW reset
-  UCB0CTL0 = UCMST + UCMODE_3 + UCSYNC;     // I2C Master, synchronous mode
-  UCB0CTL1 = UCSSEL_2 + UCSWRST;            // Use SMCLK, keep SW reset
-  UCB0BR0 = 12;                             // fSCL = SMCLK/12 = ~100kHz
-  UCB0BR1 = 0;
-  // FIXME: shouldn't set slave address here? At least a parameter
-  UCB0I2CSA = 0x4F;                         // TMP275 Slave Address is 04Fh
-  UCB0CTL1 &= ~UCSWRST;                     // Clear SW reset, resume operation
-  UCB0IE |= UCTXIE + UCRXIE;                // Enable interrupts
+  i2c_br = (clock_smclk_hz() + I2C_SCL_HZ - 1) / I2C_SCL_HZ;
+  i2c_reset();
 }
 
 
 
 /*
- * I2C send n bytes synchronously
+ * Queue the transfer, it's started right away if the bus is free.
+ * x->busy is cleared and SCHED_EVENT_I2C posted when it's done.
  */
-void i2c_send(unsigned char *buf, unsigned char bytes)
+void i2c_submit(i2c_xfer_t *x)
 {
-  I2CTXByteCtr = bytes;                     // Load TX byte counter
-  I2CPTxData = buf;                         // TX array start address
+  unsigned int gie = __get_SR_register() & GIE;
 
-  i2c_tx_state = I2C_ACTIVE;
+  __bic_status_register(GIE);
 
-  while (UCB0CTL1 & UCTXSTP);               // Ensure stop condition got sent
-  UCB0CTL1 |= UCTR + UCTXSTT;               // I2C TX, start condition
+  x->next = 0;
+  x->busy = 1;
+  x->result = I2C_PENDING;
 
-  while (i2c_tx_state == I2C_ACTIVE) {
-#if SC_USE_SLEEP == 1
-    __bis_status_register(LPM0_bits + GIE); // Enter LPM0, enable interrupts
-                                            // Remain in LPM0 until all data
-                                            // is TX'd
-#endif
+  if (i2c_queue_tail) {
+    i2c_queue_tail->next = x;
+    i2c_queue_tail = x;
+  } else {
+    i2c_queue = i2c_queue_tail = x;
+    i2c_start();
   }
 
-  while (UCB0CTL1 & UCTXSTP);               // Ensure stop condition got sent
-
+  __bis_status_register(gie);
 }
 
 
 
 /*
- * I2C read 2 bytes synchronously
+ * Sleep until the transfer is done, at most ms milliseconds. On timeout
+ * the transfer is dropped and the bus reset, so that e.g. a slave
+ * holding SCL low can't hang the node.
  */
-uint16_t i2c_read(void)
+i2c_result_t i2c_wait(i2c_xfer_t *x, uint16_t ms, uint32_t mode)
 {
-  I2CPRxData = I2CRxBuffer;                 // Start of RX buffer
-  I2CRXByteCtr = 2;                         // Load RX byte counter
+  unsigned int gie = __get_SR_register() & GIE;
 
-  i2c_rx_state = I2C_ACTIVE;
+  if (timer_wait_while(&x->busy, ms, mode)) {
+    return x->result;
+  }
 
-  while (UCB0CTL1 & UCTXSTP);               // Ensure stop condition got sent
-  UCB0CTL1 &= ~UCTR;                        // Make sure TX is not set
-  UCB0CTL1 |= UCTXSTT;                      // I2C start condition
+  __bic_status_register(GIE);
 
-#if 0
-  // FIXME: if receiving only 1 byte, need to send stop immediately
-  while(UCB0CTL1 & UCTXSTT);                // Start condition sent?
-  UCB0CTL1 |= UCTXSTP;                      // I2C stop condition
-#endif
+  if (x->busy) {
+    if (i2c_queue == x) {
+      i2c_reset();
+      i2c_done(I2C_TIMEOUT);
+    } else {
+      i2c_xfer_t *p = i2c_queue;
 
-  while (i2c_rx_state == I2C_ACTIVE) {
-#if SC_USE_SLEEP == 1
-    __bis_status_register(LPM0_bits + GIE); // Enter LPM0, enable interrupts
-                                            // Remain in LPM0 until all data
-                                            // is RX'd
-#endif
+      // Not started yet, just unlink
+      while (p && p->next != x) {
+        p = p->next;
+      }
+      if (p) {
+        p->next = x->next;
+        if (i2c_queue_tail == x) {
+          i2c_queue_tail = p;
+        }
+      }
+      x->next = 0;
+      x->result = I2C_TIMEOUT;
+      x->busy = 0;
+    }
   }
 
-  return ((I2CRxBuffer[0] << 8) | I2CRxBuffer[1]);
+  __bis_status_register(gie);
+
+  return x->result;
+}
+
+
+
+/*
+ * I2C send len bytes synchronously
+ */
+i2c_result_t i2c_write(uint8_t addr, const unsigned char *buf, uint8_t len)
+{
+  i2c_xfer_t x = {0};
+
+  x.addr = addr;
+  x.tx = buf;
+  x.tx_len = len;
+
+  i2c_submit(&x);
+
+  // Remain in LPM0 until all data is TX'd
+  return i2c_wait(&x, I2C_TIMEOUT_MS, LPM0_bits);
 }
 
 
+
+/*
+ * I2C read len bytes synchronously
+ */
+i2c_result_t i2c_read(uint8_t addr, unsigned char *buf, uint8_t len)
+{
+  i2c_xfer_t x = {0};
+
+  x.addr = addr;
+  x.rx = buf;
+  x.rx_len = len;
+
+  i2c_submit(&x);
+
+  // Remain in LPM0 until all data is RX'd
+  return i2c_wait(&x, I2C_TIMEOUT_MS, LPM0_bits);
+}
+
+
+
 /*
  * Shutdown I2C
  */
@@ -34,18 +34,35 @@
 #include <msp430.h>
 #include <stdint.h>
 
-enum i2c_state_t {
-  I2C_IDLE = 0,
-  I2C_ACTIVE,
-  I2C_READ_DATA
-};
+// Sleep at most this long in the synchronous calls
+#define I2C_TIMEOUT_MS           20
 
-extern volatile enum i2c_state_t i2c_rx_state;
-extern volatile enum i2c_state_t i2c_tx_state;
+typedef enum i2c_result_t {
+  I2C_OK = 0,
+  I2C_PENDING,
+  I2C_NACK,                                 // slave didn't acknowledge
+  I2C_ARB_LOST,                             // another master on the bus
+  I2C_TIMEOUT
+} i2c_result_t;
+
+// Write tx_len bytes, then read rx_len bytes after a repeated start.
+// Either length may be zero.
+typedef struct i2c_xfer_t {
+  uint8_t addr;
+  const unsigned char *tx;
+  uint8_t tx_len;
+  unsigned char *rx;
+  uint8_t rx_len;
+  volatile uint8_t busy;
+  volatile i2c_result_t result;
+  struct i2c_xfer_t *next;
+} i2c_xfer_t;
 
 void i2c_init(void);
-void i2c_send(unsigned char *buf, unsigned char bytes);
-uint16_t i2c_read(void);
+void i2c_submit(i2c_xfer_t *x);
+i2c_result_t i2c_wait(i2c_xfer_t *x, uint16_t ms, uint32_t mode);
+i2c_result_t i2c_write(uint8_t addr, const unsigned char *buf, uint8_t len);
+i2c_result_t i2c_read(uint8_t addr, unsigned char *buf, uint8_t len);
 void i2c_shutdown(void);
 
 #endif
@@ -29,7 +29,9 @@
 #include "common.h"
 #include "adc.h"
 #include "led.h"
+#include "fmt.h"
 #include "fps.h"
+#include "sched.h"
 #include "uart.h"
 #include "utils.h"
 
@@ -56,11 +58,29 @@ LDR ohms on my 22" IPS monitor:
 - black xterm: 45k
 */
 
+// Conversions triggered by the timer at RB_ADC_RATE_HZ into DMA
+// blocks, timestamps count samples. Otherwise free running with a
+// sample interrupt each, timestamps count interrupts (~1 ms).
+#define RB_USE_ADC_TIMER  1
+#define RB_ADC_RATE_HZ    2000
+
+static uint8_t led_count = 0;
+#if !RB_USE_ADC_TIMER
+static uint32_t timestamp_counter = 0;
+#endif
+static uint32_t timestamp_last_frame = 0;
+static uint16_t missed_adc = 0;
+
+#if RB_USE_ADC_TIMER
+static void handle_block(void);
+#else
+static void handle_sample(void);
+#endif
+static void report_frame(uint32_t timestamp_ms, uint8_t fps, uint16_t low,
+                         uint16_t low_limit, uint16_t high_limit, uint16_t high);
+
 int main(void)
 {
-  uint8_t led_count = 0;
-  uint32_t timestamp_counter = 0;
-  uint32_t timestamp_last_frame = 0;
   uint8_t channels[1] = {ADC12INCH_3};
   // Stop watchdog timer to prevent time out reset
   WDTCTL = WDTPW + WDTHOLD;
@@ -87,78 +107,158 @@ int main(void)
   // P2.3 (A3) as input
   P2DIR &= ~BIT3;
 
+  sched_init();
+
   led_init();
-  uart_init();
+  uart_init(UART_MODE_IRQ);
 
   #if SC_USE_SLEEP == 0
   // Enable interrupts
   __bis_status_register(GIE);
   #endif
 
+#if RB_USE_ADC_TIMER
+  sched_set_handler(SCHED_EVENT_ADC, handle_block);
+
+  // Channel A3 at RB_ADC_RATE_HZ, 16 cycle sample and hold
+  fps_init(RB_ADC_RATE_HZ);
+  adc_timer_start(channels[0], ADC12SHT0_2, RB_ADC_RATE_HZ);
+#else
+  sched_set_handler(SCHED_EVENT_ADC, handle_sample);
+
   // Initiate channel A3 measurement @ 1000 Hz
   adc_start(sizeof(channels), channels, ADC12SHT03 | ADC12SHT02, ADC_MODE_CONT);
+#endif
 
-  while(1) {
-    uint8_t fps;
-    uint16_t missed_adc;
-    uint16_t adc_value;
-    uint32_t timestamp_ms;
-    uint16_t low;
-    uint16_t low_limit;
-    uint16_t high_limit;
-    uint16_t high;
+  sched_run();
 
-    // Wait for the ADC interrupt
-    while (adc_state != ADC_STATE_DATA) {}
+  return 0;
+}
 
-    adc_get_data(1, &adc_value, &timestamp_ms);
 
-    ++timestamp_counter;
-    missed_adc += timestamp_ms - timestamp_counter;
 
-    led_count += timestamp_ms - timestamp_counter;
-    if (led_count++ > 100) {
-      led_count = 0;
-      led_toggle(1);
+#if RB_USE_ADC_TIMER
+/*
+ * Detect the frames in the latest block of samples, run from the
+ * scheduler on DMA interrupt
+ */
+static void handle_block(void)
+{
+  const uint16_t *samples;
+  uint32_t first;
+  uint16_t missed;
+  uint16_t left = ADC_BLOCK_LEN;
+  uint8_t fps;
+  uint16_t low;
+  uint16_t low_limit;
+  uint16_t high_limit;
+  uint16_t high;
+
+  samples = adc_get_block(&first, &missed);
+  if (!samples) {
+    return;
+  }
+  missed_adc += missed;
+
+  led_count += 1;
+  if (led_count > RB_ADC_RATE_HZ / ADC_BLOCK_LEN / 10) {
+    led_count = 0;
+    led_toggle(1);
+  }
+
+  while (left > 0) {
+    uint16_t used = handle_adc_block(samples, left, first, &fps,
+                                     &low, &low_limit, &high_limit, &high);
+
+    samples += used;
+    left -= used;
+    first += used;
+
+    if (fps) {
+      // Samples to ms only per frame, there's no hardware divider
+      uint32_t last = first - 1;
+
+      report_frame((last / RB_ADC_RATE_HZ) * 1000 +
+                   (last % RB_ADC_RATE_HZ) * 1000 / RB_ADC_RATE_HZ, fps,
+                   low, low_limit, high_limit, high);
     }
+  }
+}
 
-    timestamp_counter = timestamp_ms;
+#else
+
+/*
+ * Handle the latest ADC sample, run from the scheduler on ADC interrupt
+ */
+static void handle_sample(void)
+{
+  uint8_t fps;
+  uint16_t adc_value;
+  uint32_t timestamp_ms;
+  uint16_t low;
+  uint16_t low_limit;
+  uint16_t high_limit;
+  uint16_t high;
+
+  adc_get_data(0, &adc_value, &timestamp_ms);
+
+  ++timestamp_counter;
+  missed_adc += timestamp_ms - timestamp_counter;
+
+  led_count += timestamp_ms - timestamp_counter;
+  if (led_count++ > 100) {
+    led_count = 0;
+    led_toggle(1);
+  }
+
+  timestamp_counter = timestamp_ms;
 
 #if 0
-    {
-      uint8_t buf[64];
-      uint8_t len = 0;
+  {
+    uint8_t buf[64];
+    uint8_t len = 0;
 
-      len += sc_itoa(missed_adc, &buf[len], 64 - len);
-      buf[len++] = '\r';
-      buf[len++] = '\n';
+    len += fmt_u16(missed_adc, &buf[len], 64 - len);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
 
-      uart_tx_append_msg(buf, len);
-      uart_send_next_msg();
-    }
+    uart_tx_append_msg(buf, len);
+    uart_send_next_msg();
+  }
 #endif
 
-    if (handle_adc(adc_value, timestamp_ms, &fps, &low, &low_limit, &high_limit, &high)) {
-      uint8_t buf[64];
-      uint8_t len;
-
-      len = create_message(buf, 64,
-                           timestamp_ms,
-                           fps,
-                           missed_adc,
-                           (uint16_t)(timestamp_ms - timestamp_last_frame),
-                           low,
-                           low_limit,
-                           high_limit,
-                           high);
-      uart_tx_append_msg(buf, len);
-      uart_send_next_msg();
-
-      timestamp_last_frame = timestamp_ms;
-      missed_adc = 0;
-    }
+  if (handle_adc(adc_value, timestamp_ms, &fps, &low, &low_limit, &high_limit, &high)) {
+    report_frame(timestamp_ms, fps, low, low_limit, high_limit, high);
   }
 }
+#endif
+
+
+
+/*
+ * Send the frame over the UART
+ */
+static void report_frame(uint32_t timestamp_ms, uint8_t fps, uint16_t low,
+                         uint16_t low_limit, uint16_t high_limit, uint16_t high)
+{
+  uint8_t buf[64];
+  uint8_t len;
+
+  len = create_message(buf, 64,
+                       timestamp_ms,
+                       fps,
+                       missed_adc,
+                       (uint16_t)(timestamp_ms - timestamp_last_frame),
+                       low,
+                       low_limit,
+                       high_limit,
+                       high);
+  uart_tx_append_msg(buf, len);
+  uart_send_next_msg();
+
+  timestamp_last_frame = timestamp_ms;
+  missed_adc = 0;
+}
 
 /* Emacs indentatation information
    Local Variables:
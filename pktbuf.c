@@ -0,0 +1,92 @@
+/*
+ * Shared pool of packet buffers
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "pktbuf.h"
+
+#include <msp430.h>
+#include <stdint.h>
+
+volatile unsigned char pktbuf_pool[PKTBUF_COUNT][PKTBUF_LEN];
+
+// Bit per free slot
+static volatile uint8_t pktbuf_free_mask = (1 << PKTBUF_COUNT) - 1;
+
+/*
+ * Take a free slot. Returns its id or PKTBUF_NONE if all are in use.
+ * Safe to call also from interrupt handlers.
+ */
+uint8_t pktbuf_alloc(void)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+  uint8_t id;
+
+  __bic_status_register(GIE);
+
+  for (id = 0; id < PKTBUF_COUNT; ++id) {
+    if (pktbuf_free_mask & (1 << id)) {
+      pktbuf_free_mask &= ~(1 << id);
+      break;
+    }
+  }
+
+  __bis_status_register(gie);
+
+  if (id == PKTBUF_COUNT) {
+    return PKTBUF_NONE;
+  }
+
+  return id;
+}
+
+
+
+/*
+ * Give a slot back to the pool. Safe to call also from interrupt
+ * handlers.
+ */
+void pktbuf_free(uint8_t id)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+
+  if (id >= PKTBUF_COUNT) {
+    return;
+  }
+
+  __bic_status_register(GIE);
+  pktbuf_free_mask |= 1 << id;
+  __bis_status_register(gie);
+}
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,72 @@
+/*
+ * Shared pool of packet buffers
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_PKTBUF_H
+#define RB_PKTBUF_H
+
+#include "common.h"
+#include "rf.h"
+
+#include <stdint.h>
+
+/*
+ * Fixed size slots for whole radio packets, handed over between the
+ * drivers instead of copying the packet. The holder of a slot id owns
+ * the slot until it passes the id on or frees it. A received packet
+ * is read from the RX FIFO into a slot and may then go to the UART TX
+ * path as it is.
+ *
+ * PKTBUF_HEADROOM bytes in front of the packet leave room for a longer
+ * header, e.g. the COBS code byte and the gateway frame header in place
+ * of the length and address bytes.
+ */
+#ifndef PKTBUF_COUNT
+#define PKTBUF_COUNT             (2)     // One receiving, one on the way out
+#endif
+
+#define PKTBUF_HEADROOM          (4)
+#define PKTBUF_LEN               (PKTBUF_HEADROOM + PACKET_LEN)
+#define PKTBUF_NONE              (0xFF)
+
+extern volatile unsigned char pktbuf_pool[PKTBUF_COUNT][PKTBUF_LEN];
+
+// Start of the packet in a slot
+#define PKTBUF_PACKET(id)        (&pktbuf_pool[(id)][PKTBUF_HEADROOM])
+
+uint8_t pktbuf_alloc(void);
+void pktbuf_free(uint8_t id);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,90 @@
+/*
+ * Power sequencing of the radio wake up and VCore
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include "power.h"
+#include "prof.h"
+#include "rf.h"
+
+#include "hal_pmm.h"
+
+/*
+ * Start bringing up VCore and the radio in the given order. Returns
+ * with VCore raised and the radio waking up.
+ */
+void power_up_start(power_order_t order)
+{
+  if (order == POWER_ORDER_RADIO_FIRST) {
+    rf_wakeup_start();
+    PROF_SET_VCORE(POWER_RF_VCORE);
+  } else {
+    PROF_SET_VCORE(POWER_RF_VCORE);
+    rf_wakeup_start();
+  }
+}
+
+
+
+/*
+ * Returns 1 once the radio is ready to transmit after power_up_start()
+ */
+uint8_t power_up_ready(void)
+{
+  return rf_wakeup_ready();
+}
+
+
+
+/*
+ * Sleep in the low power mode until the radio is ready to transmit
+ */
+void power_up_wait(uint32_t mode)
+{
+  rf_wakeup_wait(mode);
+}
+
+
+
+/*
+ * Put the radio back to sleep and lower VCore
+ */
+void power_down(void)
+{
+  rf_shutdown();
+  PROF_SET_VCORE(0);
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,68 @@
+/*
+ * Power sequencing of the radio wake up and VCore
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef RB_POWER_H
+#define RB_POWER_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * Bringing up the radio for a send without busy waiting for it. The
+ * radio crystal start and the RF1A7 wait run on the timer while the
+ * CPU raises VCore, takes readings or sleeps, and power_up_ready()
+ * tells when the radio can transmit.
+ *
+ * POWER_ORDER_VCORE_FIRST: VCore up, then the radio woken up, so the
+ *                          radio never runs below POWER_RF_VCORE
+ * POWER_ORDER_RADIO_FIRST: the radio woken up first, VCore rises while
+ *                          its crystal starts
+ */
+typedef enum power_order_t {
+  POWER_ORDER_VCORE_FIRST,
+  POWER_ORDER_RADIO_FIRST
+} power_order_t;
+
+#define POWER_RF_VCORE           (2)     // PMMCOREV for radio operation
+
+void power_up_start(power_order_t order);
+uint8_t power_up_ready(void);
+void power_up_wait(uint32_t mode);
+void power_down(void);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,305 @@
+/*
+ * Profiling of the duty cycle phases
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "prof.h"
+#include "telemetry.h"
+#include "timer.h"
+
+#include "hal_pmm.h"
+
+#include <stdint.h>
+
+// Only the PROF_* probes call this code, nothing without RB_USE_PROF
+#if RB_USE_PROF
+
+typedef struct prof_stat_t {
+  uint32_t start;
+  uint32_t sum;
+  uint16_t count;
+  uint16_t min;
+  uint16_t max;
+} prof_stat_t;
+
+static prof_stat_t prof_phases[PROF_PHASE_COUNT];
+static uint32_t prof_modes[PROF_MODES];
+static uint32_t prof_vcores[PROF_VCORE_LEVELS];
+
+// Current mode and VCore level, and when they were last accounted
+static uint8_t prof_mode = 0;
+static uint8_t prof_vcore = 0;
+static uint32_t prof_mark = 0;
+
+// Bit per open phase, the pin is high while non-zero
+static uint16_t prof_open = 0;
+
+// Reporting interval and the start of the current one
+static uint32_t prof_report_ticks = 0;
+static uint32_t prof_start = 0;
+
+static void prof_account(void);
+static void prof_clear(void);
+
+/*
+ * Add the time since the last call to the current mode and VCore level
+ */
+static void prof_account(void)
+{
+  uint32_t now = timer_now();
+  uint32_t elapsed = now - prof_mark;
+
+  prof_modes[prof_mode] += elapsed;
+  prof_vcores[prof_vcore] += elapsed;
+  prof_mark = now;
+}
+
+
+
+/*
+ * Forget the collected statistics, open phases stay open
+ */
+static void prof_clear(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < PROF_PHASE_COUNT; ++i) {
+    prof_phases[i].sum = 0;
+    prof_phases[i].count = 0;
+    prof_phases[i].min = 0xffff;
+    prof_phases[i].max = 0;
+  }
+
+  for (i = 0; i < PROF_MODES; ++i) {
+    prof_modes[i] = 0;
+  }
+
+  for (i = 0; i < PROF_VCORE_LEVELS; ++i) {
+    prof_vcores[i] = 0;
+  }
+
+  prof_mark = timer_now();
+  prof_start = prof_mark;
+}
+
+
+
+/*
+ * Start profiling, in active mode at VCore level 0 (the reset default).
+ * prof_due() turns true every report_ticks.
+ */
+void prof_init(uint32_t report_ticks)
+{
+  prof_report_ticks = report_ticks;
+  prof_mode = 0;
+  prof_vcore = 0;
+  prof_open = 0;
+  prof_clear();
+
+#if PROF_USE_GPIO
+  PROF_GPIO_POUT &= ~PROF_GPIO_BIT;
+  PROF_GPIO_PDIR |= PROF_GPIO_BIT;
+#endif
+}
+
+
+
+/*
+ * Non-zero when the reporting interval has passed since the last
+ * prof_report()
+ */
+uint8_t prof_due(void)
+{
+  return timer_now() - prof_start >= prof_report_ticks;
+}
+
+
+
+/*
+ * Phase starts, or restarts if it was left open
+ */
+void prof_begin(prof_phase_t phase)
+{
+  prof_phases[phase].start = timer_now();
+  prof_open |= 1 << phase;
+
+#if PROF_USE_GPIO
+  PROF_GPIO_POUT |= PROF_GPIO_BIT;
+#endif
+}
+
+
+
+/*
+ * Phase ends, durations over 16 bits are saturated in min and max.
+ * Ignored if the phase wasn't started.
+ */
+void prof_end(prof_phase_t phase)
+{
+  prof_stat_t *s = &prof_phases[phase];
+  uint32_t duration;
+  uint16_t d;
+
+  if (!(prof_open & (1 << phase))) {
+    return;
+  }
+
+  duration = timer_now() - s->start;
+  d = duration > 0xffff ? 0xffff : duration;
+
+  s->sum += duration;
+  ++s->count;
+  if (d < s->min) {
+    s->min = d;
+  }
+  if (d > s->max) {
+    s->max = d;
+  }
+
+  prof_open &= ~(1 << phase);
+
+#if PROF_USE_GPIO
+  if (prof_open == 0) {
+    PROF_GPIO_POUT &= ~PROF_GPIO_BIT;
+  }
+#endif
+}
+
+
+
+/*
+ * Going to sleep with the given status register bits, called with
+ * interrupts disabled right before the sleep
+ */
+void prof_lpm_enter(uint16_t bits)
+{
+  prof_account();
+
+  if (bits & OSCOFF) {
+    prof_mode = 5;
+  } else {
+    prof_mode = 1 + ((bits & SCG0) ? 1 : 0) + ((bits & SCG1) ? 2 : 0);
+  }
+}
+
+
+
+/*
+ * Woken up
+ */
+void prof_lpm_exit(void)
+{
+  prof_account();
+  prof_mode = 0;
+}
+
+
+
+/*
+ * SetVCore() timed as PROF_PHASE_VCORE, and the time at each level
+ * accounted
+ */
+unsigned int prof_set_vcore(unsigned char level)
+{
+  unsigned int ret;
+
+  prof_begin(PROF_PHASE_VCORE);
+  ret = SetVCore(level);
+  prof_end(PROF_PHASE_VCORE);
+
+  prof_account();
+  if (ret == PMM_STATUS_OK && level < PROF_VCORE_LEVELS) {
+    prof_vcore = level;
+  }
+
+  return ret;
+}
+
+
+
+/*
+ * Write the statistics as telemetry records to buf and start over.
+ * A record per used phase with a TELEMETRY_TYPE_PHASE field of phase,
+ * count, min, max and average, and a record with the TELEMETRY_TYPE_LPM
+ * and TELEMETRY_TYPE_VCORE times. Returns the length, or 0 if
+ * buf is too short for all of them.
+ */
+uint8_t prof_report(unsigned char *buf, uint8_t max_len, uint8_t node_id)
+{
+  telemetry_t t;
+  uint8_t len = 0;
+  uint8_t rec_len;
+  uint8_t i;
+
+  prof_account();
+
+  for (i = 0; i < PROF_PHASE_COUNT; ++i) {
+    prof_stat_t *s = &prof_phases[i];
+    uint32_t values[5];
+
+    if (s->count == 0) {
+      continue;
+    }
+
+    values[0] = i;
+    values[1] = s->count;
+    values[2] = s->min;
+    values[3] = s->max;
+    // Once per report, the division doesn't matter here
+    values[4] = s->sum / s->count;
+
+    telemetry_start(&t, &buf[len], max_len - len, node_id);
+    telemetry_add(&t, TELEMETRY_TYPE_PHASE, values, 5);
+    rec_len = telemetry_end(&t);
+    if (rec_len == 0) {
+      return 0;
+    }
+    len += rec_len;
+  }
+
+  telemetry_start(&t, &buf[len], max_len - len, node_id);
+  telemetry_add(&t, TELEMETRY_TYPE_LPM, prof_modes, PROF_MODES);
+  telemetry_add(&t, TELEMETRY_TYPE_VCORE, prof_vcores, PROF_VCORE_LEVELS);
+  rec_len = telemetry_end(&t);
+  if (rec_len == 0) {
+    return 0;
+  }
+  len += rec_len;
+
+  prof_clear();
+
+  return len;
+}
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,122 @@
+/*
+ * Profiling of the duty cycle phases
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_PROF_H
+#define RB_PROF_H
+
+#include "common.h"
+#include "rf.h"
+
+#include <msp430.h>
+#include <stdint.h>
+
+/*
+ * Probes timestamp the duty cycle phases with timer_now() and collect
+ * the count, min, max and average duration of each phase, and the time
+ * spent active and in each LPM mode and VCore level. Phases may
+ * overlap. prof_report() writes the summary as telemetry records and
+ * starts over, prof_due() tells when it's time for that. All times are
+ * in TA0 ticks (ACLK/8).
+ *
+ * The PROF_* macros compile to nothing unless RB_USE_PROF is set for
+ * the whole build: the LPM probes are in timer.c and sched.c.
+ */
+#ifndef RB_USE_PROF
+#define RB_USE_PROF              0
+#endif
+
+// Drive a pin high while a phase is open, for a logic analyzer or to
+// line up with a current probe. Phases shorter than a tick show up only
+// here.
+#ifndef PROF_USE_GPIO
+#define PROF_USE_GPIO            0
+#endif
+
+#ifndef PROF_GPIO_POUT
+#define PROF_GPIO_POUT           P2OUT
+#define PROF_GPIO_PDIR           P2DIR
+#define PROF_GPIO_BIT            BIT7
+#endif
+
+typedef enum prof_phase_t {
+  PROF_PHASE_AWAKE = 0,                          // Whole awake part of the cycle
+  PROF_PHASE_TMP275,                             // Conversion started until read
+  PROF_PHASE_ADC,                                // Waiting for the ADC
+  PROF_PHASE_RF_WAKEUP,                          // rf_init() or rf_wakeup()
+  PROF_PHASE_RF_IDLE,                            // rf_wait_for_idle()
+  PROF_PHASE_RF_TX,                              // Send and wait for the TX
+  PROF_PHASE_VCORE,                              // SetVCore()
+  PROF_PHASE_COUNT
+} prof_phase_t;
+
+// Active and LPM0 to LPM4
+#define PROF_MODES               (6)
+#define PROF_VCORE_LEVELS        (4)
+
+// prof_report() with every phase used
+#define PROF_PHASE_RECORD_LEN    (3 + 1 + 5 * 2)
+#define PROF_POWER_RECORD_LEN    (3 + 1 + PROF_MODES * 4 + 1 + PROF_VCORE_LEVELS * 4)
+#define PROF_REPORT_LEN          (PROF_PHASE_COUNT * PROF_PHASE_RECORD_LEN + PROF_POWER_RECORD_LEN)
+
+// Each record is sent whole in a packet
+#if PROF_PHASE_RECORD_LEN > PAYLOAD_LEN || PROF_POWER_RECORD_LEN > PAYLOAD_LEN
+#error "PAYLOAD_LEN shorter than a prof_report() record"
+#endif
+
+void prof_init(uint32_t report_ticks);
+uint8_t prof_due(void);
+void prof_begin(prof_phase_t phase);
+void prof_end(prof_phase_t phase);
+void prof_lpm_enter(uint16_t bits);
+void prof_lpm_exit(void);
+unsigned int prof_set_vcore(unsigned char level);
+uint8_t prof_report(unsigned char *buf, uint8_t max_len, uint8_t node_id);
+
+#if RB_USE_PROF
+#define PROF_BEGIN(phase)        prof_begin(phase)
+#define PROF_END(phase)          prof_end(phase)
+#define PROF_LPM_ENTER(bits)     prof_lpm_enter(bits)
+#define PROF_LPM_EXIT()          prof_lpm_exit()
+#define PROF_SET_VCORE(level)    prof_set_vcore(level)
+#else
+#define PROF_BEGIN(phase)        ((void)0)
+#define PROF_END(phase)          ((void)0)
+#define PROF_LPM_ENTER(bits)     ((void)0)
+#define PROF_LPM_EXIT()          ((void)0)
+#define PROF_SET_VCORE(level)    SetVCore(level)
+#endif
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,349 @@
+/*
+ * Change based reporting with delta encoded telemetry
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include "report.h"
+#include "timer.h"
+
+// Followed fields of a node on the gateway, count 0 until a keyframe
+typedef struct report_node_t {
+  uint8_t node;
+  uint8_t number;
+  uint8_t count;
+  uint8_t types[REPORT_MAX_FIELDS];
+  uint32_t values[REPORT_MAX_FIELDS];
+} report_node_t;
+
+static const report_field_t *report_fields = 0;
+static uint8_t report_count = 0;
+static uint32_t report_heartbeat = 0;
+static uint8_t report_keyframe_every = 0;
+
+// Values the gateway has, as of the last report sent
+static uint32_t report_sent[REPORT_MAX_FIELDS];
+static uint32_t report_last = 0;
+static uint8_t report_number = 0;
+static uint8_t report_deltas = 0;               // Since the last keyframe
+static uint8_t report_keyframe = 1;             // Next one must be a keyframe
+
+static report_node_t report_nodes[REPORT_NODES];
+
+/*
+ * Change from sent to value in a field of size bytes, modulo the size
+ */
+static int32_t field_change(uint8_t size, uint32_t value, uint32_t sent)
+{
+  uint32_t change = value - sent;
+
+  if (size == 1) {
+    return (int8_t)change;
+  }
+  if (size == 2) {
+    return (int16_t)change;
+  }
+  return (int32_t)change;
+}
+
+
+
+/*
+ * Value of size bytes at p, LSB first
+ */
+static uint32_t field_value(const unsigned char *p, uint8_t size)
+{
+  uint32_t value = 0;
+  uint8_t b;
+
+  for (b = 0; b < size; ++b) {
+    value |= (uint32_t)p[b] << (8 * b);
+  }
+
+  return value;
+}
+
+
+
+/*
+ * Gateway entry of the node, a new one for a keyframe if not followed
+ * yet, otherwise 0
+ */
+static report_node_t *report_node(uint8_t node, uint8_t keyframe)
+{
+  uint8_t i;
+
+  for (i = 0; i < REPORT_NODES; ++i) {
+    if (report_nodes[i].node == node) {
+      return &report_nodes[i];
+    }
+  }
+
+  if (!keyframe) {
+    return 0;
+  }
+
+  // Broadcast address 0 marks a free entry, if none take over one
+  for (i = 0; i < REPORT_NODES; ++i) {
+    if (report_nodes[i].node == 0) {
+      break;
+    }
+  }
+  if (i == REPORT_NODES) {
+    i = node % REPORT_NODES;
+  }
+
+  report_nodes[i].node = node;
+  report_nodes[i].count = 0;
+  return &report_nodes[i];
+}
+
+
+
+/*
+ * Report count fields, up to REPORT_MAX_FIELDS, each with a single
+ * value. Reports go out at least every heartbeat_ms (0 for no
+ * heartbeat), and every keyframe_every report is a keyframe (0 for
+ * only when needed). The first report is always sent.
+ */
+void report_init(const report_field_t *fields, uint8_t count,
+                 uint32_t heartbeat_ms, uint8_t keyframe_every)
+{
+  report_fields = fields;
+  report_count = count > REPORT_MAX_FIELDS ? REPORT_MAX_FIELDS : count;
+  report_heartbeat = timer_ms_to_ticks(heartbeat_ms);
+  report_keyframe_every = keyframe_every;
+  report_deltas = 0;
+  report_keyframe = 1;
+}
+
+
+
+/*
+ * Returns 1 if the next reading is reported whatever its values, e.g.
+ * to decide whether to start the radio before it's ready
+ */
+uint8_t report_heartbeat_due(void)
+{
+  return report_keyframe ||
+    (report_heartbeat > 0 && timer_now() - report_last >= report_heartbeat);
+}
+
+
+
+/*
+ * Compare the reading of a value per field with the last one sent.
+ * Returns the length of the report record written into buf, or 0 if
+ * there's nothing to send.
+ */
+uint8_t report_update(const uint32_t *values, unsigned char *buf, uint8_t max_len, uint8_t node_id)
+{
+  uint32_t deltas[REPORT_MAX_FIELDS];
+  uint8_t send = report_heartbeat_due();
+  uint8_t keyframe = report_keyframe ||
+    (report_keyframe_every > 0 && report_deltas + 1 >= report_keyframe_every);
+  uint8_t len, i;
+  telemetry_t t;
+
+  for (i = 0; i < report_count; ++i) {
+    int32_t change = field_change(telemetry_value_size(report_fields[i].type),
+                                  values[i], report_sent[i]);
+    uint32_t distance = change < 0 ? 0 - (uint32_t)change : (uint32_t)change;
+
+    if (report_fields[i].threshold > 0 && distance >= report_fields[i].threshold) {
+      send = 1;
+    }
+    if (change < -128 || change > 127) {
+      keyframe = 1;
+    }
+    deltas[i] = change & 0xff;
+  }
+
+  if (!send) {
+    return 0;
+  }
+
+  telemetry_start(&t, buf, max_len, node_id);
+  telemetry_add_value(&t, TELEMETRY_TYPE_REPORT, report_number);
+  if (keyframe) {
+    for (i = 0; i < report_count; ++i) {
+      telemetry_add_value(&t, report_fields[i].type, values[i]);
+    }
+  } else {
+    telemetry_add(&t, TELEMETRY_TYPE_DELTA, deltas, report_count);
+  }
+  len = telemetry_end(&t);
+
+  if (len == 0) {
+    return 0;
+  }
+
+  for (i = 0; i < report_count; ++i) {
+    report_sent[i] = values[i];
+  }
+  ++report_number;
+  report_deltas = keyframe ? 0 : report_deltas + 1;
+  report_keyframe = 0;
+  report_last = timer_now();
+
+  return len;
+}
+
+
+
+/*
+ * The last report didn't reach the gateway, send the next one as a
+ * keyframe
+ */
+void report_lost(void)
+{
+  report_keyframe = 1;
+}
+
+
+
+/*
+ * On the gateway, follow the keyframes of the nodes and rewrite a
+ * delta report in rec into a full record in out, with the fields of
+ * the keyframe. Returns the length of the record in out, or 0 if rec
+ * is to be used as it is: not a delta report, or one out of sync.
+ */
+uint8_t report_expand(const unsigned char *rec, uint8_t len, unsigned char *out, uint8_t max_len)
+{
+  uint8_t types[REPORT_MAX_FIELDS];
+  uint32_t values[REPORT_MAX_FIELDS];
+  const unsigned char *delta = 0;
+  uint8_t delta_count = 0;
+  uint8_t count = 0;
+  uint8_t is_report = 0;
+  uint8_t number = 0;
+  uint8_t i = TELEMETRY_HEADER_LEN;
+  report_node_t *node;
+  telemetry_t t;
+
+  if (len < TELEMETRY_HEADER_LEN || rec[0] != TELEMETRY_MAGIC) {
+    return 0;
+  }
+
+  while (i < len) {
+    uint8_t type = rec[i] >> 4;
+    uint8_t n = rec[i] & 0x0f;
+    uint8_t size = telemetry_value_size(type);
+    uint8_t v;
+
+    if (size == 0 || i + 1 + size * n > len) {
+      return 0;
+    }
+
+    if (type == TELEMETRY_TYPE_REPORT) {
+      is_report = 1;
+      number = rec[i + 1];
+    } else if (type == TELEMETRY_TYPE_DELTA) {
+      delta = &rec[i + 1];
+      delta_count = n;
+    } else if (type != TELEMETRY_TYPE_AGE) {
+      for (v = 0; v < n && count < REPORT_MAX_FIELDS; ++v) {
+        types[count] = type;
+        values[count++] = field_value(&rec[i + 1 + size * v], size);
+      }
+    }
+    i += 1 + size * n;
+  }
+
+  if (!is_report) {
+    return 0;
+  }
+
+  node = report_node(rec[1], delta == 0);
+  if (node == 0) {
+    return 0;
+  }
+
+  if (delta == 0) {
+    // Keyframe, the base of the following deltas
+    node->number = number;
+    node->count = count;
+    for (i = 0; i < count; ++i) {
+      node->types[i] = types[i];
+      node->values[i] = values[i];
+    }
+    return 0;
+  }
+
+  if (node->count != delta_count || (uint8_t)(node->number + 1) != number) {
+    // Missed a report, wait for a keyframe
+    node->count = 0;
+    return 0;
+  }
+
+  node->number = number;
+  for (i = 0; i < node->count; ++i) {
+    node->values[i] += (int8_t)delta[i];
+  }
+
+  if (max_len < TELEMETRY_HEADER_LEN) {
+    return 0;
+  }
+  for (i = 0; i < TELEMETRY_HEADER_LEN; ++i) {
+    out[i] = rec[i];
+  }
+  telemetry_resume(&t, out, max_len, TELEMETRY_HEADER_LEN);
+  telemetry_add_value(&t, TELEMETRY_TYPE_REPORT, number);
+  for (i = 0; i < node->count; ++i) {
+    telemetry_add_value(&t, node->types[i], node->values[i]);
+  }
+
+  // The rest as they are, e.g. the age from the sample log
+  i = TELEMETRY_HEADER_LEN;
+  while (i < len) {
+    uint8_t type = rec[i] >> 4;
+    uint8_t n = rec[i] & 0x0f;
+    uint8_t size = telemetry_value_size(type);
+
+    if (type != TELEMETRY_TYPE_REPORT && type != TELEMETRY_TYPE_DELTA) {
+      uint32_t rest[TELEMETRY_MAX_COUNT];
+      uint8_t v;
+
+      for (v = 0; v < n; ++v) {
+        rest[v] = field_value(&rec[i + 1 + size * v], size);
+      }
+      telemetry_add(&t, type, rest, n);
+    }
+    i += 1 + size * n;
+  }
+
+  return telemetry_end(&t);
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,74 @@
+/*
+ * Change based reporting with delta encoded telemetry
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef RB_REPORT_H
+#define RB_REPORT_H
+
+#include "common.h"
+#include "telemetry.h"
+
+#include <stdint.h>
+
+/*
+ * A node sends a reading only when a field has moved at least its
+ * threshold from the value last sent, or when the heartbeat runs out.
+ * Each report is a telemetry record starting with a
+ * TELEMETRY_TYPE_REPORT field of the report number:
+ *   keyframe: [REPORT n][the fields with their full values]
+ *   delta:    [REPORT n][DELTA change of each field since report n - 1]
+ * A keyframe goes out first, every keyframe_every reports and whenever
+ * a change doesn't fit a signed byte, so that a gateway which missed a
+ * report gets back in sync. report_expand() turns deltas back into
+ * full records on the gateway.
+ */
+#define REPORT_MAX_FIELDS        (4)
+#define REPORT_NODES             (8)     // Nodes followed by the gateway
+#define REPORT_EXPANDED_LEN      (48)    // Full record with a few more fields
+
+typedef struct report_field_t {
+  telemetry_type_t type;
+  uint32_t threshold;           // Change that triggers a report, 0 never does
+} report_field_t;
+
+void report_init(const report_field_t *fields, uint8_t count,
+                 uint32_t heartbeat_ms, uint8_t keyframe_every);
+uint8_t report_heartbeat_due(void);
+uint8_t report_update(const uint32_t *values, unsigned char *buf, uint8_t max_len, uint8_t node_id);
+void report_lost(void);
+uint8_t report_expand(const unsigned char *rec, uint8_t len, unsigned char *out, uint8_t max_len);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
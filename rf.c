@@ -27,68 +27,783 @@
  */
 
 #include "rf.h"
-#include "uart.h"
+#include "clock.h"
 #include "led.h"
+#include "pktbuf.h"
 #include "utils.h"
 #include "timer.h"
+#include "sched.h"
+#include "stats.h"
 
-// Buffer for incoming data from RF
-volatile unsigned char RfRxBuffer[PACKET_LEN];
+// Buffer for incoming data from RF, a slot of the packet buffer pool
+volatile unsigned char *RfRxBuffer;
 volatile unsigned char RfRxBufferLength = 0;
+static uint8_t rf_rx_slot = PKTBUF_NONE;
 
 // Queue for messages to be sent out over RF
-volatile unsigned char RfTxQueue[RF_QUEUE_LEN];
-volatile unsigned char RfTxQueue_i = 0;
+static volatile unsigned char RfTxQueueData[RF_QUEUE_LEN];
+ringbuf_t RfTxQueue;
 
 // Buffer for outgoing data over RF
 volatile unsigned char RfTxBuffer[PACKET_LEN];
 volatile unsigned char rf_error = 0;
 
+// Received packet in RfRxBuffer waiting for the main loop
+volatile unsigned char rf_rx_ready = 0;
+volatile unsigned char rf_rx_status = 0;
+volatile uint16_t rf_rx_timestamp = 0;
+
 volatile unsigned char rf_transmitting = 0;
 volatile unsigned char rf_receiving = 0;
 
-static void transmit_msg(unsigned char *buffer, unsigned char length);
-static void handle_rf_rx_packet(void);
+// Rest of the packet still to be written to the TX FIFO
+static volatile unsigned char *rf_tx_next;
+static volatile unsigned char rf_tx_remaining = 0;
+
+// Ends the preamble of the packet in transmit, see transmit_msg()
+static timer_event_t rf_preamble_timer;
+
+// Own address for the hardware filter and the source of sent
+// packets, and the destination of sent packets
+static uint8_t rf_address = RF_ADDR_BROADCAST;
+static uint8_t rf_destination = RF_ADDR_BROADCAST;
+
+// Modem profiles, see SmartRF Studio for the values
+static const rf_profile_t rf_profiles[RF_PROFILE_COUNT] = {
+  // RF_PROFILE_38K4: 38.4 kbps 2-GFSK, 20.6 kHz deviation, 101.6 kHz RX BW
+  { 0x06, { 0xCA, 0x83, 0x13, 0x22, 0xF8, 0x35 },
+    { 0x16, 0x6C, 0x43, 0x40, 0x91 }, { 0x56, 0x10 }, { 0x81, 0x35 },
+    PATABLE_VAL, 210 },
+  // RF_PROFILE_38K4_LOW_POWER: as above with the DC blocking filter off
+  { 0x08, { 0xCA, 0x83, 0x93, 0x22, 0xF8, 0x35 },
+    { 0x16, 0x6C, 0x43, 0x40, 0x91 }, { 0x56, 0x10 }, { 0x81, 0x35 },
+    PATABLE_VAL, 210 },
+  // RF_PROFILE_250K: 250 kbps 2-GFSK, 127 kHz deviation, 541.7 kHz RX BW
+  { 0x0C, { 0x2D, 0x3B, 0x13, 0x22, 0xF8, 0x62 },
+    { 0x1D, 0x1C, 0xC7, 0x00, 0xB0 }, { 0xB6, 0x10 }, { 0x88, 0x31 },
+    PATABLE_VAL, 32 },
+};
+
+static rf_profile_id_t rf_profile = RF_PROFILE_38K4;
+
+// Set once the configuration registers have been written
+static unsigned char rf_configured = 0;
+
+// Set by rf_shutdown(), registers can't be written until rf_wakeup()
+static unsigned char rf_sleeping = 0;
+
+// Between rf_wakeup_start() and rf_wakeup_ready(), not before deadline.
+// rf_wake_pending is cleared by the chip ready interrupt, which moves
+// the deadline to RF1A7 ticks from it.
+static uint8_t rf_waking = 0;
+static volatile uint8_t rf_wake_pending = 0;
+static volatile uint32_t rf_wake_deadline = 0;
+static uint16_t rf_rf1a7_ticks = 0;
+
+#if RF_CHANNEL_COUNT > 16
+#error "rf_cal_valid has a bit per channel"
+#endif
+
+// Current channel (CHANNR)
+static uint8_t rf_channel = 0;
+
+// Cached frequency synthesizer calibration of each channel, FSCAL3,
+// FSCAL2, FSCAL1. Used after rf_calibrate() has turned off the
+// automatic calibration.
+static unsigned char rf_cal[RF_CHANNEL_COUNT][3];
+static uint16_t rf_cal_valid = 0;
+static unsigned char rf_cal_manual = 0;
+static int16_t rf_cal_temp = 0;
+static uint16_t rf_cal_wakeups = 0;
+
+// Wake-on-Radio sniff interval (0 for continuous RX) and the matching
+// preamble length for transmit
+static uint16_t rf_wor_interval_ms = 0;
+static uint16_t rf_tx_preamble_ms = 0;
+
+// Preamble at least this long also without Wake-on-Radio
+static uint16_t rf_tx_min_preamble_ms = 0;
+
+// Listen-before-talk threshold and retries, and the backoff random state
+static int8_t rf_cca_threshold_dbm = RF_CCA_THRESHOLD_DBM;
+static uint8_t rf_cca_retries = RF_CCA_RETRIES;
+static uint16_t rf_random_state = 1;
+
+// Cleared by the interrupt handler to wake up rf_wait_for_state()
+static volatile uint8_t rf_state_wait = 0;
+
+// RX_TIME timeouts in MCSM2 as ppm of the EVENT0 period (WOR_RES = 0)
+static const uint16_t rf_rx_time_ppm[] = {
+  36058, 18029, 9014, 4507, 2254, 1127, 563
+};
+
+static void rf_reset_state(void);
+static void rf_wakeup_finish(void);
+static void rf_write_profile(void);
+static void rf_write_channel(void);
+static int16_t rf_rssi_dbm(void);
+static void transmit_msg(unsigned char *buffer, unsigned char length);
+static void start_tx_fifo(void);
+static void preamble_done(void);
+static void refill_tx_fifo(void);
+static void drain_rx_fifo(void);
+static void handle_rf_rx_packet(void);
+
+/*
+ * Reset the driver state and empty the buffers
+ */
+static void rf_reset_state(void)
+{
+  // The driver holds a slot from the first init on, rf_rx_take()
+  // swaps it for another one
+  if (rf_rx_slot == PKTBUF_NONE) {
+    rf_rx_slot = pktbuf_alloc();
+    RfRxBuffer = PKTBUF_PACKET(rf_rx_slot);
+  }
+
+  RfRxBufferLength = 0;
+  ringbuf_init(&RfTxQueue, RfTxQueueData, RF_QUEUE_LEN);
+  timer_event_stop(&rf_preamble_timer);
+  rf_error = 0;
+  rf_transmitting = 0;
+  rf_receiving = 0;
+  rf_rx_ready = 0;
+  rf_tx_remaining = 0;
+}
+
+
+
+/*
+ * Set own address. Packets to other addresses than this or
+ * RF_ADDR_BROADCAST are dropped by the radio. Takes effect in the
+ * next rf_init(). With RF_ADDR_BROADCAST only broadcasts are received.
+ */
+void rf_set_address(uint8_t addr)
+{
+  rf_address = addr;
+}
+
+
+
+/*
+ * Own address
+ */
+uint8_t rf_get_address(void)
+{
+  return rf_address;
+}
+
+
+
+/*
+ * Address stored in the info flash at RF_ADDR_INFO, so that the same
+ * image can be used in several nodes. The fallback is returned if it's
+ * not set.
+ */
+uint8_t rf_info_address(uint8_t fallback)
+{
+  uint8_t addr = *(const volatile uint8_t *)RF_ADDR_INFO;
+
+  if (addr == RF_ADDR_ERASED || addr == RF_ADDR_BROADCAST) {
+    return fallback;
+  }
+
+  return addr;
+}
+
+
+
+/*
+ * Set the destination of the following packets
+ */
+void rf_set_destination(uint8_t addr)
+{
+  rf_destination = addr;
+}
+
+
+
+/*
+ * Take the slot of the received packet in RfRxBuffer, e.g. to hand it
+ * to the UART, and continue receiving into a free one. Returns the
+ * slot id, the packet starting at PKTBUF_PACKET(id), or PKTBUF_NONE if
+ * no slot is free and the packet stays in RfRxBuffer. Only while not
+ * receiving.
+ */
+uint8_t rf_rx_take(void)
+{
+  uint8_t slot;
+  uint8_t next;
+
+  if (!rf_rx_ready) {
+    return PKTBUF_NONE;
+  }
+
+  next = pktbuf_alloc();
+  if (next == PKTBUF_NONE) {
+    return PKTBUF_NONE;
+  }
+
+  slot = rf_rx_slot;
+  rf_rx_slot = next;
+  RfRxBuffer = PKTBUF_PACKET(next);
+  RfRxBufferLength = 0;
+  rf_rx_ready = 0;
+
+  return slot;
+}
+
+
+
+/*
+ * Source address of the received packet in RfRxBuffer
+ */
+uint8_t rf_rx_source(void)
+{
+  return RfRxBuffer[2];
+}
+
+
+
+/*
+ * Write the modem registers of the current profile, one burst per
+ * block of consecutive registers. The radio must be in IDLE.
+ */
+static void rf_write_profile(void)
+{
+  const rf_profile_t *p = &rf_profiles[rf_profile];
+
+  WriteSingleReg(FSCTRL1, p->fsctrl1);
+  WriteBurstReg(MDMCFG4, (unsigned char *)p->modem, sizeof(p->modem));
+  WriteBurstReg(FOCCFG, (unsigned char *)p->agc, sizeof(p->agc));
+  WriteBurstReg(FREND1, (unsigned char *)p->frend, sizeof(p->frend));
+  WriteBurstReg(TEST2, (unsigned char *)p->test, sizeof(p->test));
+  WriteSinglePATable(p->patable);
+}
+
+
+
+/*
+ * Switch to the given modem profile. Written right away if the radio
+ * is configured and awake, otherwise in the next rf_init() or
+ * rf_wakeup(). Both ends must use the same profile, so switch after
+ * agreeing on it on the old one.
+ */
+void rf_set_profile(rf_profile_id_t id)
+{
+  unsigned char receiving = rf_receiving;
+
+  if (id >= RF_PROFILE_COUNT) {
+    return;
+  }
+
+  rf_profile = id;
+
+  if (!rf_configured || rf_sleeping) {
+    return;
+  }
+
+  if (receiving) {
+    rf_receive_off();
+  }
+
+  rf_write_profile();
+
+  if (receiving) {
+    rf_receive_on();
+  }
+}
+
+
+
+/*
+ * Current modem profile
+ */
+rf_profile_id_t rf_get_profile(void)
+{
+  return rf_profile;
+}
+
+
+
+/*
+ * Air time of a byte in microseconds with the current profile
+ */
+uint16_t rf_byte_us(void)
+{
+  return rf_profiles[rf_profile].byte_us;
+}
+
+
+
+/*
+ * Initialize CC1101 radio inside the CC430.
+ */
+void rf_init(void)
+{
+#if 0
+  // Set the High-Power Mode Request Enable bit so LPM3 can be entered
+  // with active radio enabled
+  PMMCTL0_H = 0xA5;
+  PMMCTL0_L |= PMMHPMRE_L;
+  PMMCTL0_H = 0x00;
+#endif
+
+  Strobe(RF_SRES);                          // Reset the Radio Core
+  Strobe(RF_SNOP);                          // Reset Radio Pointer
+
+  rf_reset_state();
+
+  WriteRfSettings();
+  WriteSingleReg(PKTLEN, PAYLOAD_LEN + RF_HEADER_LEN);
+  WriteSingleReg(ADDR, rf_address);
+
+  rf_write_profile();
+
+  // Automatic calibration again until the next rf_calibrate(), which
+  // calibrates every channel afresh after the reset
+  rf_cal_manual = 0;
+  rf_cal_valid = 0;
+  rf_cal_wakeups = 0;
+  rf_write_channel();
+
+  // Registers were reset to the defaults above
+  if (rf_wor_interval_ms > 0) {
+    rf_set_wor_interval(rf_wor_interval_ms);
+  }
+
+  rf_configured = 1;
+  rf_sleeping = 0;
+}
+
+
+
+/*
+ * Wake up the radio after rf_shutdown(). The configuration registers
+ * are retained in SLEEP state, so only the test registers and the
+ * PATABLE are written, with the modem profile. Falls back to rf_init() if the radio hasn't
+ * been configured yet or there has been an error.
+ */
+void rf_wakeup(void)
+{
+  if (!rf_configured || rf_error) {
+    rf_init();
+    return;
+  }
+
+  Strobe(RF_SIDLE);                         // Wake up, waits for chip ready
+  rf_wakeup_finish();
+}
+
+
+
+/*
+ * Start waking up the radio after rf_shutdown() without waiting for
+ * it. The crystal starts while the CPU does other things or sleeps,
+ * e.g. raises VCore, until rf_wakeup_ready(). The chip ready falling
+ * edge on GDO2 (IOCFG2 is retained in SLEEP) interrupts when the
+ * crystal is up.
+ */
+void rf_wakeup_start(void)
+{
+  rf_waking = 1;
+  rf_wake_pending = 0;
+
+  if (!rf_configured || rf_error) {
+    // rf_init() in rf_wakeup_ready(), nothing to wait for
+    rf_wake_deadline = timer_now();
+    return;
+  }
+
+  // The RF1A7 wait in ticks, plus one for the phase of the current tick
+  rf_rf1a7_ticks = (uint16_t)(timer_us_to_ticks(RF_RF1A7_US) + 1);
+
+  rf_wake_deadline = timer_now() + timer_ms_to_ticks(RF_WAKEUP_TIMEOUT_MS);
+  rf_wake_pending = 1;
+  RF1AIES |= BIT2;
+  RF1AIFG &= ~BIT2;
+  RF1AIE |= BIT2;
+
+  StrobeWakeup(RF_SIDLE);
+}
+
+
+
+/*
+ * Returns 1 if the radio is ready after rf_wakeup_start(), finishing
+ * the wake up once the RF1A7 wait after the chip ready interrupt has
+ * passed, or if there's no wake up in progress. 0 until then.
+ */
+uint8_t rf_wakeup_ready(void)
+{
+  if (!rf_waking) {
+    return 1;
+  }
+
+  if ((int32_t)(timer_now() - rf_wake_deadline) < 0) {
+    return 0;
+  }
+
+  rf_waking = 0;
+  rf_wake_pending = 0;
+  RF1AIE &= ~BIT2;
+
+  if (!rf_configured || rf_error) {
+    rf_init();
+    return 1;
+  }
+
+  // Returns right away if the chip is ready, otherwise waits for it
+  // and the RF1A7 delay, if the interrupt was missed
+  Strobe(RF_SIDLE);
+  rf_wakeup_finish();
+  return 1;
+}
+
+
+
+/*
+ * Sleep in the low power mode until the radio is ready after
+ * rf_wakeup_start()
+ */
+void rf_wakeup_wait(uint32_t mode)
+{
+  // Until the chip ready interrupt, then to the deadline it set
+  if (rf_wake_pending) {
+    timer_wait_while(&rf_wake_pending, RF_WAKEUP_TIMEOUT_MS, mode);
+  }
+
+  while (!rf_wakeup_ready()) {
+    timer_sleep_until(rf_wake_deadline, mode);
+  }
+}
+
+
+
+/*
+ * The registers lost in SLEEP state, once the chip is ready
+ */
+static void rf_wakeup_finish(void)
+{
+  Strobe(RF_SFRX);
+  Strobe(RF_SFTX);
+
+  rf_reset_state();
+
+  WriteRfTestSettings();
+
+  // Also the profile and the channel may have been switched while
+  // sleeping, rf_calibrate() restores the channel's calibration
+  rf_write_profile();
+  WriteSingleReg(CHANNR, rf_channel);
+  rf_sleeping = 0;
+}
+
+
+
+/*
+ * Calibrate the frequency synthesizer, or restore the cached
+ * calibration. The cache of every channel is dropped on the first call,
+ * when temp (raw TMP275 value) has changed more than RF_CAL_TEMP_STEP
+ * since the last calibration, or after RF_CAL_MAX_WAKEUPS calls, and
+ * each channel is calibrated again when next used. Automatic
+ * calibration is turned off, so call this once per wake-up before
+ * transmitting.
+ */
+void rf_calibrate(int16_t temp)
+{
+  unsigned char receiving = rf_receiving;
+  int32_t diff = (int32_t)temp - rf_cal_temp;
+
+  // Calibration must be started from IDLE
+  if (receiving) {
+    rf_receive_off();
+  }
+
+  // Only manual calibration from now on
+  WriteSingleReg(MCSM0, ReadSingleReg(MCSM0) & ~RF_MCSM0_FS_AUTOCAL);
+  rf_cal_manual = 1;
+
+  if (!rf_cal_valid || diff > RF_CAL_TEMP_STEP || diff < -RF_CAL_TEMP_STEP ||
+      ++rf_cal_wakeups >= RF_CAL_MAX_WAKEUPS) {
+    rf_cal_valid = 0;
+    rf_cal_temp = temp;
+    rf_cal_wakeups = 0;
+  }
+
+  // Retained in SLEEP, but not over rf_init()
+  rf_write_channel();
+
+  if (receiving) {
+    rf_receive_on();
+  }
+}
+
+
+
+/*
+ * Write CHANNR and, with manual calibration, the cached calibration of
+ * the channel, calibrating it first if there's none. The radio must be
+ * in IDLE.
+ */
+static void rf_write_channel(void)
+{
+  WriteSingleReg(CHANNR, rf_channel);
+
+  if (!rf_cal_manual) {
+    return;
+  }
+
+  if (!(rf_cal_valid & (1 << rf_channel))) {
+    Strobe(RF_SCAL);
+    rf_wait_for_idle();
+
+    ReadBurstReg(FSCAL3, rf_cal[rf_channel], sizeof(rf_cal[rf_channel]));
+    rf_cal_valid |= 1 << rf_channel;
+  } else {
+    WriteBurstReg(FSCAL3, rf_cal[rf_channel], sizeof(rf_cal[rf_channel]));
+  }
+}
+
+
+
+/*
+ * Switch to channel ch, 0 .. RF_CHANNEL_COUNT - 1. Written right away
+ * if the radio is configured and awake, otherwise in the next
+ * rf_init() or rf_wakeup(). Receiving continues on the new channel.
+ */
+void rf_set_channel(uint8_t ch)
+{
+  unsigned char receiving = rf_receiving;
+
+  if (ch >= RF_CHANNEL_COUNT || ch == rf_channel) {
+    return;
+  }
+
+  rf_channel = ch;
+
+  if (!rf_configured || rf_sleeping) {
+    return;
+  }
+
+  if (receiving) {
+    rf_receive_off();
+  }
+
+  rf_write_channel();
+
+  if (receiving) {
+    rf_receive_on();
+  }
+}
+
+
+
+/*
+ * Current channel
+ */
+uint8_t rf_get_channel(void)
+{
+  return rf_channel;
+}
+
+
+
+/*
+ * Fixed channel assignment by address, consecutive addresses on
+ * different channels
+ */
+uint8_t rf_address_channel(uint8_t addr)
+{
+  return addr % RF_CHANNEL_COUNT;
+}
+
+
+
+/*
+ * Channel for the hop'th send in the sequence seeded by e.g. the own
+ * address. Every channel is used once in RF_CHANNEL_COUNT hops, nodes
+ * that send at the same time are likely on different channels.
+ */
+uint8_t rf_hop_channel(uint8_t seed, uint16_t hop)
+{
+  return (uint8_t)((seed + hop) % RF_CHANNEL_COUNT);
+}
+
+
+
+/*
+ * Listen on the next channel, unless there is a signal on the current
+ * one or a packet is being received. Call every RF_SCAN_DWELL_MS while
+ * receiving to listen on all the channels in turn. Senders need a
+ * preamble of RF_SCAN_PREAMBLE_MS to be found.
+ */
+void rf_scan_next(void)
+{
+  if (!rf_receiving || rf_transmitting || rf_rx_ready || RfRxBufferLength > 0) {
+    return;
+  }
+
+  // Preamble or a packet shorter than the FIFO threshold on air
+  if (rf_rssi_dbm() >= rf_cca_threshold_dbm) {
+    return;
+  }
+
+  rf_set_channel(rf_channel + 1 < RF_CHANNEL_COUNT ? rf_channel + 1 : 0);
+}
+
+
+
+/*
+ * Use Wake-on-Radio with the given sniff interval for receive, 0 for
+ * continuous RX. Transmitted packets get a preamble longer than the
+ * interval, so both ends must use the same setting. Takes effect on the
+ * next rf_receive_on().
+ */
+void rf_set_wor_interval(uint16_t ms)
+{
+  uint32_t event0;
+  uint8_t rx_time;
+
+  if (ms > RF_WOR_MAX_INTERVAL_MS) {
+    ms = RF_WOR_MAX_INTERVAL_MS;
+  }
+
+  rf_wor_interval_ms = ms;
+
+  if (ms == 0) {
+    rf_tx_preamble_ms = 0;
+    WriteSingleReg(WORCTRL, RF_WORCTRL_OFF);
+    WriteSingleReg(MCSM2, RF_MCSM2_DEFAULT);
+    WriteSingleReg(PKTCTRL1, ReadSingleReg(PKTCTRL1) & ~RF_PKTCTRL1_PQT_MASK);
+    return;
+  }
+
+  rf_tx_preamble_ms = ms + RF_WOR_PREAMBLE_MARGIN_MS;
+
+  // t_event0 = 750 / f_xosc * EVENT0
+  event0 = (uint32_t)ms * RF_XOSC_KHZ / 750;
+  WriteSingleReg(WOREVT1, event0 >> 8);
+  WriteSingleReg(WOREVT0, event0 & 0xff);
+
+  // Shortest RX window that still fits RF_WOR_RX_MIN_US
+  for (rx_time = sizeof(rf_rx_time_ppm) / sizeof(rf_rx_time_ppm[0]) - 1; rx_time > 0; --rx_time) {
+    if ((uint32_t)ms * rf_rx_time_ppm[rx_time] / 1000 >= RF_WOR_RX_MIN_US) {
+      break;
+    }
+  }
+
+  // Stay in RX after the window only if there is a preamble
+  WriteSingleReg(MCSM2, RF_MCSM2_RX_TIME_QUAL | rx_time);
+  WriteSingleReg(PKTCTRL1, (ReadSingleReg(PKTCTRL1) & ~RF_PKTCTRL1_PQT_MASK) | RF_WOR_PQT);
+  WriteSingleReg(WORCTRL, RF_WORCTRL_ON);
+}
+
+
 
 /*
- * Initialize CC1101 radio inside the CC430.
+ * Send a preamble of at least ms before each packet, e.g.
+ * RF_SCAN_PREAMBLE_MS for a scanning receiver. With Wake-on-Radio the
+ * longer of the two is used.
  */
-void rf_init(void)
+void rf_set_tx_preamble(uint16_t ms)
 {
-#if 0
-  // Set the High-Power Mode Request Enable bit so LPM3 can be entered
-  // with active radio enabled
-  PMMCTL0_H = 0xA5;
-  PMMCTL0_L |= PMMHPMRE_L;
-  PMMCTL0_H = 0x00;
-#endif
+  rf_tx_min_preamble_ms = ms;
+}
 
-  Strobe(RF_SRES);                          // Reset the Radio Core
-  Strobe(RF_SNOP);                          // Reset Radio Pointer
 
-  RfRxBufferLength = 0;
-  RfTxQueue_i = 0;
-  rf_error = 0;
-  rf_transmitting = 0;
-  rf_receiving = 0;
 
-  WriteRfSettings();
+/*
+ * Wait in low power mode until the radio is in the given state
+ * (CC430_STATE_*), at most ms milliseconds. Any radio interrupt, e.g.
+ * end of packet or chip ready on GDO2, ends the sleep early to check
+ * the state again. Returns 1 when in the state, 0 on timeout.
+ */
+uint8_t rf_wait_for_state(unsigned char state, uint16_t ms, uint32_t mode)
+{
+  unsigned char chip_rdy = 0;
+  uint8_t ret = 1;
+
+  // Wake up on chip ready, unless GDO2 is used for something else
+  if (ReadSingleReg(IOCFG2) == RF_IOCFG_CHIP_RDYN) {
+    chip_rdy = 1;
+    RF1AIES |= BIT2;
+    RF1AIFG &= ~BIT2;
+    RF1AIE |= BIT2;
+  }
+
+  while ((Strobe(RF_SNOP) & CC430_STATE_MASK) != state) {
+    if (ms-- == 0) {
+      ret = 0;
+      break;
+    }
+
+    // Sleep a millisecond or until the next radio interrupt
+    rf_state_wait = 1;
+    timer_wait_while(&rf_state_wait, 1, mode);
+  }
 
-  WriteSinglePATable(PATABLE_VAL);
+  if (chip_rdy) {
+    RF1AIE &= ~BIT2;
+  }
+
+  return ret;
 }
 
 
 
 /*
- * Wait until radio is idle
+ * Wait until radio is idle, flags rf_error on timeout
  */
 void rf_wait_for_idle(void)
 {
-  unsigned char RxStatus;
+  if (!rf_wait_for_state(CC430_STATE_IDLE, RF_STATE_TIMEOUT_MS, LPM0_bits)) {
+    rf_error = 1;
+  }
+}
+
+
+
+/*
+ * Preamble sent before the next packet, the longer of the Wake-on-Radio
+ * and the rf_set_tx_preamble() one
+ */
+static uint16_t rf_preamble_ms(void)
+{
+  return rf_tx_preamble_ms > rf_tx_min_preamble_ms ?
+    rf_tx_preamble_ms : rf_tx_min_preamble_ms;
+}
+
+
+
+/*
+ * Longest time on air of a packet with len payload bytes, with its
+ * preamble, for the rf_wait_for_tx() timeout
+ */
+uint16_t rf_tx_ms(uint8_t len)
+{
+  uint32_t us = (uint32_t)(len + RF_TX_OVERHEAD_LEN) * rf_byte_us();
+
+  return rf_preamble_ms() + (us + 999) / 1000 + RF_TX_MARGIN_MS;
+}
+
+
+
+/*
+ * Wait until the current transmit is done, at most ms milliseconds,
+ * e.g. rf_tx_ms() of the packet. Returns 1 when done, 0 on timeout.
+ */
+uint8_t rf_wait_for_tx(uint16_t ms, uint32_t mode)
+{
+  // The packet goes to the FIFO from timer_run() after the preamble
+  if (rf_preamble_timer.active) {
+    uint16_t preamble_ms = rf_preamble_ms();
 
-  while (((RxStatus = Strobe(RF_SNOP)) & CC430_STATE_MASK) != CC430_STATE_IDLE) {
-    busysleep_us(10);
+    timer_sleep_until(rf_preamble_timer.deadline, mode);
+    ms = ms > preamble_ms ? ms - preamble_ms : 0;
   }
+
+  return timer_wait_while(&rf_transmitting, ms, mode);
 }
 
 
@@ -97,8 +812,12 @@ void rf_wait_for_idle(void)
  */
 void rf_shutdown(void)
 {
+  // Not to be left half woken up
+  rf_wakeup_wait(LPM3_bits);
+
   Strobe(RF_SIDLE);
   Strobe(RF_SPWD);
+  rf_sleeping = 1;
 }
 
 
@@ -109,18 +828,26 @@ void rf_shutdown(void)
 void rf_receive_on(void)
 {
   rf_receiving = 1;
+  rf_rx_ready = 0;
+  RfRxBufferLength = 0;
 
-  // Falling edge of RFIFG9
+  // Falling edge of RFIFG9, rising edge of RFIFG0 (RX FIFO threshold)
   RF1AIES |= BIT9;
+  RF1AIES &= ~BIT0;
 
   // Clear a pending interrupt
-  RF1AIFG &= ~BIT9;
+  RF1AIFG &= ~(BIT9 | BIT0);
 
-  // Enable the interrupt
-  RF1AIE  |= BIT9;
+  // Enable the interrupts
+  RF1AIE  |= BIT9 | BIT0;
 
-  // Radio is in IDLE following a TX, so strobe SRX to enter Receive Mode
-  Strobe(RF_SRX);
+  // Radio is in IDLE following a TX, so strobe SRX to enter Receive
+  // Mode, or SWOR to sniff periodically from SLEEP
+  if (rf_wor_interval_ms > 0) {
+    Strobe(RF_SWOR);
+  } else {
+    Strobe(RF_SRX);
+  }
 }
 
 
@@ -132,10 +859,10 @@ void rf_receive_off(void)
 {
 
   // Disable RX interrupts
-  RF1AIE &= ~BIT9;
+  RF1AIE &= ~(BIT9 | BIT0);
 
   // Clear pending IFG
-  RF1AIFG &= ~BIT9;
+  RF1AIFG &= ~(BIT9 | BIT0);
 
   // It is possible that ReceiveOff is called while radio is receiving a packet.
   // Therefore, it is necessary to flush the RX FIFO after issuing IDLE strobe
@@ -149,16 +876,32 @@ void rf_receive_off(void)
 
 
 /*
- * RF TX or RX ready (one whole message)
+ * RF TX or RX ready (one whole message), or FIFO threshold crossed
+ * while a packet longer than the FIFO is on air
  */
 __attribute__((interrupt(CC1101_VECTOR)))
 void CC1101_ISR(void)
 {
   switch(RF1AIV) {                          // Prioritizing Radio Core Interrupt
   case  0: break;                           // No RF core interrupt pending
-  case  2: break;                           // RFIFG0
-  case  4: break;                           // RFIFG1
-  case  6: break;                           // RFIFG2
+  case  2:                                  // RFIFG0, RX FIFO above threshold
+    if (rf_receiving) {
+      drain_rx_fifo();
+    }
+    break;
+  case  4:                                  // RFIFG1, TX FIFO below threshold
+    if (rf_transmitting) {
+      refill_tx_fifo();
+    }
+    break;
+  case  6:                                  // RFIFG2, chip ready
+    if (rf_wake_pending) {
+      // rf_wakeup_start(), the RF1A7 wait from here
+      rf_wake_deadline = timer_now() + rf_rf1a7_ticks;
+      rf_wake_pending = 0;
+      RF1AIE &= ~BIT2;
+    }
+    break;                                  // Otherwise rf_wait_for_state()
   case  8: break;                           // RFIFG3
   case 10: break;                           // RFIFG4
   case 12: break;                           // RFIFG5
@@ -167,17 +910,19 @@ void CC1101_ISR(void)
   case 18: break;                           // RFIFG8
   case 20:                                  // RFIFG9
 
-    // Disable RFIFG9 interrupts
-    RF1AIE &= ~BIT9;
+    // Disable RFIFG9 and FIFO threshold interrupts
+    RF1AIE &= ~(BIT9 | BIT1 | BIT0);
 
     // RX end of packet
     if(rf_receiving) {
       handle_rf_rx_packet();
+      sched_post(SCHED_EVENT_RF_RX);
     }
 
     // RF TX end of packet
     if(rf_transmitting) {
       rf_transmitting = 0;
+      sched_post(SCHED_EVENT_RF_TX);
     }
     break;
     // FIXME: RFIFG10 == RX with valid CRC?
@@ -189,38 +934,174 @@ void CC1101_ISR(void)
   case 32: break;                           // RFIFG15
   }
 
+  // End rf_wait_for_state() sleep
+  rf_state_wait = 0;
+
 #if SC_USE_SLEEP == 1
-  __bic_status_register_on_exit(LPM0_bits); // Exit active
+  __bic_status_register_on_exit(LPM3_bits); // Exit active
 #endif
 }
 
 
 
 /*
- * Append new message to transmit queue
+ * Set the listen-before-talk RSSI threshold and the number of backoff
+ * retries for rf_send_next_msg_cca()
  */
-void rf_append_msg(unsigned char *buf, unsigned char len)
+void rf_set_cca(int8_t threshold_dbm, uint8_t retries)
 {
-  unsigned char i;
+  rf_cca_threshold_dbm = threshold_dbm;
+  rf_cca_retries = retries;
+}
 
-  // Disable interrupts to make sure RfTxQueue isn't modified in the middle
-  __bic_status_register(GIE);
 
-  // Discard msg if no space in the queue
-  if ((RfTxQueue_i + len) > RF_QUEUE_LEN) {
-    // Enable interrupts
-    __bis_status_register(GIE);
-    return;
+
+/*
+ * Measure the channel, returns 1 if the RSSI is below the threshold.
+ * The radio is put to RX for the measurement if not already receiving,
+ * sleeping in the low power mode while the RSSI settles. Returns 0 and
+ * flags rf_error if the radio doesn't get to RX.
+ */
+uint8_t rf_channel_clear(uint32_t mode)
+{
+  int16_t rssi;
+
+  if (!rf_receiving) {
+    Strobe(RF_SRX);
+    if (!rf_wait_for_state(CC430_STATE_RX, RF_STATE_TIMEOUT_MS, LPM0_bits)) {
+      rf_error = 1;
+      Strobe(RF_SIDLE);
+      Strobe(RF_SFRX);
+      return 0;
+    }
   }
 
-  for (i = 0; i < len; ++i) {
-    RfTxQueue[RfTxQueue_i + i] = buf[i];
+  // Let the RSSI settle in RX
+  timer_sleep_until(timer_now() + timer_us_to_ticks(RF_CCA_SETTLE_US) + 1, mode);
+  rssi = rf_rssi_dbm();
+
+  if (!rf_receiving) {
+    Strobe(RF_SIDLE);
+    Strobe(RF_SFRX);
   }
 
-  RfTxQueue_i += len;
+  return rssi < rf_cca_threshold_dbm;
+}
+
 
-  // Enable interrupts
-  __bis_status_register(GIE);
+
+/*
+ * Current RSSI in dBm, the radio must be in RX
+ */
+static int16_t rf_rssi_dbm(void)
+{
+  unsigned char raw = ReadSingleReg(RSSI);
+  int16_t rssi;
+
+  // Mix the noise into the backoff randomness
+  rf_random_state ^= ((uint16_t)raw << 8) | (timer_stamp() & 0xff);
+
+  if (raw >= 128) {
+    rssi = (int16_t)raw - 256;
+  } else {
+    rssi = raw;
+  }
+
+  return rssi / 2 - RF_RSSI_OFFSET;
+}
+
+
+
+/*
+ * Pseudo random number for the backoff, 16 bit xorshift
+ */
+static uint16_t rf_random(void)
+{
+  uint16_t x = rf_random_state;
+
+  if (x == 0) {
+    x = 1;
+  }
+
+  x ^= x << 7;
+  x ^= x >> 9;
+  x ^= x << 8;
+  rf_random_state = x;
+
+  return x;
+}
+
+
+
+/*
+ * Drop the messages queued but not sent, e.g. after RF_TX_GAVE_UP when
+ * the caller still has the data and queues it again the next time
+ */
+void rf_drop_queued(void)
+{
+  ringbuf_skip(&RfTxQueue, ringbuf_len(&RfTxQueue));
+}
+
+
+
+/*
+ * Send the next message when the channel is clear. While the channel
+ * is busy, sleep a random backoff of 1 to 2^n slots (n growing with each
+ * retry up to RF_CCA_MAX_EXPONENT) and measure again. Gives up right
+ * away on rf_error. The message stays queued if it isn't sent, see
+ * rf_drop_queued() for the callers that keep it themselves.
+ */
+enum RF_TX_RESULT rf_send_next_msg_cca(enum RF_SEND_MSG force, uint32_t mode)
+{
+  uint8_t attempt;
+
+  if (rf_transmitting) {
+    return RF_TX_NO_MSG;
+  }
+
+  if ((force ? ringbuf_len(&RfTxQueue) : ringbuf_line_len(&RfTxQueue)) == 0) {
+    return RF_TX_NO_MSG;
+  }
+
+  for (attempt = 0; ; ++attempt) {
+    uint8_t exponent;
+    uint16_t slots;
+
+    if (rf_channel_clear(mode)) {
+      rf_send_next_msg(force);
+      return RF_TX_SENT;
+    }
+
+    if (rf_error) {
+      return RF_TX_GAVE_UP;
+    }
+
+    if (attempt >= rf_cca_retries) {
+      return rf_cca_retries > 0 ? RF_TX_GAVE_UP : RF_TX_BUSY;
+    }
+
+    exponent = attempt + 1;
+    if (exponent > RF_CCA_MAX_EXPONENT) {
+      exponent = RF_CCA_MAX_EXPONENT;
+    }
+    slots = rf_random() & ((1 << exponent) - 1);
+
+    timer_sleep_ms((slots + 1) * RF_CCA_SLOT_MS, mode);
+  }
+}
+
+
+
+/*
+ * Append new message to transmit queue
+ */
+void rf_append_msg(unsigned char *buf, unsigned char len)
+{
+  // Discard msg if no space in the queue
+  uint16_t written = ringbuf_write(&RfTxQueue, buf, len);
+
+  STATS_ADD(rf_tx_drops, len - written);
+  STATS_MAX(rf_tx_queue_max, ringbuf_len(&RfTxQueue));
 }
 
 
@@ -230,68 +1111,67 @@ void rf_append_msg(unsigned char *buf, unsigned char len)
  */
 uint8_t rf_send_next_msg(enum RF_SEND_MSG force)
 {
-  unsigned char x;
-  int len = -1;
+  uint16_t len;
 
   // Do nothing, if already transmitting
   if (rf_transmitting) {
     return 0;
   }
 
-  // Disable interrupts to make sure RfTxQueue isn't modified in the middle
-  __bic_status_register(GIE);
-
   if (force) {
-    len = RfTxQueue_i;
+    len = ringbuf_len(&RfTxQueue);
   } else {
     // Find the end of the first message
-    for (x = 0; x < RfTxQueue_i; x++) {
-      if (RfTxQueue[x] == '\n') {
-        len = x + 1;
-        break;
-      }
-    }
-
-    // No newline, do nothing
-    if (len == -1) {
-      // Enable interrupts
-      __bis_status_register(GIE);
-      return 0;
-    }
+    len = ringbuf_line_len(&RfTxQueue);
   }
 
-  // Radio expects first byte to be packet len (excluding the len byte itself)
-  RfTxBuffer[0] = len;
-  // Copy data received over uart to RF TX buffer
-  for (x = 0; x < len; ++x) {
-    RfTxBuffer[x+1] = RfTxQueue[x];
+  // No (complete) message, do nothing
+  if (len == 0) {
+    return 0;
   }
 
-  // If we have more data to send, move them in front of the buffer
-  if (len != RfTxQueue_i) {
-    for (x = 0; x < RfTxQueue_i - len; ++x) {
-      RfTxQueue[x] = RfTxQueue[x+len];
-    }
-    RfTxQueue_i -= len;
-  } else {
-    // All data sent, clear uart buffers
-    RfTxQueue_i = 0;
+  // Send the rest in the next packet if the message doesn't fit
+  if (len > PAYLOAD_LEN) {
+    len = PAYLOAD_LEN;
   }
 
-  // Stop receive mode
+  // Copy data received over uart to RF TX buffer
+  ringbuf_read(&RfTxQueue, (unsigned char *)&RfTxBuffer[RF_PAYLOAD_OFFSET], len);
+  rf_send_buffer(len);
+
+  return len;
+}
+
+
+
+/*
+ * Send the len bytes of payload already written to
+ * RfTxBuffer[RF_PAYLOAD_OFFSET] onwards
+ */
+void rf_send_buffer(uint8_t len)
+{
+  // Radio expects first byte to be packet len (excluding the len byte
+  // itself), and the address filter the destination after it
+  len += RF_HEADER_LEN;
+  RfTxBuffer[0] = len;
+  RfTxBuffer[1] = rf_destination;
+  RfTxBuffer[2] = rf_address;
+
+  // Stop receive mode. Disable interrupts so that the RX end of
+  // packet interrupt can't access the radio in the middle.
+  __bic_status_register(GIE);
   if (rf_receiving) {
     rf_receive_off();
   }
+  __bis_status_register(GIE);
 
-  // Send buffer over RF (len +1 for length byte)
+  // Send buffer over RF (len +1 for length byte). RX interrupts are
+  // off now, so the radio core isn't shared with the interrupt handler.
   rf_transmitting = 1;
-  len = RfTxBuffer[0];
   transmit_msg((unsigned char*)RfTxBuffer, len + 1);
 
-  // Enable interrupts
-  __bis_status_register(GIE);
-
-  return len;
+  STATS_INC(rf_tx_packets);
+  STATS_ADD(rf_tx_bytes, len - RF_HEADER_LEN);
 }
 
 
@@ -301,7 +1181,6 @@ uint8_t rf_send_next_msg(enum RF_SEND_MSG force)
  */
 static void handle_rf_rx_packet(void)
 {
-  unsigned char x;
   unsigned char RxStatus;
 
   // Radio is in IDLE after receiving a message (See MCSM0 default values)
@@ -310,95 +1189,54 @@ static void handle_rf_rx_packet(void)
   // Validate radio state
   RxStatus = Strobe(RF_SNOP);
   if ((RxStatus & CC430_STATE_MASK) != CC430_STATE_IDLE) {
-    rf_error = 1;
-    goto rx_error;
-  }
-
-  // Read the length byte from the FIFO
-  RfRxBufferLength = ReadSingleReg(RXBYTES);
-
-  // Must have at least 4 bytes (len <payload> RSSI CRC) for a valid packet
-  if (RfRxBufferLength < 4) {
-    goto rx_error;
-  }
-
-  // Read the packet data
-  ReadBurstReg(RF_RXFIFORD, (unsigned char *)RfRxBuffer, RfRxBufferLength);
-
-  // Verify CRC
-  if(!(RfRxBuffer[RfRxBufferLength - 1] & CRC_OK)) {
+    if ((RxStatus & CC430_STATE_MASK) == CC430_STATE_RX_OVERFLOW) {
+      STATS_INC(rf_rx_overflows);
+    } else {
+      STATS_INC(rf_rx_errors);
+    }
     goto rx_error;
   }
 
-  // FIXME: use uart API instead of directly poking the buffers
-
-  // If there's not enough space for new data in uart tx buffer, discard new data
-  if (UartTxBufferLength + (RfRxBufferLength - 3) > UART_BUF_LEN) {
-    goto failed_to_receive;
-  }
-
-  // Append the RF RX buffer to Uart TX, skipping the length, RSSI and CRC/Quality bytes
-  for (x = 0; x < RfRxBufferLength - 3; ++x) {
-    UartTxBuffer[UartTxBufferLength + x] = RfRxBuffer[x+1];
-  }
-  UartTxBufferLength += (RfRxBufferLength - 3);
-
+  // Read the rest of the packet, the start may have been read already
+  // by drain_rx_fifo()
   {
-    // DEBUG: Write RSSI to UartTxBuffer
-    // Remove \r\n
-    UartTxBufferLength -= 2;
-    UartTxBuffer[UartTxBufferLength++] = ' ';
-    unsigned char len;
-    volatile unsigned char *buf = &UartTxBuffer[UartTxBufferLength];
-    unsigned char value = RfRxBuffer[RfRxBufferLength - 2];
-    unsigned char max_len = UART_BUF_LEN - UartTxBufferLength;
-    int16_t rssi;
-
-    // Convert RSSI to 0-255, 255 being the best signal
-    if (value >= 128) {
-      rssi = value - 256;
-    } else {
-      rssi = value;
-    }
-    rssi -= 2*74; // double RSSI offset from data sheet
-
-    // turn negative value to 0-255, 255 being the best signal
-    rssi += 276;
+    unsigned char bytes = ReadSingleReg(RXBYTES) & ~CC430_RXFIFO_OVERFLOW;
 
-    len = sc_itoa(rssi, (unsigned char *)buf, max_len);
-    if (len == 0) {
-      UartTxBuffer[UartTxBufferLength] = 'X';
-      ++len;
+    if (RfRxBufferLength + bytes > PACKET_LEN) {
+      STATS_INC(rf_rx_overflows);
+      goto rx_error;
     }
-    UartTxBuffer[UartTxBufferLength + len++] = ' ';
-    UartTxBufferLength += len;
+
+    ReadBurstReg(RF_RXFIFORD, (unsigned char *)&RfRxBuffer[RfRxBufferLength], bytes);
+    RfRxBufferLength += bytes;
   }
 
-  {
-    // DEBUG: Write CRC/LQI to UartTxBuffer
-    unsigned char len;
-    volatile unsigned char *buf = &UartTxBuffer[UartTxBufferLength];
-    unsigned char value = RfRxBuffer[RfRxBufferLength - 1];
-    unsigned char max_len = UART_BUF_LEN - UartTxBufferLength;
-    len = sc_itoa(value, (unsigned char *)buf, max_len);
-    if (len == 0) {
-      UartTxBuffer[UartTxBufferLength] = 'X';
-      ++len;
-    }
-    UartTxBuffer[UartTxBufferLength + len++] = '\r';
-    UartTxBuffer[UartTxBufferLength + len++] = '\n';
-    UartTxBufferLength += len;
+  // Must have at least the len byte, the addresses, RSSI and CRC for
+  // a valid packet, and exactly as many bytes as the length byte says
+  if (RfRxBufferLength < RF_PAYLOAD_OFFSET + 2 ||
+      RfRxBufferLength != RfRxBuffer[0] + 3) {
+    STATS_INC(rf_rx_errors);
+    goto rx_error;
   }
 
-  // Send the first byte to Uart
-  //while (!(UCA0IFG&UCTXIFG));           // USCI_A0 TX buffer ready?
-  UCA0TXBUF = UartTxBuffer[UartTxBuffer_i]; // Send first byte
+  // Hand the packet over to the main loop, also with a bad CRC so that
+  // it can be reported
+  rf_rx_status = 0;
+  if (RfRxBuffer[RfRxBufferLength - 1] & CRC_OK) {
+    rf_rx_status |= RF_RX_STATUS_CRC_OK;
+    STATS_INC(rf_rx_packets);
+    STATS_ADD(rf_rx_bytes, RfRxBufferLength - RF_PAYLOAD_OFFSET - 2);
+    STATS_RSSI(RfRxBuffer[RfRxBufferLength - 2]);
+  } else {
+    STATS_INC(rf_rx_crc_errors);
+    rf_error = 1;
+  }
+  rf_rx_timestamp = timer_stamp();
+  rf_rx_ready = 1;
   return;
 
  rx_error:
   rf_error = 1;
-
- failed_to_receive:
   RfRxBufferLength = 0;
   return;
 }
@@ -407,20 +1245,37 @@ static void handle_rf_rx_packet(void)
 
 
 /*
- * Start RF transmit with the given message
+ * Start RF transmit with the given message. Packets longer than the
+ * FIFO are written in pieces from the TX FIFO threshold interrupt.
  */
 static void transmit_msg(unsigned char *buffer, unsigned char length)
 {
-  // Falling edge of RFIFG9
-  RF1AIES |= BIT9;
+  uint16_t preamble_ms;
+
+  // Falling edge of RFIFG9, falling edge of RFIFG1 (TX FIFO threshold)
+  RF1AIES |= BIT9 | BIT1;
 
   // Clear pending interrupts
-  RF1AIFG &= ~BIT9;
+  RF1AIFG &= ~(BIT9 | BIT1);
 
   // Enable TX end-of-packet interrupt
   RF1AIE |= BIT9;
 
-  WriteBurstReg(RF_TXFIFOWR, buffer, length);
+  rf_tx_next = buffer;
+  rf_tx_remaining = length;
+
+  // The radio sends preamble until there's data in the TX FIFO, make it
+  // long enough for Wake-on-Radio and scanning receivers to notice. The
+  // CPU sleeps or does other things until preamble_done().
+  preamble_ms = rf_preamble_ms();
+  if (preamble_ms > 0) {
+    Strobe(RF_STX);
+    timer_event_start(&rf_preamble_timer, timer_ms_to_ticks(preamble_ms),
+                      0, preamble_done);
+    return;
+  }
+
+  start_tx_fifo();
 
   // Start transmit
   Strobe(RF_STX);
@@ -428,6 +1283,96 @@ static void transmit_msg(unsigned char *buffer, unsigned char length)
 
 
 
+/*
+ * Write the first FIFO full of the packet, the rest from the TX FIFO
+ * threshold interrupt
+ */
+static void start_tx_fifo(void)
+{
+  unsigned char first = rf_tx_remaining;
+
+  if (first > RF_FIFO_LEN) {
+    first = RF_FIFO_LEN;
+  }
+
+  WriteBurstReg(RF_TXFIFOWR, (unsigned char *)rf_tx_next, first);
+
+  rf_tx_next += first;
+  rf_tx_remaining -= first;
+
+  // Refill the FIFO when it has drained below the threshold
+  if (rf_tx_remaining > 0) {
+    RF1AIFG &= ~BIT1;
+    RF1AIE |= BIT1;
+  }
+}
+
+
+
+/*
+ * The preamble of transmit_msg() is long enough, from timer_run()
+ */
+static void preamble_done(void)
+{
+  if (rf_transmitting) {
+    start_tx_fifo();
+  }
+}
+
+
+
+/*
+ * Called from interrupt handler to write more of the current packet
+ * to the TX FIFO
+ */
+static void refill_tx_fifo(void)
+{
+  unsigned char space;
+
+  space = RF_FIFO_LEN - (ReadSingleReg(TXBYTES) & ~CC430_TXFIFO_UNDERFLOW);
+  if (space > rf_tx_remaining) {
+    space = rf_tx_remaining;
+  }
+
+  WriteBurstReg(RF_TXFIFOWR, (unsigned char *)rf_tx_next, space);
+  rf_tx_next += space;
+  rf_tx_remaining -= space;
+
+  if (rf_tx_remaining == 0) {
+    RF1AIE &= ~BIT1;
+  }
+}
+
+
+
+/*
+ * Called from interrupt handler to move received bytes from the RX FIFO
+ * to RfRxBuffer while the packet is still being received
+ */
+static void drain_rx_fifo(void)
+{
+  unsigned char bytes;
+
+  bytes = ReadSingleReg(RXBYTES) & ~CC430_RXFIFO_OVERFLOW;
+
+  // The last byte in the FIFO must not be read before the whole
+  // packet has been received (see CC1101 errata)
+  if (bytes < 2) {
+    return;
+  }
+  --bytes;
+
+  // Too long packet, the end of packet interrupt will discard it
+  if (RfRxBufferLength + bytes > PACKET_LEN) {
+    return;
+  }
+
+  ReadBurstReg(RF_RXFIFORD, (unsigned char *)&RfRxBuffer[RfRxBufferLength], bytes);
+  RfRxBufferLength += bytes;
+}
+
+
+
 /* Emacs indentatation information
    Local Variables:
    indent-tabs-mode:nil
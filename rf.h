@@ -30,6 +30,7 @@
 #define RB_RF_H
 
 #include "common.h"
+#include "ringbuf.h"
 
 #include "RF1A.h"
 #include "hal_pmm.h"
@@ -37,10 +38,30 @@
 #include <msp430.h>
 #include <stdint.h>
 
-#define PAYLOAD_LEN        (60)                // Max payload
-#define PACKET_LEN         (PAYLOAD_LEN + 3)   // PACKET_LEN = payload + len + RSSI + LQI
-#define RF_QUEUE_LEN       (PAYLOAD_LEN * 3)   // Space for several messages
+#define RF_HEADER_LEN      (2)                 // Destination and source address
+#define RF_PAYLOAD_OFFSET  (1 + RF_HEADER_LEN) // Payload after len and header
+#define RF_FIFO_LEN        (64)                // Radio TX and RX FIFO size
+#define RF_FIFO_PAYLOAD_LEN (RF_FIFO_LEN - RF_PAYLOAD_OFFSET) // Sent without refills
+// Max payload, PKTLEN written in rf_init(). The sensors build with a
+// FIFO full, RF_FIFO_PAYLOAD_LEN, see the Makefile.
+#ifndef PAYLOAD_LEN
+#define PAYLOAD_LEN        (248 - RF_HEADER_LEN)
+#endif
+#if PAYLOAD_LEN + RF_HEADER_LEN > 248
+#error "PAYLOAD_LEN too long for PKTLEN"
+#endif
+#define PACKET_LEN         (PAYLOAD_LEN + RF_HEADER_LEN + 3) // + len + RSSI + LQI
+#define RF_QUEUE_LEN       (PAYLOAD_LEN * 2)   // Space for several messages
 #define CRC_OK             (BIT7)              // CRC_OK bit
+#define RF_CAL_TEMP_STEP   (4 * 256)           // Recalibrate after 4 C change (TMP275 raw)
+#define RF_CAL_MAX_WAKEUPS (100)               // Recalibrate at least this often
+#define RF_RX_STATUS_CRC_OK (0x01)             // CRC_OK in rf_rx_status
+
+// rf_wakeup_start() to rf_wakeup_ready(): the chip ready interrupt and
+// then the RF1A7 wait on TA0, or the whole wake up in Strobe() if the
+// interrupt doesn't come in time
+#define RF_RF1A7_US        (810)               // Wait after chip ready, RF1A7
+#define RF_WAKEUP_TIMEOUT_MS (2)               // Chip ready interrupt at most
 #define PATABLE_VAL        (0xC3)              // +10 dBm output
 //#define PATABLE_VAL        (0x51)              // 0 dBm output
 
@@ -52,14 +73,93 @@
 #define CC430_FIFO_BYTES_AVAILABLE_MASK  (0x0F)
 #define CC430_STATE_RX                   (0x10)
 #define CC430_STATE_RX_OVERFLOW          (0x60)
+#define CC430_RXFIFO_OVERFLOW            (0x80)  // In RXBYTES
+#define CC430_TXFIFO_UNDERFLOW           (0x80)  // In TXBYTES
+#define RF_MCSM0_FS_AUTOCAL              (0x30)  // Automatic calibration bits in MCSM0
+#define RF_MCSM2_RX_TIME_QUAL            (0x08)
+#define RF_MCSM2_DEFAULT                 (0x07)  // MCSM2 in WriteRfSettings()
+#define RF_PKTCTRL1_PQT_MASK             (0xE0)
+#define RF_WORCTRL_OFF                   (0xFB)  // RC oscillator off, WORCTRL in WriteRfSettings()
+#define RF_WORCTRL_ON                    (0x78)  // RC oscillator on, EVENT1 = 7, RC_CAL, WOR_RES = 0
+
+#define RF_IOCFG_CHIP_RDYN               (0x29)
+#define RF_STATE_TIMEOUT_MS              (10)
+
+// Packet bytes on air besides the payload: preamble 4, sync word 4,
+// length, header and CRC 2. The margin covers the calibration and the
+// TX start.
+#define RF_TX_OVERHEAD_LEN               (4 + 4 + 1 + RF_HEADER_LEN + 2)
+#define RF_TX_MARGIN_MS                  (2)
+
+#define RF_XOSC_KHZ                      (26000)
+#define RF_WOR_MAX_INTERVAL_MS           (1890)  // Max EVENT0 with WOR_RES = 0
+#define RF_WOR_RX_MIN_US                 (1000)  // Min time to detect the preamble
+#define RF_WOR_PREAMBLE_MARGIN_MS        (5)
+#define RF_WOR_PQT                       (0x40)  // Preamble quality threshold 8
+
+#define RF_RSSI_OFFSET                   (74)    // dB, from the data sheet
+#define RF_CCA_THRESHOLD_DBM             (-90)   // Channel busy at or above
+#define RF_CCA_RETRIES                   (5)
+#define RF_CCA_SLOT_MS                   (2)     // Backoff unit, > one CCA + TX start
+#define RF_CCA_MAX_EXPONENT              (5)     // At most 32 slots
+#define RF_CCA_SETTLE_US                 (500)   // RSSI valid after entering RX
+
+// Channels CHANNR 0 .. RF_CHANNEL_COUNT - 1, 200 kHz apart (MDMCFG1
+// and MDMCFG0 of the profiles) up from 434.0 MHz (FREQ in
+// WriteRfSettings()), which fits four in the 433 MHz band. The 250k
+// profile is wider than the spacing, use every other channel with it.
+#ifndef RF_CHANNEL_COUNT
+#define RF_CHANNEL_COUNT                 (4)
+#endif
 
-// Buffer for incoming data from RF
-extern volatile unsigned char RfRxBuffer[PACKET_LEN];
+// A scanning receiver listens RF_SCAN_DWELL_MS on each channel unless
+// there is a signal, so packets to it need a preamble of a full round
+#define RF_SCAN_DWELL_MS                 (2)
+#define RF_SCAN_PREAMBLE_MS              (RF_CHANNEL_COUNT * RF_SCAN_DWELL_MS + 2)
+
+// Packets start with [len][destination][source]. The radio drops
+// packets not addressed to ADDR or to RF_ADDR_BROADCAST (ADR_CHK = 2
+// in PKTCTRL1).
+#define RF_ADDR_BROADCAST                (0x00)
+#define RF_ADDR_GATEWAY                  (0xFE)
+#define RF_ADDR_ERASED                   (0xFF)  // Not set in info flash
+#define RF_ADDR_INFO                     (0x1800) // First byte of info segment D
+
+/*
+ * Modem settings that differ between data rates. Both ends must use the
+ * same profile.
+ */
+typedef enum rf_profile_id_t {
+  RF_PROFILE_38K4 = 0,                           // WriteRfSettings() default, sensitive
+  RF_PROFILE_38K4_LOW_POWER,                     // Less RX current, less sensitive
+  RF_PROFILE_250K,                               // Throughput on short links
+  RF_PROFILE_COUNT
+} rf_profile_id_t;
+
+typedef struct rf_profile_t {
+  unsigned char fsctrl1;                         // IF frequency
+  unsigned char modem[6];                        // MDMCFG4 .. DEVIATN
+  unsigned char agc[5];                          // FOCCFG .. AGCCTRL0
+  unsigned char frend[2];                        // FREND1, FREND0
+  unsigned char test[2];                         // TEST2, TEST1, not retained in SLEEP
+  unsigned char patable;                         // TX power
+  uint16_t byte_us;                              // Air time of a byte
+} rf_profile_t;
+
+// Buffer for incoming data from RF, PACKET_LEN bytes in a slot of the
+// packet buffer pool (pktbuf.h)
+extern volatile unsigned char *RfRxBuffer;
 extern volatile unsigned char RfRxBufferLength;
 
+// Set when a received packet in RfRxBuffer is waiting to be handled.
+// The buffer is reused on the next rf_receive_on(), unless its slot is
+// taken with rf_rx_take().
+extern volatile unsigned char rf_rx_ready;
+extern volatile unsigned char rf_rx_status;
+extern volatile uint16_t rf_rx_timestamp;
+
 // Queue for messages to be sent out over RF
-extern volatile unsigned char RfTxQueue[RF_QUEUE_LEN];
-extern volatile unsigned char RfTxQueue_i;
+extern ringbuf_t RfTxQueue;
 
 // Buffer for message currently being sent out over RF
 extern volatile unsigned char RfTxBuffer[PACKET_LEN];
@@ -73,12 +173,48 @@ enum RF_SEND_MSG {
   RF_SEND_MSG_FORCE
 };
 
+enum RF_TX_RESULT {
+  RF_TX_SENT = 0,
+  RF_TX_NO_MSG,                                  // Nothing to send or already sending
+  RF_TX_BUSY,                                    // Channel busy and no retries set
+  RF_TX_GAVE_UP                                  // Channel busy on every retry
+};
+
+void rf_set_address(uint8_t addr);
+uint8_t rf_get_address(void);
+uint8_t rf_info_address(uint8_t fallback);
+void rf_set_destination(uint8_t addr);
+uint8_t rf_rx_take(void);
+uint8_t rf_rx_source(void);
+void rf_set_profile(rf_profile_id_t id);
+rf_profile_id_t rf_get_profile(void);
+uint16_t rf_byte_us(void);
 void rf_init(void);
+void rf_wakeup(void);
+void rf_wakeup_start(void);
+uint8_t rf_wakeup_ready(void);
+void rf_wakeup_wait(uint32_t mode);
+void rf_calibrate(int16_t temp);
+void rf_set_wor_interval(uint16_t ms);
+void rf_set_tx_preamble(uint16_t ms);
+void rf_set_channel(uint8_t ch);
+uint8_t rf_get_channel(void);
+uint8_t rf_address_channel(uint8_t addr);
+uint8_t rf_hop_channel(uint8_t seed, uint16_t hop);
+void rf_scan_next(void);
+uint8_t rf_wait_for_state(unsigned char state, uint16_t ms, uint32_t mode);
 void rf_wait_for_idle(void);
+uint16_t rf_tx_ms(uint8_t len);
+uint8_t rf_wait_for_tx(uint16_t ms, uint32_t mode);
 void rf_shutdown(void);
 void rf_receive_on(void);
 void rf_receive_off(void);
 void rf_append_msg(unsigned char *buf, unsigned char len);
 uint8_t rf_send_next_msg(enum RF_SEND_MSG force);
+void rf_send_buffer(uint8_t len);
+void rf_set_cca(int8_t threshold_dbm, uint8_t retries);
+uint8_t rf_channel_clear(uint32_t mode);
+enum RF_TX_RESULT rf_send_next_msg_cca(enum RF_SEND_MSG force, uint32_t mode);
+void rf_drop_queued(void);
 
 #endif
@@ -0,0 +1,311 @@
+/*
+ * Single producer, single consumer ring buffer
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "ringbuf.h"
+
+/*
+ * Advance index i by n, wrapping at the end of the buffer
+ */
+static inline uint16_t ringbuf_wrap(ringbuf_t *rb, uint16_t i, uint16_t n)
+{
+  i += n;
+  if (i >= rb->size) {
+    i -= rb->size;
+  }
+  return i;
+}
+
+
+
+/*
+ * Consumer has removed n bytes, update the newline search state
+ */
+static void ringbuf_consumed(ringbuf_t *rb, uint16_t n)
+{
+  rb->scan = (rb->scan > n) ? rb->scan - n : 0;
+  rb->line_len = (rb->line_len > n) ? rb->line_len - n : 0;
+}
+
+
+
+/*
+ * Initialise an empty ring buffer using size bytes of buf
+ */
+void ringbuf_init(ringbuf_t *rb, volatile unsigned char *buf, uint16_t size)
+{
+  rb->buf = buf;
+  rb->size = size;
+  rb->head = 0;
+  rb->tail = 0;
+  rb->scan = 0;
+  rb->line_len = 0;
+}
+
+
+
+/*
+ * Number of bytes in the buffer
+ */
+uint16_t ringbuf_len(ringbuf_t *rb)
+{
+  uint16_t head = rb->head;
+  uint16_t tail = rb->tail;
+
+  if (head >= tail) {
+    return head - tail;
+  }
+  return rb->size - tail + head;
+}
+
+
+
+/*
+ * Number of bytes that can still be written
+ */
+uint16_t ringbuf_free(ringbuf_t *rb)
+{
+  return rb->size - 1 - ringbuf_len(rb);
+}
+
+
+
+/*
+ * Append one byte. Returns 0 if the buffer is full.
+ */
+uint8_t ringbuf_put(ringbuf_t *rb, unsigned char c)
+{
+  uint16_t head = rb->head;
+  uint16_t next = ringbuf_wrap(rb, head, 1);
+
+  if (next == rb->tail) {
+    return 0;
+  }
+
+  rb->buf[head] = c;
+
+  // Publish the byte only after it has been stored
+  rb->head = next;
+
+  return 1;
+}
+
+
+
+/*
+ * Append len bytes, all or nothing. Returns len or 0 if there wasn't
+ * enough space.
+ */
+uint16_t ringbuf_write(ringbuf_t *rb, const unsigned char *buf, uint16_t len)
+{
+  uint16_t head = rb->head;
+  uint16_t i;
+
+  if (len > ringbuf_free(rb)) {
+    return 0;
+  }
+
+  for (i = 0; i < len; ++i) {
+    rb->buf[head] = buf[i];
+    if (++head == rb->size) {
+      head = 0;
+    }
+  }
+
+  // Publish the bytes only after they have been stored
+  rb->head = head;
+
+  return len;
+}
+
+
+
+/*
+ * Publish bytes written directly into the buffer memory (e.g. by DMA)
+ * up to, but not including, index head
+ */
+void ringbuf_set_head(ringbuf_t *rb, uint16_t head)
+{
+  rb->head = head;
+}
+
+
+
+/*
+ * Remove one byte. Returns 0 if the buffer is empty.
+ */
+uint8_t ringbuf_get(ringbuf_t *rb, unsigned char *c)
+{
+  uint16_t tail = rb->tail;
+
+  if (tail == rb->head) {
+    return 0;
+  }
+
+  *c = rb->buf[tail];
+  rb->tail = ringbuf_wrap(rb, tail, 1);
+  ringbuf_consumed(rb, 1);
+
+  return 1;
+}
+
+
+
+/*
+ * Remove up to len bytes. Returns the amount of bytes copied to buf.
+ */
+uint16_t ringbuf_read(ringbuf_t *rb, unsigned char *buf, uint16_t len)
+{
+  uint16_t tail = rb->tail;
+  uint16_t avail = ringbuf_len(rb);
+  uint16_t i;
+
+  if (len > avail) {
+    len = avail;
+  }
+
+  for (i = 0; i < len; ++i) {
+    buf[i] = rb->buf[tail];
+    if (++tail == rb->size) {
+      tail = 0;
+    }
+  }
+
+  rb->tail = tail;
+  ringbuf_consumed(rb, len);
+
+  return len;
+}
+
+
+
+/*
+ * Point *p to the oldest byte and return how many bytes can be read
+ * from there without wrapping. Nothing is removed.
+ */
+uint16_t ringbuf_peek(ringbuf_t *rb, volatile unsigned char **p)
+{
+  uint16_t head = rb->head;
+  uint16_t tail = rb->tail;
+
+  *p = &rb->buf[tail];
+
+  if (head >= tail) {
+    return head - tail;
+  }
+  return rb->size - tail;
+}
+
+
+
+/*
+ * Copy up to len bytes starting offset bytes after the tail without
+ * removing them, e.g. to resend data that is not yet acknowledged
+ */
+uint16_t ringbuf_copy(ringbuf_t *rb, uint16_t offset, volatile unsigned char *buf, uint16_t len)
+{
+  uint16_t avail = ringbuf_len(rb);
+  uint16_t i, pos;
+
+  if (offset >= avail) {
+    return 0;
+  }
+  if (len > avail - offset) {
+    len = avail - offset;
+  }
+
+  pos = ringbuf_wrap(rb, rb->tail, offset);
+  for (i = 0; i < len; ++i) {
+    buf[i] = rb->buf[pos];
+    pos = ringbuf_wrap(rb, pos, 1);
+  }
+
+  return len;
+}
+
+
+
+/*
+ * Remove n bytes without copying them, e.g. after ringbuf_peek()
+ */
+void ringbuf_skip(ringbuf_t *rb, uint16_t n)
+{
+  uint16_t avail = ringbuf_len(rb);
+
+  if (n > avail) {
+    n = avail;
+  }
+
+  rb->tail = ringbuf_wrap(rb, rb->tail, n);
+  ringbuf_consumed(rb, n);
+}
+
+
+
+/*
+ * Return the length of the first line including the '\n', or 0 if
+ * there's no complete line in the buffer. Bytes already searched are
+ * not searched again.
+ */
+uint16_t ringbuf_line_len(ringbuf_t *rb)
+{
+  uint16_t avail;
+  uint16_t i;
+
+  if (rb->line_len) {
+    return rb->line_len;
+  }
+
+  avail = ringbuf_len(rb);
+  i = ringbuf_wrap(rb, rb->tail, rb->scan);
+
+  while (rb->scan < avail) {
+    unsigned char c = rb->buf[i];
+
+    ++rb->scan;
+    if (++i == rb->size) {
+      i = 0;
+    }
+
+    if (c == '\n') {
+      rb->line_len = rb->scan;
+      break;
+    }
+  }
+
+  return rb->line_len;
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,79 @@
+/*
+ * Single producer, single consumer ring buffer
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_RINGBUF_H
+#define RB_RINGBUF_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * Lock free ring buffer for one producer and one consumer, e.g. an
+ * interrupt handler and the main loop. The producer only writes head
+ * and the consumer only writes tail, so neither side needs to disable
+ * interrupts. One byte is always left unused to tell full from empty.
+ *
+ * The consumer also remembers how far it has already searched for a
+ * newline, so finding the end of the first line is amortized O(1).
+ */
+typedef struct ringbuf_t {
+  volatile unsigned char *buf;
+  uint16_t size;
+  volatile uint16_t head;                   // Written by the producer only
+  volatile uint16_t tail;                   // Written by the consumer only
+  uint16_t scan;                            // Consumer: bytes after tail searched for '\n'
+  uint16_t line_len;                        // Consumer: length of the first line, 0 if none
+} ringbuf_t;
+
+void ringbuf_init(ringbuf_t *rb, volatile unsigned char *buf, uint16_t size);
+uint16_t ringbuf_len(ringbuf_t *rb);
+uint16_t ringbuf_free(ringbuf_t *rb);
+
+// Producer side
+uint8_t ringbuf_put(ringbuf_t *rb, unsigned char c);
+uint16_t ringbuf_write(ringbuf_t *rb, const unsigned char *buf, uint16_t len);
+void ringbuf_set_head(ringbuf_t *rb, uint16_t head);
+
+// Consumer side
+uint8_t ringbuf_get(ringbuf_t *rb, unsigned char *c);
+uint16_t ringbuf_read(ringbuf_t *rb, unsigned char *buf, uint16_t len);
+uint16_t ringbuf_peek(ringbuf_t *rb, volatile unsigned char **p);
+uint16_t ringbuf_copy(ringbuf_t *rb, uint16_t offset, volatile unsigned char *buf, uint16_t len);
+void ringbuf_skip(ringbuf_t *rb, uint16_t n);
+uint16_t ringbuf_line_len(ringbuf_t *rb);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
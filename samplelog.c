@@ -0,0 +1,264 @@
+/*
+ * Sample log for batching telemetry records
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "samplelog.h"
+#include "ringbuf.h"
+#include "telemetry.h"
+#include "timer.h"
+
+static volatile unsigned char SampleLogData[SAMPLELOG_LEN];
+static ringbuf_t SampleLog;
+
+static uint8_t samplelog_records = 0;
+static uint8_t samplelog_batch = 1;
+static uint32_t samplelog_max_delay = 0;
+static uint8_t samplelog_last_len = 0;          // Latest entry with its header
+
+// Entries in the packet of the last samplelog_peek()
+static uint16_t samplelog_peek_bytes = 0;
+static uint8_t samplelog_peek_records = 0;
+
+/*
+ * Read the header of the entry at offset, returns the record length
+ */
+static uint8_t samplelog_entry(uint16_t offset, uint32_t *timestamp)
+{
+  unsigned char header[SAMPLELOG_ENTRY_HEADER];
+
+  ringbuf_copy(&SampleLog, offset, header, sizeof(header));
+
+  *timestamp = (uint32_t)header[1] | ((uint32_t)header[2] << 8) |
+    ((uint32_t)header[3] << 16) | ((uint32_t)header[4] << 24);
+
+  return header[0];
+}
+
+
+
+/*
+ * Read the header of the oldest entry, returns the record length
+ */
+static uint8_t samplelog_oldest(uint32_t *timestamp)
+{
+  return samplelog_entry(0, timestamp);
+}
+
+
+
+/*
+ * Remove the oldest entry
+ */
+static void samplelog_drop(uint8_t len)
+{
+  ringbuf_skip(&SampleLog, SAMPLELOG_ENTRY_HEADER + len);
+  --samplelog_records;
+  samplelog_peek_bytes = 0;
+  samplelog_peek_records = 0;
+}
+
+
+
+/*
+ * Empty the log. Send when batch records have been collected or the
+ * oldest one has waited max_delay_ms (0 for no limit).
+ */
+void samplelog_init(uint8_t batch, uint32_t max_delay_ms)
+{
+  ringbuf_init(&SampleLog, SampleLogData, SAMPLELOG_LEN);
+  samplelog_records = 0;
+  samplelog_last_len = 0;
+  samplelog_peek_bytes = 0;
+  samplelog_peek_records = 0;
+  samplelog_max_delay = timer_ms_to_ticks(max_delay_ms);
+  samplelog_set_batch(batch);
+}
+
+
+
+/*
+ * Change the batch size, e.g. with the available energy. 1 sends every
+ * record right away.
+ */
+void samplelog_set_batch(uint8_t batch)
+{
+  samplelog_batch = batch > 0 ? batch : 1;
+}
+
+
+
+/*
+ * Number of records in the log
+ */
+uint8_t samplelog_count(void)
+{
+  return samplelog_records;
+}
+
+
+
+/*
+ * Add a finished telemetry record, the oldest ones are dropped if
+ * there's no space. Returns 0 if the record is too long for the log.
+ */
+uint8_t samplelog_add(const unsigned char *rec, uint8_t len)
+{
+  unsigned char header[SAMPLELOG_ENTRY_HEADER];
+  uint16_t entry = SAMPLELOG_ENTRY_HEADER + len;
+  uint32_t now = timer_now();
+
+  if (entry >= SAMPLELOG_LEN) {
+    return 0;
+  }
+
+  while (ringbuf_free(&SampleLog) < entry) {
+    uint32_t timestamp;
+    samplelog_drop(samplelog_oldest(&timestamp));
+  }
+
+  header[0] = len;
+  header[1] = now & 0xff;
+  header[2] = (now >> 8) & 0xff;
+  header[3] = (now >> 16) & 0xff;
+  header[4] = now >> 24;
+
+  ringbuf_write(&SampleLog, header, sizeof(header));
+  ringbuf_write(&SampleLog, rec, len);
+  ++samplelog_records;
+  samplelog_last_len = entry;
+
+  return 1;
+}
+
+
+
+/*
+ * Returns 1 if the log should be sent once pending more records have
+ * been added, e.g. to decide whether to start the radio before the
+ * next reading is ready
+ */
+uint8_t samplelog_due(uint8_t pending)
+{
+  uint32_t timestamp;
+
+  if (samplelog_records + pending == 0) {
+    return 0;
+  }
+
+  if (samplelog_records + pending >= samplelog_batch) {
+    return 1;
+  }
+
+  if (samplelog_records == 0) {
+    return 0;
+  }
+
+  // Oldest record would be late
+  samplelog_oldest(&timestamp);
+  if (samplelog_max_delay > 0 &&
+      timer_now() - timestamp >= samplelog_max_delay) {
+    return 1;
+  }
+
+  // Records of the latest size wouldn't fit without dropping
+  return ringbuf_free(&SampleLog) < (uint16_t)pending * samplelog_last_len;
+}
+
+
+
+/*
+ * Copy the oldest records that fit into buf, each with its age
+ * appended, and keep them in the log until samplelog_commit(). Returns
+ * the length of the packet, 0 if the log is empty. A record that isn't
+ * sent gets its age again in the next packet.
+ */
+uint8_t samplelog_peek(unsigned char *buf, uint8_t max_len)
+{
+  uint32_t now = timer_now();
+  uint16_t offset = 0;
+  uint8_t records = 0;
+  uint8_t out = 0;
+
+  while (records < samplelog_records) {
+    uint32_t timestamp;
+    uint8_t len = samplelog_entry(offset, &timestamp);
+    uint32_t age = timer_ticks_to_ms(now - timestamp) / 1000;
+    uint8_t rec_len = len + (age > 0 ? SAMPLELOG_AGE_FIELD_LEN : 0);
+
+    if (out + rec_len > max_len) {
+      if (out > 0) {
+        break;
+      }
+
+      // Never fits
+      samplelog_drop(len);
+      continue;
+    }
+
+    ringbuf_copy(&SampleLog, offset + SAMPLELOG_ENTRY_HEADER, &buf[out], len);
+
+    if (age > 0) {
+      telemetry_t t;
+
+      telemetry_resume(&t, &buf[out], max_len - out, len);
+      telemetry_add_value(&t, TELEMETRY_TYPE_AGE, age > 0xffff ? 0xffff : age);
+    }
+
+    out += rec_len;
+    offset += SAMPLELOG_ENTRY_HEADER + len;
+    ++records;
+  }
+
+  samplelog_peek_bytes = offset;
+  samplelog_peek_records = records;
+
+  return out;
+}
+
+
+
+/*
+ * Remove the records of the last samplelog_peek() packet once it's
+ * sent. Call samplelog_peek() again for the next packet.
+ */
+void samplelog_commit(void)
+{
+  ringbuf_skip(&SampleLog, samplelog_peek_bytes);
+  samplelog_records -= samplelog_peek_records;
+  samplelog_peek_bytes = 0;
+  samplelog_peek_records = 0;
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,72 @@
+/*
+ * Sample log for batching telemetry records
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_SAMPLELOG_H
+#define RB_SAMPLELOG_H
+
+#include "common.h"
+#include "rf.h"
+
+#include <stdint.h>
+
+/*
+ * Telemetry records waiting in RAM to be sent several in one packet,
+ * so that the radio start up, calibration and preamble are paid once
+ * per batch instead of once per reading. Each record is stored as
+ * [len][timestamp, 4 bytes LSB first][record] and gets a
+ * TELEMETRY_TYPE_AGE field when it's sent. If the log is full the
+ * oldest records are dropped.
+ */
+#define SAMPLELOG_LEN            (192)
+#define SAMPLELOG_ENTRY_HEADER   (5)
+#define SAMPLELOG_AGE_FIELD_LEN  (3)
+
+// Fits the radio FIFO, so it's sent without refill interrupts
+#define SAMPLELOG_PACKET_LEN     (RF_FIFO_PAYLOAD_LEN)
+
+#if SAMPLELOG_PACKET_LEN > PAYLOAD_LEN
+#error "PAYLOAD_LEN shorter than SAMPLELOG_PACKET_LEN"
+#endif
+
+void samplelog_init(uint8_t batch, uint32_t max_delay_ms);
+void samplelog_set_batch(uint8_t batch);
+uint8_t samplelog_count(void);
+uint8_t samplelog_add(const unsigned char *rec, uint8_t len);
+uint8_t samplelog_due(uint8_t pending);
+uint8_t samplelog_peek(unsigned char *buf, uint8_t max_len);
+void samplelog_commit(void);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,178 @@
+/*
+ * Event scheduler
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "sched.h"
+#include "prof.h"
+#include "timer.h"
+#include "utils.h"
+
+static volatile uint16_t sched_events;
+
+static sched_handler_t sched_handlers[SCHED_EVENTS];
+static uint8_t sched_holds[SCHED_LPM_COUNT];
+
+static const uint16_t sched_lpm_sr[SCHED_LPM_COUNT] = {
+  LPM0_bits, LPM1_bits, LPM2_bits, LPM3_bits, LPM4_bits
+};
+
+/*
+ * Clear pending events and handlers, timer events are run by default.
+ * Low power mode holds taken by the drivers are kept.
+ */
+void sched_init(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < SCHED_EVENTS; ++i) {
+    sched_handlers[i] = 0;
+  }
+  sched_events = 0;
+
+  sched_set_handler(SCHED_EVENT_TIMER, timer_run);
+}
+
+
+
+/*
+ * Set the handler run for the event bit
+ */
+void sched_set_handler(uint16_t event, sched_handler_t handler)
+{
+  uint8_t i;
+
+  for (i = 0; i < SCHED_EVENTS; ++i) {
+    if (event & (1 << i)) {
+      sched_handlers[i] = handler;
+    }
+  }
+}
+
+
+
+/*
+ * Mark events pending. Interrupt handlers must still exit the low
+ * power mode themselves.
+ */
+void sched_post(uint16_t events)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+
+  __bic_status_register(GIE);
+  sched_events |= events;
+  __bis_status_register(gie);
+}
+
+
+
+/*
+ * Keep the MCU at most in the given low power mode, e.g. while a
+ * peripheral needs a clock stopped by the deeper modes
+ */
+void sched_lpm_hold(sched_lpm_t lpm)
+{
+  if (lpm < SCHED_LPM_COUNT) {
+    ++sched_holds[lpm];
+  }
+}
+
+
+
+/*
+ * Release a hold taken with sched_lpm_hold()
+ */
+void sched_lpm_release(sched_lpm_t lpm)
+{
+  if (lpm < SCHED_LPM_COUNT && sched_holds[lpm] > 0) {
+    --sched_holds[lpm];
+  }
+}
+
+
+
+/*
+ * Status register bits of the deepest low power mode allowed
+ */
+uint16_t sched_lpm_bits(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < SCHED_LPM_COUNT - 1; ++i) {
+    if (sched_holds[i]) {
+      break;
+    }
+  }
+
+  return sched_lpm_sr[i];
+}
+
+
+
+/*
+ * Run the handlers of the pending events, sleep when there are none.
+ * Never returns.
+ */
+void sched_run(void)
+{
+  while (1) {
+    uint16_t events;
+    uint8_t i;
+
+    // Check and sleep atomically so that a posted event isn't missed
+    __bic_status_register(GIE);
+    events = sched_events;
+    sched_events = 0;
+    if (!events) {
+#if SC_USE_SLEEP == 1
+      PROF_LPM_ENTER(sched_lpm_bits());
+      __bis_status_register(sched_lpm_bits() + GIE);
+      PROF_LPM_EXIT();
+#else
+      __bis_status_register(GIE);
+      busysleep_ms(1);
+#endif
+      continue;
+    }
+    __bis_status_register(GIE);
+
+    for (i = 0; i < SCHED_EVENTS; ++i) {
+      if ((events & (1 << i)) && sched_handlers[i]) {
+        sched_handlers[i]();
+      }
+    }
+  }
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
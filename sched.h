@@ -0,0 +1,85 @@
+/*
+ * Event scheduler
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_SCHED_H
+#define RB_SCHED_H
+
+#include "common.h"
+
+#include <msp430.h>
+#include <stdint.h>
+
+/*
+ * Event loop of wireless-uart and main-fps. The sensors keep their
+ * duty cycle loops on timer_sleep_*() with the mode of each sleep.
+ * Armed timer events hold SCHED_LPM3, so TA0 keeps its clock.
+ */
+
+// Event bits posted by the interrupt handlers
+#define SCHED_EVENT_TIMER        (0x0001)   // timer event due, runs timer_run()
+#define SCHED_EVENT_RF_RX        (0x0002)   // packet received
+#define SCHED_EVENT_RF_TX        (0x0004)   // packet sent
+#define SCHED_EVENT_UART_RX      (0x0008)   // new bytes in UartRxBuffer
+#define SCHED_EVENT_ADC          (0x0010)   // ADC data or oversampling done
+#define SCHED_EVENT_I2C          (0x0020)   // I2C transfer done
+#define SCHED_EVENT_COMP         (0x0040)   // comparator edge
+#define SCHED_EVENT_LINK         (0x0080)   // link layer timeout, resend
+#define SCHED_EVENT_APP          (0x0100)   // first bit free for the firmware
+
+#define SCHED_EVENTS             (16)
+
+// Low power modes from the shallowest to the deepest
+typedef enum sched_lpm_t {
+  SCHED_LPM0 = 0,
+  SCHED_LPM1,
+  SCHED_LPM2,
+  SCHED_LPM3,
+  SCHED_LPM4,
+  SCHED_LPM_COUNT
+} sched_lpm_t;
+
+// Called from sched_run() in the main loop, runs to completion
+typedef void (*sched_handler_t)(void);
+
+void sched_init(void);
+void sched_set_handler(uint16_t event, sched_handler_t handler);
+void sched_post(uint16_t events);
+void sched_lpm_hold(sched_lpm_t lpm);
+void sched_lpm_release(sched_lpm_t lpm);
+uint16_t sched_lpm_bits(void);
+void sched_run(void);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
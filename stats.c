@@ -0,0 +1,138 @@
+/*
+ * Radio and UART link statistics
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "stats.h"
+#include "rf.h"
+#include "telemetry.h"
+
+#include <stdint.h>
+
+stats_t stats;
+
+/*
+ * Clear all the counters
+ */
+void stats_reset(void)
+{
+  uint8_t i;
+  unsigned char *p = (unsigned char *)&stats;
+
+  for (i = 0; i < sizeof(stats); ++i) {
+    p[i] = 0;
+  }
+}
+
+
+
+/*
+ * Count a received packet with the raw RSSI register value in the
+ * histogram
+ */
+void stats_rssi(unsigned char raw)
+{
+  int16_t dbm;
+  int16_t bin;
+
+  if (raw >= 128) {
+    dbm = (int16_t)raw - 256;
+  } else {
+    dbm = raw;
+  }
+  dbm = (dbm >> 1) - RF_RSSI_OFFSET;
+
+  bin = (dbm - STATS_RSSI_MIN_DBM) >> STATS_RSSI_BIN_SHIFT;
+  if (bin < 0) {
+    bin = 0;
+  } else if (bin >= STATS_RSSI_BINS) {
+    bin = STATS_RSSI_BINS - 1;
+  }
+
+  ++stats.rssi[bin];
+}
+
+
+
+/*
+ * Write the counters as telemetry records to buf. Returns the length,
+ * or 0 if buf is too short.
+ */
+uint8_t stats_report(unsigned char *buf, uint8_t max_len, uint8_t node_id)
+{
+  uint32_t values[STATS_VALUES > STATS_RSSI_BINS ? STATS_VALUES : STATS_RSSI_BINS];
+  telemetry_t t;
+  uint8_t len;
+  uint8_t rec_len;
+  uint8_t i;
+
+  values[0] = stats.rf_tx_packets;
+  values[1] = stats.rf_tx_bytes;
+  values[2] = stats.rf_rx_packets;
+  values[3] = stats.rf_rx_bytes;
+
+  telemetry_start(&t, buf, max_len, node_id);
+  telemetry_add(&t, TELEMETRY_TYPE_COUNTER, values, STATS_COUNTERS);
+
+  values[0] = stats.rf_rx_crc_errors;
+  values[1] = stats.rf_rx_overflows;
+  values[2] = stats.rf_rx_errors;
+  values[3] = stats.rf_tx_drops;
+  values[4] = stats.uart_rx_drops;
+  values[5] = stats.uart_tx_drops;
+  values[6] = stats.rf_tx_queue_max;
+  values[7] = stats.uart_rx_max;
+  values[8] = stats.uart_tx_max;
+  telemetry_add(&t, TELEMETRY_TYPE_STATS, values, STATS_VALUES);
+
+  len = telemetry_end(&t);
+  if (len == 0) {
+    return 0;
+  }
+
+  // The histogram in a record of its own keeps the decoded lines short
+  for (i = 0; i < STATS_RSSI_BINS; ++i) {
+    values[i] = stats.rssi[i];
+  }
+
+  telemetry_start(&t, &buf[len], max_len - len, node_id);
+  telemetry_add(&t, TELEMETRY_TYPE_RSSI, values, STATS_RSSI_BINS);
+  rec_len = telemetry_end(&t);
+  if (rec_len == 0) {
+    return 0;
+  }
+
+  return len + rec_len;
+}
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
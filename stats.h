@@ -0,0 +1,106 @@
+/*
+ * Radio and UART link statistics
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_STATS_H
+#define RB_STATS_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * Counters of the radio and UART traffic, the packets and bytes lost
+ * at each buffer and the highest fill level of the queues. 16 bit
+ * counters wrap around. stats_report() writes them as two telemetry
+ * records: TELEMETRY_TYPE_COUNTER and TELEMETRY_TYPE_STATS fields in
+ * the first, the TELEMETRY_TYPE_RSSI histogram in the second.
+ *
+ * Set RB_USE_STATS to 0 for the whole build to leave the counting out.
+ */
+#ifndef RB_USE_STATS
+#define RB_USE_STATS             1
+#endif
+
+// RSSI histogram of the received packets, 8 dB bins from -112 dBm,
+// the first and last ones are open ended
+#define STATS_RSSI_BINS          (8)
+#define STATS_RSSI_MIN_DBM       (-112)
+#define STATS_RSSI_BIN_SHIFT     (3)
+
+#define STATS_COUNTERS           (4)     // In the TELEMETRY_TYPE_COUNTER field
+#define STATS_VALUES             (9)     // In the TELEMETRY_TYPE_STATS field
+#define STATS_REPORT_LEN         (2 * 3 + 1 + STATS_COUNTERS * 4 + 1 + STATS_VALUES * 2 + 1 + STATS_RSSI_BINS * 2)
+
+typedef struct stats_t {
+  // TELEMETRY_TYPE_COUNTER, in this order
+  uint32_t rf_tx_packets;
+  uint32_t rf_tx_bytes;                  // Payload
+  uint32_t rf_rx_packets;                // CRC OK
+  uint32_t rf_rx_bytes;                  // Payload of the above
+
+  // TELEMETRY_TYPE_STATS, in this order
+  uint16_t rf_rx_crc_errors;
+  uint16_t rf_rx_overflows;              // RX FIFO or RfRxBuffer
+  uint16_t rf_rx_errors;                 // Bad length or radio state
+  uint16_t rf_tx_drops;                  // Bytes, RfTxQueue full
+  uint16_t uart_rx_drops;                // Bytes, UartRxBuffer full
+  uint16_t uart_tx_drops;                // Bytes, UartTxBuffer full
+  uint16_t rf_tx_queue_max;              // Highest fill levels in bytes
+  uint16_t uart_rx_max;
+  uint16_t uart_tx_max;
+
+  uint16_t rssi[STATS_RSSI_BINS];
+} stats_t;
+
+extern stats_t stats;
+
+void stats_reset(void);
+void stats_rssi(unsigned char raw);
+uint8_t stats_report(unsigned char *buf, uint8_t max_len, uint8_t node_id);
+
+#if RB_USE_STATS
+#define STATS_INC(field)         (++stats.field)
+#define STATS_ADD(field, n)      (stats.field += (n))
+#define STATS_MAX(field, value)  do { uint16_t v_ = (value); if (v_ > stats.field) stats.field = v_; } while (0)
+#define STATS_RSSI(raw)          stats_rssi(raw)
+#else
+#define STATS_INC(field)         ((void)0)
+#define STATS_ADD(field, n)      ((void)0)
+#define STATS_MAX(field, value)  ((void)0)
+#define STATS_RSSI(raw)          ((void)0)
+#endif
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,275 @@
+/*
+ * Compact binary telemetry records
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "telemetry.h"
+#include "fmt.h"
+
+// Sequence counter shared by all records sent from this node
+static uint8_t telemetry_seq = 0;
+
+/*
+ * Size in bytes of one value of the given field type, or 0 if unknown
+ */
+static uint8_t value_size(uint8_t type)
+{
+  switch (type) {
+  case TELEMETRY_TYPE_FLAGS:
+  case TELEMETRY_TYPE_REPORT:
+  case TELEMETRY_TYPE_DELTA:
+  case TELEMETRY_TYPE_PROFILE:
+    return 1;
+  case TELEMETRY_TYPE_BATTERY:
+  case TELEMETRY_TYPE_TEMP:
+  case TELEMETRY_TYPE_ADC:
+  case TELEMETRY_TYPE_AGE:
+  case TELEMETRY_TYPE_PHASE:
+  case TELEMETRY_TYPE_STATS:
+  case TELEMETRY_TYPE_RSSI:
+    return 2;
+  case TELEMETRY_TYPE_COUNTER:
+  case TELEMETRY_TYPE_LPM:
+  case TELEMETRY_TYPE_VCORE:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+
+
+/*
+ * Size in bytes of one value of a field type, 0 if it's not known
+ */
+uint8_t telemetry_value_size(uint8_t type)
+{
+  return value_size(type);
+}
+
+
+
+/*
+ * Start a new record into buf
+ */
+void telemetry_start(telemetry_t *t, unsigned char *buf, uint8_t max_len, uint8_t node_id)
+{
+  t->buf = buf;
+  t->max_len = max_len;
+  t->len = 0;
+  t->error = 0;
+
+  if (max_len < TELEMETRY_HEADER_LEN) {
+    t->error = 1;
+    return;
+  }
+
+  t->buf[t->len++] = TELEMETRY_MAGIC;
+  t->buf[t->len++] = node_id;
+  t->buf[t->len++] = telemetry_seq++;
+}
+
+
+
+/*
+ * Append a field with count values. The values are truncated to the
+ * size of the field type.
+ */
+void telemetry_add(telemetry_t *t, telemetry_type_t type, const uint32_t *values, uint8_t count)
+{
+  uint8_t size = value_size(type);
+  uint8_t i, b;
+
+  if (t->error || size == 0 || count == 0 || count > TELEMETRY_MAX_COUNT ||
+      t->len + 1 + size * count > t->max_len) {
+    t->error = 1;
+    return;
+  }
+
+  t->buf[t->len++] = (type << 4) | count;
+
+  for (i = 0; i < count; ++i) {
+    uint32_t value = values[i];
+    for (b = 0; b < size; ++b) {
+      t->buf[t->len++] = value & 0xff;
+      value >>= 8;
+    }
+  }
+}
+
+
+
+/*
+ * Append a field with a single value
+ */
+void telemetry_add_value(telemetry_t *t, telemetry_type_t type, uint32_t value)
+{
+  telemetry_add(t, type, &value, 1);
+}
+
+
+
+/*
+ * Finish the record. Returns the record length or 0 if it didn't fit
+ * the buffer.
+ */
+uint8_t telemetry_end(telemetry_t *t)
+{
+  if (t->error) {
+    return 0;
+  }
+
+  return t->len;
+}
+
+
+
+/*
+ * Continue a finished record of len bytes at buf, e.g. to append
+ * fields when it's sent
+ */
+void telemetry_resume(telemetry_t *t, unsigned char *buf, uint8_t max_len, uint8_t len)
+{
+  t->buf = buf;
+  t->max_len = max_len;
+  t->len = len;
+  t->error = (len < TELEMETRY_HEADER_LEN || len > max_len);
+}
+
+
+
+/*
+ * Length of the first record in rec, which may be followed by more
+ * records. Returns 0 if it's not a valid record.
+ */
+uint8_t telemetry_record_len(const unsigned char *rec, uint8_t len)
+{
+  uint8_t i = TELEMETRY_HEADER_LEN;
+
+  if (len < TELEMETRY_HEADER_LEN || rec[0] != TELEMETRY_MAGIC) {
+    return 0;
+  }
+
+  while (i < len && rec[i] != TELEMETRY_MAGIC) {
+    uint8_t size = value_size(rec[i] >> 4);
+    uint16_t end = i + 1 + size * (rec[i] & 0x0f);
+
+    if (size == 0 || end > len) {
+      return 0;
+    }
+    i = end;
+  }
+
+  return i;
+}
+
+
+
+/*
+ * Decode a record into a human readable line, e.g.
+ * "N:1 S:23 B:2345 T:+23.50 A:1,2,3". Returns the length of the string
+ * (without \r\n) or 0 if rec is not a valid record or str is too short.
+ */
+uint8_t telemetry_decode(const unsigned char *rec, uint8_t len, unsigned char *str, uint8_t max_len)
+{
+  static const char prefix[] = "?BTACFGPLVERKDM";
+  uint8_t i = TELEMETRY_HEADER_LEN;
+  uint8_t out = 0;
+
+  if (len < TELEMETRY_HEADER_LEN || rec[0] != TELEMETRY_MAGIC || max_len < 16) {
+    return 0;
+  }
+
+  str[out++] = 'N';
+  str[out++] = ':';
+  out += fmt_u16(rec[1], &str[out], max_len - out);
+  str[out++] = ' ';
+  str[out++] = 'S';
+  str[out++] = ':';
+  out += fmt_u16(rec[2], &str[out], max_len - out);
+
+  while (i < len) {
+    uint8_t type = rec[i] >> 4;
+    uint8_t count = rec[i] & 0x0f;
+    uint8_t size = value_size(type);
+    uint8_t v, b;
+
+    ++i;
+    if (size == 0 || i + size * count > len) {
+      return 0;
+    }
+
+    if (out + 3 > max_len) {
+      return 0;
+    }
+    str[out++] = ' ';
+    str[out++] = prefix[type];
+    str[out++] = ':';
+
+    for (v = 0; v < count; ++v) {
+      uint32_t value = 0;
+      uint8_t n;
+
+      for (b = 0; b < size; ++b) {
+        value |= (uint32_t)rec[i++] << (8 * b);
+      }
+
+      // Space for the separator and at least one digit with \0
+      if (out + 3 > max_len) {
+        return 0;
+      }
+
+      if (v > 0) {
+        str[out++] = ',';
+      }
+
+      if (type == TELEMETRY_TYPE_TEMP) {
+        n = fmt_q8_8((int16_t)value, &str[out], max_len - out);
+      } else if (type == TELEMETRY_TYPE_DELTA) {
+        n = fmt_i32((int8_t)value, &str[out], max_len - out);
+      } else {
+        n = fmt_u32(value, &str[out], max_len - out);
+      }
+
+      if (n == 0) {
+        return 0;
+      }
+      out += n;
+    }
+  }
+
+  return out;
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,91 @@
+/*
+ * Compact binary telemetry records
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_TELEMETRY_H
+#define RB_TELEMETRY_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * Record layout:
+ *   [TELEMETRY_MAGIC][node id][sequence] followed by fields
+ *   [type << 4 | count][count values, LSB first]
+ *
+ * The size of a value is implied by the field type. A packet may carry
+ * several records back to back, a new one starts at TELEMETRY_MAGIC
+ * in place of a field.
+ */
+#define TELEMETRY_MAGIC          (0xFE)
+#define TELEMETRY_HEADER_LEN     (3)
+#define TELEMETRY_MAX_COUNT      (15)
+#define TELEMETRY_TEXT_LEN       (128)   // Enough for a typical decoded record
+
+typedef enum telemetry_type_t {
+  TELEMETRY_TYPE_BATTERY = 1,   // uint16_t, raw ADC of (AVCC - AVSS) / 2
+  TELEMETRY_TYPE_TEMP,          // int16_t, raw TMP275 value (1/256 C)
+  TELEMETRY_TYPE_ADC,           // uint16_t, raw ADC
+  TELEMETRY_TYPE_COUNTER,       // uint32_t
+  TELEMETRY_TYPE_FLAGS,         // uint8_t
+  TELEMETRY_TYPE_AGE,           // uint16_t, seconds since the reading, 0 if left out
+  TELEMETRY_TYPE_PHASE,         // uint16_t, profiled phase, count, min, max, avg (prof.h)
+  TELEMETRY_TYPE_LPM,           // uint32_t, ticks active and in LPM0 to LPM4 (prof.h)
+  TELEMETRY_TYPE_VCORE,         // uint32_t, ticks at each VCore level (prof.h)
+  TELEMETRY_TYPE_STATS,         // uint16_t, link errors, drops and queue maximums (stats.h)
+  TELEMETRY_TYPE_RSSI,          // uint16_t, RSSI histogram of received packets (stats.h)
+  TELEMETRY_TYPE_REPORT,        // uint8_t, number of a change based report (report.h)
+  TELEMETRY_TYPE_DELTA,         // int8_t, changes since the previous report (report.h)
+  TELEMETRY_TYPE_PROFILE        // uint8_t, modem profile switch step and profile (wireless-uart.c)
+} telemetry_type_t;
+
+typedef struct telemetry_t {
+  unsigned char *buf;
+  uint8_t max_len;
+  uint8_t len;
+  uint8_t error;
+} telemetry_t;
+
+uint8_t telemetry_value_size(uint8_t type);
+void telemetry_start(telemetry_t *t, unsigned char *buf, uint8_t max_len, uint8_t node_id);
+void telemetry_add(telemetry_t *t, telemetry_type_t type, const uint32_t *values, uint8_t count);
+void telemetry_add_value(telemetry_t *t, telemetry_type_t type, uint32_t value);
+uint8_t telemetry_end(telemetry_t *t);
+void telemetry_resume(telemetry_t *t, unsigned char *buf, uint8_t max_len, uint8_t len);
+uint8_t telemetry_record_len(const unsigned char *rec, uint8_t len);
+uint8_t telemetry_decode(const unsigned char *rec, uint8_t len, unsigned char *str, uint8_t max_len);
+
+#endif
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -27,100 +27,489 @@
  */
 
 #include "timer.h"
+#include "clock.h"
+#include "prof.h"
+#include "sched.h"
 #include "utils.h"
 
-static volatile uint16_t timer_repeats = 0;
-volatile uint8_t timer_occurred = 0;
+static timer_handler_t timer_poll_handler = 0;
+static uint16_t timer_poll_ticks = 0;
+
+static volatile uint8_t timer_wait_expired = 0;
+
+// Armed events sorted by deadline, TA0 overflows for the upper 16 bits
+static timer_event_t *timer_events = 0;
+static volatile uint16_t timer_overflows = 0;
+static volatile uint8_t timer_due = 0;
+
+// SCHED_LPM3 held while an event is armed, LPM4 would stop ACLK and TA0
+static uint8_t timer_lpm_held = 0;
+
+
 
 /*
- * Timeout, repeat timer_repeats times, then wake up from sleep
+ * 32 bit tick count, interrupts must be disabled
  */
-__attribute__((interrupt(TIMER1_A0_VECTOR)))
-void TIMER1_A0_ISR(void)
+static uint32_t timer_ticks(void)
 {
+  uint16_t hi = timer_overflows;
+  uint16_t lo, check;
 
-  if (timer_repeats > 0) {
-    --timer_repeats;
-    return;
+  // TA0 runs from ACLK, read until stable
+  do {
+    lo = TA0R;
+    check = TA0R;
+  } while (lo != check);
+
+  // Overflow not yet handled
+  if ((TA0CTL & TAIFG) && lo < 0x8000) {
+    ++hi;
   }
 
-  timer_clear();
-#if SC_USE_SLEEP == 1
-  // Exit from lower power mode
-  // Clearing all LPM4 bits should be fine even if we are only in LPM0
-  __bic_status_register_on_exit(LPM4_bits);
-#endif
-  timer_occurred = 1;
+  return ((uint32_t)hi << 16) | lo;
 }
 
 
 
+/*
+ * Insert the event in deadline order, interrupts must be disabled
+ */
+static void timer_insert(timer_event_t *e)
+{
+  timer_event_t **p = &timer_events;
+
+  while (*p && (int32_t)((*p)->deadline - e->deadline) <= 0) {
+    p = &(*p)->next;
+  }
+
+  e->next = *p;
+  *p = e;
+  e->active = 1;
+}
+
 
 
 /*
- * Set timer to raise an interrupt after ms milliseconds
- * NOTE: this assumes timer_repeats has already been set!
+ * Take or release the low power mode hold of the armed events,
+ * interrupts must be disabled
  */
-void timer_set(int ms)
+static void timer_lpm_update(void)
 {
-  if (ms > 16000) {
-    ms = 16000;
+  if (timer_events && !timer_lpm_held) {
+    sched_lpm_hold(SCHED_LPM3);
+    timer_lpm_held = 1;
+  } else if (!timer_events && timer_lpm_held) {
+    sched_lpm_release(SCHED_LPM3);
+    timer_lpm_held = 0;
   }
+}
+
+
+
+/*
+ * Remove the event if armed, interrupts must be disabled
+ */
+static void timer_remove(timer_event_t *e)
+{
+  timer_event_t **p = &timer_events;
 
-  timer_occurred = 0;
-  TA1CCR0  = ms << 0;                       // ms milliseconds
-  TA1CTL = TASSEL_1 + MC_1 + ID_3;          // ACLK/8, upmode
-  TA1CCTL0 = CCIE;                          // CCR0 interrupt enabled
+  while (*p && *p != e) {
+    p = &(*p)->next;
+  }
+
+  if (*p) {
+    *p = e->next;
+  }
+
+  e->next = 0;
+  e->active = 0;
 }
 
 
 
 /*
- * Set timer to raise an interrupt after ms milliseconds
+ * Program TA0 CCR3 for the nearest deadline, interrupts must be
+ * disabled. Deadlines beyond the current 16 bit round are armed from
+ * the overflow interrupt, so a long sleep doesn't wake up the main loop.
  */
-void timer_clear(void)
+static void timer_program(void)
 {
-  // Clear timer register, disable timer interrupts
-  timer_occurred = 0;
-  timer_repeats = 0;
-  TA1CCTL0 = 0;                             // CCR0 interrupt disabled
-  TA1CTL = TACLR;
+  int32_t diff;
+
+  TA0CCTL3 = 0;
+
+  if (!timer_events) {
+    return;
+  }
+
+  diff = (int32_t)(timer_events->deadline - timer_ticks());
+
+  if (diff < TIMER_MIN_TICKS) {
+    timer_due = 1;
+    sched_post(SCHED_EVENT_TIMER);
+  } else if (diff <= 0xFFFF) {
+    TA0CCR3 = (uint16_t)timer_events->deadline;
+    TA0CCTL3 = CCIE;                        // CCR3 interrupt enabled
+  }
 }
 
 
 
 /*
- * Block in low power mode for ms milliseconds
+ * Current time in TA0 ticks, 32 bits
  */
-void timer_sleep_ms(uint16_t ms, uint32_t mode)
+uint32_t timer_now(void)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+  uint32_t now;
+
+  timer_stamp_start();
+
+  __bic_status_register(GIE);
+  now = timer_ticks();
+  __bis_status_register(gie);
+
+  return now;
+}
+
+
+
+/*
+ * TA0 ticks in ms milliseconds at the ACLK of the clock profile,
+ * rounded up so that a timeout is never shorter than asked
+ */
+uint32_t timer_ms_to_ticks(uint32_t ms)
+{
+  uint32_t hz = clock_aclk_hz() / TIMER_ACLK_DIV;
+
+  return (ms / 1000) * hz + ((ms % 1000) * hz + 999) / 1000;
+}
+
+
+
+/*
+ * TA0 ticks in us microseconds, rounded up like timer_ms_to_ticks().
+ * A wait from timer_now() needs one more for the current tick.
+ */
+uint32_t timer_us_to_ticks(uint32_t us)
+{
+  uint32_t hz = clock_aclk_hz() / TIMER_ACLK_DIV;
+
+  // hz is at most 4096, so the remainder times hz fits 32 bits
+  return (us / 1000000UL) * hz + ((us % 1000000UL) * hz + 999999UL) / 1000000UL;
+}
+
+
+
+/*
+ * Milliseconds in ticks TA0 ticks at the ACLK of the clock profile
+ */
+uint32_t timer_ticks_to_ms(uint32_t ticks)
+{
+  uint32_t hz = clock_aclk_hz() / TIMER_ACLK_DIV;
+
+  return (ticks / hz) * 1000 + (ticks % hz) * 1000 / hz;
+}
+
+
+
+/*
+ * Arm the event to expire after ticks, and then every period ticks if
+ * period is non-zero. The callback, if any, is called from
+ * timer_run(). Re-arms an already armed event.
+ */
+void timer_event_start(timer_event_t *e, uint32_t ticks, uint32_t period,
+                       timer_callback_t callback)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+
+  timer_stamp_start();
+
+  __bic_status_register(GIE);
+  timer_remove(e);
+  e->deadline = timer_ticks() + ticks;
+  e->period = period;
+  e->callback = callback;
+  timer_insert(e);
+  timer_program();
+  timer_lpm_update();
+  __bis_status_register(gie);
+}
+
+
+
+/*
+ * Disarm the event
+ */
+void timer_event_stop(timer_event_t *e)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+
+  __bic_status_register(GIE);
+  timer_remove(e);
+  timer_program();
+  timer_lpm_update();
+  __bis_status_register(gie);
+}
+
+
+
+/*
+ * Call the callbacks of the expired events, from the main loop.
+ * Callbacks must not sleep.
+ */
+void timer_run(void)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+  timer_event_t *e;
+  uint32_t now;
+
+  __bic_status_register(GIE);
+  timer_due = 0;
+  now = timer_ticks();
+
+  while ((e = timer_events) && (int32_t)(e->deadline - now) <= 0) {
+    timer_callback_t callback = e->callback;
+
+    timer_remove(e);
+
+    if (e->period) {
+      e->deadline += e->period;
+      // Skip the missed periods instead of catching up
+      if ((int32_t)(e->deadline - now) <= 0) {
+        e->deadline = now + e->period;
+      }
+      timer_insert(e);
+    }
+
+    if (callback) {
+      __bis_status_register(gie);
+      callback();
+      __bic_status_register(GIE);
+      now = timer_ticks();
+    }
+  }
+
+  timer_program();
+  timer_lpm_update();
+  __bis_status_register(gie);
+}
+
+
+
+/*
+ * Block in low power mode for ticks, running timer_run() on wake ups
+ */
+static void timer_sleep_ticks(uint32_t ticks, uint32_t mode)
 {
 #if SC_USE_SLEEP == 1
-  timer_repeats = 0;
-  timer_set(ms);
-  __bis_status_register(mode + GIE);
+  timer_event_t sleep = {0};
+
+  timer_event_start(&sleep, ticks, 0, 0);
+
+  while (sleep.active) {
+    // Check and sleep atomically so that a wake up isn't missed
+    __bic_status_register(GIE);
+    if (!timer_due) {
+      PROF_LPM_ENTER(mode);
+      __bis_status_register(mode + GIE);
+      PROF_LPM_EXIT();
+    }
+    __bis_status_register(GIE);
+    timer_run();
+  }
 #else
-  busysleep_ms(ms);
+  uint32_t left = timer_ticks_to_ms(ticks);
+
+  while (left > 0) {
+    uint16_t ms = left > 10000 ? 10000 : left;
+    busysleep_ms(ms);
+    left -= ms;
+  }
 #endif
 }
 
 
 
 /*
- * Block in low poewr mode for min minutes
+ * Block in low power mode until the timer_now() deadline, returns
+ * right away if already passed
+ */
+void timer_sleep_until(uint32_t deadline, uint32_t mode)
+{
+  int32_t ticks = (int32_t)(deadline - timer_now());
+
+  if (ticks > 0) {
+    timer_sleep_ticks(ticks, mode);
+  }
+}
+
+
+
+/*
+ * Block in low power mode for ms milliseconds
+ */
+void timer_sleep_ms(uint16_t ms, uint32_t mode)
+{
+  timer_sleep_ticks(timer_ms_to_ticks(ms), mode);
+}
+
+
+
+/*
+ * Block in low power mode for min minutes, without waking up in between
  */
 void timer_sleep_min(uint16_t min, uint32_t mode)
+{
+  timer_sleep_ticks(timer_ms_to_ticks((uint32_t)min * 60000), mode);
+}
+
+
+
+/*
+ * Start free running TA0 for timestamps, ACLK/8. The overflow interrupt
+ * counts the upper bits of timer_now(). Does nothing if already running.
+ */
+void timer_stamp_start(void)
+{
+  if ((TA0CTL & MC_3) == 0) {
+    TA0CTL = TASSEL_1 + MC_2 + ID_3 + TACLR + TAIE; // ACLK/8, continuous mode
+  }
+}
+
+
+
+/*
+ * Current timestamp in TA0 ticks, wraps around at 16 bits
+ */
+uint16_t timer_stamp(void)
+{
+  return TA0R;
+}
+
+
+
+/*
+ * Call handler from TA0 CCR1 interrupt every ticks TA0 ticks. Starts
+ * TA0, if not already running.
+ */
+void timer_poll_start(uint16_t ticks, timer_handler_t handler)
+{
+  timer_stamp_start();
+
+  timer_poll_handler = handler;
+  timer_poll_ticks = ticks;
+  TA0CCR1 = TA0R + ticks;
+  TA0CCTL1 = CCIE;                          // CCR1 interrupt enabled
+}
+
+
+
+/*
+ * Stop calling the poll handler
+ */
+void timer_poll_stop(void)
+{
+  TA0CCTL1 = 0;                             // CCR1 interrupt disabled
+  timer_poll_handler = 0;
+}
+
+
+
+/*
+ * Sleep in low power mode while *busy is set, at most ms milliseconds,
+ * up to 0xFFFF ticks (16 s with XT1 or REFO). The interrupt handler
+ * clearing *busy must also exit the low power mode. Returns 1 if *busy
+ * was cleared, 0 on timeout.
+ */
+uint8_t timer_wait_while(volatile uint8_t *busy, uint16_t ms, uint32_t mode)
 {
 #if SC_USE_SLEEP == 1
-  // Repeat 10sec sleep 6*min times.
-  timer_repeats = 6 * min;
-  timer_set(10000); // sleep 10 sec timer_repeats times
-  __bis_status_register(mode + GIE);
+  unsigned int gie = __get_SR_register() & GIE;
+  uint32_t ticks;
+
+  if (ms == 0 || !*busy) {
+    return !*busy;
+  }
+
+  ticks = timer_ms_to_ticks(ms);
+  if (ticks > 0xFFFF) {
+    ticks = 0xFFFF;
+  }
+
+  timer_stamp_start();
+
+  // Check and sleep atomically so that a wake up isn't missed
+  __bic_status_register(GIE);
+  timer_wait_expired = 0;
+  TA0CCR2 = TA0R + (uint16_t)ticks;
+  TA0CCTL2 = CCIE;                          // CCR2 interrupt enabled
+
+  while (*busy && !timer_wait_expired) {
+    PROF_LPM_ENTER(mode);
+    __bis_status_register(mode + GIE);
+    PROF_LPM_EXIT();
+    __bic_status_register(GIE);
+  }
+
+  TA0CCTL2 = 0;                             // CCR2 interrupt disabled
+  __bis_status_register(gie);
 #else
-  int i;
-  for (i = 0; i < 6 * min; ++i) {
-    busysleep_ms(10000);
+  while (*busy && ms-- > 0) {
+    busysleep_ms(1);
   }
 #endif
+
+  return !*busy;
+}
+
+
+
+/*
+ * Periodic poll and waits, wake up from sleep if needed
+ */
+__attribute__((interrupt(TIMER0_A1_VECTOR)))
+void TIMER0_A1_ISR(void)
+{
+  switch (TA0IV) {
+  case 2:                                   // CCR1
+    TA0CCR1 += timer_poll_ticks;
+    if (timer_poll_handler && timer_poll_handler()) {
+#if SC_USE_SLEEP == 1
+      __bic_status_register_on_exit(LPM4_bits);
+#endif
+    }
+    break;
+  case 4:                                   // CCR2
+    TA0CCTL2 = 0;
+    timer_wait_expired = 1;
+#if SC_USE_SLEEP == 1
+    __bic_status_register_on_exit(LPM4_bits);
+#endif
+    break;
+  case 6:                                   // CCR3
+    TA0CCTL3 = 0;
+    timer_due = 1;
+    sched_post(SCHED_EVENT_TIMER);
+#if SC_USE_SLEEP == 1
+    __bic_status_register_on_exit(LPM4_bits);
+#endif
+    break;
+  case 14:                                  // Overflow
+    ++timer_overflows;
+    // Arm CCR3 once the nearest deadline is within this round
+    if (timer_events && !(TA0CCTL3 & CCIE)) {
+      timer_program();
+#if SC_USE_SLEEP == 1
+      if (timer_due) {
+        __bic_status_register_on_exit(LPM4_bits);
+      }
+#endif
+    }
+    break;
+  default:
+    break;
+  }
 }
 
 /* Emacs indentatation information
@@ -34,11 +34,42 @@
 #include <msp430.h>
 #include <stdint.h>
 
-extern volatile uint8_t timer_occurred;
+// Deadlines closer than this are handled as already expired
+#define TIMER_MIN_TICKS          2
 
+// TA0 runs from ACLK/8, so a tick is 244us with XT1 or REFO and about
+// 0.85ms with VLO. Convert milliseconds with timer_ms_to_ticks().
+#define TIMER_ACLK_DIV           8
+
+// Called from timer interrupt, return non-zero to wake up the main loop
+typedef uint8_t (*timer_handler_t)(void);
+
+// Called from timer_run() in the main loop
+typedef void (*timer_callback_t)(void);
+
+typedef struct timer_event_t {
+  uint32_t deadline;
+  uint32_t period;
+  timer_callback_t callback;
+  struct timer_event_t *next;
+  volatile uint8_t active;
+} timer_event_t;
+
+uint32_t timer_now(void);
+uint32_t timer_ms_to_ticks(uint32_t ms);
+uint32_t timer_us_to_ticks(uint32_t us);
+uint32_t timer_ticks_to_ms(uint32_t ticks);
+void timer_event_start(timer_event_t *e, uint32_t ticks, uint32_t period,
+                       timer_callback_t callback);
+void timer_event_stop(timer_event_t *e);
+void timer_run(void);
 void timer_sleep_ms(uint16_t ms, uint32_t mode);
 void timer_sleep_min(uint16_t min, uint32_t mode);
-void timer_set(int ms);
-void timer_clear(void);
+void timer_sleep_until(uint32_t deadline, uint32_t mode);
+void timer_stamp_start(void);
+uint16_t timer_stamp(void);
+void timer_poll_start(uint16_t ticks, timer_handler_t handler);
+void timer_poll_stop(void);
+uint8_t timer_wait_while(volatile uint8_t *busy, uint16_t ms, uint32_t mode);
 
 #endif
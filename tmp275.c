@@ -30,7 +30,10 @@
 #include "tmp275.h"
 #include "i2c.h"
 
-void tmp275_start_oneshot(void)
+/*
+ * Start one temperature conversion, the TMP275 shuts down after it
+ */
+i2c_result_t tmp275_start_oneshot(void)
 {
     unsigned char tx_data[2];
 
@@ -46,17 +49,15 @@ void tmp275_start_oneshot(void)
        One-shot: 1
     */
     tx_data[1] = 0b11100001;
-    i2c_send(tx_data, 2);
+    return i2c_write(TMP275_ADDRESS, tx_data, 2);
+}
 
-    // FIXME: move out side this function?
-    __delay_cycles(50);                    // Delay required between transaction
 
-    /* Set pointer to temperature register here so we can read without writing */
-    tx_data[0] = 0x0;
-    i2c_send(tx_data, 1);
-}
 
-void tmp275_shutdown(void)
+/*
+ * Shutdown the TMP275
+ */
+i2c_result_t tmp275_shutdown(void)
 {
     unsigned char tx_data[2];
 
@@ -72,14 +73,35 @@ void tmp275_shutdown(void)
        One-shot: 0
     */
     tx_data[1] = 0b01100001;
-    i2c_send(tx_data, 2);
+    return i2c_write(TMP275_ADDRESS, tx_data, 2);
+}
+
+
+
+/*
+ * Read the raw temperature register, 1/256 degrees Celsius. Left
+ * untouched on error, e.g. if the sensor is missing.
+ */
+i2c_result_t tmp275_read(uint16_t *raw)
+{
+    const unsigned char pointer = 0x0;      /* Temperature register */
+    unsigned char rx_data[2];
+    i2c_xfer_t x = {0};
+    i2c_result_t result;
+
+    x.addr = TMP275_ADDRESS;
+    x.tx = &pointer;
+    x.tx_len = 1;
+    x.rx = rx_data;
+    x.rx_len = 2;
 
-    // FIXME: move out side this function?
-    __delay_cycles(50);                    // Delay required between transaction
+    i2c_submit(&x);
+    result = i2c_wait(&x, I2C_TIMEOUT_MS, LPM0_bits);
+    if (result == I2C_OK) {
+        *raw = (rx_data[0] << 8) | rx_data[1];
+    }
 
-    /* Set pointer to temperature register here so we can read without writing */
-    tx_data[0] = 0x0;
-    i2c_send(tx_data, 1);
+    return result;
 }
 
 
@@ -30,8 +30,17 @@
 #define RB_TMP275_H
 
 #include "common.h"
+#include "i2c.h"
 
-void tmp275_start_oneshot(void);
-void tmp275_shutdown(void);
+#include <stdint.h>
+
+// One shot conversion time at 12 bits
+#define TMP275_CONVERSION_MS     220
+
+#define TMP275_ADDRESS           0x4F
+
+i2c_result_t tmp275_start_oneshot(void);
+i2c_result_t tmp275_shutdown(void);
+i2c_result_t tmp275_read(uint16_t *raw);
 
 #endif
@@ -27,15 +27,20 @@
  */
 
 #include "uart.h"
+#include "clock.h"
+#include "dma.h"
+#include "pktbuf.h"
+#include "timer.h"
+#include "sched.h"
+#include "stats.h"
 
 // Buffer for incoming data from UART
-volatile unsigned char UartRxBuffer[UART_BUF_LEN];
-volatile unsigned char UartRxBuffer_i = 0;
+static volatile unsigned char UartRxBufferData[UART_BUF_LEN];
+ringbuf_t UartRxBuffer;
 
 // Buffer for outoing data over UART
-volatile unsigned char UartTxBuffer[UART_BUF_LEN];
-volatile unsigned char UartTxBuffer_i = 0;
-volatile unsigned char UartTxBufferLength = 0;
+static volatile unsigned char UartTxBufferData[UART_TX_BUF_LEN];
+ringbuf_t UartTxBuffer;
 volatile unsigned char uart_rx_timeout = 0;
 
 typedef enum uart_state_t {
@@ -43,22 +48,100 @@ typedef enum uart_state_t {
   UART_STATE_TX,
 } uart_state_t;
 
-static uart_state_t uart_state = UART_STATE_IDLE;
+static volatile uart_state_t uart_state = UART_STATE_IDLE;
+static uart_mode_t uart_mode = UART_MODE_IRQ;
+static uint32_t uart_baudrate = UART_DEFAULT_BAUDRATE;
+static uint8_t uart_flow = 0;
+static volatile uint8_t uart_rts_off = 0;
+
+// Packet buffer slots to send, oldest at the head. Each goes out after
+// the bytes that were in UartTxBuffer before it was queued.
+typedef struct uart_tx_pkt_t {
+  uint8_t slot;
+  volatile unsigned char *data;
+  uint16_t len;
+  uint16_t before;                                  // UartTxBuffer bytes first
+} uart_tx_pkt_t;
+
+static volatile uart_tx_pkt_t uart_tx_pkts[PKTBUF_COUNT];
+static volatile uint8_t uart_tx_pkt_head = 0;
+static volatile uint8_t uart_tx_pkt_count = 0;
+static volatile uint16_t uart_tx_pkt_before = 0;    // Sum in the queue
+static volatile uint16_t uart_tx_pkt_sent = 0;      // Of the head
+
+// Bytes in the DMA transfer currently being sent, from a slot or not
+static volatile uint16_t uart_dma_tx_len = 0;
+static volatile uint8_t uart_dma_tx_pkt = 0;
+
+// Set by the RX DMA poll when the DMA has written over unread bytes
+static volatile uint8_t uart_dma_rx_overrun = 0;
 
 static void handle_uart_rx_byte(void);
+static void uart_rts_update(void);
+static void uart_tx_pkt_done(void);
+static void uart_tx_buffer_sent(uint16_t len);
+static void uart_dma_init(void);
+static void uart_dma_start_tx(void);
+static uint8_t uart_dma_tx_done(void);
+static uint8_t uart_dma_rx_poll(void);
 
 /*
- * Map P1.5 & P1.6 to Uart TX and RX and initialise Uart as 115200 8N1
- * with interrupts enabled
+ * Set the baud rate used by the next uart_init()
  */
-void uart_init(void)
+void uart_set_baudrate(uint32_t baud)
 {
-  UartTxBuffer_i = 0;
-  UartTxBufferLength = 0;
+  uart_baudrate = baud;
+}
+
+
+
+/*
+ * Enable or disable RTS/CTS flow control from the next uart_init()
+ */
+void uart_set_flow_control(uint8_t enable)
+{
+  uart_flow = enable;
+}
+
+
+
+/*
+ * Map P1.5 & P1.6 to Uart TX and RX and initialise Uart as 8N1 at the
+ * set baud rate with interrupts or DMA. The dividers come from the
+ * SMCLK of the clock profile. With flow control RTS is asserted and
+ * CTS interrupts on its falling edge.
+ */
+void uart_init(uart_mode_t mode)
+{
+  // Divider N = SMCLK / baud in eighths, the integer part to UCBRx and
+  // the fraction to UCBRSx (low-frequency mode, see User's Guide)
+  uint32_t n8 = (clock_smclk_hz() * 8 + uart_baudrate / 2) / uart_baudrate;
+
+  while (uart_tx_pkt_count > 0) {
+    uart_tx_pkt_done();
+  }
+  uart_tx_pkt_before = 0;
+  uart_tx_pkt_sent = 0;
+
+  ringbuf_init(&UartTxBuffer, UartTxBufferData, UART_TX_BUF_LEN);
+  ringbuf_init(&UartRxBuffer, UartRxBufferData, UART_BUF_LEN);
   uart_rx_timeout = 0;
   uart_state = UART_STATE_IDLE;
-
-  UartRxBuffer_i = 0;
+  uart_mode = mode;
+  uart_rts_off = 0;
+
+  if (uart_flow) {
+    UART_RTS_POUT &= ~UART_RTS_BIT;         // Ready to receive
+    UART_RTS_PDIR |= UART_RTS_BIT;
+
+    // Pulled down, an unconnected CTS doesn't block TX
+    UART_CTS_PDIR &= ~UART_CTS_BIT;
+    UART_CTS_POUT &= ~UART_CTS_BIT;
+    UART_CTS_PREN |= UART_CTS_BIT;
+    UART_CTS_PIES |= UART_CTS_BIT;          // High to low, CTS asserted
+    UART_CTS_PIFG &= ~UART_CTS_BIT;
+    UART_CTS_PIE |= UART_CTS_BIT;
+  }
 
   PMAPPWD = 0x02D52;                        // Get write-access to port mapping regs
   P1MAP5 = PM_UCA0RXD;                      // Map UCA0RXD output to P1.6
@@ -70,10 +153,20 @@ void uart_init(void)
 
   UCA0CTL1 |= UCSWRST;                      // **Put state machine in reset**
   UCA0CTL1 |= UCSSEL_2;                     // SMCLK
-  UCA0BR0 = 9;                              // 1MHz 115200 (see User's Guide)
-  UCA0BR1 = 0;                              // 1MHz 115200
-  UCA0MCTL |= UCBRS_1 + UCBRF_0;            // Modulation UCBRSx=1, UCBRFx=0
+  UCA0BR0 = (n8 >> 3) & 0xff;
+  UCA0BR1 = (n8 >> 11) & 0xff;
+  UCA0MCTL = (n8 & 0x07) << 1;              // Modulation UCBRSx, UCBRFx=0
   UCA0CTL1 &= ~UCSWRST;                     // **Initialize USCI state machine**
+
+  // Receiving needs SMCLK running, sleep at most in LPM0
+  sched_lpm_hold(SCHED_LPM0);
+
+  if (uart_mode == UART_MODE_DMA) {
+    // The flags trigger DMA instead of interrupts
+    uart_dma_init();
+    return;
+  }
+
   UCA0IE |= UCRXIE;                         // Enable USCI_A0 RX interrupt
   UCA0IE |= UCTXIE;                         // Enable USCI_A0 TX interrupt
 }
@@ -91,27 +184,46 @@ void USCI_A0_ISR(void)
   case 0: break;                            // Vector 0 - no interrupt
   case 2:                                   // Vector 2 - RXIFG
     handle_uart_rx_byte();
+    sched_post(SCHED_EVENT_UART_RX);
 #if SC_USE_SLEEP == 1
     // Exit active
     __bic_status_register_on_exit(LPM3_bits);
 #endif
     break;
   case 4:                                   // Vector 4 - TXIFG
-    if (UartTxBufferLength == 0) {          // Spurious interrupt (or a workaround for a bug)?
+    if (uart_state != UART_STATE_TX) {      // Spurious interrupt (or a workaround for a bug)?
       return;
     }
 
-    if (++UartTxBuffer_i == UartTxBufferLength) { // All data sent?
-      UartTxBuffer_i = 0;                   // Clear the Uart TX buffers
-      UartTxBufferLength = 0;
+    // Paused until CTS is asserted again, see PORT2_ISR
+    if (uart_flow && (UART_CTS_PIN & UART_CTS_BIT)) {
       uart_state = UART_STATE_IDLE;
       return;
     }
 
-    // More data to be sent to Uart
-    //while (!(UCA0IFG&UCTXIFG));             // USCI_A0 TX buffer ready? (should be always in here??)
-    UCA0TXBUF = UartTxBuffer[UartTxBuffer_i]; // Send a byte
-
+    {
+      unsigned char c;
+
+      // In the order queued, each slot as a whole
+      if ((uart_tx_pkt_count == 0 || uart_tx_pkts[uart_tx_pkt_head].before > 0) &&
+          ringbuf_get(&UartTxBuffer, &c)) {
+        uart_tx_buffer_sent(1);
+      } else {
+        if (uart_tx_pkt_count == 0) {       // All data sent?
+          uart_state = UART_STATE_IDLE;
+          return;
+        }
+
+        c = uart_tx_pkts[uart_tx_pkt_head].data[uart_tx_pkt_sent++];
+        if (uart_tx_pkt_sent == uart_tx_pkts[uart_tx_pkt_head].len) {
+          uart_tx_pkt_sent = 0;
+          uart_tx_pkt_done();
+        }
+      }
+
+      // More data to be sent to Uart
+      UCA0TXBUF = c;                        // Send a byte
+    }
     break;
   default: break;
   }
@@ -119,49 +231,155 @@ void USCI_A0_ISR(void)
 
 
 
+/*
+ * CTS asserted, resume sending
+ */
+__attribute__((interrupt(PORT2_VECTOR)))
+void PORT2_ISR(void)
+{
+  if (UART_CTS_PIFG & UART_CTS_BIT) {
+    UART_CTS_PIFG &= ~UART_CTS_BIT;
+    uart_send_next_msg();
+  }
+}
+
+
+
+/*
+ * Read up to len bytes received from the UART. Asserts RTS again once
+ * the buffer has drained below the low watermark.
+ */
+uint16_t uart_read(unsigned char *buf, uint16_t len)
+{
+  unsigned int gie;
+
+  // The unread bytes are a mix of old and new after an RX DMA overrun,
+  // drop all of them up to where the overrun was seen
+  if (uart_dma_rx_overrun) {
+    uint16_t lost = ringbuf_len(&UartRxBuffer);
+
+    uart_dma_rx_overrun = 0;
+    ringbuf_skip(&UartRxBuffer, lost);
+    STATS_ADD(uart_rx_drops, lost);
+  }
+
+  len = ringbuf_read(&UartRxBuffer, buf, len);
+
+  if (uart_rts_off) {
+    gie = __get_SR_register() & GIE;
+    __bic_status_register(GIE);
+    uart_rts_update();
+    __bis_status_register(gie);
+  }
+
+  return len;
+}
+
+
+
 /*
  * Append new message to transmit buffer
  */
 uint8_t uart_tx_append_msg(unsigned char *buf, unsigned char len)
 {
-  int i;
+  uint16_t written = ringbuf_write(&UartTxBuffer, buf, len);
+
+  STATS_ADD(uart_tx_drops, len - written);
+  STATS_MAX(uart_tx_max, ringbuf_len(&UartTxBuffer));
+
+  return written;
+}
+
+
+/*
+ * Queue len bytes at data in a packet buffer slot to be sent after
+ * what's in UartTxBuffer. The slot is freed when sent. Returns 0 if
+ * the queue is full, then the slot is freed right away.
+ */
+uint8_t uart_tx_append_pkt(uint8_t slot, volatile unsigned char *data, uint16_t len)
+{
+  unsigned int gie = __get_SR_register() & GIE;
+  uint8_t i;
 
-  // Disable interrupts to make sure UartTxBuffer state isn't modified in the middle
   __bic_status_register(GIE);
 
-  // Check that there's enough space
-  if (UartTxBufferLength + len >= UART_BUF_LEN) {
-    // Enable interrupts
-    __bis_status_register(GIE);
+  if (uart_tx_pkt_count == PKTBUF_COUNT) {
+    __bis_status_register(gie);
+    STATS_ADD(uart_tx_drops, len);
+    pktbuf_free(slot);
     return 0;
   }
 
-  for (i = 0; i < len; ++i) {
-    UartTxBuffer[UartTxBufferLength + i] = buf[i];
+  i = uart_tx_pkt_head + uart_tx_pkt_count;
+  if (i >= PKTBUF_COUNT) {
+    i -= PKTBUF_COUNT;
   }
-  UartTxBufferLength += i;
+  uart_tx_pkts[i].slot = slot;
+  uart_tx_pkts[i].data = data;
+  uart_tx_pkts[i].len = len;
+  uart_tx_pkts[i].before = ringbuf_len(&UartTxBuffer) - uart_tx_pkt_before;
+  uart_tx_pkt_before += uart_tx_pkts[i].before;
+  ++uart_tx_pkt_count;
+
+  __bis_status_register(gie);
+
+  return 1;
+}
 
-  // Enable interrupts
-  __bis_status_register(GIE);
 
-  return i;
+
+/*
+ * Free the slot at the head of the queue once it's sent
+ */
+static void uart_tx_pkt_done(void)
+{
+  pktbuf_free(uart_tx_pkts[uart_tx_pkt_head].slot);
+  if (++uart_tx_pkt_head == PKTBUF_COUNT) {
+    uart_tx_pkt_head = 0;
+  }
+  --uart_tx_pkt_count;
 }
 
 
+
 /*
- * Start sending (unless already sending)
+ * Account for len bytes of UartTxBuffer sent ahead of the queued slots
+ */
+static void uart_tx_buffer_sent(uint16_t len)
+{
+  if (uart_tx_pkt_count > 0) {
+    uart_tx_pkts[uart_tx_pkt_head].before -= len;
+    uart_tx_pkt_before -= len;
+  }
+}
+
+
+
+/*
+ * Start sending (unless already sending). Safe to call also from
+ * interrupt handlers.
  */
 void uart_send_next_msg(void)
 {
-   // Disable interrupts to make sure UartTxBuffer state isn't modified in the middle
+  unsigned int gie = __get_SR_register() & GIE;
+
+  // Only the state change needs to be atomic, the buffer itself is lock free
   __bic_status_register(GIE);
 
-  if (UartTxBufferLength > 0 && uart_state != UART_STATE_TX) {
+  if ((ringbuf_len(&UartTxBuffer) > 0 || uart_tx_pkt_count > 0) &&
+      uart_state != UART_STATE_TX) {
     uart_state = UART_STATE_TX;
-    UCA0TXBUF = UartTxBuffer[UartTxBuffer_i]; // Send first byte
+
+    if (uart_mode == UART_MODE_DMA) {
+      uart_dma_start_tx();
+    } else {
+      // Only the TXIFG interrupt takes bytes from the buffer, so just
+      // raise it to send the first byte
+      UCA0IFG |= UCTXIFG;
+    }
   }
-   // Enable interrupts
-  __bis_status_register(GIE);
+
+  __bis_status_register(gie);
 }
 
 
@@ -176,14 +394,171 @@ static void handle_uart_rx_byte(void)
   tmpchar = UCA0RXBUF;
 
   // Discard the byte if buffer already full
-  if (UartRxBuffer_i == UART_BUF_LEN) {
+  if (!ringbuf_put(&UartRxBuffer, tmpchar)) {
+    STATS_INC(uart_rx_drops);
+  }
+  STATS_MAX(uart_rx_max, ringbuf_len(&UartRxBuffer));
+  uart_rts_update();
+
+  return;
+}
+
+
+
+/*
+ * Deassert RTS above the high watermark of UartRxBuffer and assert it
+ * below the low one. Called with interrupts disabled.
+ */
+static void uart_rts_update(void)
+{
+  uint16_t len;
+
+  if (!uart_flow) {
     return;
   }
 
-  // Store received byte
-  UartRxBuffer[UartRxBuffer_i++] = tmpchar;
+  len = ringbuf_len(&UartRxBuffer);
+  if (!uart_rts_off && len >= UART_RTS_HIGH_WATER) {
+    UART_RTS_POUT |= UART_RTS_BIT;
+    uart_rts_off = 1;
+  } else if (uart_rts_off && len <= UART_RTS_LOW_WATER) {
+    UART_RTS_POUT &= ~UART_RTS_BIT;
+    uart_rts_off = 0;
+  }
+}
+
 
-  return;
+
+/*
+ * Set up DMA channels for TX and start circular RX into UartRxBuffer
+ */
+static void uart_dma_init(void)
+{
+  dma_set_trigger(DMA_CHANNEL_UART_TX, DMA_TRIGGER_UCA0TXIFG);
+  dma_set_handler(DMA_CHANNEL_UART_TX, uart_dma_tx_done);
+
+  dma_set_trigger(DMA_CHANNEL_UART_RX, DMA_TRIGGER_UCA0RXIFG);
+  DMA1CTL = 0;
+  DMA1SAL = (uint16_t)(uintptr_t)&UCA0RXBUF;
+  DMA1DAL = (uint16_t)(uintptr_t)UartRxBufferData;
+  DMA1SZ = UART_BUF_LEN;
+  // Repeated single transfer, byte to byte, increment destination
+  DMA1CTL = DMADT_4 + DMADSTINCR_3 + DMASBDB + DMAEN;
+
+  timer_poll_start(timer_ms_to_ticks(UART_DMA_RX_POLL_MS), uart_dma_rx_poll);
+}
+
+
+
+/*
+ * Send the next contiguous chunk of UartTxBuffer, or the next queued
+ * slot, with one DMA transfer. With flow control the chunks are short
+ * to check CTS between them. Called with interrupts disabled or from
+ * the DMA interrupt.
+ */
+static void uart_dma_start_tx(void)
+{
+  volatile unsigned char *data;
+  uint16_t len;
+
+  uart_dma_tx_pkt = 0;
+  if (uart_flow && (UART_CTS_PIN & UART_CTS_BIT)) {
+    // Paused until CTS is asserted again, see PORT2_ISR
+    uart_state = UART_STATE_IDLE;
+    return;
+  }
+
+  if (uart_tx_pkt_count > 0 && uart_tx_pkts[uart_tx_pkt_head].before == 0) {
+    data = uart_tx_pkts[uart_tx_pkt_head].data + uart_tx_pkt_sent;
+    len = uart_tx_pkts[uart_tx_pkt_head].len - uart_tx_pkt_sent;
+    uart_dma_tx_pkt = 1;
+  } else {
+    len = ringbuf_peek(&UartTxBuffer, &data);
+    if (uart_tx_pkt_count > 0 && len > uart_tx_pkts[uart_tx_pkt_head].before) {
+      len = uart_tx_pkts[uart_tx_pkt_head].before;
+    }
+  }
+
+  if (len == 0) {
+    uart_state = UART_STATE_IDLE;
+    return;
+  }
+
+  if (uart_flow && len > UART_CTS_DMA_CHUNK) {
+    len = UART_CTS_DMA_CHUNK;
+  }
+
+  uart_dma_tx_len = len;
+
+  DMA0CTL = 0;
+  DMA0SAL = (uint16_t)(uintptr_t)data;
+  DMA0DAL = (uint16_t)(uintptr_t)&UCA0TXBUF;
+  DMA0SZ = len;
+  // Single transfer, byte to byte, increment source
+  DMA0CTL = DMADT_0 + DMASRCINCR_3 + DMASBDB + DMAIE + DMAEN;
+
+  // DMA is triggered by the rising edge of UCTXIFG, which is already
+  // set when the transmitter is idle
+  UCA0IFG &= ~UCTXIFG;
+  UCA0IFG |= UCTXIFG;
+}
+
+
+
+/*
+ * Called from DMA interrupt handler when a TX chunk has been sent
+ */
+static uint8_t uart_dma_tx_done(void)
+{
+  if (uart_dma_tx_pkt) {
+    uart_tx_pkt_sent += uart_dma_tx_len;
+    if (uart_tx_pkt_sent == uart_tx_pkts[uart_tx_pkt_head].len) {
+      uart_tx_pkt_sent = 0;
+      uart_tx_pkt_done();
+    }
+  } else {
+    ringbuf_skip(&UartTxBuffer, uart_dma_tx_len);
+    uart_tx_buffer_sent(uart_dma_tx_len);
+  }
+  uart_dma_start_tx();
+
+  return 0;
+}
+
+
+
+/*
+ * Called from timer interrupt handler to publish the bytes written by
+ * the RX DMA. Wakes up the main loop if there is new data. The DMA
+ * doesn't stop at the tail, so more bytes since the last poll than
+ * there was free space means it has overwritten unread ones, and
+ * uart_read() drops them.
+ */
+static uint8_t uart_dma_rx_poll(void)
+{
+  uint16_t head = UART_BUF_LEN - DMA1SZ;
+  uint16_t written;
+
+  if (head >= UART_BUF_LEN) {
+    head = 0;
+  }
+
+  if (head == UartRxBuffer.head) {
+    return 0;
+  }
+
+  written = head >= UartRxBuffer.head ?
+    head - UartRxBuffer.head : UART_BUF_LEN - UartRxBuffer.head + head;
+  if (written > ringbuf_free(&UartRxBuffer)) {
+    uart_dma_rx_overrun = 1;
+  }
+
+  ringbuf_set_head(&UartRxBuffer, head);
+  STATS_MAX(uart_rx_max, ringbuf_len(&UartRxBuffer));
+  uart_rts_update();
+  sched_post(SCHED_EVENT_UART_RX);
+
+  return 1;
 }
 
 
@@ -31,28 +31,81 @@
 
 #include "common.h"
 #include "rf.h"
+#include "ringbuf.h"
 
 #include <msp430.h>
 #include <stdint.h>
 
-#define UART_BUF_LEN       (PAYLOAD_LEN * 3)   // Bigger buffers for uart
+// Bigger buffers for uart. Received packets go out in their pktbuf
+// slots, so UartTxBuffer needs only to hold the text lines and a packet
+// while no slot is free, and a target may build it smaller.
+#ifndef UART_BUF_LEN
+#define UART_BUF_LEN       (PAYLOAD_LEN * 2)
+#endif
+#ifndef UART_TX_BUF_LEN
+#define UART_TX_BUF_LEN    (UART_BUF_LEN)
+#endif
+
+#define UART_DEFAULT_BAUDRATE            115200UL
 
 #define UART_RX_NEWDATA_TIMEOUT_MS       4   // 4ms timeout for sending current uart rx data
 //#define UART_RX_NEWDATA_TIMEOUT_MS       511   // 511ms timeout for sending current uart rx data
 
+#define UART_DMA_RX_POLL_MS              1   // RX DMA published every 1ms
+
+/*
+ * Optional RTS/CTS flow control, both active low. USCI_A has no
+ * handshake lines, so they are plain GPIOs: RTS is deasserted when
+ * UartRxBuffer fills past the high watermark and asserted again when
+ * uart_read() drains it below the low one. The margin above the high
+ * watermark covers the bytes the sender has already committed and, in
+ * DMA mode, a poll interval. CTS pauses TX between bytes, or between
+ * UART_CTS_DMA_CHUNK byte transfers in DMA mode.
+ */
+#define UART_RTS_POUT                    P2OUT
+#define UART_RTS_PDIR                    P2DIR
+#define UART_RTS_BIT                     BIT5
+#define UART_CTS_PIN                     P2IN
+#define UART_CTS_PDIR                    P2DIR
+#define UART_CTS_POUT                    P2OUT
+#define UART_CTS_PREN                    P2REN
+#define UART_CTS_PIE                     P2IE
+#define UART_CTS_PIES                    P2IES
+#define UART_CTS_PIFG                    P2IFG
+#define UART_CTS_BIT                     BIT4
+
+#define UART_RTS_HIGH_WATER              (UART_BUF_LEN - UART_BUF_LEN / 4)
+#define UART_RTS_LOW_WATER               (UART_BUF_LEN / 2)
+#define UART_CTS_DMA_CHUNK               16
+
+/*
+ * UART_MODE_IRQ: one interrupt per byte in both directions
+ * UART_MODE_DMA: TX as one DMA transfer per contiguous chunk of the TX
+ *                buffer, RX into the RX buffer with circular DMA which
+ *                is polled with a timer. Data arriving faster than the
+ *                main loop reads it overwrites the oldest unread data,
+ *                which the poll detects. uart_read() then drops all
+ *                unread bytes and counts them in uart_rx_drops.
+ */
+typedef enum uart_mode_t {
+  UART_MODE_IRQ,
+  UART_MODE_DMA
+} uart_mode_t;
+
 // Buffer for incoming data from UART
-extern volatile unsigned char UartRxBuffer[UART_BUF_LEN];
-extern volatile unsigned char UartRxBuffer_i;
+extern ringbuf_t UartRxBuffer;
 
 // Buffer for outoing data over UART
-extern volatile unsigned char UartTxBuffer[UART_BUF_LEN];
-extern volatile unsigned char UartTxBuffer_i;
-extern volatile unsigned char UartTxBufferLength;
+extern ringbuf_t UartTxBuffer;
 extern volatile unsigned char uart_rx_timeout;
 
 
-void uart_init(void);
+void uart_set_baudrate(uint32_t baud);
+void uart_set_flow_control(uint8_t enable);
+void uart_init(uart_mode_t mode);
+uint16_t uart_read(unsigned char *buf, uint16_t len);
 uint8_t uart_tx_append_msg(unsigned char *buf, unsigned char len);
+uint8_t uart_tx_append_pkt(uint8_t slot, volatile unsigned char *data, uint16_t len);
 void uart_send_next_msg(void);
 
 #endif
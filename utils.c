@@ -27,73 +27,24 @@
  */
 
 #include "utils.h"
+#include "clock.h"
 #include "stdint.h"
 
 
 
 /*
- * Convert int to string. Returns length on the converted string
- * (excluding the trailing \0) or 0 in error.
- */
-unsigned char sc_itoa(int32_t value, unsigned char *str, unsigned char len)
-{
-  unsigned char index = len;
-  unsigned char extra, i;
-  unsigned char str_len;
-  unsigned char negative = 0;
-  unsigned char start = 0;
-
-  // Check for negative values
-  if (value < 0) {
-    negative = 1;
-    value *= -1;
-  }
-
-  // Go through all numbers and store the last digit to the string
-  // starting for the last character
-  while (--index >= 0) {
-    str[index] = (value % 10) + '0';
-    if (value < 10) {
-      break;
-    }
-    value /= 10;
-  }
-
-  // Check for overflow (needs also space for '\0' and possible '-').
-  if (index < 1 || (negative && index < 2)) {
-    str[0] = '\0';
-    return 0;
-  }
-
-  // Add - for negative numbers
-  if (negative) {
-    str[0] = '-';
-    start = 1;
-  }
-
-  // Move numbers to the start of the string. Add \0 after the last
-  // number or as the last character in case of overflow
-  extra = index;
-  for (i = 0; i < len - extra; i++) {
-    str[i + start] = str[i + extra];
-  }
-  str_len = len - extra + start;
-
-  str[str_len] = '\0';
-
-  return str_len;
-}
-
-
-
-/*
- * Busy loop sleep ms milliseconds.
+ * Busy loop sleep ms milliseconds at the MCLK of the clock profile.
  */
 void busysleep_ms(int ms)
 {
+  uint8_t mhz = clock_mclk_mhz();
   int a;
+  uint8_t b;
+
   for (a = 0; a < ms; a++) {
-    __delay_cycles(1000);
+    for (b = 0; b < mhz; b++) {
+      __delay_cycles(1000);
+    }
   }
 }
 
@@ -101,13 +52,24 @@ void busysleep_ms(int ms)
 
 
 /*
- * Busy loop sleep ms microseconds.
+ * Busy loop sleep at least us microseconds at the MCLK of the clock
+ * profile. The loop itself takes a few cycles per round, so this is
+ * coarse at 1 MHz.
  */
 void busysleep_us(int us)
 {
+  uint8_t rounds = clock_mclk_mhz() >> 2;
   int a;
+  uint8_t b;
+
+  if (rounds == 0) {
+    rounds = 1;
+  }
+
   for (a = 0; a < us; a++) {
-    __delay_cycles(1);
+    for (b = 0; b < rounds; b++) {
+      __delay_cycles(1);
+    }
   }
 }
 
@@ -32,7 +32,6 @@
 #include "common.h"
 #include "stdint.h"
 
-unsigned char sc_itoa(int32_t value, unsigned char *str, unsigned char len);
 void busysleep_ms(int ms);
 void busysleep_us(int us);
 
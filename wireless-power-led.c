@@ -29,10 +29,14 @@
 
 #include "common.h"
 #include "adc.h"
+#include "clock.h"
 #include "comp.h"
 #include "i2c.h"
 #include "led.h"
+#include "power.h"
+#include "report.h"
 #include "rf.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "tmp275.h"
 #include "uart.h"
@@ -44,13 +48,42 @@
 
 #include <stdint.h>
 
-static void send_message(uint16_t batt, uint16_t temp, uint32_t blinks);
+static uint8_t build_message(uint16_t batt, uint16_t temp, uint32_t blinks,
+                             unsigned char *buf, uint8_t max_len);
+static uint8_t send_message(unsigned char *buf, uint8_t len);
 
 #define RB_USE_RF                1
 #define RB_USE_ADC               1
 #define RB_USE_I2C               1
 #define RB_USE_SHUTDOWN_TMP275   0
 
+#define RB_NODE_ADDRESS          2        // Unless set in info flash
+
+// Count the blinks in TA1 without waking up
+#define RB_COMP_MODE             COMP_MODE_TIMER
+
+// VCore first keeps the radio from running below level 2, radio first
+// overlaps VCore rising with the radio crystal start. See power.h.
+#define RB_POWER_ORDER           POWER_ORDER_VCORE_FIRST
+
+// Send the minute's reading only when the blinks, i.e. the power, the
+// battery or the temperature has moved from the last one sent, or at
+// the heartbeat, with a full keyframe every few reports. See report.h.
+#define RB_USE_REPORT            1
+#define RB_REPORT_BATT_THRESHOLD (8)
+#define RB_REPORT_TEMP_THRESHOLD (128)    // 0.5 C
+#define RB_REPORT_BLINK_THRESHOLD (5)     // Per minute
+#define RB_REPORT_HEARTBEAT_MS   (15UL * 60 * 1000)
+#define RB_REPORT_KEYFRAME_EVERY (8)
+
+#if RB_USE_REPORT
+static const report_field_t report_fields[] = {
+  { TELEMETRY_TYPE_BATTERY, RB_REPORT_BATT_THRESHOLD },
+  { TELEMETRY_TYPE_TEMP, RB_REPORT_TEMP_THRESHOLD },
+  { TELEMETRY_TYPE_COUNTER, RB_REPORT_BLINK_THRESHOLD },
+};
+#endif
+
 int main(void)
 {
   uint8_t temp_counter = 0;
@@ -58,8 +91,8 @@ int main(void)
   // Stop watchdog timer to prevent time out reset
   WDTCTL = WDTPW + WDTHOLD;
 
-  // Select VLOCLK for aux clock source
-  UCSCTL4 |= SELA__VLOCLK;
+  // VLOCLK for aux clock source, DCO at the reset default
+  clock_set_profile(CLOCK_PROFILE_LOW_POWER);
 
   SetVCore(0);
 
@@ -77,6 +110,15 @@ int main(void)
 
   //led_init();
 
+  // Packets to the gateway only, the radio ignores other nodes
+  rf_set_address(rf_info_address(RB_NODE_ADDRESS));
+  rf_set_destination(RF_ADDR_GATEWAY);
+
+  #if RB_USE_REPORT
+  report_init(report_fields, sizeof(report_fields) / sizeof(report_fields[0]),
+              RB_REPORT_HEARTBEAT_MS, RB_REPORT_KEYFRAME_EVERY);
+  #endif
+
   #if SC_USE_SLEEP == 0
   // Enable interrupts
   __bis_status_register(GIE);
@@ -91,9 +133,11 @@ int main(void)
   #endif
 
   // Start comparator to count led blinks
-  comp_start();
+  comp_start(RB_COMP_MODE);
 
   while(1) {
+    unsigned char buf[PAYLOAD_LEN];
+    uint8_t len;
     uint16_t adcbatt = 0;
     uint16_t temp = 0;
     uint32_t blinks = 0;
@@ -113,45 +157,44 @@ int main(void)
     #if RB_USE_I2C
     tmp275_start_oneshot();
     timer_sleep_ms(220, LPM4_bits);
-    temp = i2c_read();
+    tmp275_read(&temp);
     // TMP275 will shutdown after one shot conversion
     #endif
 
-    #if RB_USE_RF
-    // Increase PMMCOREV level to 2 for proper radio operation
-    SetVCore(2);
-    rf_init();
-    #endif
-
     #if RB_USE_ADC
-    if (1) {
-      uint8_t adc_timeout = 0;
+    {
       uint8_t channels[1] = {ADC_CHANNEL_BATTERY};
+      uint32_t sum;
 
-      adc_start(sizeof(channels), channels, ADC12SHT0_6, ADC_MODE_SINGLE);
+      adc_oversample_start(sizeof(channels), channels, ADC12SHT0_6, 1);
 
-      // FIXME: implement adc_read() that returns the value or timeout
-      // Wait until ADC ready, with timeout
-      while (adc_state != ADC_STATE_DATA) {
-        if (adc_timeout++ == 10) {
-          break;
-        }
-        timer_sleep_ms(1, LPM1_bits);
-      }
-
-      if (adc_state == ADC_STATE_DATA) {
-        adc_get_data(1, &adcbatt, (void*)0);
+      // Sleep until the battery measurement is done, with timeout
+      if (adc_oversample_wait(1, &sum, 10, LPM3_bits)) {
+        adcbatt = sum;
       }
 
       adc_shutdown();
     }
     #endif
 
+    // Radio only if there's something to send
+    len = build_message(adcbatt, temp, blinks, buf, sizeof(buf));
+
     #if RB_USE_RF
-    rf_wait_for_idle();
-    send_message(adcbatt, temp, blinks);
-    rf_shutdown();
-    SetVCore(0);
+    if (len > 0) {
+      // Increase PMMCOREV level to 2 for proper radio operation,
+      // sleep while the radio wakes up
+      power_up_start(RB_POWER_ORDER);
+      power_up_wait(LPM3_bits);
+      rf_calibrate((int16_t)temp);
+      rf_wait_for_idle();
+      if (!send_message(buf, len)) {
+        #if RB_USE_REPORT
+        report_lost();
+        #endif
+      }
+      power_down();
+    }
     #endif
 
   }
@@ -159,91 +202,45 @@ int main(void)
 
 
 /*
- * Construct a message and send it over the RF
+ * Construct a message of the reading into buf. Returns its length, 0
+ * if there's nothing to send.
  */
-static void send_message(uint16_t adcbatt, uint16_t rawtemp, uint32_t blinks)
+static uint8_t build_message(uint16_t adcbatt, uint16_t rawtemp, uint32_t blinks,
+                             unsigned char *buf, uint8_t max_len)
 {
-  static uint32_t tx_count = 0;
-  unsigned char buf[UART_BUF_LEN];
-  unsigned char len = 0;
-  uint8_t rf_timeout = 0;
-
-  // Append tx counter
-  buf[len++] = 'P';
-  buf[len++] = ':';
-  buf[len++] = ' ';
-  len += sc_itoa(tx_count, &buf[len], UART_BUF_LEN - len);
-  buf[len++] = ' ';
-
-  // Append battery level
-  len += sc_itoa(adcbatt, &buf[len], UART_BUF_LEN - len);
-  buf[len++] = ' ';
-
-  // Append temperature
-  {
-    int16_t temp;
-    uint16_t temp_int;
-    uint32_t temp_frac;
-    char sign = 1;
-
-    temp = (int16_t)rawtemp;
-
-    /* Grab the sign and convert to positive
-     * Negative integer math is... interesting so we take the risk of
-     * asymmetry and convert to positive. This might incur heavy error
-     * for some values, but is verified to work correctly with a fixed
-     * dataset in the range of 127.93...-55.00 (from datasheets).
-     */
-    if (temp < 0) {
-      sign = -1;
-      temp *= -1;
-    }
-    /* We always mark the sign to make parsing easier */
-    buf[len++] = (sign == 1) ? '+' : '-';
-
-    /* Integer part */
-    temp_int = temp >> 8;
-
-    len += sc_itoa(temp_int, buf + len, UART_BUF_LEN - len);
-
-    /* Decimal part is in the low 8 bits, but only top 4 bits are used.
-     * One step is roughly 0.06253 degrees Celsius, but no floats here!
-     * So we multiply by 6253 and divide by 1000 to catch the first two
-     * decimal places
-     */
-    temp_frac = (((((uint32_t)temp) & 0xf0) >> 4) * 6253) / 1000;
-    buf[len++] = '.';
-
-    /* Add leading zero, if needed */
-    if (temp_frac < 10) {
-      buf[len++] = '0';
-    }
-
-    len += sc_itoa(temp_frac, buf + len, UART_BUF_LEN - len);
-
-    buf[len++] = ' ';
-  }
+  #if RB_USE_REPORT
+  uint32_t values[3] = { adcbatt, rawtemp, blinks };
+
+  return report_update(values, buf, max_len, rf_get_address());
+  #else
+  telemetry_t t;
+
+  telemetry_start(&t, buf, max_len, rf_get_address());
+  telemetry_add_value(&t, TELEMETRY_TYPE_BATTERY, adcbatt);
+  telemetry_add_value(&t, TELEMETRY_TYPE_TEMP, rawtemp);
+  telemetry_add_value(&t, TELEMETRY_TYPE_COUNTER, blinks);
+  return telemetry_end(&t);
+  #endif
+}
 
-  // Append blink count
-  len += sc_itoa((int32_t)blinks, &buf[len], UART_BUF_LEN - len);
 
-  // Append newline
-  buf[len++] = '\r';
-  buf[len++] = '\n';
 
-  // Send the message
+/*
+ * Send a message over the RF. Returns 0 if the channel stayed busy.
+ */
+static uint8_t send_message(unsigned char *buf, uint8_t len)
+{
   rf_append_msg(buf, len);
-  rf_send_next_msg(RF_SEND_MSG_FORCE);
-
-  // Wait for completion of the tx, with timeout
-  while (rf_transmitting) {
-    if (rf_timeout++ == 20) {
-      break;
-    }
-    timer_sleep_ms(1, LPM1_bits);
+  // Listen before talk, back off while the channel is busy. The next
+  // reading takes the place of this one, see report_lost().
+  if (rf_send_next_msg_cca(RF_SEND_MSG_FORCE, LPM3_bits) != RF_TX_SENT) {
+    rf_drop_queued();
+    return 0;
   }
 
-  ++tx_count;
+  // Wait for completion of the tx, with timeout
+  rf_wait_for_tx(rf_tx_ms(len), LPM1_bits);
+  return 1;
 }
 
 
@@ -29,9 +29,15 @@
 
 #include "common.h"
 #include "adc.h"
+#include "clock.h"
 #include "i2c.h"
 #include "led.h"
+#include "power.h"
+#include "prof.h"
+#include "report.h"
 #include "rf.h"
+#include "samplelog.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "tmp275.h"
 #include "uart.h"
@@ -43,20 +49,63 @@
 
 #include <stdint.h>
 
-static void send_message(uint16_t batt, uint16_t temp);
+static void log_reading(uint16_t batt, uint16_t temp);
+static void send_log(void);
+#if RB_USE_PROF
+static void send_prof(void);
+#endif
 
 #define RB_USE_RF                1
 #define RB_USE_ADC               1
 #define RB_USE_I2C               1
 #define RB_USE_SHUTDOWN_TMP275   0
 
+#define RB_NODE_ADDRESS          1        // Unless set in info flash
+
+// Channel of the node, e.g. rf_address_channel() of the address with a
+// gateway on each channel. With hopping each send goes on the next
+// channel of a sequence seeded by the address, with the preamble that
+// a scanning gateway (RB_USE_CHANNEL_SCAN in wireless-uart.c) needs.
+#define RB_RF_CHANNEL            0
+#define RB_USE_CHANNEL_HOP       0
+
+// VCore raise, radio crystal start and the RF1A7 wait before TX
+#define RB_RF_STARTUP_MS         3
+// VCore first keeps the radio from running below level 2, radio first
+// overlaps VCore rising with the radio crystal start. See power.h.
+#define RB_POWER_ORDER           POWER_ORDER_VCORE_FIRST
+
+// Readings sent together in one wake up of the radio, and the longest
+// a reading may wait for it
+#define RB_SAMPLELOG_BATCH       5
+#define RB_SAMPLELOG_MAX_DELAY_MS (60UL * 1000)
+
+// Profiling summary with the log at most this often, see prof.h
+#define RB_PROF_REPORT_MS        (10UL * 60 * 1000)
+
+// Log a reading only when the battery or the temperature has moved
+// from the last one sent (raw ADC steps, TMP275 1/256 C), or at the
+// heartbeat, with a full keyframe every few reports. See report.h.
+#define RB_USE_REPORT            1
+#define RB_REPORT_BATT_THRESHOLD (8)
+#define RB_REPORT_TEMP_THRESHOLD (64)     // 0.25 C
+#define RB_REPORT_HEARTBEAT_MS   (10UL * 60 * 1000)
+#define RB_REPORT_KEYFRAME_EVERY (8)
+
+#if RB_USE_REPORT
+static const report_field_t report_fields[] = {
+  { TELEMETRY_TYPE_BATTERY, RB_REPORT_BATT_THRESHOLD },
+  { TELEMETRY_TYPE_TEMP, RB_REPORT_TEMP_THRESHOLD },
+};
+#endif
+
 int main(void)
 {
   // Stop watchdog timer to prevent time out reset
   WDTCTL = WDTPW + WDTHOLD;
 
-  // Select VLOCLK for aux clock source
-  UCSCTL4 |= SELA__VLOCLK;
+  // VLOCLK for aux clock source, DCO at the reset default
+  clock_set_profile(CLOCK_PROFILE_LOW_POWER);
 
   // Turn off SMCLK (it turns on automatically, if a module uses it)
   // FIXME: Nothing is received, if SMCLK is turned off
@@ -78,36 +127,60 @@ int main(void)
 
   led_init();
 
+  #if RB_USE_PROF
+  prof_init(timer_ms_to_ticks(RB_PROF_REPORT_MS));
+  #endif
+
+  // Packets to the gateway only, the radio ignores other nodes
+  rf_set_address(rf_info_address(RB_NODE_ADDRESS));
+  rf_set_destination(RF_ADDR_GATEWAY);
+  rf_set_channel(RB_RF_CHANNEL);
+  #if RB_USE_CHANNEL_HOP
+  rf_set_tx_preamble(RF_SCAN_PREAMBLE_MS);
+  #endif
+
+  samplelog_init(RB_SAMPLELOG_BATCH, RB_SAMPLELOG_MAX_DELAY_MS);
+  #if RB_USE_REPORT
+  report_init(report_fields, sizeof(report_fields) / sizeof(report_fields[0]),
+              RB_REPORT_HEARTBEAT_MS, RB_REPORT_KEYFRAME_EVERY);
+  #endif
+
   #if SC_USE_SLEEP == 0
   // Enable interrupts
   __bis_status_register(GIE);
   #endif
 
-  // Main loop:
+  // Main loop, independent steps overlap:
   // - init i2c
   // - initiate tmp275 (will take 220ms) in one shot mode
-  // - sleep 220
-  // - initiate battery adc
-  // - start radio
-  // - wait until radio idle
-  // - battery adc ready
-  // - shutdown adc
+  // - measure battery while tmp275 converts, shutdown adc
+  // - if the sample log is due, sleep until the radio startup time
+  //   before tmp275 is ready, start the radio and raise VCore while
+  //   tmp275 finishes
   // - read tmp275
   // - shutdown i2c
-  // - wait for empty air
-  // - send message
-  // - shutdown radio
+  // - add the reading to the sample log, if changed enough
+  // - if due, wait for empty air, send the log
+  // - shutdown radio, VCore back to 0
   // - LPM4
   // - sleep minutes
   while(1) {
     uint16_t adcbatt = 0;
     uint16_t temp = 0;
     uint8_t channels[1] = {ADC_CHANNEL_BATTERY};
-
-    // Increase PMMCOREV level to 2 for proper radio operation
-    SetVCore(2);
+    uint32_t temp_ready = timer_now() + timer_ms_to_ticks(TMP275_CONVERSION_MS);
+    #if RB_USE_REPORT
+    // A changed reading waits for the next time, unless the log is late
+    uint8_t send = samplelog_due(report_heartbeat_due());
+    #else
+    uint8_t send = samplelog_due(1);
+    #endif
+    #if RB_USE_CHANNEL_HOP
+    static uint16_t hop = 0;
+    #endif
 
     led_on(1);
+    PROF_BEGIN(PROF_PHASE_AWAKE);
 
     #if RB_USE_I2C
     i2c_init();
@@ -118,52 +191,53 @@ int main(void)
     //i2c_shutdown();
     #else
     tmp275_start_oneshot();
+    PROF_BEGIN(PROF_PHASE_TMP275);
     #endif
     #endif
 
-    timer_sleep_ms(220, LPM4_bits);
-    led_off(2);
-
     #if RB_USE_ADC
-    adc_start(sizeof(channels), channels, ADC12SHT0_6, ADC_MODE_SINGLE);
-    #endif
-
-    #if RB_USE_RF
-    rf_init();
-
-    rf_wait_for_idle();
-
-    rf_receive_on();
-    #endif
-
-    #if RB_USE_ADC
-    if (1) {
-      uint8_t adc_timeout = 0;
-
-      // FIXME: implement adc_read() that return's the value or timeout
-      // Wait until ADC ready, with timeout
-      while (adc_state != ADC_STATE_DATA) {
-        if (adc_timeout++ == 10) {
-          break;
-        }
-        timer_sleep_ms(1, LPM1_bits);
-      }
-
-      if (adc_state == ADC_STATE_DATA) {
-        adc_get_data(1, &adcbatt, (void*)0);
+    {
+      uint32_t sum;
+
+      // Measure the battery while the TMP275 converts
+      adc_oversample_start(sizeof(channels), channels, ADC12SHT0_6, 1);
+      PROF_BEGIN(PROF_PHASE_ADC);
+      if (adc_oversample_wait(1, &sum, 10, LPM3_bits)) {
+        adcbatt = sum;
       }
+      PROF_END(PROF_PHASE_ADC);
 
       adc_shutdown();
     }
     #endif
 
+    #if RB_USE_RF
+    if (send) {
+      // Bring up the radio only for the last milliseconds of the conversion
+      timer_sleep_until(temp_ready - timer_ms_to_ticks(RB_RF_STARTUP_MS), LPM4_bits);
+      led_off(2);
+
+      #if RB_USE_CHANNEL_HOP
+      // Written in the wake up, calibrated from the cache
+      rf_set_channel(rf_hop_channel(rf_get_address(), hop++));
+      #endif
+
+      // Increase PMMCOREV level to 2 for proper radio operation, the
+      // radio finishes waking up during the sleep below
+      PROF_BEGIN(PROF_PHASE_RF_WAKEUP);
+      power_up_start(RB_POWER_ORDER);
+    }
+    #endif
+
     #if RB_USE_I2C
     #if RB_USE_SHUTDOWN_TMP275
     // Do nothing if not using TMP275
     #else
+    timer_sleep_until(temp_ready, LPM4_bits);
+
     // Read temperature from TMP275
-    // FIXME: implement tmp275_read_temp() instead
-    temp = i2c_read();
+    tmp275_read(&temp);
+    PROF_END(PROF_PHASE_TMP275);
 
     tmp275_shutdown();
 
@@ -172,20 +246,39 @@ int main(void)
     #endif
     #endif
 
+    log_reading(adcbatt, temp);
+
     #if RB_USE_RF
-    send_message(adcbatt, temp);
-    #endif
+    if (send) {
+      power_up_wait(LPM3_bits);
+      PROF_END(PROF_PHASE_RF_WAKEUP);
 
-    led_on(2);
+      PROF_BEGIN(PROF_PHASE_RF_IDLE);
+      rf_wait_for_idle();
+      PROF_END(PROF_PHASE_RF_IDLE);
 
-    #if RB_USE_RF
-    rf_shutdown();
+      rf_receive_on();
+
+      rf_calibrate((int16_t)temp);
+      PROF_BEGIN(PROF_PHASE_RF_TX);
+      send_log();
+      PROF_END(PROF_PHASE_RF_TX);
+
+      #if RB_USE_PROF
+      if (prof_due()) {
+        send_prof();
+      }
+      #endif
+
+      led_on(2);
+
+      power_down();
+    }
     #endif
 
     led_off(1);
     led_off(2);
-
-    SetVCore(0);
+    PROF_END(PROF_PHASE_AWAKE);
 
     timer_sleep_ms(4*1000, LPM4_bits);
 
@@ -195,83 +288,89 @@ int main(void)
 
 
 /*
- * Construct a message and send it over the RF
+ * Construct a record of the reading and add it to the sample log
  */
-static void send_message(uint16_t adcbatt, uint16_t rawtemp)
+static void log_reading(uint16_t adcbatt, uint16_t rawtemp)
 {
-  unsigned char buf[UART_BUF_LEN];
-  unsigned char len = 0;
-  uint8_t rf_timeout = 0;
-
-  // Send battery level
-  buf[len++] = 'B';
-  buf[len++] = ':';
-  buf[len++] = ' ';
-  len += sc_itoa(adcbatt, &buf[len], UART_BUF_LEN - len);
-  buf[len++] = ',';
-  buf[len++] = ' ';
-
-  // Send temperature
-  {
-    int16_t temp;
-    uint16_t temp_int;
-    uint32_t temp_frac;
-    char sign = 1;
-
-    temp = (int16_t)rawtemp;
-
-    /* Grab the sign and convert to positive
-     * Negative integer math is... interesting so we take the risk of
-     * asymmetry and convert to positive. This might incur heavy error
-     * for some values, but is verified to work correctly with a fixed
-     * dataset in the range of 127.93...-55.00 (from datasheets).
-     */
-    if (temp < 0) {
-      sign = -1;
-      temp *= -1;
-    }
-    buf[len++] = 'T';
-    buf[len++] = ':';
-    buf[len++] = ' ';
+  unsigned char buf[SAMPLELOG_PACKET_LEN];
+  unsigned char len;
+  #if RB_USE_REPORT
+  uint32_t values[2] = { adcbatt, rawtemp };
+
+  len = report_update(values, buf, sizeof(buf), rf_get_address());
+  if (len == 0) {
+    return;
+  }
+  #else
+  telemetry_t t;
 
-    /* We always mark the sign to make parsing easier */
-    buf[len++] = (sign == 1) ? '+' : '-';
+  telemetry_start(&t, buf, sizeof(buf), rf_get_address());
+  telemetry_add_value(&t, TELEMETRY_TYPE_BATTERY, adcbatt);
+  telemetry_add_value(&t, TELEMETRY_TYPE_TEMP, rawtemp);
+  len = telemetry_end(&t);
+  #endif
 
-    /* Integer part */
-    temp_int = temp >> 8;
+  samplelog_add(buf, len);
+}
 
-    len += sc_itoa(temp_int, buf + len, UART_BUF_LEN - len);
 
-    /* Decimal part is in the low 8 bits, but only top 4 bits are used.
-     * One step is roughly 0.06253 degrees Celsius, but no floats here!
-     * So we multiply by 6253 and divide by 1000 to catch the first two
-     * decimal places
-     */
-    temp_frac = (((((uint32_t)temp) & 0xf0) >> 4) * 6253) / 1000;
-    buf[len++] = '.';
 
-    /* Add leading zero, if needed */
-    if (temp_frac < 10) {
-      buf[len++] = '0';
+/*
+ * Send the sample log over the RF, as many packets as it takes
+ */
+static void send_log(void)
+{
+  unsigned char buf[SAMPLELOG_PACKET_LEN];
+  unsigned char len;
+
+  while ((len = samplelog_peek(buf, sizeof(buf))) > 0) {
+    rf_append_msg(buf, len);
+    // Listen before talk, back off while the channel is busy. If it
+    // stays taken, the records wait in the log for the next time and
+    // aren't left queued.
+    if (rf_send_next_msg_cca(RF_SEND_MSG_FORCE, LPM3_bits) != RF_TX_SENT) {
+      rf_drop_queued();
+      break;
     }
-
-    len += sc_itoa(temp_frac, buf + len, UART_BUF_LEN - len);
-    buf[len++] = '\r';
-    buf[len++] = '\n';
+    samplelog_commit();
+    // Wait for completion of the tx, with timeout
+    rf_wait_for_tx(rf_tx_ms(len), LPM1_bits);
   }
+}
 
-  // Send the message
-  rf_append_msg(buf, len);
-  rf_send_next_msg(RF_SEND_MSG_FORCE);
 
-  // Wait for completion of the tx, with timeout
-  while (rf_transmitting) {
-    if (rf_timeout++ == 20) {
-      break;
+
+#if RB_USE_PROF
+/*
+ * Send the profiling summary since the last one over the RF, as many
+ * whole records in a packet as fit SAMPLELOG_PACKET_LEN
+ */
+static void send_prof(void)
+{
+  unsigned char buf[PROF_REPORT_LEN];
+  uint8_t len, start, end, rec_len;
+
+  len = prof_report(buf, sizeof(buf), rf_get_address());
+
+  for (start = 0; start < len; start = end) {
+    end = start;
+    while (end < len && (rec_len = telemetry_record_len(&buf[end], len - end)) > 0 &&
+           end - start + rec_len <= SAMPLELOG_PACKET_LEN) {
+      end += rec_len;
+    }
+    if (end == start) {
+      return;
+    }
+
+    rf_append_msg(&buf[start], end - start);
+    if (rf_send_next_msg_cca(RF_SEND_MSG_FORCE, LPM3_bits) != RF_TX_SENT) {
+      rf_drop_queued();
+      return;
     }
-    timer_sleep_ms(1, LPM1_bits);
+    rf_wait_for_tx(rf_tx_ms(end - start), LPM1_bits);
   }
 }
+#endif
 
 
 /* Emacs indentatation information
@@ -29,10 +29,15 @@
 
 #include "common.h"
 #include "adc.h"
+#include "clock.h"
 #include "comp.h"
 #include "i2c.h"
 #include "led.h"
+#include "power.h"
+#include "prof.h"
 #include "rf.h"
+#include "samplelog.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "tmp275.h"
 #include "uart.h"
@@ -46,6 +51,31 @@
 
 #define DEBUG_MODE 0
 
+#define RB_NODE_ADDRESS          3        // Unless set in info flash
+
+// Channel of the node, e.g. rf_address_channel() of the address with a
+// gateway on each channel. With hopping each send goes on the next
+// channel of a sequence seeded by the address, with the preamble that
+// a scanning gateway (RB_USE_CHANNEL_SCAN in wireless-uart.c) needs.
+#define RB_RF_CHANNEL            0
+#define RB_USE_CHANNEL_HOP       0
+
+// VCore first keeps the radio from running below level 2, radio first
+// overlaps VCore rising with the radio crystal start. See power.h.
+#define RB_POWER_ORDER           POWER_ORDER_VCORE_FIRST
+
+// Check the supercap and solar panel voltages, see the limits below
+#define RB_USE_POWER_STATE       0
+
+// Readings sent together in one wake up of the radio, and the longest
+// a reading may wait for it. With full power every reading is sent
+// right away, with low power none until there's enough again.
+#define RB_SAMPLELOG_BATCH       4
+#define RB_SAMPLELOG_MAX_DELAY_MS (6UL * 60 * 60 * 1000)
+
+// Profiling summary with the log at most this often, see prof.h
+#define RB_PROF_REPORT_MS        (60UL * 60 * 1000)
+
 // FIXME: these probably will change per temperature?
 #define SUPER_CAP_LOW_LIMIT               1000
 #define SUPER_CAP_FULL_LIMIT              2200
@@ -67,7 +97,16 @@ typedef enum power_flags_t {
 
 #define ADC_PINS                 (BIT0 | BIT1 | BIT2 | BIT3)
 
-static void send_message(uint32_t *adc, uint16_t temp);
+// 16 sequences per measurement, i.e. 4 extra bits
+#define ADC_OVERSAMPLE_BITS        4
+#define ADC_OVERSAMPLE             (1 << ADC_OVERSAMPLE_BITS)
+#define ADC_OVERSAMPLE_TIMEOUT_MS  250
+
+static void log_reading(uint32_t *adc, uint16_t temp);
+static void send_log(void);
+#if RB_USE_PROF
+static void send_prof(void);
+#endif
 static void get_adc(uint32_t adcdata[], uint8_t min_ch, uint8_t max_ch);
 
 #define RB_USE_I2C               1
@@ -80,8 +119,8 @@ int main(void)
   // Stop watchdog timer to prevent time out reset
   WDTCTL = WDTPW + WDTHOLD;
 
-  // Select VLOCLK for aux clock source
-  UCSCTL4 |= SELA__VLOCLK;
+  // VLOCLK for aux clock source, DCO at the reset default
+  clock_set_profile(CLOCK_PROFILE_LOW_POWER);
 
   SetVCore(0);
 
@@ -101,6 +140,20 @@ int main(void)
   led_init();
   #endif
 
+  #if RB_USE_PROF
+  prof_init(timer_ms_to_ticks(RB_PROF_REPORT_MS));
+  #endif
+
+  // Packets to the gateway only, the radio ignores other nodes
+  rf_set_address(rf_info_address(RB_NODE_ADDRESS));
+  rf_set_destination(RF_ADDR_GATEWAY);
+  rf_set_channel(RB_RF_CHANNEL);
+  #if RB_USE_CHANNEL_HOP
+  rf_set_tx_preamble(RF_SCAN_PREAMBLE_MS);
+  #endif
+
+  samplelog_init(RB_SAMPLELOG_BATCH, RB_SAMPLELOG_MAX_DELAY_MS);
+
   #if SC_USE_SLEEP == 0
   // Enable interrupts
   __bis_status_register(GIE);
@@ -119,15 +172,18 @@ int main(void)
     uint32_t adcdata[sizeof(ADC_CHANNELS)] = {0};
     uint16_t temp = 0;
     uint8_t sleep_min = 60;
+    uint32_t temp_ready = timer_now() + timer_ms_to_ticks(TMP275_CONVERSION_MS);
+
+    PROF_BEGIN(PROF_PHASE_AWAKE);
 
     // Initialise power state
     power_state = 0;
 
     #if RB_USE_I2C
+    // The TMP275 converts while the ADC measures and the moisture
+    // sensor settles. It will shutdown after one shot conversion.
     tmp275_start_oneshot();
-    timer_sleep_ms(220, LPM4_bits);
-    temp = i2c_read();
-    // TMP275 will shutdown after one shot conversion
+    PROF_BEGIN(PROF_PHASE_TMP275);
     #endif
 
     // Initialise analog pins
@@ -139,7 +195,7 @@ int main(void)
 
     // Check for power states
     // FIXME: bad limits at least with 2.5V VDD, ignoring for now
-    if (0){
+    #if RB_USE_POWER_STATE
     if (adcdata[3] < SUPER_CAP_LOW_LIMIT) {
       power_state |= POWER_FLAG_SUPERCAP_LOW;
     }
@@ -149,6 +205,13 @@ int main(void)
     if (adcdata[2] > SOLAR_PANEL_MAX_LIMIT) {
       power_state |= POWER_FLAG_SOLAR_MAX;
     }
+    #endif
+
+    // Energy to spare, send every reading right away
+    if (power_state & (POWER_FLAG_SUPERCAP_FULL | POWER_FLAG_SOLAR_MAX)) {
+      samplelog_set_batch(1);
+    } else {
+      samplelog_set_batch(RB_SAMPLELOG_BATCH);
     }
 
     // If supercap voltage too low, skip moisture measurement and radio usage
@@ -160,9 +223,13 @@ int main(void)
       PMAPPWD = 0;                    // Lock port mapping registers
       P1SEL   |= BIT1;
 
-      // Increase PMMCOREV level to 2 for proper radio operation
-      SetVCore(2);
-      rf_init();
+      // The radio clock excites the moisture sensor, so the radio is
+      // needed already here. Increase PMMCOREV level to 2 for proper
+      // radio operation.
+      PROF_BEGIN(PROF_PHASE_RF_WAKEUP);
+      power_up_start(RB_POWER_ORDER);
+      power_up_wait(LPM3_bits);
+      PROF_END(PROF_PHASE_RF_WAKEUP);
 
       // gdo2 output configuration,
       // 0x39 == RFCLK/24 (1.083MHz)
@@ -176,7 +243,7 @@ int main(void)
       P1OUT |= BIT4;
 
       // Wait for the moisture sensor to stabilize
-      busysleep_ms(250);
+      timer_sleep_ms(250, LPM3_bits);
 
       // Read soil moisture and reference
       get_adc(adcdata, 0, 1);
@@ -187,16 +254,45 @@ int main(void)
       // gdo2 output configuration, 0x29 == RF_RDY
       WriteSingleReg(IOCFG2, 0x29);
 
-      rf_wait_for_idle();
-      send_message(adcdata, temp);
-      rf_shutdown();
-      SetVCore(0);
+      #if RB_USE_I2C
+      // Already converted during the settle time
+      timer_sleep_until(temp_ready, LPM4_bits);
+      tmp275_read(&temp);
+      PROF_END(PROF_PHASE_TMP275);
+      #endif
+
+      // The radio is up anyway for the moisture sensor, but leave out
+      // the calibration and TX until the log is due
+      log_reading(adcdata, temp);
+      if (samplelog_due(0)) {
+        #if RB_USE_CHANNEL_HOP
+        static uint16_t hop = 0;
+
+        rf_set_channel(rf_hop_channel(rf_get_address(), hop++));
+        #endif
+        rf_calibrate((int16_t)temp);
+        PROF_BEGIN(PROF_PHASE_RF_IDLE);
+        rf_wait_for_idle();
+        PROF_END(PROF_PHASE_RF_IDLE);
+        PROF_BEGIN(PROF_PHASE_RF_TX);
+        send_log();
+        PROF_END(PROF_PHASE_RF_TX);
+        #if RB_USE_PROF
+        if (prof_due()) {
+          send_prof();
+        }
+        #endif
+      }
+      power_down();
 
       // De-configure GD2 (P1.1)
       PMAPPWD = 0x02D52;              // Get write-access to port mapping regs
       P1MAP1  = 0x0;                  // Map GPIO to P1.1
       PMAPPWD = 0;                    // Lock port mapping registers
       P1SEL  &= ~BIT1;
+    } else {
+      // Keep the harvester state, sent once there's power again
+      log_reading(adcdata, temp);
     }
 
     // Analog pins to digital output low
@@ -204,6 +300,8 @@ int main(void)
     P2SEL &= ~ADC_PINS;
     P2OUT &= ~ADC_PINS;
 
+    PROF_END(PROF_PHASE_AWAKE);
+
     // Sleep between measurements
     #if DEBUG_MODE
     {
@@ -215,7 +313,7 @@ int main(void)
       }
     }
     #else
-    if (power_state & (POWER_FLAG_SUPERCAP_FULL | POWER_FLAG_SUPERCAP_FULL)) {
+    if (power_state & (POWER_FLAG_SUPERCAP_FULL | POWER_FLAG_SOLAR_MAX)) {
       // If full power, sleep only 10 minutes
       sleep_min = 10;
     } else if (power_state & POWER_FLAG_SUPERCAP_LOW) {
@@ -230,107 +328,94 @@ int main(void)
 
 
 /*
- * Construct a message and send it over the RF
+ * Construct a record of the reading and add it to the sample log
  */
-static void send_message(uint32_t *adc, uint16_t rawtemp)
+static void log_reading(uint32_t *adc, uint16_t rawtemp)
 {
-  static uint32_t tx_count = 0;
-  unsigned char buf[UART_BUF_LEN];
-  unsigned char len = 0;
-  uint8_t i;
-
-  // Append tx counter
-  buf[len++] = 'S';
-  buf[len++] = '[';
-  buf[len++] = '0';
-  buf[len++] = ']';
-  buf[len++] = ' ';
-  len += sc_itoa(tx_count, &buf[len], UART_BUF_LEN - len);
-  buf[len++] = ' ';
-
-  // Append ADC values
-  for (i = 0; i < sizeof(ADC_CHANNELS); ++i) {
-    len += sc_itoa(adc[i], &buf[len], UART_BUF_LEN - len);
-    buf[len++] = ' ';
-  }
+  unsigned char buf[SAMPLELOG_PACKET_LEN];
+  unsigned char len;
+  telemetry_t t;
 
-  // Append temperature
-  {
-    int16_t temp;
-    uint16_t temp_int;
-    uint32_t temp_frac;
-    char sign = 1;
-
-    temp = (int16_t)rawtemp;
-
-    /* Grab the sign and convert to positive
-     * Negative integer math is... interesting so we take the risk of
-     * asymmetry and convert to positive. This might incur heavy error
-     * for some values, but is verified to work correctly with a fixed
-     * dataset in the range of 127.93...-55.00 (from datasheets).
-     */
-    if (temp < 0) {
-      sign = -1;
-      temp *= -1;
-    }
-    /* We always mark the sign to make parsing easier */
-    buf[len++] = (sign == 1) ? '+' : '-';
+  telemetry_start(&t, buf, sizeof(buf), rf_get_address());
+  telemetry_add(&t, TELEMETRY_TYPE_ADC, adc, sizeof(ADC_CHANNELS));
+  telemetry_add_value(&t, TELEMETRY_TYPE_TEMP, rawtemp);
+  telemetry_add_value(&t, TELEMETRY_TYPE_FLAGS, power_state);
+  len = telemetry_end(&t);
+
+  samplelog_add(buf, len);
+}
 
-    /* Integer part */
-    temp_int = temp >> 8;
 
-    len += sc_itoa(temp_int, buf + len, UART_BUF_LEN - len);
 
-    /* Decimal part is in the low 8 bits, but only top 4 bits are used.
-     * One step is roughly 0.06253 degrees Celsius, but no floats here!
-     * So we multiply by 6253 and divide by 1000 to catch the first two
-     * decimal places
-     */
-    temp_frac = (((((uint32_t)temp) & 0xf0) >> 4) * 6253) / 1000;
-    buf[len++] = '.';
+/*
+ * Send the sample log, as many packets as it takes
+ */
+static void send_log(void)
+{
+  unsigned char buf[SAMPLELOG_PACKET_LEN];
+  unsigned char len;
 
-    /* Add leading zero, if needed */
-    if (temp_frac < 10) {
-      buf[len++] = '0';
+  while ((len = samplelog_peek(buf, sizeof(buf))) > 0) {
+#if 1
+    rf_append_msg(buf, len);
+    // Listen before talk, back off while the channel is busy. If it
+    // stays taken, the records wait in the log for the next time and
+    // aren't left queued.
+    if (rf_send_next_msg_cca(RF_SEND_MSG_FORCE, LPM3_bits) != RF_TX_SENT) {
+      rf_drop_queued();
+      break;
     }
-
-    len += sc_itoa(temp_frac, buf + len, UART_BUF_LEN - len);
+    samplelog_commit();
+    // Wait for completion of the tx, with timeout
+    rf_wait_for_tx(rf_tx_ms(len), LPM1_bits);
+#else
+    uart_tx_append_msg(buf, len);
+    uart_send_next_msg();
+#endif
   }
+}
 
-  // Append newline
-  buf[len++] = '\r';
-  buf[len++] = '\n';
 
-  // Send the message
-#if 1
-  {
-    uint8_t rf_timeout = 0;
 
-    rf_append_msg(buf, len);
-    rf_send_next_msg(RF_SEND_MSG_FORCE);
+#if RB_USE_PROF
+/*
+ * Send the profiling summary since the last one over the RF, as many
+ * whole records in a packet as fit SAMPLELOG_PACKET_LEN
+ */
+static void send_prof(void)
+{
+  unsigned char buf[PROF_REPORT_LEN];
+  uint8_t len, start, end, rec_len;
 
-    // Wait for completion of the tx, with timeout
-    while (rf_transmitting) {
-      if (rf_timeout++ == 200) {
-        break;
-      }
-      busysleep_us(100);
+  len = prof_report(buf, sizeof(buf), rf_get_address());
+
+  for (start = 0; start < len; start = end) {
+    end = start;
+    while (end < len && (rec_len = telemetry_record_len(&buf[end], len - end)) > 0 &&
+           end - start + rec_len <= SAMPLELOG_PACKET_LEN) {
+      end += rec_len;
+    }
+    if (end == start) {
+      return;
     }
-  }
-#else
-  uart_tx_append_msg(buf, len);
-  uart_send_next_msg();
-#endif
 
-  ++tx_count;
+    rf_append_msg(&buf[start], end - start);
+    if (rf_send_next_msg_cca(RF_SEND_MSG_FORCE, LPM3_bits) != RF_TX_SENT) {
+      rf_drop_queued();
+      return;
+    }
+    rf_wait_for_tx(rf_tx_ms(end - start), LPM1_bits);
+  }
 }
+#endif
 
 /*
  * Fill in channels from min_ch to max_ch in adcdata
  */
 static void get_adc(uint32_t adcdata[], uint8_t min_ch, uint8_t max_ch)
 {
-  uint8_t adc_count = 0;
+  uint32_t sums[sizeof(ADC_CHANNELS)];
+  uint16_t done;
   uint8_t j = 0;
   uint8_t ch;
   uint8_t ch_count = 0;
@@ -341,35 +426,21 @@ static void get_adc(uint32_t adcdata[], uint8_t min_ch, uint8_t max_ch)
     adc_channels[ch_count++] = ADC_CHANNELS[ch];
   }
 
-  adc_start(ch_count, adc_channels, ADC12SHT1_12, ADC_MODE_CONT);
-
-  do {
-    uint16_t adc_timeout = 0;
-    // FIXME: implement adc_read() that returns the value or timeout
-    // Wait until ADC ready, with timeout
-    while (adc_state != ADC_STATE_DATA) {
-      if (adc_timeout++ == 10000) {
-        break;
-      }
-      busysleep_us(100);
-    }
-
-    if (adc_state == ADC_STATE_DATA) {
-      uint16_t data;
-      
-      for (j = 0; j < ch_count; ++j) {
-        adc_get_data(j, &data, (void*)0);
-        adcdata[j + min_ch] += data;
-      }
-      ++adc_count;
-    }
-  } while (adc_count < 16); // 16 times, i.e. 4 extra bits
-
+  // Sleep while the ADC interrupt accumulates the samples
+  adc_oversample_start(ch_count, adc_channels, ADC12SHT1_12, ADC_OVERSAMPLE);
+  PROF_BEGIN(PROF_PHASE_ADC);
+  done = adc_oversample_wait(ADC_OVERSAMPLE, sums, ADC_OVERSAMPLE_TIMEOUT_MS, LPM3_bits);
+  PROF_END(PROF_PHASE_ADC);
   adc_shutdown();
 
   // Calculate the ADC average
   for (j = 0; j < ch_count; ++j) {
-    adcdata[j + min_ch] >>= 4;
+    if (done == ADC_OVERSAMPLE) {
+      adcdata[j + min_ch] = sums[j] >> ADC_OVERSAMPLE_BITS;
+    } else if (done > 0) {
+      // Timed out, average what was got
+      adcdata[j + min_ch] = sums[j] / done;
+    }
   }
 }
 
@@ -28,9 +28,15 @@
 #include "common.h"
 
 #include "adc.h"
+#include "arq.h"
+#include "clock.h"
+#include "gateway.h"
 #include "i2c.h"
 #include "led.h"
 #include "rf.h"
+#include "sched.h"
+#include "stats.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "tmp275.h"
 #include "uart.h"
@@ -42,7 +48,139 @@
 
 #include <stdint.h>
 
-#define UART_RX_NEWDATA_TIMEOUT_MS       4   // 4ms timeout for sending current uart rx data
+// Wake-on-Radio for battery powered ends. Both ends must use the same
+// interval, it's the worst case latency on the air and longer
+// intervals mean lower average receive current.
+#define RB_USE_WOR                       0
+#define RB_WOR_INTERVAL_MS               500
+
+// Reliable mode: frames are acknowledged and resent, see arq.h. Both
+// ends must use the same setting.
+#define RB_USE_ARQ                       0
+
+// RF_PROFILE_250K for more throughput on short links. Both ends must
+// use the same profile, at start and after ESC 'P' (see below).
+#define RB_RF_PROFILE                    RF_PROFILE_38K4
+
+// Sent packets go to all, or to a single peer with its address
+#define RB_RF_DESTINATION                RF_ADDR_BROADCAST
+
+// Channel, or listen on all RF_CHANNEL_COUNT channels in turn for nodes
+// spread over them (rf_address_channel(), rf_hop_channel()). Scanning
+// also sends with the long preamble a scanning peer needs, and caches
+// the calibration of each channel, refreshed after RF_CAL_MAX_WAKEUPS
+// times RB_SCAN_RECAL_MS.
+#define RB_RF_CHANNEL                    0
+#define RB_USE_CHANNEL_SCAN              0
+#define RB_SCAN_RECAL_MS                 (60UL * 1000)
+
+// Mains powered, so the fastest DCO for the per byte work. 460800 and
+// 921600 baud need at least CLOCK_PROFILE_12MHZ.
+#define RB_CLOCK_PROFILE                 CLOCK_PROFILE_20MHZ
+#define RB_UART_BAUDRATE                 UART_DEFAULT_BAUDRATE
+
+// RTS/CTS on the pins in uart.h, see there. Without it bytes arriving
+// faster than the radio sends them are dropped.
+#define RB_USE_UART_FLOW_CONTROL         0
+
+// Coalescing of UART data to packets: while the UART byte rate over
+// the last window predicts a full packet within RB_FLUSH_MAX_MS, the
+// data waits for it at most that long from its first byte. Otherwise
+// lines are sent right away and the rest after an idle gap of
+// UART_RX_NEWDATA_TIMEOUT_MS.
+#define RB_FLUSH_MAX_MS                  16
+#define RB_RATE_WINDOW_MS                8
+
+// Commands from the UART, each alone in the UART buffer: ESC 'S'
+// prints the own link statistics, ESC 'R' asks the peer to send its
+// counters over the air and ESC 'P' <digit> switches both ends to that
+// rf_profile_id_t. A lone ESC waits this long for the rest before it's
+// sent as data.
+#define RB_CMD_ESCAPE                    0x1B
+#define RB_CMD_PRINT_STATS               'S'
+#define RB_CMD_REQUEST_STATS             'R'
+#define RB_CMD_SWITCH_PROFILE            'P'
+#define RB_CMD_TIMEOUT_MS                1000
+
+// Profile switch handshake, resent every RB_PROFILE_RETRY_MS: the
+// peer answers the ask on the old profile and switches, then the
+// asker switches and checks the peer on the new one. An end that
+// doesn't get the check (peer) or its answer (asker) in
+// RB_PROFILE_TRIES goes back to the old profile, as does the peer that
+// missed the ask. The asker prints the profile in use as "M:<id>".
+#define RB_PROFILE_RETRY_MS              100
+#define RB_PROFILE_TRIES                 5
+
+// Steps of the handshake, [step][profile] in a TELEMETRY_TYPE_PROFILE
+// field. Sent outside of the ARQ frames like the stats requests.
+#define PROFILE_MSG_ASK                  1
+#define PROFILE_MSG_ACK                  2
+#define PROFILE_MSG_CHECK                3
+#define PROFILE_MSG_CHECKED              4
+#define PROFILE_MSG_LEN                  (TELEMETRY_HEADER_LEN + 1 + 2)
+
+enum PROFILE_STATE {
+  PROFILE_IDLE = 0,
+  PROFILE_ASKING,                                // Asker, waiting for the ack
+  PROFILE_CHECKING,                              // Asker on the new profile
+  PROFILE_PROBATION                              // Peer on the new profile
+};
+
+static timer_event_t flush_timer;
+static volatile uint8_t flush_due;
+#if RB_USE_CHANNEL_SCAN
+static timer_event_t scan_timer;
+static timer_event_t recal_timer;
+#endif
+static uint32_t rate_start = 0;
+static uint16_t rate_count = 0;
+static uint16_t rate_bytes = 0;
+
+static uint8_t cmd_waiting = 0;
+static timer_event_t profile_timer;
+static uint8_t profile_state = PROFILE_IDLE;
+static uint8_t profile_tries;
+static uint8_t profile_prev;
+static uint8_t profile_next;
+static uint8_t profile_apply = 0;                // Switch to profile_next when not sending
+static uint8_t profile_report = 0;
+static uint8_t profile_send_msg = 0;
+static uint8_t profile_send_to;
+
+#if RB_USE_STATS
+static uint8_t stats_request_pending = 0;
+static uint8_t stats_reply_pending = 0;
+static uint8_t stats_reply_to;
+#endif
+
+static void gateway_service(void);
+#if RB_USE_CHANNEL_SCAN
+static void recalibrate(void);
+#endif
+static void rate_update(uint16_t bytes);
+static uint8_t bulk_stream(uint16_t queued);
+static uint8_t handle_command(void);
+static void profile_ask(uint8_t id);
+static void profile_start(uint8_t state, uint8_t tries);
+static void profile_stop(void);
+static void profile_tick(void);
+static uint8_t handle_profile_rx(void);
+static void profile_service(void);
+#if RB_USE_STATS
+static uint8_t handle_stats_rx(void);
+static void send_stats(void);
+#endif
+
+/*
+ * UART RX data has waited long enough, send it even without \n
+ */
+static void flush_timeout(void)
+{
+  flush_due = 1;
+  gateway_service();
+}
+
+
 
 int main(void)
 {
@@ -51,74 +189,543 @@ int main(void)
 
   // Increase PMMCOREV level to 2 for proper radio operation
   SetVCore(2);
+  clock_set_profile(RB_CLOCK_PROFILE);
+
+  sched_init();
 
+  // Sensor nodes send to RF_ADDR_GATEWAY
+  rf_set_address(rf_info_address(RF_ADDR_GATEWAY));
+  rf_set_destination(RB_RF_DESTINATION);
+  rf_set_profile(RB_RF_PROFILE);
+  rf_set_channel(RB_RF_CHANNEL);
   rf_init();
+#if RB_USE_WOR
+  rf_set_wor_interval(RB_WOR_INTERVAL_MS);
+#endif
+#if RB_USE_CHANNEL_SCAN
+  rf_set_tx_preamble(RF_SCAN_PREAMBLE_MS);
+  rf_calibrate(0);
+#endif
 
-  uart_init();
+  uart_set_baudrate(RB_UART_BAUDRATE);
+  uart_set_flow_control(RB_USE_UART_FLOW_CONTROL);
+  uart_init(UART_MODE_DMA);
   led_init();
+  gateway_init(GATEWAY_DEFAULT_MODE);
+#if RB_USE_ARQ
+  arq_init();
+#endif
 
 #if SC_USE_SLEEP == 0
   // Enable interrupts
   __bis_status_register(GIE);
 #endif
 
-  while (1) {
+  sched_set_handler(SCHED_EVENT_RF_RX | SCHED_EVENT_RF_TX | SCHED_EVENT_UART_RX |
+                    SCHED_EVENT_LINK, gateway_service);
 
-    // If not sending nor listening, start listening
-    if(!rf_transmitting && !rf_receiving) {
-      unsigned char RxStatus;
+  // Start listening
+  gateway_service();
 
-      rf_receive_off();
+#if RB_USE_CHANNEL_SCAN
+  timer_event_start(&scan_timer, timer_ms_to_ticks(RF_SCAN_DWELL_MS),
+                    timer_ms_to_ticks(RF_SCAN_DWELL_MS), rf_scan_next);
+  timer_event_start(&recal_timer, timer_ms_to_ticks(RB_SCAN_RECAL_MS),
+                    timer_ms_to_ticks(RB_SCAN_RECAL_MS), recalibrate);
+#endif
 
-      // Reset radio on error
-      if (rf_error) {
-        rf_init();
-      }
+  // Sleeps at most in LPM0 as the UART needs SMCLK
+  sched_run();
 
-      // Wait until idle
-      while (((RxStatus = Strobe(RF_SNOP)) & CC430_STATE_MASK) != CC430_STATE_IDLE) {
-        busysleep_ms(1);
-      }
+  return 0;
+}
 
-      // Start listening
-      rf_receive_on();
-    }
 
-#if SC_USE_SLEEP == 1
-    // Sleep while waiting for interrupt
-    __bis_status_register(LPM0_bits + GIE);
+
+/*
+ * Move data between the radio and the UART, and keep the radio
+ * listening when not sending
+ */
+static void gateway_service(void)
+{
+  uint8_t handled;
+
+  // Profile switches and stats requests and replies go outside of the
+  // ARQ frames
+  handled = handle_profile_rx();
+#if RB_USE_STATS
+  if (!handled) {
+    handled = handle_stats_rx();
+  }
+#endif
+
+  // Forward a packet received over RF to UART before listening again
+  if (!handled) {
+#if RB_USE_ARQ
+    if (arq_handle_rx()) {
+      gateway_forward_skip(ARQ_HEADER_LEN);
+    }
 #else
-    busysleep_ms(1);
+    gateway_forward();
 #endif
+  }
+
+  // If not sending nor listening, start listening
+  if(!rf_transmitting && !rf_receiving) {
+    rf_receive_off();
 
-    // If there is data received from UART, push it to RF.
-    if (UartRxBuffer_i > 0) {
-      rf_append_msg((unsigned char *)UartRxBuffer, UartRxBuffer_i);
-      UartRxBuffer_i = 0;
-      timer_set(UART_RX_NEWDATA_TIMEOUT_MS);
+    // Reset radio on error
+    if (rf_error) {
+      rf_init();
+#if RB_USE_CHANNEL_SCAN
+      rf_calibrate(0);
+#endif
+#if RB_USE_ARQ
+      arq_reset_tx();
+#endif
     }
 
-    // We have data to send over RF
-    if (RfTxQueue_i > 0) {
-      uint8_t len;
-      enum RF_SEND_MSG mode = RF_SEND_MSG_FULL;
-      
-      // On UART RX timeout or with full buffer, send msg even without \n
-      if (timer_occurred || RfTxQueue_i == RF_QUEUE_LEN) {
-        mode = RF_SEND_MSG_FORCE;
-      }
+    // Wait until idle, retry on the next event if it doesn't get there
+    rf_wait_for_idle();
+    if (rf_error) {
+      sched_post(SCHED_EVENT_RF_TX);
+      return;
+    }
 
-      len = rf_send_next_msg(mode);
-      if (len > 0) {
-        timer_clear();
+    // Start listening
+    rf_receive_on();
+  }
+
+  if (!rf_transmitting) {
+    profile_service();
+  }
+#if RB_USE_STATS
+  if (!rf_transmitting && (stats_reply_pending || stats_request_pending)) {
+    send_stats();
+  }
+#endif
+
+  handled = handle_command();
+
+  // If there is data received from UART, push it to RF. What doesn't
+  // fit in the RF queue waits in the UART buffer instead of being dropped.
+  if (!handled && ringbuf_len(&UartRxBuffer) > 0 && ringbuf_free(&RfTxQueue) > 0) {
+    unsigned char buf[PAYLOAD_LEN];
+    uint16_t space;
+    uint8_t len;
+
+    uint16_t moved = 0;
+
+    while ((space = ringbuf_free(&RfTxQueue)) > 0 &&
+           (len = uart_read(buf, space < sizeof(buf) ? space : sizeof(buf))) > 0) {
+      rf_append_msg(buf, len);
+      moved += len;
+    }
+    rate_update(moved);
+
+    if (!bulk_stream(ringbuf_len(&RfTxQueue))) {
+      flush_due = 0;
+      timer_event_start(&flush_timer, timer_ms_to_ticks(UART_RX_NEWDATA_TIMEOUT_MS), 0, flush_timeout);
+    } else if (!flush_due && !flush_timer.active) {
+      // The deadline runs from the first byte waiting for the packet
+      timer_event_start(&flush_timer, timer_ms_to_ticks(RB_FLUSH_MAX_MS), 0, flush_timeout);
+    }
+  }
+
+#if RB_USE_ARQ
+  // Keep flushing until everything queued is on air
+  arq_service(flush_due);
+  if (flush_due && arq_unsent() == 0) {
+    timer_event_stop(&flush_timer);
+    flush_due = 0;
+  }
+#else
+  // We have data to send over RF
+  if (ringbuf_len(&RfTxQueue) > 0) {
+    uint8_t len;
+    enum RF_SEND_MSG mode = RF_SEND_MSG_FULL;
+
+    // On UART RX timeout or with a full packet, send msg even without
+    // \n. A bulk stream fills the packet first.
+    if (flush_due || ringbuf_len(&RfTxQueue) >= PAYLOAD_LEN) {
+      mode = RF_SEND_MSG_FORCE;
+    } else if (bulk_stream(ringbuf_len(&RfTxQueue))) {
+      return;
+    }
+
+    len = rf_send_next_msg(mode);
+    if (len > 0) {
+      timer_event_stop(&flush_timer);
+      flush_due = 0;
+
+      // The rest waits for its own deadline even if the UART goes quiet
+      if (ringbuf_len(&RfTxQueue) > 0) {
+        timer_event_start(&flush_timer,
+                          timer_ms_to_ticks(bulk_stream(ringbuf_len(&RfTxQueue)) ?
+                                            RB_FLUSH_MAX_MS : UART_RX_NEWDATA_TIMEOUT_MS),
+                          0, flush_timeout);
       }
     }
   }
+#endif
+}
 
-  return 0;
+
+
+#if RB_USE_CHANNEL_SCAN
+/*
+ * Count towards the next calibration of every channel
+ */
+static void recalibrate(void)
+{
+  rf_calibrate(0);
+}
+#endif
+
+
+
+/*
+ * Count bytes moved from the UART in RB_RATE_WINDOW_MS windows, the
+ * last full window gives the rate
+ */
+static void rate_update(uint16_t bytes)
+{
+  uint32_t window = timer_ms_to_ticks(RB_RATE_WINDOW_MS);
+  uint32_t elapsed = timer_now() - rate_start;
+
+  if (elapsed >= window) {
+    // Windows without data in between mean the stream paused
+    rate_bytes = elapsed < 2 * window ? rate_count : 0;
+    rate_count = 0;
+    rate_start = timer_now();
+  }
+  rate_count += bytes;
+}
+
+
+
+/*
+ * Whether the UART byte rate fills a packet with queued bytes in it
+ * within RB_FLUSH_MAX_MS
+ */
+static uint8_t bulk_stream(uint16_t queued)
+{
+  if (timer_now() - rate_start >= 2 * timer_ms_to_ticks(RB_RATE_WINDOW_MS)) {
+    return 0;
+  }
+
+  return (uint32_t)rate_bytes * (RB_FLUSH_MAX_MS / RB_RATE_WINDOW_MS) + queued >= PAYLOAD_LEN;
+}
+
+
+
+/*
+ * Run a command that is alone in the UART buffer. Returns 1 if the
+ * buffer was a command or may become one and must not be sent yet.
+ */
+static uint8_t handle_command(void)
+{
+  unsigned char cmd[3];
+  uint16_t len = ringbuf_len(&UartRxBuffer);
+  uint16_t cmd_len = 2;
+
+  if (len == 0 || len > sizeof(cmd)) {
+    cmd_waiting = 0;
+    return 0;
+  }
+
+  ringbuf_copy(&UartRxBuffer, 0, cmd, len);
+  if (cmd[0] != RB_CMD_ESCAPE) {
+    cmd_waiting = 0;
+    return 0;
+  }
+
+  // The profile switch takes the profile number after it
+  if (len > 1 && cmd[1] == RB_CMD_SWITCH_PROFILE) {
+    cmd_len = 3;
+  }
+  if (len > cmd_len) {
+    cmd_waiting = 0;
+    return 0;
+  }
+
+  if (len < cmd_len) {
+    // Data after all, if nothing followed in time
+    if (cmd_waiting && flush_due) {
+      cmd_waiting = 0;
+      return 0;
+    }
+    if (!cmd_waiting) {
+      cmd_waiting = 1;
+      flush_due = 0;
+      timer_event_start(&flush_timer, timer_ms_to_ticks(RB_CMD_TIMEOUT_MS), 0, flush_timeout);
+    }
+    return 1;
+  }
+
+  cmd_waiting = 0;
+
+  if (cmd[1] == RB_CMD_SWITCH_PROFILE) {
+    profile_ask(cmd[2] - '0');
+#if RB_USE_STATS
+  } else if (cmd[1] == RB_CMD_PRINT_STATS) {
+    unsigned char buf[STATS_REPORT_LEN];
+    uint8_t buf_len = stats_report(buf, sizeof(buf), rf_get_address());
+
+    gateway_print_records(buf, buf_len);
+  } else if (cmd[1] == RB_CMD_REQUEST_STATS) {
+    stats_request_pending = 1;
+    sched_post(SCHED_EVENT_RF_TX);
+#endif
+  } else {
+    return 0;
+  }
+
+  ringbuf_skip(&UartRxBuffer, len);
+  timer_event_stop(&flush_timer);
+  flush_due = 0;
+  return 1;
+}
+
+
+
+/*
+ * Ask the peer to switch to the profile with the given number. Only
+ * prints the profile in use if it's not valid, already in use or a
+ * switch is still going on.
+ */
+static void profile_ask(uint8_t id)
+{
+  if (id >= RF_PROFILE_COUNT || id == rf_get_profile() || profile_state != PROFILE_IDLE) {
+    profile_report = 1;
+  } else {
+    profile_prev = rf_get_profile();
+    profile_next = id;
+    profile_send_msg = PROFILE_MSG_ASK;
+    profile_send_to = RB_RF_DESTINATION;
+    // Outlasts the probation of a peer that switched on a lost ack
+    profile_start(PROFILE_ASKING, 2 * RB_PROFILE_TRIES);
+  }
+
+  sched_post(SCHED_EVENT_RF_TX);
+}
+
+
+
+/*
+ * Enter a step of the switch, which ends after tries resends
+ */
+static void profile_start(uint8_t state, uint8_t tries)
+{
+  profile_state = state;
+  profile_tries = tries;
+  timer_event_start(&profile_timer, timer_ms_to_ticks(RB_PROFILE_RETRY_MS),
+                    timer_ms_to_ticks(RB_PROFILE_RETRY_MS), profile_tick);
+}
+
+
+
+/*
+ * The switch is done or given up
+ */
+static void profile_stop(void)
+{
+  timer_event_stop(&profile_timer);
+  profile_state = PROFILE_IDLE;
 }
 
 
+
+/*
+ * Resend the ask or the check, or give up the switch after the last
+ * try. An end already on the new profile goes back to the old one.
+ */
+static void profile_tick(void)
+{
+  if (--profile_tries == 0) {
+    if (profile_state != PROFILE_ASKING) {
+      profile_next = profile_prev;
+      profile_apply = 1;
+    }
+    profile_report = (profile_state != PROFILE_PROBATION);
+    profile_stop();
+  } else if (profile_state == PROFILE_ASKING) {
+    profile_send_msg = PROFILE_MSG_ASK;
+  } else if (profile_state == PROFILE_CHECKING) {
+    profile_send_msg = PROFILE_MSG_CHECK;
+  }
+
+  gateway_service();
+}
+
+
+
+/*
+ * Take a received step of a profile switch. The answers and the
+ * switches are done from profile_service(). Returns 1 if the packet
+ * was taken.
+ */
+static uint8_t handle_profile_rx(void)
+{
+  unsigned char *payload = (unsigned char *)&RfRxBuffer[RF_PAYLOAD_OFFSET];
+  uint8_t msg, id;
+
+  if (!rf_rx_ready || !(rf_rx_status & RF_RX_STATUS_CRC_OK) ||
+      RfRxBufferLength != RF_PAYLOAD_OFFSET + 2 + PROFILE_MSG_LEN ||
+      payload[0] != TELEMETRY_MAGIC ||
+      payload[TELEMETRY_HEADER_LEN] != (TELEMETRY_TYPE_PROFILE << 4 | 2)) {
+    return 0;
+  }
+
+  msg = payload[TELEMETRY_HEADER_LEN + 1];
+  id = payload[TELEMETRY_HEADER_LEN + 2];
+  rf_rx_ready = 0;
+
+  if (id >= RF_PROFILE_COUNT) {
+    return 1;
+  }
+
+  if (msg == PROFILE_MSG_ASK && profile_state == PROFILE_IDLE) {
+    // Answered on the current profile, switched once the answer is out
+    profile_next = id;
+    profile_send_msg = PROFILE_MSG_ACK;
+    profile_send_to = rf_rx_source();
+  } else if (msg == PROFILE_MSG_ACK && profile_state == PROFILE_ASKING &&
+             id == profile_next) {
+    profile_apply = 1;
+    profile_send_msg = PROFILE_MSG_CHECK;
+    profile_send_to = rf_rx_source();
+    profile_start(PROFILE_CHECKING, RB_PROFILE_TRIES);
+  } else if (msg == PROFILE_MSG_CHECK && id == rf_get_profile() && !profile_apply) {
+    // Also answered after the switch is done, in case the answer was lost
+    if (profile_state == PROFILE_PROBATION) {
+      profile_stop();
+    }
+    profile_next = id;
+    profile_send_msg = PROFILE_MSG_CHECKED;
+    profile_send_to = rf_rx_source();
+  } else if (msg == PROFILE_MSG_CHECKED && profile_state == PROFILE_CHECKING &&
+             id == rf_get_profile()) {
+    profile_report = 1;
+    profile_stop();
+  }
+
+  return 1;
+}
+
+
+
+/*
+ * Switch the profile, print it and send the next step of a switch.
+ * Called when the radio isn't transmitting.
+ */
+static void profile_service(void)
+{
+  telemetry_t t;
+  uint32_t values[2];
+  uint8_t len;
+
+  if (profile_apply) {
+    profile_apply = 0;
+    rf_set_profile(profile_next);
+  }
+
+  if (profile_report) {
+    unsigned char buf[TELEMETRY_HEADER_LEN + 2];
+
+    profile_report = 0;
+    telemetry_start(&t, buf, sizeof(buf), rf_get_address());
+    telemetry_add_value(&t, TELEMETRY_TYPE_PROFILE, rf_get_profile());
+    gateway_print_records(buf, telemetry_end(&t));
+  }
+
+  if (profile_send_msg == 0) {
+    return;
+  }
+
+  values[0] = profile_send_msg;
+  values[1] = profile_next;
+  telemetry_start(&t, (unsigned char *)&RfTxBuffer[RF_PAYLOAD_OFFSET], PAYLOAD_LEN,
+                  rf_get_address());
+  telemetry_add(&t, TELEMETRY_TYPE_PROFILE, values, 2);
+  len = telemetry_end(&t);
+
+  rf_set_destination(profile_send_to);
+  rf_send_buffer(len);
+  rf_set_destination(RB_RF_DESTINATION);
+
+  if (profile_send_msg == PROFILE_MSG_ACK) {
+    // Switch after the ack is sent, back unless checked in time
+    profile_prev = rf_get_profile();
+    profile_apply = 1;
+    profile_start(PROFILE_PROBATION, RB_PROFILE_TRIES);
+  }
+  profile_send_msg = 0;
+}
+
+
+
+#if RB_USE_STATS
+/*
+ * Take a received stats request or reply, a telemetry record that is
+ * never an ARQ header. Requests are answered from the main loop, replies
+ * forwarded to the UART. Returns 1 if the packet was taken.
+ */
+static uint8_t handle_stats_rx(void)
+{
+  unsigned char *payload = (unsigned char *)&RfRxBuffer[RF_PAYLOAD_OFFSET];
+
+  if (!rf_rx_ready || !(rf_rx_status & RF_RX_STATUS_CRC_OK) ||
+      RfRxBufferLength < RF_PAYLOAD_OFFSET + 2 + TELEMETRY_HEADER_LEN ||
+      payload[0] != TELEMETRY_MAGIC) {
+    return 0;
+  }
+
+  // An empty record is a request
+  if (RfRxBufferLength == RF_PAYLOAD_OFFSET + 2 + TELEMETRY_HEADER_LEN) {
+    stats_reply_pending = 1;
+    stats_reply_to = rf_rx_source();
+    rf_rx_ready = 0;
+    return 1;
+  }
+
+  gateway_forward();
+  return 1;
+}
+
+
+
+/*
+ * Send the own counters to the one who asked, or ask the peer. Called
+ * when the radio isn't transmitting.
+ */
+static void send_stats(void)
+{
+  uint8_t len;
+
+  if (stats_reply_pending) {
+    stats_reply_pending = 0;
+    len = stats_report((unsigned char *)&RfTxBuffer[RF_PAYLOAD_OFFSET], PAYLOAD_LEN,
+                       rf_get_address());
+    if (len == 0) {
+      return;
+    }
+    rf_set_destination(stats_reply_to);
+  } else {
+    telemetry_t t;
+
+    stats_request_pending = 0;
+    telemetry_start(&t, (unsigned char *)&RfTxBuffer[RF_PAYLOAD_OFFSET], PAYLOAD_LEN,
+                    rf_get_address());
+    len = telemetry_end(&t);
+  }
+
+  rf_send_buffer(len);
+  rf_set_destination(RB_RF_DESTINATION);
+}
+#endif
+
+
 /* Emacs indentatation information
    Local Variables:
    indent-tabs-mode:nil